@@ -105,6 +105,40 @@ namespace pen
         T*   check();
     };
 
+    // lockless single producer single consumer - ring buffer of variable sized packets. each packet is a packet_header
+    // followed by payload, sizes are multiples of 4 bytes. packets never straddle the end of the buffer, when a packet
+    // will not fit the producer pads to the end and the consumer skips the padding.
+    struct packet_header
+    {
+        u16 id;
+        u16 size; // payload size in bytes
+    };
+
+    struct packet_ring_buffer
+    {
+        u8*   data = nullptr;
+        a_u32 get_pos;
+        a_u32 put_pos;
+        u32   _capacity = 0;
+
+        // consumer side, get_pos is published in batches to avoid an atomic store per packet
+        u32 _get = 0;
+        u32 _put_cached = 0;
+        u32 _get_published = 0;
+
+        static const u16 k_pad_id = 0xffff;
+
+        packet_ring_buffer();
+        ~packet_ring_buffer();
+
+        void           create(u32 capacity_bytes);
+        u32            put(const void* packets, u32 size_bytes);
+        packet_header* peek();
+        void           pop();
+        u32            size();
+        u32            free_bytes();
+    };
+
     // lockless single producer multiple consumer - thread safe resource pool which will grow to accomodate contents
     template <typename T>
     struct res_pool
@@ -181,6 +215,34 @@ namespace pen
         T&     operator[](size_t slot);
     };
 
+    // bump allocator - single threaded, carves allocations linearly from one block and releases them all with reset.
+    // allocations which do not fit fall back to the heap until reset, which grows the block (up to max_capacity).
+    // a grown block shrinks back toward the initial capacity once the extra space goes unused for trim_resets resets.
+    struct linear_allocator
+    {
+        static const u32 trim_resets = 32;
+
+        u8*    _data = nullptr;
+        size_t _capacity = 0;
+        size_t _initial_capacity = 0;
+        size_t _max_capacity = 0;
+        size_t _offset = 0;
+        void** _overflow = nullptr;
+        size_t _overflow_size = 0;
+        size_t _peak = 0; // most used in one frame since the last trim check
+        u32    _num_resets = 0;
+
+        // stats since the last reset
+        u32 num_allocs = 0;
+        u32 num_heap_allocs = 0;
+
+        void   create(size_t capacity, size_t max_capacity);
+        void   destroy();
+        void*  alloc(size_t size, size_t align = 16);
+        void   reset();
+        size_t size();
+    };
+
     // function impls with always inline for fast data structs
     template <typename T>
     pen_inline void stack<T>::clear()
@@ -272,6 +334,136 @@ namespace pen
         return &data[gp];
     }
 
+    pen_inline packet_ring_buffer::packet_ring_buffer()
+    {
+        get_pos = 0;
+        put_pos = 0;
+    }
+
+    pen_inline packet_ring_buffer::~packet_ring_buffer()
+    {
+        pen::memory_free(data);
+    }
+
+    inline void packet_ring_buffer::create(u32 capacity_bytes)
+    {
+        get_pos = 0;
+        put_pos = 0;
+        _get = 0;
+        _put_cached = 0;
+        _get_published = 0;
+        _capacity = (capacity_bytes + 3) & ~3;
+
+        data = (u8*)pen::memory_alloc(_capacity);
+        memset(data, 0x0, _capacity);
+    }
+
+    inline u32 packet_ring_buffer::put(const void* packets, u32 size_bytes)
+    {
+        // writes as many whole packets as there is space for and publishes them all at once, returns the number of
+        // bytes written. a single header sized gap is always kept free so a full buffer is not mistaken for empty
+        const u8* src = (const u8*)packets;
+        u32       cap = _capacity;
+        u32       gp = get_pos;
+        u32       pp = put_pos;
+        u32       used = pp >= gp ? pp - gp : cap - gp + pp;
+        u32       free_bytes = cap - used - sizeof(packet_header);
+
+        u32 written = 0;
+        u32 run = 0;
+        while (written + run < size_bytes)
+        {
+            const packet_header* h = (const packet_header*)(src + written + run);
+            u32                  ps = sizeof(packet_header) + h->size;
+            PEN_ASSERT(ps <= cap - sizeof(packet_header));
+
+            u32 contiguous = cap - pp - run;
+            if (ps > contiguous)
+            {
+                if (contiguous > free_bytes)
+                    break;
+
+                // flush the run so far and pad to the end of the buffer
+                memcpy(&data[pp], src + written, run);
+                written += run;
+                run = 0;
+
+                if (contiguous > 0)
+                {
+                    packet_header* pad = (packet_header*)&data[cap - contiguous];
+                    pad->id = k_pad_id;
+                    pad->size = (u16)(contiguous - sizeof(packet_header));
+                    free_bytes -= contiguous;
+                }
+
+                pp = 0;
+                continue;
+            }
+
+            if (ps > free_bytes)
+                break;
+
+            run += ps;
+            free_bytes -= ps;
+        }
+
+        memcpy(&data[pp], src + written, run);
+        written += run;
+
+        put_pos = (pp + run) % cap;
+        return written;
+    }
+
+    pen_inline packet_header* packet_ring_buffer::peek()
+    {
+        // returns the next packet without releasing it, call pop when finished with it
+        for (;;)
+        {
+            if (_get == _put_cached)
+            {
+                // caught up, release everything consumed so far and look for more
+                get_pos = _get;
+                _get_published = _get;
+                _put_cached = put_pos;
+                if (_get == _put_cached)
+                    return nullptr;
+            }
+
+            packet_header* h = (packet_header*)&data[_get];
+            if (h->id != k_pad_id)
+                return h;
+
+            _get = 0;
+        }
+    }
+
+    pen_inline void packet_ring_buffer::pop()
+    {
+        packet_header* h = (packet_header*)&data[_get];
+        _get = (_get + sizeof(packet_header) + h->size) % _capacity;
+
+        // release space periodically so a waiting producer is not stalled for the whole batch
+        u32 consumed = _get >= _get_published ? _get - _get_published : _capacity - _get_published + _get;
+        if (consumed > _capacity / 8)
+        {
+            get_pos = _get;
+            _get_published = _get;
+        }
+    }
+
+    pen_inline u32 packet_ring_buffer::size()
+    {
+        u32 gp = get_pos;
+        u32 pp = put_pos;
+        return pp >= gp ? pp - gp : _capacity - gp + pp;
+    }
+
+    pen_inline u32 packet_ring_buffer::free_bytes()
+    {
+        // the producer side view, less the gap which is always kept free
+        return _capacity - size() - sizeof(packet_header);
+    }
+
     template <typename T>
     pen_inline res_pool<T>::res_pool()
     {
@@ -461,4 +653,102 @@ namespace pen
     {
         return _data[_fb][slot];
     }
+
+    inline void linear_allocator::create(size_t capacity, size_t max_capacity)
+    {
+        _capacity = capacity;
+        _initial_capacity = capacity;
+        _max_capacity = max(capacity, max_capacity);
+        _offset = 0;
+        _peak = 0;
+        _num_resets = 0;
+        _data = (u8*)pen::memory_alloc(_capacity);
+    }
+
+    inline void linear_allocator::destroy()
+    {
+        u32 num_overflow = sb_count(_overflow);
+        for (u32 i = 0; i < num_overflow; ++i)
+            pen::memory_free_align(_overflow[i]);
+
+        pen::memory_free(_data);
+        sb_free(_overflow);
+        _overflow = nullptr;
+        _data = nullptr;
+        _capacity = 0;
+    }
+
+    pen_inline void* linear_allocator::alloc(size_t size, size_t align)
+    {
+        ++num_allocs;
+
+        // align the address rather than the offset, the block itself is only as aligned as the heap makes it
+        size_t base = (size_t)_data;
+        size_t start = ((base + _offset + align - 1) & ~(align - 1)) - base;
+        if (start + size <= _capacity)
+        {
+            _offset = start + size;
+            return _data + start;
+        }
+
+        // block is full, heap allocate and remember the shortfall so reset can grow the block
+        ++num_heap_allocs;
+        _overflow_size += size + align;
+
+        void* mem = pen::memory_alloc_align(size, max<size_t>(align, sizeof(void*)));
+        sb_push(_overflow, mem);
+        return mem;
+    }
+
+    inline void linear_allocator::reset()
+    {
+        u32 num_overflow = sb_count(_overflow);
+        for (u32 i = 0; i < num_overflow; ++i)
+            pen::memory_free_align(_overflow[i]);
+
+        size_t required = _offset + _overflow_size;
+        _peak = max(_peak, required);
+
+        // nothing can reference the old block once reset, so there is nothing to preserve when it is resized
+        size_t new_capacity = _capacity;
+        if (num_overflow)
+        {
+            stb__sbn(_overflow) = 0;
+
+            new_capacity = max<size_t>(_capacity, 1);
+            while (new_capacity < required && new_capacity < _max_capacity)
+                new_capacity *= 2;
+
+            new_capacity = min(new_capacity, _max_capacity);
+        }
+        else if (++_num_resets >= trim_resets)
+        {
+            // a spike grows the block for good otherwise, halve it while the peak since the last check still fits
+            size_t min_capacity = max(_initial_capacity, _peak);
+            while (new_capacity > _initial_capacity && new_capacity / 2 >= min_capacity)
+                new_capacity /= 2;
+
+            _num_resets = 0;
+            _peak = 0;
+        }
+
+        if (new_capacity != _capacity)
+        {
+            pen::memory_free(_data);
+            _data = (u8*)pen::memory_alloc(new_capacity);
+            _capacity = new_capacity;
+            _num_resets = 0;
+            _peak = 0;
+        }
+
+        _offset = 0;
+        _overflow_size = 0;
+        num_allocs = 0;
+        num_heap_allocs = 0;
+    }
+
+    pen_inline size_t linear_allocator::size()
+    {
+        return _offset + _overflow_size;
+    }
 } // namespace pen
@@ -6,6 +6,7 @@
 
 // Can read files and also enumerate file system and volumes as an fs_tree_node.
 // Make sure to free p_buffer yourself allocated from filesystem_read_file_to_buffer.
+// Files mapped with filesystem_map_file are read only and must be released with filesystem_unmap_file.
 // Make sure to call filesystem_enum_free_mem with your fs_tree_node once finished with it.
 
 // Implemented with:
@@ -28,6 +29,8 @@ namespace pen
 
     bool       filesystem_file_exists(const c8* filename);
     pen_error  filesystem_read_file_to_buffer(const c8* filename, void** p_buffer, u32& buffer_size);
+    pen_error  filesystem_map_file(const c8* filename, const void** p_buffer, size_t& buffer_size);
+    void       filesystem_unmap_file(const void* p_buffer, size_t buffer_size);
     pen_error  filesystem_getmtime(const c8* filename, u32& mtime_out);
     void       filesystem_toggle_hidden_files();
     pen_error  filesystem_enum_volumes(fs_tree_node& results);
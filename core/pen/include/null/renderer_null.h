@@ -0,0 +1,38 @@
+// renderer_null.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Headless renderer backend which implements pen::direct without a gpu or window, selected with --renderer=null.
+// it tracks bound state and resource memory and records statistics so front end cpu cost can be measured in isolation.
+
+#pragma once
+
+#include "types.h"
+
+namespace pen
+{
+    struct renderer_null_stats
+    {
+        // per frame, for the last presented frame
+        u32    draw_calls;
+        u32    instances;
+        u32    dispatches;
+        u64    vertices; // vertex or index count submitted
+        u32    state_changes;
+        u32    redundant_state_changes; // set calls which bound what was already bound
+        u32    clears;
+        size_t bytes_uploaded; // buffer updates and resource creation data
+
+        // totals for live resources
+        u32    num_buffers;
+        u32    num_textures;
+        u32    num_render_targets;
+        u32    num_shaders;
+        size_t buffer_bytes;
+        size_t texture_bytes;
+        size_t render_target_bytes;
+    };
+
+    // thread safe
+    void renderer_null_get_stats(renderer_null_stats& stats);
+} // namespace pen
@@ -53,6 +53,26 @@ namespace pen
         u64       caps;
     };
 
+    // command payload memory for the last submitted frame
+    struct renderer_frame_alloc_stats
+    {
+        u32    num_allocs;      // payloads carved from the frame allocator
+        u32    num_heap_allocs; // payloads which did not fit and fell back to the heap
+        size_t allocated_bytes;
+        size_t capacity_bytes;
+    };
+
+    // packed command stream usage for the last submitted frame
+    struct renderer_cmd_stats
+    {
+        u32    num_cmds;
+        u32    num_out_of_line; // commands with large params stored in the frame allocator
+        size_t packed_bytes;    // bytes written to the command stream
+        size_t unpacked_bytes;  // bytes the same commands would take as fixed size commands
+        f32    consume_ms;      // render thread time decoding and executing commands, excluding present
+        u32    num_filtered;    // redundant set_* commands dropped before they were added to the stream
+    };
+
     enum special_values
     {
         BACK_BUFFER_RATIO = (u32)-1,
@@ -440,6 +460,16 @@ namespace pen
     void        renderer_consume_cmd_buffer();
     void        renderer_update_queries();
     void        renderer_get_present_time(f32& cpu_ms, f32& gpu_ms);
+    void        renderer_get_frame_alloc_stats(renderer_frame_alloc_stats& stats);
+    void        renderer_get_cmd_stats(renderer_cmd_stats& stats);
+
+    // cmd lists allow commands to be recorded on any thread, one list per thread at a time.
+    // lists are submitted from the user thread and consumed in the order they are passed to submit.
+    // resource create and release calls are not recorded, they are sent to the render thread immediately.
+    u32         renderer_create_cmd_list();
+    void        renderer_begin_cmd_list(u32 cmd_list);
+    void        renderer_end_cmd_list();
+    void        renderer_submit_cmd_lists(const u32* cmd_lists, u32 num_cmd_lists);
  
     namespace direct
     {
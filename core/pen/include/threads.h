@@ -4,6 +4,7 @@
 
 // Minimalist cross platform thread wrapper api.
 // Includes functions to create jobs, threads, mutex and semaphore.
+// Plus a work stealing job system for fine grained tasks which run on a fixed pool of worker threads.
 
 #pragma once
 
@@ -18,6 +19,8 @@ namespace pen
     typedef void (*completion_callback)(void*);
     typedef void* (*dispatch_thread)(void*);
     typedef loop_t (*single_thread_update_func)();
+    typedef void (*task_func)(void* user_data);
+    typedef void (*parallel_for_func)(u32 start, u32 end, void* user_data);
 
     // A Job is just a thread with some user data, a callback
     // and some syncronisation semaphores
@@ -63,14 +66,27 @@ namespace pen
     thread* thread_create(dispatch_thread thread_func, u32 stack_size, void* thread_params, thread_start_flags flags);
     void    thread_sleep_ms(u32 milliseconds);
     void    thread_sleep_us(u32 microseconds);
+    u32     thread_get_num_hardware_threads();
 
     // Jobs
     bool    jobs_terminate_all();
     job*    jobs_create_job(dispatch_thread thread_func, u32 stack_size, void* user_data, thread_start_flags flags,
                             completion_callback cb = nullptr);
+    void    jobs_release_job(job* jt); // waits for the thread to post p_sem_terminated then frees its slot for reuse
     void    jobs_create_single_thread_update(single_thread_update_func func);
     void    jobs_run_single_threaded();
 
+    // Tasks
+    // Workers are created lazily on first use with num_workers = hardware threads - 1, or explicitly.
+    // A counter is incremented for each task submitted and decremented as they complete, jobs_wait will
+    // execute other tasks while waiting for the counter to hit zero. with PEN_SINGLE_THREADED tasks run inline.
+    void    jobs_create_workers(u32 num_workers = 0);
+    u32     jobs_get_num_workers();
+    void    jobs_submit(task_func func, void* user_data, a_u32* counter = nullptr);
+    void    jobs_parallel_for(u32 count, u32 batch_size, parallel_for_func func, void* user_data,
+                              a_u32* counter = nullptr); // when counter is null parallel_for waits for completion
+    void    jobs_wait(a_u32* counter);
+
     // Mutex
     mutex* mutex_create();
     void   mutex_destroy(mutex* p_mutex);
@@ -6,6 +6,7 @@
 #include "threads.h"
 #include "console.h"
 #include "data_struct.h"
+#include "memory.h"
 
 #define MAX_THREADS 32 // lazy fixed sized array to avoid any thread saftey issues
 
@@ -16,19 +17,447 @@ namespace
     job                         s_jt[MAX_THREADS];
     u32                         s_num_active_threads = 0;
     single_thread_update_func*  s_single_thread_funcs = nullptr;
+
+    struct task
+    {
+        task_func         func;
+        parallel_for_func for_func;
+        void*             user_data;
+        u32               start;
+        u32               end;
+        a_u32*            counter;
+    };
+
+#if !PEN_SINGLE_THREADED
+    void wake_waiters();
+#endif
+
+    pen_inline void run_task(const task& t)
+    {
+        if (t.for_func)
+            t.for_func(t.start, t.end, t.user_data);
+        else
+            t.func(t.user_data);
+
+#if !PEN_SINGLE_THREADED
+        if (t.counter && t.counter->fetch_sub(1) == 1)
+            wake_waiters();
+#endif
+    }
+}
+
+#if !PEN_SINGLE_THREADED
+namespace
+{
+    namespace e_jobs_constants
+    {
+        enum jobs_constants_t
+        {
+            max_workers = 32,
+            max_deques = 64, // workers + any other threads which submit tasks
+            deque_capacity = 4096,
+            spin_count = 64
+        };
+    }
+
+    // chase-lev work stealing deque, owner pushes and pops from the bottom, thieves steal from the top.
+    struct task_deque
+    {
+        std::atomic<s64> top;
+        std::atomic<s64> bottom;
+        task             tasks[e_jobs_constants::deque_capacity];
+    };
+
+    namespace e_deque_state
+    {
+        enum deque_state_t
+        {
+            unused,
+            in_use,
+            free,
+            released
+        };
+    }
+
+    struct worker_pool
+    {
+        std::atomic<task_deque*> deques[e_jobs_constants::max_deques];
+        a_u32                    deque_state[e_jobs_constants::max_deques];
+        semaphore*               wait_sems[e_jobs_constants::max_deques]; // jobs_wait blocks on its deque's semaphore
+        a_bool                   waiting[e_jobs_constants::max_deques];
+        a_u32                    num_deques = {0};
+        a_u32                    state = {0}; // 0 = none, 1 = creating, 2 = running
+        a_u32                    num_sleeping = {0};
+        a_u32                    num_waiting = {0};
+        a_u32                    num_exited = {0};
+        a_u32                    num_stealing = {0}; // non worker threads inside try_get_task
+        a_bool                   exit = {false};
+        a_bool                   steal_closed = {false};
+        a_bool                   deques_freed = {false};
+        u32                      num_workers = 0;
+        semaphore*               wake = nullptr;
+    };
+    worker_pool s_pool;
+
+    bool deque_pop(task_deque* q, task& out);
+
+    void release_thread_deque();
+
+    // releases the deque of any thread which submitted tasks when it exits, so threads can come and go
+    struct thread_deque_owner
+    {
+        ~thread_deque_owner()
+        {
+            release_thread_deque();
+        }
+    };
+
+    thread_local task_deque*        s_thread_deque = nullptr;
+    thread_local u32                s_thread_deque_index = 0;
+    thread_local bool               s_thread_is_worker = false;
+    thread_local thread_deque_owner s_thread_deque_owner;
+
+    task_deque* get_thread_deque()
+    {
+        if (s_thread_deque)
+            return s_thread_deque;
+
+        // odr-use the owner so its destructor runs on thread exit
+        (void)&s_thread_deque_owner;
+
+        // recycle a deque released by a thread which has exited
+        u32 nd = s_pool.num_deques.load();
+        for (u32 i = 0; i < nd; ++i)
+        {
+            u32 expected = e_deque_state::free;
+            if (!s_pool.deque_state[i].compare_exchange_strong(expected, e_deque_state::in_use))
+                continue;
+
+            s_thread_deque = s_pool.deques[i].load();
+            s_thread_deque_index = i;
+            return s_thread_deque;
+        }
+
+        u32 index = s_pool.num_deques.load();
+        for (;;)
+        {
+            PEN_ASSERT(index < e_jobs_constants::max_deques);
+            if (s_pool.num_deques.compare_exchange_weak(index, index + 1))
+                break;
+        }
+
+        task_deque* q = (task_deque*)pen::memory_alloc_align(sizeof(task_deque), 64);
+        q->top = 0;
+        q->bottom = 0;
+
+        s_pool.wait_sems[index] = pen::semaphore_create(0, 1);
+        s_pool.deque_state[index] = e_deque_state::in_use;
+        s_pool.deques[index].store(q);
+        s_thread_deque = q;
+        s_thread_deque_index = index;
+        return q;
+    }
+
+    void release_thread_deque()
+    {
+        task_deque* q = s_thread_deque;
+        if (!q)
+            return;
+
+        // run anything left behind, nothing else can push to this deque so it is empty when pop fails
+        task t;
+        while (q->top.load() < q->bottom.load())
+            if (deque_pop(q, t))
+                run_task(t);
+
+        s_thread_deque = nullptr;
+
+        u32 index = s_thread_deque_index;
+        s_pool.deque_state[index] = e_deque_state::free;
+
+        // if the pool has already freed its deques nobody else will free this one, free_deques may be scanning at
+        // the same time so whoever wins the exchange frees it
+        if (!s_pool.deques_freed)
+            return;
+
+        u32 expected = e_deque_state::free;
+        if (!s_pool.deque_state[index].compare_exchange_strong(expected, e_deque_state::released))
+            return;
+
+        pen::memory_free_align(s_pool.deques[index].exchange(nullptr));
+        pen::semaphore_destroy(s_pool.wait_sems[index]);
+        s_pool.wait_sems[index] = nullptr;
+    }
+
+    void free_deques()
+    {
+        s_pool.deques_freed = true;
+
+        u32 nd = s_pool.num_deques.load();
+        for (u32 i = 0; i < nd; ++i)
+        {
+            u32 expected = e_deque_state::free;
+            if (!s_pool.deque_state[i].compare_exchange_strong(expected, e_deque_state::released))
+                continue;
+
+            pen::memory_free_align(s_pool.deques[i].exchange(nullptr));
+            pen::semaphore_destroy(s_pool.wait_sems[i]);
+            s_pool.wait_sems[i] = nullptr;
+        }
+    }
+
+    bool deque_push(task_deque* q, const task& t)
+    {
+        s64 b = q->bottom.load(std::memory_order_relaxed);
+        s64 tp = q->top.load(std::memory_order_acquire);
+        if (b - tp >= e_jobs_constants::deque_capacity)
+            return false;
+
+        q->tasks[b & (e_jobs_constants::deque_capacity - 1)] = t;
+        q->bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool deque_pop(task_deque* q, task& out)
+    {
+        s64 b = q->bottom.load(std::memory_order_relaxed) - 1;
+        q->bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        s64 t = q->top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            // empty
+            q->bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        out = q->tasks[b & (e_jobs_constants::deque_capacity - 1)];
+        if (t != b)
+            return true;
+
+        // last item, race against thieves
+        bool won = q->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        q->bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    bool deque_steal(task_deque* q, task& out)
+    {
+        s64 t = q->top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        s64 b = q->bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+            return false;
+
+        out = q->tasks[t & (e_jobs_constants::deque_capacity - 1)];
+        return q->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    bool steal_task(task& out)
+    {
+        u32 nd = s_pool.num_deques.load();
+        for (u32 i = 1; i <= nd; ++i)
+        {
+            task_deque* q = s_pool.deques[(s_thread_deque_index + i) % nd].load();
+            if (!q || q == s_thread_deque)
+                continue;
+
+            if (deque_steal(q, out))
+                return true;
+        }
+
+        return false;
+    }
+
+    bool try_get_task(task& out)
+    {
+        // own work first (lifo), then steal (fifo) starting from our neighbour to spread contention
+        if (s_thread_deque && deque_pop(s_thread_deque, out))
+            return true;
+
+        // workers have all exited before the deques are freed, any other thread takes a reference first so shutdown
+        // can wait for it to leave before freeing the deques it is stealing from
+        if (s_thread_is_worker)
+            return steal_task(out);
+
+        s_pool.num_stealing.fetch_add(1);
+
+        bool stolen = false;
+        if (!s_pool.steal_closed)
+            stolen = steal_task(out);
+
+        s_pool.num_stealing.fetch_sub(1);
+        return stolen;
+    }
+
+    void wake_workers(u32 count)
+    {
+        // pairs with the increment of num_sleeping and re-check in worker_thread
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        u32 sleeping = s_pool.num_sleeping.load();
+        u32 n = min(sleeping, count);
+        for (u32 i = 0; i < n; ++i)
+            pen::semaphore_post(s_pool.wake, 1);
+    }
+
+    void wake_waiters()
+    {
+        // pairs with the set of waiting and re-check of the counter in jobs_wait
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (s_pool.num_waiting.load() == 0)
+            return;
+
+        // wake every waiter to re-check its own counter, a counter can only be waited on by a thread that has a deque
+        u32 nd = s_pool.num_deques.load();
+        for (u32 i = 0; i < nd; ++i)
+            if (s_pool.waiting[i])
+                pen::semaphore_post(s_pool.wait_sems[i], 1);
+    }
+
+    void* worker_thread(void* params)
+    {
+        s_thread_is_worker = true;
+        get_thread_deque();
+
+        task t;
+        for (;;)
+        {
+            if (try_get_task(t))
+            {
+                run_task(t);
+                continue;
+            }
+
+            if (s_pool.exit)
+                break;
+
+            // spin a little before sleeping to keep dispatch latency low
+            bool found = false;
+            for (u32 i = 0; i < e_jobs_constants::spin_count; ++i)
+            {
+                pen::thread_sleep_ms(0);
+                if (try_get_task(t))
+                {
+                    found = true;
+                    break;
+                }
+            }
+
+            if (found)
+            {
+                run_task(t);
+                continue;
+            }
+
+            s_pool.num_sleeping.fetch_add(1);
+
+            // re-check after announcing we are going to sleep, a task may have been pushed in between
+            if (try_get_task(t))
+            {
+                s_pool.num_sleeping.fetch_sub(1);
+                run_task(t);
+                continue;
+            }
+
+            if (s_pool.exit)
+            {
+                s_pool.num_sleeping.fetch_sub(1);
+                break;
+            }
+
+            pen::semaphore_wait(s_pool.wake);
+            s_pool.num_sleeping.fetch_sub(1);
+        }
+
+        release_thread_deque();
+
+        s_pool.num_exited.fetch_add(1);
+        return PEN_THREAD_OK;
+    }
+
+    void ensure_workers()
+    {
+        if (s_pool.state.load() == 2)
+            return;
+
+        pen::jobs_create_workers(0);
+    }
+
+    void submit(const task& t)
+    {
+        ensure_workers();
+
+        if (t.counter)
+            t.counter->fetch_add(1);
+
+        task_deque* q = get_thread_deque();
+        if (!deque_push(q, t))
+        {
+            // deque is full, just execute inline
+            run_task(t);
+            return;
+        }
+
+        wake_workers(1);
+    }
+
+    bool shutdown_workers()
+    {
+        if (s_pool.state.load() != 2)
+            return true;
+
+        if (!s_pool.exit)
+        {
+            s_pool.exit = true;
+            for (u32 i = 0; i < s_pool.num_workers; ++i)
+                pen::semaphore_post(s_pool.wake, 1);
+        }
+
+        if (s_pool.num_exited.load() != s_pool.num_workers)
+            return false;
+
+        // stop other threads stealing and wait until any already inside try_get_task have left
+        s_pool.steal_closed = true;
+        if (s_pool.num_stealing.load() != 0)
+            return false;
+
+        if (!s_pool.deques_freed)
+            free_deques();
+
+        return true;
+    }
 }
+#endif
 
 namespace pen
 {
     pen::job* jobs_create_job(dispatch_thread thread_func, u32 stack_size, void* user_data, thread_start_flags flags,
                               completion_callback cb)
     {
-        if (s_num_active_threads >= MAX_THREADS)
-            return nullptr;
+        // reuse a slot released by jobs_release_job before growing
+        job* jt = nullptr;
+        for (u32 i = 0; i < s_num_active_threads; ++i)
+        {
+            if (!s_jt[i].p_thread)
+            {
+                jt = &s_jt[i];
+                break;
+            }
+        }
 
-        job_thread_params params;
+        if (!jt)
+        {
+            if (s_num_active_threads >= MAX_THREADS)
+                return nullptr;
 
-        job* jt = &s_jt[s_num_active_threads++];
+            jt = &s_jt[s_num_active_threads++];
+        }
+
+        job_thread_params params;
 
         jt->p_sem_continue = semaphore_create(0, 1);
         jt->p_sem_consume = semaphore_create(0, 1);
@@ -47,11 +476,33 @@ namespace pen
         return jt;
     }
 
+    void jobs_release_job(job* jt)
+    {
+        pen::semaphore_wait(jt->p_sem_terminated);
+
+        pen::semaphore_destroy(jt->p_sem_continue);
+        pen::semaphore_destroy(jt->p_sem_consume);
+        pen::semaphore_destroy(jt->p_sem_exit);
+        pen::semaphore_destroy(jt->p_sem_terminated);
+        pen::memory_free(jt->p_thread);
+
+        *jt = job();
+
+        while (s_num_active_threads > 0 && !s_jt[s_num_active_threads - 1].p_thread)
+            s_num_active_threads--;
+    }
+
     bool jobs_terminate_all()
     {
         // remove threads in reverse order
         for (s32 i = s_num_active_threads - 1; i >= 0; --i)
         {
+            if (!s_jt[i].p_thread)
+            {
+                s_num_active_threads--;
+                continue;
+            }
+
             pen::semaphore_post(s_jt[i].p_sem_exit, 1);
             if (pen::semaphore_try_wait(s_jt[i].p_sem_terminated))
             {
@@ -63,14 +514,19 @@ namespace pen
             }
         }
 
+        // workers last, job threads may be waiting on tasks
+#if !PEN_SINGLE_THREADED
+        return shutdown_workers();
+#else
         return true;
+#endif
     }
-    
+
     void jobs_create_single_thread_update(single_thread_update_func func)
     {
         sb_push(s_single_thread_funcs, func);
     }
-    
+
     void jobs_run_single_threaded()
     {
         s32 count = sb_count(s_single_thread_funcs);
@@ -78,6 +534,157 @@ namespace pen
         {
             ((single_thread_update_func)s_single_thread_funcs[i])();
         }
-        
+
+    }
+
+#if !PEN_SINGLE_THREADED
+    void jobs_create_workers(u32 num_workers)
+    {
+        u32 expected = 0;
+        if (!s_pool.state.compare_exchange_strong(expected, 1))
+        {
+            // another thread is creating the pool
+            while (s_pool.state.load() != 2)
+                pen::thread_sleep_ms(0);
+
+            return;
+        }
+
+        if (num_workers == 0)
+        {
+            u32 hw = pen::thread_get_num_hardware_threads();
+            num_workers = hw > 1 ? hw - 1 : 1;
+        }
+
+        num_workers = min<u32>(num_workers, e_jobs_constants::max_workers);
+
+        s_pool.num_workers = num_workers;
+        s_pool.wake = pen::semaphore_create(0, num_workers);
+
+        for (u32 i = 0; i < num_workers; ++i)
+            pen::thread_create(worker_thread, 1024 * 1024, nullptr, pen::e_thread_start_flags::detached);
+
+        s_pool.state = 2;
+    }
+
+    u32 jobs_get_num_workers()
+    {
+        return s_pool.num_workers;
+    }
+
+    void jobs_submit(task_func func, void* user_data, a_u32* counter)
+    {
+        task t = {func, nullptr, user_data, 0, 0, counter};
+        submit(t);
+    }
+
+    void jobs_parallel_for(u32 count, u32 batch_size, parallel_for_func func, void* user_data, a_u32* counter)
+    {
+        if (count == 0)
+            return;
+
+        // not worth the dispatch overhead
+        if (count <= batch_size && !counter)
+        {
+            func(0, count, user_data);
+            return;
+        }
+
+        ensure_workers();
+
+        a_u32  local_counter = {0};
+        a_u32* c = counter ? counter : &local_counter;
+
+        batch_size = max<u32>(batch_size, 1);
+        u32 num_batches = (count + batch_size - 1) / batch_size;
+
+        task_deque* q = get_thread_deque();
+        c->fetch_add(num_batches);
+
+        for (u32 i = 0; i < num_batches; ++i)
+        {
+            u32  start = i * batch_size;
+            task t = {nullptr, func, user_data, start, min(start + batch_size, count), c};
+            if (!deque_push(q, t))
+                run_task(t);
+        }
+
+        wake_workers(num_batches);
+
+        if (!counter)
+            jobs_wait(&local_counter);
+    }
+
+    void jobs_wait(a_u32* counter)
+    {
+        if (!counter)
+            return;
+
+        // waiters block on the semaphore of their deque slot
+        get_thread_deque();
+        u32 index = s_thread_deque_index;
+
+        task t;
+        while (counter->load() > 0)
+        {
+            // help with any work there is, including tasks which are not part of this counter
+            if (try_get_task(t))
+            {
+                run_task(t);
+                continue;
+            }
+
+            // spin a little before blocking, most waits are short
+            bool found = false;
+            for (u32 i = 0; i < e_jobs_constants::spin_count && !found && counter->load() > 0; ++i)
+                found = try_get_task(t);
+
+            if (found)
+            {
+                run_task(t);
+                continue;
+            }
+
+            if (counter->load() == 0)
+                break;
+
+            // the remaining tasks are running on other threads, block until a counter completes. the waiting flag is
+            // set before the re-check so a counter hitting zero in between still posts the semaphore
+            s_pool.waiting[index] = true;
+            s_pool.num_waiting.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (counter->load() > 0)
+                pen::semaphore_wait(s_pool.wait_sems[index]);
+
+            s_pool.num_waiting.fetch_sub(1);
+            s_pool.waiting[index] = false;
+        }
+    }
+#else
+    void jobs_create_workers(u32 num_workers)
+    {
+    }
+
+    u32 jobs_get_num_workers()
+    {
+        return 0;
+    }
+
+    void jobs_submit(task_func func, void* user_data, a_u32* counter)
+    {
+        task t = {func, nullptr, user_data, 0, 0, counter};
+        run_task(t);
+    }
+
+    void jobs_parallel_for(u32 count, u32 batch_size, parallel_for_func func, void* user_data, a_u32* counter)
+    {
+        if (count > 0)
+            func(0, count, user_data);
+    }
+
+    void jobs_wait(a_u32* counter)
+    {
     }
+#endif
 } // namespace pen
@@ -1,7 +1,9 @@
 // os.cpp
 // Copyright 2014 - 2019 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
+#ifndef PEN_RENDERER_NULL
 #include "GL/glew.h"
+#endif
 
 #include "console.h"
 #include "hash.h"
@@ -21,9 +23,12 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+// the null renderer has no window or gl context, so headless builds don't need gl or x11
+#ifndef PEN_RENDERER_NULL
 #include <GL/glx.h>
 #include <GL/glxext.h>
 #include <X11/Xlib.h>
+#endif
 
 using namespace pen;
 
@@ -31,6 +36,7 @@ using namespace pen;
 window_creation_params pen_window;
 pen::user_info         pen_user_info;
 
+#ifndef PEN_RENDERER_NULL
 // glx / gl stuff
 #define GLX_CONTEXT_MAJOR_VERSION_ARB 0x2091
 #define GLX_CONTEXT_MINOR_VERSION_ARB 0x2092
@@ -61,19 +67,24 @@ void pen_gl_swap_buffers()
 {
     glXSwapBuffers(_display, _window);
 }
+#endif
 
 namespace
 {
+#ifndef PEN_RENDERER_NULL
     XIM                 _xim;
     XIC                 _xic;
     bool                _ctx_error_occured = false;
+#endif
     window_frame        _window_frame;
     bool                _invalidate_window_frame = false;
 
     u32                 s_error_code = 0;
     bool                s_pen_terminate_app = false;
-    bool                s_windowed = false;
     pen_creation_params s_creation_params;
+#ifndef PEN_RENDERER_NULL
+    bool                s_windowed = false;
+#endif
 
     void users()
     {
@@ -82,6 +93,7 @@ namespace
         pen_user_info.user_name = &homedir[6];
     }
 
+#ifndef PEN_RENDERER_NULL
     int ctx_error_handler(Display* dpy, XErrorEvent* ev)
     {
         PEN_LOG("CONTEXT ERROR %i", ev->error_code);
@@ -230,6 +242,16 @@ namespace
 
         return s_error_code;
     }
+#else
+    int pen_run_headless()
+    {
+        // null renderer, no window or gl context. inits renderer and loops in wait for jobs, calling os update
+        renderer_init(nullptr, true, s_creation_params.max_renderer_commands);
+
+        pen::jobs_terminate_all();
+        return s_error_code;
+    }
+#endif
 
     int pen_run_console_app()
     {
@@ -245,6 +267,7 @@ namespace
         return s_error_code;
     }
 
+#ifndef PEN_RENDERER_NULL
     s32 translate_mouse_button(s32 b)
     {
         static f32 mw = 0.0f;
@@ -501,6 +524,7 @@ namespace
 
         pen::input_gamepad_update();
     }
+#endif
 } // namespace
 
 int main(int argc, char* argv[])
@@ -519,7 +543,11 @@ int main(int argc, char* argv[])
 
     if (pc.flags & e_pen_create_flags::renderer)
     {
+#ifdef PEN_RENDERER_NULL
+        pen_run_headless();
+#else
         pen_run_windowed();
+#endif
     }
     else
     {
@@ -544,8 +572,10 @@ namespace pen
             init_jobs = true;
         }
 
+#ifndef PEN_RENDERER_NULL
         if(s_windowed)
             update_window();
+#endif
 
         // Check for terminate and poll terminated jobs
         if (s_pen_terminate_app)
@@ -570,7 +600,11 @@ namespace pen
 
     void* window_get_primary_display_handle()
     {
+#ifdef PEN_RENDERER_NULL
+        return nullptr;
+#else
         return (void*)(intptr_t)_window;
+#endif
     }
 
     void window_get_size(s32& width, s32& height)
@@ -0,0 +1,733 @@
+// renderer_null.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "renderer_null.h"
+
+#include "console.h"
+#include "data_struct.h"
+#include "memory.h"
+#include "os.h"
+#include "renderer.h"
+#include "renderer_shared.h"
+#include "threads.h"
+
+using namespace pen;
+
+namespace pen
+{
+    a_u64 g_gpu_total;
+}
+
+namespace
+{
+    enum null_resource_type
+    {
+        RES_NONE = 0,
+        RES_BUFFER,
+        RES_TEXTURE,
+        RES_RENDER_TARGET,
+        RES_SHADER,
+        RES_STATE
+    };
+
+    struct null_resource
+    {
+        u32    type;
+        size_t size;
+    };
+
+    static const u32 k_max_bind_slots = 32;
+    static const u32 k_max_shader_types = 8;
+
+    struct null_bound_state
+    {
+        u32      shader[k_max_shader_types];
+        u32      input_layout;
+        u32      vertex_buffer;
+        u32      vertex_buffer_offset;
+        u32      index_buffer;
+        u32      index_buffer_offset;
+        u32      constant_buffer[k_max_bind_slots];
+        u32      structured_buffer[k_max_bind_slots];
+        u32      texture[k_max_bind_slots];
+        u32      sampler[k_max_bind_slots];
+        u32      raster_state;
+        u32      blend_state;
+        u32      depth_stencil_state;
+        u32      stencil_ref;
+        u32      colour_targets[MAX_MRT];
+        u32      num_colour_targets;
+        u32      depth_target;
+        viewport vp;
+        rect     scissor;
+    };
+
+    res_pool<null_resource> s_resources;
+    null_bound_state        s_bound;
+    renderer_null_stats     s_stats = {};
+    renderer_null_stats     s_presented_stats = {};
+    pen::mutex*             s_stats_mutex = nullptr;
+    renderer_info           s_renderer_info;
+
+    void reset_bound_state()
+    {
+        // invalid handles so the first set of each frame counts as a change
+        memset(&s_bound, 0xff, sizeof(s_bound));
+    }
+
+    template <typename T>
+    void set_state(T& bound, const T& value)
+    {
+        if (memcmp(&bound, &value, sizeof(T)) == 0)
+        {
+            s_stats.redundant_state_changes++;
+            return;
+        }
+
+        bound = value;
+        s_stats.state_changes++;
+    }
+
+    void set_slot_state(u32* bound, u32 slot, u32 value)
+    {
+        if (slot >= k_max_bind_slots)
+        {
+            s_stats.state_changes++;
+            return;
+        }
+
+        set_state(bound[slot], value);
+    }
+
+    size_t format_size(u32 format, u32& pixels_per_block)
+    {
+        // bytes per pixel, or per block for compressed formats
+        pixels_per_block = 1;
+        switch (format)
+        {
+            case PEN_TEX_FORMAT_R8_UNORM:
+                return 1;
+            case PEN_TEX_FORMAT_R16_FLOAT:
+                return 2;
+            case PEN_TEX_FORMAT_R32G32_FLOAT:
+            case PEN_TEX_FORMAT_R16G16B16A16_FLOAT:
+            case PEN_TEX_FORMAT_D32_FLOAT_S8_UINT:
+                return 8;
+            case PEN_TEX_FORMAT_R32G32B32A32_FLOAT:
+                return 16;
+            case PEN_TEX_FORMAT_BC1_UNORM:
+            case PEN_TEX_FORMAT_BC4_UNORM:
+                pixels_per_block = 4;
+                return 8;
+            case PEN_TEX_FORMAT_BC2_UNORM:
+            case PEN_TEX_FORMAT_BC3_UNORM:
+            case PEN_TEX_FORMAT_BC5_UNORM:
+                pixels_per_block = 4;
+                return 16;
+            default:
+                return 4;
+        }
+    }
+
+    size_t texture_size(const texture_creation_params& tcp)
+    {
+        u32    ppb = 1;
+        size_t block_size = format_size(tcp.format, ppb);
+
+        u32 w = tcp.width;
+        u32 h = tcp.height;
+        u32 d = 1;
+        u32 num_slices = max<u32>(tcp.num_arrays, 1);
+        if (tcp.collection_type == TEXTURE_COLLECTION_VOLUME)
+        {
+            d = num_slices;
+            num_slices = 1;
+        }
+
+        s32 num_mips = tcp.num_mips == -1 ? calc_num_mips(w, h) : max<s32>(tcp.num_mips, 1);
+
+        size_t size = 0;
+        for (s32 m = 0; m < num_mips; ++m)
+        {
+            size += calc_mip_level_size(w, h, d, (u32)block_size, ppb);
+
+            w = max<u32>(w / 2, 1);
+            h = max<u32>(h / 2, 1);
+            d = max<u32>(d / 2, 1);
+        }
+
+        return size * num_slices * max<u32>(tcp.sample_count, 1);
+    }
+
+    void create_resource(u32 resource_slot, u32 type, size_t size)
+    {
+        s_resources.grow(resource_slot);
+
+        null_resource& res = s_resources[resource_slot];
+        res.type = type;
+        res.size = size;
+
+        switch (type)
+        {
+            case RES_BUFFER:
+                s_stats.num_buffers++;
+                s_stats.buffer_bytes += size;
+                break;
+            case RES_TEXTURE:
+                s_stats.num_textures++;
+                s_stats.texture_bytes += size;
+                break;
+            case RES_RENDER_TARGET:
+                s_stats.num_render_targets++;
+                s_stats.render_target_bytes += size;
+                break;
+            case RES_SHADER:
+                s_stats.num_shaders++;
+                break;
+        }
+    }
+
+    void release_resource(u32 resource_slot)
+    {
+        s_resources.grow(resource_slot);
+        null_resource& res = s_resources[resource_slot];
+
+        switch (res.type)
+        {
+            case RES_BUFFER:
+                s_stats.num_buffers--;
+                s_stats.buffer_bytes -= res.size;
+                break;
+            case RES_TEXTURE:
+                s_stats.num_textures--;
+                s_stats.texture_bytes -= res.size;
+                break;
+            case RES_RENDER_TARGET:
+                s_stats.num_render_targets--;
+                s_stats.render_target_bytes -= res.size;
+                break;
+            case RES_SHADER:
+                s_stats.num_shaders--;
+                break;
+        }
+
+        res.type = RES_NONE;
+        res.size = 0;
+    }
+} // namespace
+
+namespace pen
+{
+    void renderer_null_get_stats(renderer_null_stats& stats)
+    {
+        pen::mutex_lock(s_stats_mutex);
+        stats = s_presented_stats;
+        pen::mutex_unlock(s_stats_mutex);
+    }
+
+    u32 direct::renderer_initialise(void*, u32 bb_res, u32 bb_depth_res)
+    {
+        s_resources.init(2048);
+        s_stats_mutex = pen::mutex_create();
+        reset_bound_state();
+
+        s_renderer_info.api_version = "null";
+        s_renderer_info.shader_version = "none";
+        s_renderer_info.renderer = "null";
+        s_renderer_info.vendor = "pmtech";
+        s_renderer_info.renderer_cmd = "-renderer null";
+
+        // claim support for everything so the full front end runs
+        s_renderer_info.caps = PEN_CAPS_TEXTURE_MULTISAMPLE | PEN_CAPS_DEPTH_CLAMP | PEN_CAPS_COMPUTE |
+                               PEN_CAPS_TEXTURE_CUBE_ARRAY | PEN_CAPS_TEX_FORMAT_BC1 | PEN_CAPS_TEX_FORMAT_BC2 |
+                               PEN_CAPS_TEX_FORMAT_BC3 | PEN_CAPS_TEX_FORMAT_BC4 | PEN_CAPS_TEX_FORMAT_BC5;
+
+        // backbuffer
+        s32 w, h;
+        pen::window_get_size(w, h);
+
+        texture_creation_params bb = {};
+        bb.width = w;
+        bb.height = h;
+        bb.num_mips = 1;
+        bb.num_arrays = 1;
+        bb.sample_count = 1;
+        bb.format = PEN_TEX_FORMAT_RGBA8_UNORM;
+        create_resource(bb_res, RES_RENDER_TARGET, texture_size(bb));
+
+        bb.format = PEN_TEX_FORMAT_D24_UNORM_S8_UINT;
+        create_resource(bb_depth_res, RES_RENDER_TARGET, texture_size(bb));
+
+        return PEN_ERR_OK;
+    }
+
+    void direct::renderer_shutdown()
+    {
+        pen::mutex_destroy(s_stats_mutex);
+    }
+
+    const renderer_info& renderer_get_info()
+    {
+        return s_renderer_info;
+    }
+
+    const c8* renderer_get_shader_platform()
+    {
+        // no shaders are compiled, but pmfx still needs the technique info for the host platform
+#ifdef _WIN32
+        return "hlsl";
+#else
+        return "glsl";
+#endif
+    }
+
+    bool renderer_viewport_vup()
+    {
+        return false;
+    }
+
+    bool renderer_depth_0_to_1()
+    {
+        return true;
+    }
+
+    void direct::renderer_sync()
+    {
+    }
+
+    void direct::renderer_retain()
+    {
+    }
+
+    void direct::renderer_new_frame()
+    {
+        _renderer_new_frame();
+    }
+
+    void direct::renderer_end_frame()
+    {
+    }
+
+    void direct::renderer_present()
+    {
+        _renderer_end_frame();
+
+        pen::mutex_lock(s_stats_mutex);
+        s_presented_stats = s_stats;
+        pen::mutex_unlock(s_stats_mutex);
+
+        // keep resource totals, reset per frame counters
+        s_stats.draw_calls = 0;
+        s_stats.instances = 0;
+        s_stats.dispatches = 0;
+        s_stats.vertices = 0;
+        s_stats.state_changes = 0;
+        s_stats.redundant_state_changes = 0;
+        s_stats.clears = 0;
+        s_stats.bytes_uploaded = 0;
+
+        reset_bound_state();
+    }
+
+    void direct::renderer_push_perf_marker(const c8* name)
+    {
+        PEN_UNUSED(name);
+    }
+
+    void direct::renderer_pop_perf_marker()
+    {
+    }
+
+    // clears
+
+    void direct::renderer_create_clear_state(const clear_state& cs, u32 resource_slot)
+    {
+        PEN_UNUSED(cs);
+
+        create_resource(resource_slot, RES_STATE, 0);
+    }
+
+    void direct::renderer_clear(u32 clear_state_index, u32 colour_slice, u32 depth_slice)
+    {
+        PEN_UNUSED(clear_state_index);
+        PEN_UNUSED(colour_slice);
+        PEN_UNUSED(depth_slice);
+
+        s_stats.clears++;
+    }
+
+    void direct::renderer_clear_texture(u32 clear_state_index, u32 texture)
+    {
+        PEN_UNUSED(clear_state_index);
+        PEN_UNUSED(texture);
+
+        s_stats.clears++;
+    }
+
+    // shaders
+
+    void direct::renderer_load_shader(const pen::shader_load_params& params, u32 resource_slot)
+    {
+        PEN_UNUSED(params);
+
+        create_resource(resource_slot, RES_SHADER, 0);
+    }
+
+    void direct::renderer_set_shader(u32 shader_index, u32 shader_type)
+    {
+        set_state(s_bound.shader[shader_type % k_max_shader_types], shader_index);
+    }
+
+    void direct::renderer_create_input_layout(const input_layout_creation_params& params, u32 resource_slot)
+    {
+        PEN_UNUSED(params);
+
+        create_resource(resource_slot, RES_STATE, 0);
+    }
+
+    void direct::renderer_set_input_layout(u32 layout_index)
+    {
+        set_state(s_bound.input_layout, layout_index);
+    }
+
+    void direct::renderer_link_shader_program(const shader_link_params& params, u32 resource_slot)
+    {
+        PEN_UNUSED(params);
+
+        create_resource(resource_slot, RES_SHADER, 0);
+    }
+
+    // buffers
+
+    void direct::renderer_create_buffer(const buffer_creation_params& params, u32 resource_slot)
+    {
+        create_resource(resource_slot, RES_BUFFER, params.buffer_size);
+
+        if (params.data)
+            s_stats.bytes_uploaded += params.buffer_size;
+    }
+
+    void direct::renderer_set_vertex_buffers(u32* buffer_indices, u32 num_buffers, u32 start_slot, const u32* strides,
+                                             const u32* offsets)
+    {
+        PEN_UNUSED(start_slot);
+        PEN_UNUSED(strides);
+
+        set_state(s_bound.vertex_buffer, buffer_indices[0]);
+        set_state(s_bound.vertex_buffer_offset, offsets[0]);
+
+        // additional streams (instance buffers) always count as a change
+        if (num_buffers > 1)
+            s_stats.state_changes += num_buffers - 1;
+    }
+
+    void direct::renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset)
+    {
+        PEN_UNUSED(format);
+
+        set_state(s_bound.index_buffer, buffer_index);
+        set_state(s_bound.index_buffer_offset, offset);
+    }
+
+    void direct::renderer_set_constant_buffer(u32 buffer_index, u32 resource_slot, u32 flags)
+    {
+        PEN_UNUSED(flags);
+
+        set_slot_state(s_bound.constant_buffer, resource_slot, buffer_index);
+    }
+
+    void direct::renderer_set_structured_buffer(u32 buffer_index, u32 resource_slot, u32 flags)
+    {
+        PEN_UNUSED(flags);
+
+        set_slot_state(s_bound.structured_buffer, resource_slot, buffer_index);
+    }
+
+    void direct::renderer_update_buffer(u32 buffer_index, const void* data, u32 data_size, u32 offset)
+    {
+        PEN_UNUSED(buffer_index);
+        PEN_UNUSED(data);
+        PEN_UNUSED(offset);
+
+        s_stats.bytes_uploaded += data_size;
+    }
+
+    // textures
+
+    void direct::renderer_create_texture(const texture_creation_params& tcp, u32 resource_slot)
+    {
+        create_resource(resource_slot, RES_TEXTURE, texture_size(tcp));
+
+        if (tcp.data)
+            s_stats.bytes_uploaded += tcp.data_size;
+    }
+
+    void direct::renderer_create_sampler(const sampler_creation_params& scp, u32 resource_slot)
+    {
+        PEN_UNUSED(scp);
+
+        create_resource(resource_slot, RES_STATE, 0);
+    }
+
+    void direct::renderer_set_texture(u32 texture_index, u32 sampler_index, u32 resource_slot, u32 bind_flags)
+    {
+        PEN_UNUSED(bind_flags);
+
+        set_slot_state(s_bound.texture, resource_slot, texture_index);
+        set_slot_state(s_bound.sampler, resource_slot, sampler_index);
+    }
+
+    // rasterizer
+
+    void direct::renderer_create_rasterizer_state(const rasteriser_state_creation_params& rscp, u32 resource_slot)
+    {
+        PEN_UNUSED(rscp);
+
+        create_resource(resource_slot, RES_STATE, 0);
+    }
+
+    void direct::renderer_set_rasterizer_state(u32 rasterizer_state_index)
+    {
+        set_state(s_bound.raster_state, rasterizer_state_index);
+    }
+
+    void direct::renderer_set_viewport(const viewport& vp)
+    {
+        set_state(s_bound.vp, vp);
+    }
+
+    void direct::renderer_set_scissor_rect(const rect& r)
+    {
+        set_state(s_bound.scissor, r);
+    }
+
+    // blending
+
+    void direct::renderer_create_blend_state(const blend_creation_params& bcp, u32 resource_slot)
+    {
+        PEN_UNUSED(bcp);
+
+        create_resource(resource_slot, RES_STATE, 0);
+    }
+
+    void direct::renderer_set_blend_state(u32 blend_state_index)
+    {
+        set_state(s_bound.blend_state, blend_state_index);
+    }
+
+    // depth stencil state
+
+    void direct::renderer_create_depth_stencil_state(const depth_stencil_creation_params& dscp, u32 resource_slot)
+    {
+        PEN_UNUSED(dscp);
+
+        create_resource(resource_slot, RES_STATE, 0);
+    }
+
+    void direct::renderer_set_depth_stencil_state(u32 depth_stencil_state)
+    {
+        set_state(s_bound.depth_stencil_state, depth_stencil_state);
+    }
+
+    void direct::renderer_set_stencil_ref(u8 ref)
+    {
+        set_state(s_bound.stencil_ref, (u32)ref);
+    }
+
+    // draw calls
+
+    void direct::renderer_draw(u32 vertex_count, u32 start_vertex, u32 primitive_topology)
+    {
+        PEN_UNUSED(start_vertex);
+        PEN_UNUSED(primitive_topology);
+
+        s_stats.draw_calls++;
+        s_stats.instances++;
+        s_stats.vertices += vertex_count;
+    }
+
+    void direct::renderer_draw_indexed(u32 index_count, u32 start_index, u32 base_vertex, u32 primitive_topology)
+    {
+        PEN_UNUSED(start_index);
+        PEN_UNUSED(base_vertex);
+        PEN_UNUSED(primitive_topology);
+
+        s_stats.draw_calls++;
+        s_stats.instances++;
+        s_stats.vertices += index_count;
+    }
+
+    void direct::renderer_draw_indexed_instanced(u32 instance_count, u32 start_instance, u32 index_count,
+                                                 u32 start_index, u32 base_vertex, u32 primitive_topology)
+    {
+        PEN_UNUSED(start_instance);
+        PEN_UNUSED(start_index);
+        PEN_UNUSED(base_vertex);
+        PEN_UNUSED(primitive_topology);
+
+        s_stats.draw_calls++;
+        s_stats.instances += instance_count;
+        s_stats.vertices += (u64)index_count * instance_count;
+    }
+
+    void direct::renderer_draw_auto()
+    {
+        s_stats.draw_calls++;
+        s_stats.instances++;
+    }
+
+    void direct::renderer_dispatch_compute(uint3 grid, uint3 num_threads)
+    {
+        PEN_UNUSED(grid);
+        PEN_UNUSED(num_threads);
+
+        s_stats.dispatches++;
+    }
+
+    // render targets
+
+    void direct::renderer_create_render_target(const texture_creation_params& tcp, u32 resource_slot, bool track)
+    {
+        PEN_ASSERT(tcp.width != 0 && tcp.height != 0);
+
+        texture_creation_params _tcp = _renderer_tcp_resolve_ratio(tcp);
+
+        if (track)
+            _renderer_track_managed_render_target(tcp, resource_slot);
+
+        // managed targets are re-created on resize without a release
+        s_resources.grow(resource_slot);
+        if (s_resources[resource_slot].type == RES_RENDER_TARGET)
+            release_resource(resource_slot);
+
+        create_resource(resource_slot, RES_RENDER_TARGET, texture_size(_tcp));
+    }
+
+    void direct::renderer_set_targets(const u32* const colour_targets, u32 num_colour_targets, u32 depth_target,
+                                      u32 colour_slice, u32 depth_slice)
+    {
+        PEN_UNUSED(colour_slice);
+        PEN_UNUSED(depth_slice);
+
+        u32 targets[MAX_MRT];
+        memset(targets, 0xff, sizeof(targets));
+        for (u32 i = 0; i < min<u32>(num_colour_targets, MAX_MRT); ++i)
+            targets[i] = colour_targets[i];
+
+        bool changed = num_colour_targets != s_bound.num_colour_targets || depth_target != s_bound.depth_target ||
+                       memcmp(targets, s_bound.colour_targets, sizeof(targets)) != 0;
+
+        if (!changed)
+        {
+            s_stats.redundant_state_changes++;
+            return;
+        }
+
+        memcpy(s_bound.colour_targets, targets, sizeof(targets));
+        s_bound.num_colour_targets = num_colour_targets;
+        s_bound.depth_target = depth_target;
+        s_stats.state_changes++;
+    }
+
+    void direct::renderer_set_resolve_targets(u32 colour_target, u32 depth_target)
+    {
+        PEN_UNUSED(colour_target);
+        PEN_UNUSED(depth_target);
+    }
+
+    void direct::renderer_set_stream_out_target(u32 buffer_index)
+    {
+        PEN_UNUSED(buffer_index);
+
+        s_stats.state_changes++;
+    }
+
+    void direct::renderer_resolve_target(u32 target, e_msaa_resolve_type type, resolve_resources res)
+    {
+        PEN_UNUSED(target);
+        PEN_UNUSED(type);
+        PEN_UNUSED(res);
+    }
+
+    // resource
+
+    void direct::renderer_read_back_resource(const resource_read_back_params& rrbp)
+    {
+        // nothing to read back, but callers may be waiting on the result
+        void* data = pen::memory_alloc(rrbp.data_size);
+        memset(data, 0x0, rrbp.data_size);
+
+        rrbp.call_back_function(data, rrbp.row_pitch, rrbp.depth_pitch, rrbp.block_size);
+
+        pen::memory_free(data);
+    }
+
+    // cleanup
+
+    void direct::renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type)
+    {
+        PEN_UNUSED(type);
+
+        release_resource(dest);
+
+        // src is owned by dest now, so its memory is only counted once
+        s_resources.grow(max(dest, src));
+        s_resources[dest] = s_resources[src];
+        s_resources[src].type = RES_NONE;
+        s_resources[src].size = 0;
+    }
+
+    void direct::renderer_release_shader(u32 shader_index, u32 shader_type)
+    {
+        PEN_UNUSED(shader_type);
+
+        release_resource(shader_index);
+    }
+
+    void direct::renderer_release_clear_state(u32 clear_state)
+    {
+        release_resource(clear_state);
+    }
+
+    void direct::renderer_release_buffer(u32 buffer_index)
+    {
+        release_resource(buffer_index);
+    }
+
+    void direct::renderer_release_texture(u32 texture_index)
+    {
+        release_resource(texture_index);
+    }
+
+    void direct::renderer_release_sampler(u32 sampler)
+    {
+        release_resource(sampler);
+    }
+
+    void direct::renderer_release_raster_state(u32 raster_state_index)
+    {
+        release_resource(raster_state_index);
+    }
+
+    void direct::renderer_release_blend_state(u32 blend_state)
+    {
+        release_resource(blend_state);
+    }
+
+    void direct::renderer_release_render_target(u32 render_target)
+    {
+        _renderer_untrack_managed_render_target(render_target);
+        release_resource(render_target);
+    }
+
+    void direct::renderer_release_input_layout(u32 input_layout)
+    {
+        release_resource(input_layout);
+    }
+
+    void direct::renderer_release_depth_stencil_state(u32 depth_stencil_state)
+    {
+        release_resource(depth_stencil_state);
+    }
+} // namespace pen
@@ -3,9 +3,11 @@
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <fnmatch.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/param.h>
 #include <sys/stat.h>
@@ -104,6 +106,44 @@ namespace pen
         return PEN_ERR_FILE_NOT_FOUND;
     }
 
+    pen_error filesystem_map_file(const c8* filename, const void** p_buffer, size_t& buffer_size)
+    {
+        WRITE_FILE_DEPENDENCIES(filename);
+
+        const c8* resource_name = os_path_for_resource(filename);
+
+        *p_buffer = nullptr;
+        buffer_size = 0;
+
+        int fd = open(resource_name, O_RDONLY);
+        if (fd < 0)
+            return PEN_ERR_FILE_NOT_FOUND;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            return PEN_ERR_FAILED;
+        }
+
+        // the mapping holds its own reference to the file
+        void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (mapped == MAP_FAILED)
+            return PEN_ERR_FAILED;
+
+        *p_buffer = mapped;
+        buffer_size = (size_t)st.st_size;
+        return PEN_ERR_OK;
+    }
+
+    void filesystem_unmap_file(const void* p_buffer, size_t buffer_size)
+    {
+        if (p_buffer)
+            munmap((void*)p_buffer, buffer_size);
+    }
+
     pen_error filesystem_enum_volumes(fs_tree_node& results)
     {
         static const c8* volumes_name = "Volumes";
@@ -99,6 +99,12 @@ namespace pen
         usleep(microseconds);
     }
 
+    u32 thread_get_num_hardware_threads()
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (u32)n : 1;
+    }
+
 #ifndef PEN_PLATFORM_WEB // posix semaphore implementation proper
     struct semaphore
     {
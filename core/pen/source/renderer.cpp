@@ -26,12 +26,6 @@ pen::resolve_resources             g_resolve_resources;
 
 using namespace pen;
 
-#if PEN_SINGLE_THREADED
-#define add_cmd(cmd) exec_cmd(cmd)
-#else
-#define add_cmd(cmd) _ctx->cmd_buffer.put(cmd)
-#endif
-
 namespace
 {
     enum commands : u32
@@ -243,24 +237,447 @@ namespace
 
         renderer_cmd(){};
     };
-        
+
+    // commands are packed into the cmd stream as a packet_header followed by only the active union member. large,
+    // infrequent commands (resource creation, read back) are copied out-of-line into the frame allocator and packed as
+    // a pointer, so the hot state and draw commands take 8 - 48 bytes instead of sizeof(renderer_cmd).
+    static const u32 k_out_of_line = 0xffffffff;
+    static const u32 k_max_cmd_payload_size = 64;
+    static const u32 k_max_packed_cmd_size = sizeof(packet_header) + k_max_cmd_payload_size;
+    static const u32 k_cmd_stream_bytes_per_cmd = 32;
+
+    u32 cmd_payload_size(u32 command_index)
+    {
+        switch (command_index)
+        {
+            case CMD_NEW_FRAME:
+            case CMD_UPDATE_QUERIES:
+            case CMD_DRAW_AUTO:
+            case CMD_POP_PERF_MARKER:
+                return 0;
+            case CMD_CLEAR:
+            case CMD_CLEAR_TEXTURE:
+                return sizeof(clear_cmd);
+            case CMD_SET_SHADER:
+            case CMD_RELEASE_SHADER:
+                return sizeof(set_shader_cmd);
+            case CMD_SET_VERTEX_BUFFER:
+                return sizeof(set_vertex_buffer_cmd);
+            case CMD_SET_INDEX_BUFFER:
+                return sizeof(set_index_buffer_cmd);
+            case CMD_DRAW:
+                return sizeof(draw_cmd);
+            case CMD_DRAW_INDEXED:
+                return sizeof(draw_indexed_cmd);
+            case CMD_DRAW_INDEXED_INSTANCED:
+                return sizeof(draw_indexed_instanced_cmd);
+            case CMD_SET_TEXTURE:
+                return sizeof(set_texture_cmd);
+            case CMD_SET_VIEWPORT:
+            case CMD_SET_VIEWPORT_RATIO:
+                return sizeof(viewport);
+            case CMD_SET_SCISSOR_RECT:
+            case CMD_SET_SCISSOR_RECT_RATIO:
+                return sizeof(rect);
+            case CMD_SET_CONSTANT_BUFFER:
+            case CMD_SET_STRUCTURED_BUFFER:
+                return sizeof(set_buffer_cmd);
+            case CMD_UPDATE_BUFFER:
+                return sizeof(update_buffer_cmd);
+            case CMD_SET_TARGETS:
+                return sizeof(set_target_cmd);
+            case CMD_RESOLVE_TARGET:
+                return sizeof(msaa_resolve_params);
+            case CMD_REPLACE_RESOURCE:
+                return sizeof(replace_resource);
+            case CMD_PUSH_PERF_MARKER:
+                return sizeof(c8*);
+            case CMD_DISPATCH_COMPUTE:
+                return sizeof(compute_dispatch_params);
+            case CMD_SET_STENCIL_REF:
+                return sizeof(u8);
+            case CMD_LOAD_SHADER:
+            case CMD_LINK_SHADER:
+            case CMD_CREATE_INPUT_LAYOUT:
+            case CMD_CREATE_BUFFER:
+            case CMD_CREATE_TEXTURE:
+            case CMD_CREATE_SAMPLER:
+            case CMD_CREATE_RASTER_STATE:
+            case CMD_CREATE_BLEND_STATE:
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+            case CMD_CREATE_RENDER_TARGET:
+            case CMD_CREATE_CLEAR_STATE:
+            case CMD_CREATE_SO_SHADER:
+            case CMD_MAP_RESOURCE:
+                return k_out_of_line;
+            default:
+                // set / release by handle
+                return sizeof(u32);
+        }
+    }
+
+    // command payloads are carved from a per-frame allocator, which is reset when the render thread presents the
+    // frame. the user thread can be at most 2 frames ahead of the render thread.
+    static const u32 k_num_frame_allocators = 3;
+    static const size_t k_frame_allocator_size = 1024 * 1024;
+    static const size_t k_frame_allocator_max_size = 64 * 1024 * 1024;
+
+    // cmd lists can be recorded on any thread and submitted by the user thread, payloads are carved from the lists
+    // own frame allocators so recording threads dont need to synchronise.
+    static const u32 k_max_cmd_lists = 256;
+    static const u32 k_cmd_list_initial_capacity = 16 * 1024;
+    static const size_t k_cmd_list_allocator_size = 64 * 1024;
+
+    // shadow copy of the state bound by a stream of commands, set_* commands which would bind what is already bound
+    // are dropped before they are packed. the user thread and each cmd list have their own, bindings above the slot
+    // limits are never filtered.
+    static const u32 k_shadow_unknown = 0xffffffff;
+    static const u32 k_max_shadow_slots = 32;
+    static const u32 k_max_shadow_vertex_buffers = 8;
+    static const u32 k_num_shadow_stages = 3; // ps, vs, cs matching the bind flags
+
+    struct shadow_texture
+    {
+        u32 texture;
+        u32 sampler;
+        u32 msaa;
+    };
+
+    struct shadow_state
+    {
+        u32            shader[PEN_SHADER_TYPE_CS + 1];
+        u32            input_layout;
+        u32            vertex_buffers[2];                             // start slot, num buffers of the last set
+        u32            vertex_buffer[k_max_shadow_vertex_buffers][3]; // buffer, stride, offset
+        u32            index_buffer[3];                               // buffer, format, offset
+        u32            raster_state;
+        u32            blend_state;
+        u32            depth_stencil_state;
+        u32            stencil_ref;
+        u32            constant_buffer[k_num_shadow_stages][k_max_shadow_slots];
+        u32            structured_buffer[k_num_shadow_stages][k_max_shadow_slots];
+        shadow_texture texture[k_num_shadow_stages][k_max_shadow_slots];
+        u32            viewport_valid;
+        u32            scissor_valid;
+        viewport       vp;
+        rect           scissor;
+        u32            num_filtered = 0;
+
+        shadow_state()
+        {
+            invalidate();
+        }
+
+        void invalidate()
+        {
+            u32 nf = num_filtered;
+            memset((void*)this, 0xff, sizeof(shadow_state));
+            viewport_valid = 0;
+            scissor_valid = 0;
+            num_filtered = nf;
+        }
+    };
+
+    struct cmd_list
+    {
+        u8*              data = nullptr; // packed commands
+        u32              size = 0;
+        u32              capacity = 0;
+        u32              num_cmds = 0;
+        linear_allocator frame_allocators[k_num_frame_allocators];
+        shadow_state     shadow;
+    };
+
     // front end render_ctx
     struct fe_render_ctx
     {
-        pen::timer*               present_timer = nullptr;
-        f64                       present_time = 0.0f;
-        pen::resolve_resources    resolve_resources;
-        pen::semaphore*           consume_semaphore = nullptr;
-        pen::semaphore*           continue_semaphore = nullptr;
-        pen::slot_resources       renderer_slot_resources;
-        ring_buffer<renderer_cmd> cmd_buffer;
-        ring_buffer<renderer_cmd> release_cmd_buffer;
-        u32*                      free_slots = nullptr;
-        a_s32                     wait;
+        pen::timer*                present_timer = nullptr;
+        f64                        present_time = 0.0f;
+        pen::resolve_resources     resolve_resources;
+        pen::semaphore*            consume_semaphore = nullptr;
+        pen::semaphore*            continue_semaphore = nullptr;
+        pen::semaphore*            cmd_space_semaphore = nullptr; // posted by the render thread as it frees cmd_buffer
+        a_u32                      cmd_space_waiters = {0};
+        u32                        cmd_space_signalled = 0;
+        pen::slot_resources        renderer_slot_resources;
+        packet_ring_buffer         cmd_buffer;
+        ring_buffer<renderer_cmd>  release_cmd_buffer;
+        u32*                       free_slots = nullptr;
+        a_s32                      wait;
+        linear_allocator           frame_allocators[k_num_frame_allocators];
+        u32                        frame_allocator = 0;
+        u64                        frames_submitted = 0;
+        a_u64                      frames_retired = {0};
+        renderer_frame_alloc_stats frame_alloc_stats = {};
+        cmd_list*                  cmd_lists[k_max_cmd_lists] = {0};
+        a_u32                      num_cmd_lists = {0};
+        pen::mutex*                resource_mutex = nullptr;
+        a_u32                      frame_cmds = {0};
+        a_u32                      frame_out_of_line_cmds = {0};
+        a_u64                      frame_cmd_bytes = {0};
+        pen::timer*                consume_timer = nullptr;
+        f64                        consume_time = 0.0;
+        renderer_cmd_stats         cmd_stats;
+        shadow_state               shadow;
+        a_u32                      frame_filtered_cmds = {0};
     };
     static fe_render_ctx* _ctx;
     static render_ctx     _main_ctx;
 
+    // cmd list being recorded on this thread, when null commands go straight to the render thread
+    thread_local cmd_list* s_cmd_list = nullptr;
+    thread_local u32       s_cmd_stream_lock_depth = 0;
+
+    // cmd_buffer and the shared frame allocators have a producer on the user thread and resource calls from any thread,
+    // every write to them holds resource_mutex. it is re-entrant per thread so resource calls can hold it throughout.
+    struct cmd_stream_lock
+    {
+        cmd_stream_lock()
+        {
+            if (s_cmd_stream_lock_depth++ == 0)
+                pen::mutex_lock(_ctx->resource_mutex);
+        }
+
+        ~cmd_stream_lock()
+        {
+            if (--s_cmd_stream_lock_depth == 0)
+                pen::mutex_unlock(_ctx->resource_mutex);
+        }
+    };
+
+    pen_inline void* cmd_alloc(size_t size)
+    {
+        if (s_cmd_list)
+            return s_cmd_list->frame_allocators[_ctx->frame_allocator].alloc(size);
+
+        cmd_stream_lock lock;
+        return _ctx->frame_allocators[_ctx->frame_allocator].alloc(size);
+    }
+
+    pen_inline shadow_state& current_shadow_state()
+    {
+        if (s_cmd_list)
+            return s_cmd_list->shadow;
+
+        return _ctx->shadow;
+    }
+
+    // returns true if cached already holds v, cached is updated to v either way
+    pen_inline bool shadow_filter(u32& cached, u32 v)
+    {
+        if (cached == v && v != k_shadow_unknown)
+            return true;
+
+        cached = v;
+        return false;
+    }
+
+    // buffer binds can target multiple stages, they are only redundant if every stage in flags already has it bound
+    bool shadow_filter_slot(u32 (&cache)[k_num_shadow_stages][k_max_shadow_slots], u32 slot, u32 flags, u32 v)
+    {
+        if (slot >= k_max_shadow_slots)
+            return false;
+
+        u32  num_stages = 0;
+        bool redundant = true;
+        for (u32 s = 0; s < k_num_shadow_stages; ++s)
+        {
+            if (!(flags & (CBUFFER_BIND_PS << s)))
+                continue;
+
+            redundant &= shadow_filter(cache[s][slot], v);
+            num_stages++;
+        }
+
+        return redundant && num_stages > 0;
+    }
+
+    bool shadow_filter_texture(shadow_state& ss, u32 texture, u32 sampler, u32 slot, u32 flags)
+    {
+        if (slot >= k_max_shadow_slots)
+            return false;
+
+        u32  msaa = flags & TEXTURE_BIND_MSAA;
+        u32  num_stages = 0;
+        bool redundant = true;
+        for (u32 s = 0; s < k_num_shadow_stages; ++s)
+        {
+            if (!(flags & (TEXTURE_BIND_PS << s)))
+                continue;
+
+            // textures and structured buffers can share registers
+            ss.structured_buffer[s][slot] = k_shadow_unknown;
+
+            shadow_texture& st = ss.texture[s][slot];
+            redundant &= shadow_filter(st.texture, texture);
+            redundant &= shadow_filter(st.sampler, sampler);
+            redundant &= shadow_filter(st.msaa, msaa);
+            num_stages++;
+        }
+
+        return redundant && num_stages > 0;
+    }
+
+    // some platforms need buffers rebinding after an update, ie. metal dynamic buffers move on write
+    void shadow_invalidate_buffer(shadow_state& ss, u32 buffer)
+    {
+        for (u32 i = 0; i < k_max_shadow_vertex_buffers; ++i)
+            if (ss.vertex_buffer[i][0] == buffer)
+                ss.vertex_buffer[i][0] = k_shadow_unknown;
+
+        if (ss.index_buffer[0] == buffer)
+            ss.index_buffer[0] = k_shadow_unknown;
+
+        for (u32 s = 0; s < k_num_shadow_stages; ++s)
+        {
+            for (u32 i = 0; i < k_max_shadow_slots; ++i)
+            {
+                if (ss.constant_buffer[s][i] == buffer)
+                    ss.constant_buffer[s][i] = k_shadow_unknown;
+
+                if (ss.structured_buffer[s][i] == buffer)
+                    ss.structured_buffer[s][i] = k_shadow_unknown;
+            }
+        }
+    }
+
+    // commands which can change bindings as a side effect (new encoders on metal, srv unbinds on d3d) invalidate all
+    pen_inline void shadow_invalidate()
+    {
+        current_shadow_state().invalidate();
+    }
+
+    pen_inline bool shadow_drop(shadow_state& ss, bool redundant)
+    {
+        if (redundant)
+            ss.num_filtered++;
+
+        return redundant;
+    }
+
+    // packs cmd into dst which must have space for k_max_packed_cmd_size bytes, returns the packed size
+    u32 pack_cmd(const renderer_cmd& cmd, u8* dst)
+    {
+        packet_header* h = (packet_header*)dst;
+        h->id = (u16)cmd.command_index;
+
+        u32 ps = cmd_payload_size(cmd.command_index);
+        if (ps == k_out_of_line)
+        {
+            renderer_cmd* ool = (renderer_cmd*)cmd_alloc(sizeof(renderer_cmd));
+            *ool = cmd;
+            memcpy(h + 1, &ool, sizeof(renderer_cmd*));
+            ps = sizeof(renderer_cmd*);
+            _ctx->frame_out_of_line_cmds++;
+        }
+        else
+        {
+            ps = (ps + 3) & ~3;
+            PEN_ASSERT(ps <= k_max_cmd_payload_size);
+            memcpy(h + 1, &cmd.command_data_index, ps);
+        }
+
+        h->size = (u16)ps;
+        return sizeof(packet_header) + ps;
+    }
+
+    // returns the command for a packet, hot commands are unpacked into scratch
+    pen_inline const renderer_cmd* unpack_cmd(const packet_header* h, renderer_cmd& scratch)
+    {
+        if (cmd_payload_size(h->id) == k_out_of_line)
+        {
+            renderer_cmd* ool;
+            memcpy(&ool, h + 1, sizeof(renderer_cmd*));
+            return ool;
+        }
+
+        scratch.command_index = h->id;
+        memcpy(&scratch.command_data_index, h + 1, h->size);
+        return &scratch;
+    }
+
+    // blocks until the render thread has released enough of cmd_buffer for needed bytes
+    void wait_for_cmd_space(u32 needed)
+    {
+        _ctx->cmd_space_waiters++;
+
+        // the render thread publishes space before it reads the waiter count, re-check after announcing the wait
+        while (_ctx->cmd_buffer.free_bytes() < needed)
+            pen::semaphore_wait(_ctx->cmd_space_semaphore);
+
+        _ctx->cmd_space_waiters--;
+    }
+
+    // render thread side, wakes producers waiting on space once packets have been released
+    void signal_cmd_space()
+    {
+        u32 n = _ctx->cmd_space_waiters.load();
+        if (n == 0)
+            return;
+
+        u32 gp = _ctx->cmd_buffer.get_pos;
+        if (gp == _ctx->cmd_space_signalled)
+            return;
+
+        _ctx->cmd_space_signalled = gp;
+        for (u32 i = 0; i < n; ++i)
+            pen::semaphore_post(_ctx->cmd_space_semaphore, 1);
+    }
+
+    void put_packed_cmds(const u8* data, u32 size, u32 num_cmds)
+    {
+        // a batch goes in whole so commands from other threads can't land between its packets, wrapping pads by less
+        // than one packet. the lock is not held while waiting for room so other producers are not stalled behind it
+        u32 needed = size + k_max_packed_cmd_size;
+        for (;;)
+        {
+            {
+                cmd_stream_lock lock;
+
+                // a batch too big for the buffer, or a call nested in a resource call which already holds the lock,
+                // has to be streamed in under the lock as the render thread makes room
+                bool fits = _ctx->cmd_buffer.free_bytes() >= needed;
+                bool stream = needed > _ctx->cmd_buffer._capacity / 2 || s_cmd_stream_lock_depth > 1;
+
+                if (fits || stream)
+                {
+                    _ctx->frame_cmds += num_cmds;
+                    _ctx->frame_cmd_bytes += size;
+
+                    u32 pos = _ctx->cmd_buffer.put(data, size);
+                    while (pos < size)
+                    {
+                        wait_for_cmd_space(k_max_packed_cmd_size * 2);
+                        pos += _ctx->cmd_buffer.put(data + pos, size - pos);
+                    }
+
+                    return;
+                }
+            }
+
+            wait_for_cmd_space(needed);
+        }
+    }
+
+    // resource creation and release bypass cmd lists and are sent straight to the render thread (serialised with a
+    // mutex) so any resource is created before a cmd list that might use it is submitted. the lock is held for the
+    // whole call so its payloads and command are in the same frame.
+    struct resource_cmd_scope
+    {
+        cmd_stream_lock lock;
+        cmd_list*       suspended_list;
+
+        resource_cmd_scope()
+        {
+            suspended_list = s_cmd_list;
+            s_cmd_list = nullptr;
+        }
+
+        ~resource_cmd_scope()
+        {
+            s_cmd_list = suspended_list;
+        }
+    };
 } // namespace
 
 namespace pen
@@ -293,6 +710,14 @@ namespace pen
                 break;
             case CMD_PRESENT:
                 direct::renderer_present();
+
+                // all commands for this frame have been consumed, release their payloads
+                _ctx->frame_allocators[cmd.command_data_index].reset();
+                for (u32 i = 0; i < _ctx->num_cmd_lists; ++i)
+                    _ctx->cmd_lists[i]->frame_allocators[cmd.command_data_index].reset();
+
+                _ctx->frames_retired++;
+
                 end_frame_internal();
                 _ctx->present_time = timer_elapsed_ms(_ctx->present_timer);
                 timer_start(_ctx->present_timer);
@@ -300,8 +725,6 @@ namespace pen
 
             case CMD_LOAD_SHADER:
                 direct::renderer_load_shader(cmd.shader_load, cmd.resource_slot);
-                memory_free(cmd.shader_load.byte_code);
-                memory_free(cmd.shader_load.so_decl_entries);
                 break;
 
             case CMD_SET_SHADER:
@@ -310,19 +733,10 @@ namespace pen
 
             case CMD_LINK_SHADER:
                 direct::renderer_link_shader_program(cmd.link_params, cmd.resource_slot);
-                for (u32 i = 0; i < cmd.link_params.num_constants; ++i)
-                    memory_free(cmd.link_params.constants[i].name);
-                memory_free(cmd.link_params.constants);
-                if (cmd.link_params.stream_out_names)
-                    for (u32 i = 0; i < cmd.link_params.num_stream_out_names; ++i)
-                        memory_free(cmd.link_params.stream_out_names[i]);
-                memory_free(cmd.link_params.stream_out_names);
                 break;
 
             case CMD_CREATE_INPUT_LAYOUT:
                 direct::renderer_create_input_layout(cmd.create_input_layout, cmd.resource_slot);
-                memory_free(cmd.create_input_layout.vs_byte_code);
-                memory_free(cmd.create_input_layout.input_layout);
                 break;
 
             case CMD_SET_INPUT_LAYOUT:
@@ -331,16 +745,12 @@ namespace pen
 
             case CMD_CREATE_BUFFER:
                 direct::renderer_create_buffer(cmd.create_buffer, cmd.resource_slot);
-                memory_free(cmd.create_buffer.data);
                 break;
 
             case CMD_SET_VERTEX_BUFFER:
                 direct::renderer_set_vertex_buffers(cmd.set_vertex_buffer.buffer_indices, cmd.set_vertex_buffer.num_buffers,
                                                     cmd.set_vertex_buffer.start_slot, cmd.set_vertex_buffer.strides,
                                                     cmd.set_vertex_buffer.offsets);
-                memory_free(cmd.set_vertex_buffer.buffer_indices);
-                memory_free(cmd.set_vertex_buffer.strides);
-                memory_free(cmd.set_vertex_buffer.offsets);
                 break;
 
             case CMD_SET_INDEX_BUFFER:
@@ -366,7 +776,6 @@ namespace pen
 
             case CMD_CREATE_TEXTURE:
                 direct::renderer_create_texture(cmd.create_texture, cmd.resource_slot);
-                memory_free(cmd.create_texture.data);
                 break;
 
             case CMD_CREATE_SAMPLER:
@@ -420,7 +829,6 @@ namespace pen
 
             case CMD_CREATE_BLEND_STATE:
                 direct::renderer_create_blend_state(cmd.create_blend_state, cmd.resource_slot);
-                memory_free(cmd.create_blend_state.render_targets);
                 break;
 
             case CMD_SET_BLEND_STATE:
@@ -440,12 +848,10 @@ namespace pen
             case CMD_UPDATE_BUFFER:
                 direct::renderer_update_buffer(cmd.update_buffer.buffer_index, cmd.update_buffer.data,
                                                cmd.update_buffer.data_size, cmd.update_buffer.offset);
-                memory_free(cmd.update_buffer.data);
                 break;
 
             case CMD_CREATE_DEPTH_STENCIL_STATE:
                 direct::renderer_create_depth_stencil_state(*cmd.p_create_depth_stencil_state, cmd.resource_slot);
-                memory_free(cmd.p_create_depth_stencil_state);
                 break;
 
             case CMD_SET_DEPTH_STENCIL_STATE:
@@ -533,6 +939,31 @@ namespace pen
         }
     }
     
+    void add_cmd(const renderer_cmd& cmd)
+    {
+        if (s_cmd_list)
+        {
+            cmd_list* cl = s_cmd_list;
+            if (cl->size + k_max_packed_cmd_size > cl->capacity)
+            {
+                cl->capacity = max(cl->capacity * 2, (u32)k_cmd_list_initial_capacity);
+                cl->data = (u8*)memory_realloc(cl->data, cl->capacity);
+            }
+
+            cl->size += pack_cmd(cmd, cl->data + cl->size);
+            cl->num_cmds++;
+            return;
+        }
+
+#if PEN_SINGLE_THREADED
+        exec_cmd(cmd);
+#else
+        u32 packed[k_max_packed_cmd_size / sizeof(u32)];
+        u32 size = pack_cmd(cmd, (u8*)&packed[0]);
+        put_packed_cmds((u8*)&packed[0], size, 1);
+#endif
+    }
+
     //
     // 
     //
@@ -607,21 +1038,43 @@ namespace pen
         // this is a dedicated thread which stays for the duration of the program
         semaphore_post(_ctx->continue_semaphore, 1);
 
+        f64 consume_ms = 0.0;
         for (;;)
         {
-            renderer_cmd* cmd = _ctx->cmd_buffer.get();
-            
-            while(cmd)
+            timer_start(_ctx->consume_timer);
+
+            renderer_cmd   scratch;
+            packet_header* h = nullptr;
+            bool           present = false;
+            while ((h = _ctx->cmd_buffer.peek()))
             {
+                // hot commands are copied into scratch and out-of-line ones live in the frame allocator, so the
+                // packet can be released before executing
+                const renderer_cmd* cmd = unpack_cmd(h, scratch);
+                _ctx->cmd_buffer.pop();
+                signal_cmd_space();
+
+                if (cmd->command_index == CMD_PRESENT)
+                {
+                    // consume time excludes present which may block on the swap chain
+                    _ctx->consume_time = consume_ms + timer_elapsed_ms(_ctx->consume_timer);
+                    consume_ms = 0.0;
+                    present = true;
+                }
+
                 exec_cmd(*cmd);
 
                 // break at present to re-call os update
-                if (cmd->command_index == CMD_PRESENT)
+                if (present)
                     break;
-
-                cmd = _ctx->cmd_buffer.get();
             }
-            
+
+            // peek releases everything consumed once it has caught up
+            signal_cmd_space();
+
+            if (!present)
+                consume_ms += timer_elapsed_ms(_ctx->consume_timer);
+
             if(!pen::os_update())
                 break;
         }
@@ -632,18 +1085,25 @@ namespace pen
         // this function is invoked from mtk draw in view
         //if we start renderin  we need to wait for present to prevent command buffer being released before ending encoding
 
-        renderer_cmd* cmd = _ctx->cmd_buffer.get();
-        bool started = cmd;
-        while(cmd)
+        renderer_cmd   scratch;
+        packet_header* h = _ctx->cmd_buffer.peek();
+        bool           started = h;
+        while(h)
         {
+            const renderer_cmd* cmd = unpack_cmd(h, scratch);
+            _ctx->cmd_buffer.pop();
+            signal_cmd_space();
+
             exec_cmd(*cmd);
 
             // break at present to re-call os update
             if (cmd->command_index == CMD_PRESENT)
                 break;
-                    
-            cmd = _ctx->cmd_buffer.get();
+
+            h = _ctx->cmd_buffer.peek();
         }
+
+        signal_cmd_space();
         
         direct::renderer_retain();
         return started;
@@ -713,14 +1173,20 @@ namespace pen
     render_ctx renderer_create_context(u32 max_commands)
     {
         fe_render_ctx* new_ctx = new fe_render_ctx();
-        new_ctx->cmd_buffer.create(max_commands);
+        new_ctx->cmd_buffer.create(max_commands * k_cmd_stream_bytes_per_cmd);
         new_ctx->release_cmd_buffer.create(1024);
         new_ctx->present_timer = timer_create();
         timer_start(new_ctx->present_timer);
         new_ctx->present_time = 0.0f;
+        new_ctx->consume_timer = timer_create();
         new_ctx->consume_semaphore = semaphore_create(0, 1);
         new_ctx->continue_semaphore = semaphore_create(0, 1);
+        new_ctx->cmd_space_semaphore = semaphore_create(0, k_max_cmd_lists);
         slot_resources_init(&new_ctx->renderer_slot_resources, 2048);
+        new_ctx->resource_mutex = mutex_create();
+
+        for (u32 i = 0; i < k_num_frame_allocators; ++i)
+            new_ctx->frame_allocators[i].create(k_frame_allocator_size, k_frame_allocator_max_size);
 
         return (render_ctx*)new_ctx;
     }
@@ -900,6 +1366,8 @@ namespace pen
 
     void renderer_new_frame()
     {
+        shadow_invalidate();
+
         renderer_cmd cmd;
         cmd.command_index = CMD_NEW_FRAME;
         add_cmd(cmd);
@@ -914,6 +1382,8 @@ namespace pen
 
     void renderer_clear(u32 clear_state_index, u32 array_index)
     {
+        shadow_invalidate();
+
         renderer_cmd cmd;
         cmd.command_index = CMD_CLEAR;
         cmd.clear.clear_state = clear_state_index;
@@ -923,6 +1393,8 @@ namespace pen
 
     void renderer_clear_texture(u32 clear_state_index, u32 texture)
     {
+        shadow_invalidate();
+
         renderer_cmd cmd;
         cmd.command_index = CMD_CLEAR_TEXTURE;
         cmd.clear.clear_state = clear_state_index;
@@ -934,13 +1406,124 @@ namespace pen
     {
         pen::renderer_test_run();
                 
-        renderer_cmd cmd;
-        cmd.command_index = CMD_PRESENT;
-        add_cmd(cmd);
+        // cmd lists must be ended and submitted before present
+        PEN_ASSERT(!s_cmd_list);
+
+        // resource calls on other threads must not allocate from the old allocator after present
+        {
+            cmd_stream_lock lock;
+
+            // stats must be taken before the cmd, single threaded will reset the allocator inline
+            linear_allocator& fa = _ctx->frame_allocators[_ctx->frame_allocator];
+            _ctx->frame_alloc_stats.num_allocs = fa.num_allocs;
+            _ctx->frame_alloc_stats.num_heap_allocs = fa.num_heap_allocs;
+            _ctx->frame_alloc_stats.allocated_bytes = fa.size();
+            _ctx->frame_alloc_stats.capacity_bytes = fa._capacity;
+
+            _ctx->cmd_stats.num_cmds = _ctx->frame_cmds;
+            _ctx->cmd_stats.num_out_of_line = _ctx->frame_out_of_line_cmds;
+            _ctx->cmd_stats.packed_bytes = _ctx->frame_cmd_bytes;
+            _ctx->cmd_stats.unpacked_bytes = _ctx->cmd_stats.num_cmds * sizeof(renderer_cmd);
+            _ctx->cmd_stats.consume_ms = (f32)_ctx->consume_time;
+            _ctx->cmd_stats.num_filtered = _ctx->frame_filtered_cmds + _ctx->shadow.num_filtered;
+            _ctx->frame_cmds = 0;
+            _ctx->frame_out_of_line_cmds = 0;
+            _ctx->frame_cmd_bytes = 0;
+            _ctx->frame_filtered_cmds = 0;
+            _ctx->shadow.num_filtered = 0;
+
+            // backends may reset their bound state at present
+            _ctx->shadow.invalidate();
+
+            renderer_cmd cmd;
+            cmd.command_index = CMD_PRESENT;
+            cmd.command_data_index = _ctx->frame_allocator;
+            add_cmd(cmd);
+
+            _ctx->frames_submitted++;
+            _ctx->frame_allocator = _ctx->frames_submitted % k_num_frame_allocators;
+        }
+
+        // wait for the render thread to retire the frame which last used the next allocator
+        while (_ctx->frames_submitted - _ctx->frames_retired >= k_num_frame_allocators)
+            pen::thread_sleep_us(100);
+    }
+
+    void renderer_get_frame_alloc_stats(renderer_frame_alloc_stats& stats)
+    {
+        stats = _ctx->frame_alloc_stats;
+    }
+
+    void renderer_get_cmd_stats(renderer_cmd_stats& stats)
+    {
+        stats = _ctx->cmd_stats;
+    }
+
+    u32 renderer_create_cmd_list()
+    {
+        u32 index = _ctx->num_cmd_lists;
+        PEN_ASSERT(index < k_max_cmd_lists);
+
+        cmd_list* cl = new cmd_list();
+        for (u32 i = 0; i < k_num_frame_allocators; ++i)
+            cl->frame_allocators[i].create(k_cmd_list_allocator_size, k_frame_allocator_max_size);
+
+        // publish once initialised, the render thread resets cmd list allocators at present
+        _ctx->cmd_lists[index] = cl;
+        _ctx->num_cmd_lists = index + 1;
+
+        return index;
+    }
+
+    void renderer_begin_cmd_list(u32 cmd_list)
+    {
+        // only one cmd list can be recorded per thread at a time
+        PEN_ASSERT(!s_cmd_list);
+        s_cmd_list = _ctx->cmd_lists[cmd_list];
+
+        // the state a list starts with depends on what was submitted before it
+        s_cmd_list->shadow.invalidate();
+    }
+
+    void renderer_end_cmd_list()
+    {
+        s_cmd_list = nullptr;
+    }
+
+    void renderer_submit_cmd_lists(const u32* cmd_lists, u32 num_cmd_lists)
+    {
+        PEN_ASSERT(!s_cmd_list);
+
+        for (u32 i = 0; i < num_cmd_lists; ++i)
+        {
+            cmd_list* cl = _ctx->cmd_lists[cmd_lists[i]];
+
+#if PEN_SINGLE_THREADED
+            renderer_cmd scratch;
+            for (u32 pos = 0; pos < cl->size;)
+            {
+                const packet_header* h = (const packet_header*)(cl->data + pos);
+                exec_cmd(*unpack_cmd(h, scratch));
+                pos += sizeof(packet_header) + h->size;
+            }
+#else
+            // already packed, bulk copy into the cmd stream
+            put_packed_cmds(cl->data, cl->size, cl->num_cmds);
+#endif
+            cl->size = 0;
+            cl->num_cmds = 0;
+
+            _ctx->frame_filtered_cmds += cl->shadow.num_filtered;
+            cl->shadow.num_filtered = 0;
+        }
+
+        // direct commands follow whatever state the lists left bound
+        _ctx->shadow.invalidate();
     }
 
     u32 renderer_load_shader(const shader_load_params& params)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_LOAD_SHADER;
@@ -950,7 +1533,7 @@ namespace pen
 
         if (params.byte_code)
         {
-            cmd.shader_load.byte_code = memory_alloc(params.byte_code_size);
+            cmd.shader_load.byte_code = cmd_alloc(params.byte_code_size);
             memcpy(cmd.shader_load.byte_code, params.byte_code, params.byte_code_size);
         }
 
@@ -960,7 +1543,7 @@ namespace pen
             cmd.shader_load.so_num_entries = params.so_num_entries;
 
             u32 entries_size = sizeof(stream_out_decl_entry) * params.so_num_entries;
-            cmd.shader_load.so_decl_entries = (stream_out_decl_entry*)memory_alloc(entries_size);
+            cmd.shader_load.so_decl_entries = (stream_out_decl_entry*)cmd_alloc(entries_size);
 
             memcpy(cmd.shader_load.so_decl_entries, params.so_decl_entries, entries_size);
         }
@@ -975,6 +1558,7 @@ namespace pen
 
     u32 renderer_link_shader_program(const shader_link_params& params)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_LINK_SHADER;
@@ -983,7 +1567,7 @@ namespace pen
 
         u32 num = params.num_constants;
         u32 layout_size = sizeof(constant_layout_desc) * num;
-        cmd.link_params.constants = (constant_layout_desc*)memory_alloc(layout_size);
+        cmd.link_params.constants = (constant_layout_desc*)cmd_alloc(layout_size);
 
         constant_layout_desc* c = cmd.link_params.constants;
         for (u32 i = 0; i < num; ++i)
@@ -992,7 +1576,7 @@ namespace pen
             c[i].type = params.constants[i].type;
 
             u32 len = string_length(params.constants[i].name);
-            c[i].name = (c8*)memory_alloc(len + 1);
+            c[i].name = (c8*)cmd_alloc(len + 1);
 
             memcpy(c[i].name, params.constants[i].name, len);
             c[i].name[len] = '\0';
@@ -1002,13 +1586,13 @@ namespace pen
         if (params.stream_out_shader != 0)
         {
             u32 num_so = params.num_stream_out_names;
-            cmd.link_params.stream_out_names = (c8**)memory_alloc(sizeof(c8*) * num_so);
+            cmd.link_params.stream_out_names = (c8**)cmd_alloc(sizeof(c8*) * num_so);
 
             c8** so = cmd.link_params.stream_out_names;
             for (u32 i = 0; i < num_so; ++i)
             {
                 u32 len = string_length(params.stream_out_names[i]);
-                so[i] = (c8*)memory_alloc(len + 1);
+                so[i] = (c8*)cmd_alloc(len + 1);
 
                 memcpy(so[i], params.stream_out_names[i], len);
                 so[i][len] = '\0';
@@ -1025,6 +1609,10 @@ namespace pen
 
     void renderer_set_shader(u32 shader_index, u32 shader_type)
     {
+        shadow_state& ss = current_shadow_state();
+        if (shader_type < PEN_ARRAY_SIZE(ss.shader) && shadow_drop(ss, shadow_filter(ss.shader[shader_type], shader_index)))
+            return;
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_SHADER;
@@ -1037,6 +1625,7 @@ namespace pen
 
     u32 renderer_create_input_layout(const input_layout_creation_params& params)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_CREATE_INPUT_LAYOUT;
@@ -1046,12 +1635,12 @@ namespace pen
         cmd.create_input_layout.vs_byte_code_size = params.vs_byte_code_size;
 
         // copy buffer
-        cmd.create_input_layout.vs_byte_code = memory_alloc(params.vs_byte_code_size);
+        cmd.create_input_layout.vs_byte_code = cmd_alloc(params.vs_byte_code_size);
         memcpy(cmd.create_input_layout.vs_byte_code, params.vs_byte_code, params.vs_byte_code_size);
 
         // copy array
         u32 input_layouts_size = sizeof(input_layout_desc) * params.num_elements;
-        cmd.create_input_layout.input_layout = (input_layout_desc*)memory_alloc(input_layouts_size);
+        cmd.create_input_layout.input_layout = (input_layout_desc*)cmd_alloc(input_layouts_size);
 
         memcpy(cmd.create_input_layout.input_layout, params.input_layout, input_layouts_size);
 
@@ -1065,6 +1654,10 @@ namespace pen
 
     void renderer_set_input_layout(u32 layout_index)
     {
+        shadow_state& ss = current_shadow_state();
+        if (shadow_drop(ss, shadow_filter(ss.input_layout, layout_index)))
+            return;
+
         renderer_cmd cmd;
         cmd.command_index = CMD_SET_INPUT_LAYOUT;
         cmd.command_data_index = layout_index;
@@ -1074,6 +1667,7 @@ namespace pen
 
     u32 renderer_create_buffer(const buffer_creation_params& params)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_CREATE_BUFFER;
@@ -1083,7 +1677,7 @@ namespace pen
         if (params.data)
         {
             // make a copy of the buffers data
-            cmd.create_buffer.data = memory_alloc(params.buffer_size);
+            cmd.create_buffer.data = cmd_alloc(params.buffer_size);
             memcpy(cmd.create_buffer.data, params.data, params.buffer_size);
         }
 
@@ -1103,6 +1697,23 @@ namespace pen
     void renderer_set_vertex_buffers(u32* buffer_indices, u32 num_buffers, u32 start_slot, const u32* strides,
                                      const u32* offsets)
     {
+        shadow_state& ss = current_shadow_state();
+        if (start_slot + num_buffers <= k_max_shadow_vertex_buffers)
+        {
+            bool redundant = shadow_filter(ss.vertex_buffers[0], start_slot);
+            redundant &= shadow_filter(ss.vertex_buffers[1], num_buffers);
+            for (u32 i = 0; i < num_buffers; ++i)
+            {
+                u32* vb = &ss.vertex_buffer[start_slot + i][0];
+                redundant &= shadow_filter(vb[0], buffer_indices[i]);
+                redundant &= shadow_filter(vb[1], strides[i]);
+                redundant &= shadow_filter(vb[2], offsets[i]);
+            }
+
+            if (shadow_drop(ss, redundant))
+                return;
+        }
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_VERTEX_BUFFER;
@@ -1110,9 +1721,9 @@ namespace pen
         cmd.set_vertex_buffer.start_slot = start_slot;
         cmd.set_vertex_buffer.num_buffers = num_buffers;
 
-        cmd.set_vertex_buffer.buffer_indices = (u32*)memory_alloc(sizeof(u32) * num_buffers);
-        cmd.set_vertex_buffer.strides = (u32*)memory_alloc(sizeof(u32) * num_buffers);
-        cmd.set_vertex_buffer.offsets = (u32*)memory_alloc(sizeof(u32) * num_buffers);
+        cmd.set_vertex_buffer.buffer_indices = (u32*)cmd_alloc(sizeof(u32) * num_buffers);
+        cmd.set_vertex_buffer.strides = (u32*)cmd_alloc(sizeof(u32) * num_buffers);
+        cmd.set_vertex_buffer.offsets = (u32*)cmd_alloc(sizeof(u32) * num_buffers);
 
         for (u32 i = 0; i < num_buffers; ++i)
         {
@@ -1126,6 +1737,13 @@ namespace pen
 
     void renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset)
     {
+        shadow_state& ss = current_shadow_state();
+        bool          redundant = shadow_filter(ss.index_buffer[0], buffer_index);
+        redundant &= shadow_filter(ss.index_buffer[1], format);
+        redundant &= shadow_filter(ss.index_buffer[2], offset);
+        if (shadow_drop(ss, redundant))
+            return;
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_INDEX_BUFFER;
@@ -1179,6 +1797,7 @@ namespace pen
 
     u32 renderer_create_render_target(const texture_creation_params& tcp)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         PEN_ASSERT(tcp.width != 0 && tcp.height != 0);
@@ -1201,6 +1820,7 @@ namespace pen
 
     u32 renderer_create_texture(const texture_creation_params& tcp)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         switch ((pen::texture_collection_type)tcp.collection_type)
@@ -1219,16 +1839,13 @@ namespace pen
 
         memcpy(&cmd.create_texture, (void*)&tcp, sizeof(texture_creation_params));
 
-        cmd.create_texture.data = memory_alloc(tcp.data_size);
+        cmd.create_texture.data = nullptr;
 
         if (tcp.data)
         {
+            cmd.create_texture.data = cmd_alloc(tcp.data_size);
             memcpy(cmd.create_texture.data, tcp.data, tcp.data_size);
         }
-        else
-        {
-            cmd.create_texture.data = nullptr;
-        }
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
@@ -1240,6 +1857,7 @@ namespace pen
 
     u32 renderer_create_sampler(const sampler_creation_params& scp)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_CREATE_SAMPLER;
@@ -1256,6 +1874,10 @@ namespace pen
 
     void renderer_set_texture(u32 texture_index, u32 sampler_index, u32 resource_slot, u32 bind_flags)
     {
+        shadow_state& ss = current_shadow_state();
+        if (shadow_drop(ss, shadow_filter_texture(ss, texture_index, sampler_index, resource_slot, bind_flags)))
+            return;
+
         renderer_cmd cmd;
         
         cmd.command_index = CMD_SET_TEXTURE;
@@ -1270,6 +1892,7 @@ namespace pen
 
     u32 renderer_create_rasterizer_state(const rasteriser_state_creation_params& rscp)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_CREATE_RASTER_STATE;
@@ -1286,6 +1909,10 @@ namespace pen
 
     void renderer_set_rasterizer_state(u32 rasterizer_state_index)
     {
+        shadow_state& ss = current_shadow_state();
+        if (shadow_drop(ss, shadow_filter(ss.raster_state, rasterizer_state_index)))
+            return;
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_RASTER_STATE;
@@ -1297,6 +1924,13 @@ namespace pen
 
     void renderer_set_viewport(const viewport& vp)
     {
+        shadow_state& ss = current_shadow_state();
+        if (shadow_drop(ss, ss.viewport_valid && memcmp(&ss.vp, &vp, sizeof(viewport)) == 0))
+            return;
+
+        ss.vp = vp;
+        ss.viewport_valid = 1;
+
         renderer_cmd cmd;
         cmd.command_index = CMD_SET_VIEWPORT;
         memcpy(&cmd.set_viewport, (void*)&vp, sizeof(viewport));
@@ -1305,6 +1939,13 @@ namespace pen
 
     void renderer_set_scissor_rect(const rect& r)
     {
+        shadow_state& ss = current_shadow_state();
+        if (shadow_drop(ss, ss.scissor_valid && memcmp(&ss.scissor, &r, sizeof(rect)) == 0))
+            return;
+
+        ss.scissor = r;
+        ss.scissor_valid = 1;
+
         renderer_cmd cmd;
         cmd.command_index = CMD_SET_SCISSOR_RECT;
         memcpy(&cmd.set_rect, (void*)&r, sizeof(rect));
@@ -1313,6 +1954,9 @@ namespace pen
 
     void renderer_set_viewport_ratio(const viewport& vp)
     {
+        // resolved against the backbuffer on the render thread
+        current_shadow_state().viewport_valid = 0;
+
         renderer_cmd cmd;
         cmd.command_index = CMD_SET_VIEWPORT_RATIO;
         memcpy(&cmd.set_viewport, (void*)&vp, sizeof(viewport));
@@ -1321,6 +1965,8 @@ namespace pen
 
     void renderer_set_scissor_rect_ratio(const rect& r)
     {
+        current_shadow_state().scissor_valid = 0;
+
         renderer_cmd cmd;
         cmd.command_index = CMD_SET_SCISSOR_RECT_RATIO;
         memcpy(&cmd.set_rect, (void*)&r, sizeof(rect));
@@ -1329,6 +1975,7 @@ namespace pen
 
     u32 renderer_create_blend_state(const blend_creation_params& bcp)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_CREATE_BLEND_STATE;
@@ -1337,7 +1984,7 @@ namespace pen
 
         // alloc and copy the render targets blend modes. to save space in the cmd buffer
         u32   render_target_modes_size = sizeof(render_target_blend) * bcp.num_render_targets;
-        void* mem = memory_alloc(render_target_modes_size);
+        void* mem = cmd_alloc(render_target_modes_size);
         cmd.create_blend_state.render_targets = (render_target_blend*)mem;
 
         memcpy(cmd.create_blend_state.render_targets, (void*)bcp.render_targets, render_target_modes_size);
@@ -1352,6 +1999,10 @@ namespace pen
 
     void renderer_set_blend_state(u32 blend_state_index)
     {
+        shadow_state& ss = current_shadow_state();
+        if (shadow_drop(ss, shadow_filter(ss.blend_state, blend_state_index)))
+            return;
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_BLEND_STATE;
@@ -1363,6 +2014,10 @@ namespace pen
 
     void renderer_set_constant_buffer(u32 buffer_index, u32 resource_slot, u32 flags)
     {
+        shadow_state& ss = current_shadow_state();
+        if (shadow_drop(ss, shadow_filter_slot(ss.constant_buffer, resource_slot, flags, buffer_index)))
+            return;
+
         renderer_cmd cmd;
         
         cmd.command_index = CMD_SET_CONSTANT_BUFFER;
@@ -1376,6 +2031,18 @@ namespace pen
 
     void renderer_set_structured_buffer(u32 buffer_index, u32 resource_slot, u32 flags)
     {
+        shadow_state& ss = current_shadow_state();
+        if (resource_slot < k_max_shadow_slots)
+        {
+            // textures and structured buffers can share registers
+            for (u32 s = 0; s < k_num_shadow_stages; ++s)
+                if (flags & (SBUFFER_BIND_PS << s))
+                    ss.texture[s][resource_slot].texture = k_shadow_unknown;
+        }
+
+        if (shadow_drop(ss, shadow_filter_slot(ss.structured_buffer, resource_slot, flags, buffer_index)))
+            return;
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_STRUCTURED_BUFFER;
@@ -1394,12 +2061,14 @@ namespace pen
         if (buffer_index == 0)
             return;
 
+        shadow_invalidate_buffer(current_shadow_state(), buffer_index);
+
         cmd.command_index = CMD_UPDATE_BUFFER;
 
         cmd.update_buffer.buffer_index = buffer_index;
         cmd.update_buffer.data_size = data_size;
         cmd.update_buffer.offset = offset;
-        cmd.update_buffer.data = memory_alloc(data_size);
+        cmd.update_buffer.data = cmd_alloc(data_size);
         memcpy(cmd.update_buffer.data, data, data_size);
 
         add_cmd(cmd);
@@ -1407,12 +2076,13 @@ namespace pen
 
     u32 renderer_create_depth_stencil_state(const depth_stencil_creation_params& dscp)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_CREATE_DEPTH_STENCIL_STATE;
 
         cmd.p_create_depth_stencil_state =
-            (depth_stencil_creation_params*)memory_alloc(sizeof(depth_stencil_creation_params));
+            (depth_stencil_creation_params*)cmd_alloc(sizeof(depth_stencil_creation_params));
 
         memcpy(cmd.p_create_depth_stencil_state, &dscp, sizeof(depth_stencil_creation_params));
 
@@ -1426,6 +2096,10 @@ namespace pen
 
     void renderer_set_depth_stencil_state(u32 depth_stencil_state)
     {
+        shadow_state& ss = current_shadow_state();
+        if (shadow_drop(ss, shadow_filter(ss.depth_stencil_state, depth_stencil_state)))
+            return;
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_DEPTH_STENCIL_STATE;
@@ -1437,6 +2111,8 @@ namespace pen
 
     void renderer_set_targets(u32* colour_targets, u32 num_colour_targets, u32 depth_target, u32 array_index)
     {
+        shadow_invalidate();
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_TARGETS;
@@ -1450,6 +2126,8 @@ namespace pen
 
     void renderer_set_targets(u32 colour_target, u32 depth_target)
     {
+        shadow_invalidate();
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_TARGETS;
@@ -1463,6 +2141,7 @@ namespace pen
     
     void renderer_release_shader(u32 shader_index, u32 shader_type)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_SHADER;
@@ -1476,6 +2155,7 @@ namespace pen
 
     void renderer_release_buffer(u32 buffer_index)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_BUFFER;
@@ -1488,6 +2168,7 @@ namespace pen
 
     void renderer_release_texture(u32 texture_index)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_TEXTURE_2D;
@@ -1500,6 +2181,7 @@ namespace pen
 
     void renderer_release_blend_state(u32 blend_state)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_BLEND_STATE;
@@ -1512,6 +2194,7 @@ namespace pen
 
     void renderer_release_render_target(u32 render_target)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_RENDER_TARGET;
@@ -1524,6 +2207,7 @@ namespace pen
 
     void renderer_release_clear_state(u32 clear_state)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_CLEAR_STATE;
@@ -1536,6 +2220,7 @@ namespace pen
 
     void renderer_release_input_layout(u32 input_layout)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_INPUT_LAYOUT;
@@ -1548,6 +2233,7 @@ namespace pen
 
     void renderer_release_sampler(u32 sampler)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_SAMPLER;
@@ -1560,6 +2246,7 @@ namespace pen
 
     void renderer_release_depth_stencil_state(u32 depth_stencil_state)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_DEPTH_STENCIL_STATE;
@@ -1572,6 +2259,7 @@ namespace pen
     
     void renderer_release_raster_state(u32 raster_state_index)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_RASTER_STATE;
@@ -1583,6 +2271,8 @@ namespace pen
 
     void renderer_set_stream_out_target(u32 buffer_index)
     {
+        shadow_invalidate();
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_SO_TARGET;
@@ -1593,6 +2283,8 @@ namespace pen
 
     void renderer_resolve_target(u32 target, e_msaa_resolve_type type)
     {
+        shadow_invalidate();
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RESOLVE_TARGET;
@@ -1614,6 +2306,8 @@ namespace pen
 
     void renderer_dispatch_compute(uint3 grid, uint3 num_threads)
     {
+        shadow_invalidate();
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_DISPATCH_COMPUTE;
@@ -1625,6 +2319,8 @@ namespace pen
 
     void renderer_read_back_resource(const resource_read_back_params& rrbp)
     {
+        shadow_invalidate();
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_MAP_RESOURCE;
@@ -1636,6 +2332,8 @@ namespace pen
 
     void renderer_replace_resource(u32 dest, u32 src, e_renderer_resource type)
     {
+        shadow_invalidate();
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_REPLACE_RESOURCE;
@@ -1647,6 +2345,7 @@ namespace pen
 
     u32 renderer_create_clear_state(const clear_state& cs)
     {
+        resource_cmd_scope scope;
         renderer_cmd cmd;
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
@@ -1662,6 +2361,10 @@ namespace pen
 
     void renderer_set_stencil_ref(u8 ref)
     {
+        shadow_state& ss = current_shadow_state();
+        if (shadow_drop(ss, shadow_filter(ss.stencil_ref, ref)))
+            return;
+
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_STENCIL_REF;
@@ -1678,7 +2381,7 @@ namespace pen
 
         // make copy of string to be able to use temporaries
         u32 len = string_length(name);
-        cmd.name = (c8*)memory_alloc(len);
+        cmd.name = (c8*)cmd_alloc(len + 1);
         memcpy(cmd.name, name, len);
         cmd.name[len] = '\0';
 
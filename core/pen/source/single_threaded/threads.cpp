@@ -72,6 +72,11 @@ namespace pen
         usleep(microseconds);
     }
 
+    u32 thread_get_num_hardware_threads()
+    {
+        return 1;
+    }
+
     pen::semaphore* semaphore_create(u32 initial_count, u32 max_count)
     {
         pen::semaphore* new_semaphore = (pen::semaphore*)pen::memory_alloc(sizeof(pen::semaphore));
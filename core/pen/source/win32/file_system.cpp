@@ -122,6 +122,54 @@ namespace pen
         return PEN_ERR_FILE_NOT_FOUND;
     }
 
+    pen_error filesystem_map_file(const c8* filename, const void** p_buffer, size_t& buffer_size)
+    {
+        c8* windir_filename = swap_slashes(filename);
+
+        *p_buffer = nullptr;
+        buffer_size = 0;
+
+        HANDLE file = CreateFileA(windir_filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        pen::memory_free(windir_filename);
+
+        if (file == INVALID_HANDLE_VALUE)
+            return PEN_ERR_FILE_NOT_FOUND;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return PEN_ERR_FAILED;
+        }
+
+        // the view holds its own reference to the mapping and file
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+
+        if (!mapping)
+            return PEN_ERR_FAILED;
+
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+
+        if (!view)
+            return PEN_ERR_FAILED;
+
+        *p_buffer = view;
+        buffer_size = (size_t)size.QuadPart;
+        return PEN_ERR_OK;
+    }
+
+    void filesystem_unmap_file(const void* p_buffer, size_t buffer_size)
+    {
+        PEN_UNUSED(buffer_size);
+
+        if (p_buffer)
+            UnmapViewOfFile(p_buffer);
+    }
+
     pen_error filesystem_enum_volumes(fs_tree_node& tree)
     {
         DWORD drive_bit_mask = GetLogicalDrives();
@@ -0,0 +1,434 @@
+#include "ecs_anim.h"
+#include "ecs_cull.h"
+#include "ecs_simd.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        namespace
+        {
+            // interpolate count animation keys, quaternions are 4 streams x, y, z, w of stride floats
+            typedef void (*lerp_keys_func)(const f32* a, const f32* b, const f32* t, f32* out, u32 count);
+            typedef void (*slerp_keys_func)(const f32* a, const f32* b, const f32* t, f32* out, u32 count, u32 stride);
+
+            struct anim_impl
+            {
+                lerp_keys_func  lerp_keys;
+                slerp_keys_func slerp_keys;
+            };
+
+            anim_impl s_anim_impls[e_simd::COUNT];
+        } // namespace
+
+        //
+        // scalar float implementation
+        //
+
+        static void lerp_keys_scalar(const f32* a, const f32* b, const f32* t, f32* out, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+                out[i] = (1.0f - t[i]) * a[i] + t[i] * b[i];
+        }
+
+        // polynomial-corrected nlerp: a normalised lerp along the shortest path with t corrected for the angle between
+        // the keys, t + t(t - 0.5)(t - 1)k where k is a polynomial in t fitted to |dot(a, b)|. the error is under 1e-3
+        // radians for keys any angle apart and under 1e-4 for the few degrees between neighbouring keys.
+        static void slerp_keys_scalar(const f32* a, const f32* b, const f32* t, f32* out, u32 count, u32 stride)
+        {
+            const f32* ax = a;
+            const f32* ay = a + stride;
+            const f32* az = a + stride * 2;
+            const f32* aw = a + stride * 3;
+            const f32* bx = b;
+            const f32* by = b + stride;
+            const f32* bz = b + stride * 2;
+            const f32* bw = b + stride * 3;
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                f32 d = ax[i] * bx[i];
+                d = d + ay[i] * by[i];
+                d = d + az[i] * bz[i];
+                d = d + aw[i] * bw[i];
+
+                f32 sign = d < 0.0f ? -1.0f : 1.0f;
+                f32 ad = d * sign;
+
+                f32 ka = ad * -1.43519f;
+                ka = ka + 3.55645f;
+                ka = ka * ad;
+                ka = ka + -3.2452f;
+                ka = ka * ad;
+                ka = ka + 1.0904f;
+
+                f32 kb = ad * 0.215638f;
+                kb = kb + -1.06021f;
+                kb = kb * ad;
+                kb = kb + 0.848013f;
+
+                f32 h = t[i] - 0.5f;
+                f32 k = ka * h;
+                k = k * h;
+                k = k + kb;
+
+                f32 ct = t[i] * h;
+                ct = ct * (t[i] - 1.0f);
+                ct = ct * k;
+                ct = t[i] + ct;
+
+                f32 wa = 1.0f - ct;
+                f32 wb = ct * sign;
+
+                f32 x = ax[i] * wa + bx[i] * wb;
+                f32 y = ay[i] * wa + by[i] * wb;
+                f32 z = az[i] * wa + bz[i] * wb;
+                f32 w = aw[i] * wa + bw[i] * wb;
+
+                f32 l = x * x;
+                l = l + y * y;
+                l = l + z * z;
+                l = l + w * w;
+
+                f32 rl = 1.0f / sqrtf(l);
+
+                out[i] = x * rl;
+                out[i + stride] = y * rl;
+                out[i + stride * 2] = z * rl;
+                out[i + stride * 3] = w * rl;
+            }
+        }
+
+        //
+        // sse2 128 implementation
+        //
+
+#if CULL_X86
+        CULL_TARGET("sse2")
+        static void lerp_keys_sse2(const f32* a, const f32* b, const f32* t, f32* out, u32 count)
+        {
+            const __m128 one = _mm_set1_ps(1.0f);
+
+            u32 i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 vt = _mm_loadu_ps(&t[i]);
+                __m128 va = _mm_mul_ps(_mm_sub_ps(one, vt), _mm_loadu_ps(&a[i]));
+                _mm_storeu_ps(&out[i], _mm_add_ps(va, _mm_mul_ps(vt, _mm_loadu_ps(&b[i]))));
+            }
+
+            lerp_keys_scalar(&a[i], &b[i], &t[i], &out[i], count - i);
+        }
+
+        CULL_TARGET("sse2")
+        static void slerp_keys_sse2(const f32* a, const f32* b, const f32* t, f32* out, u32 count, u32 stride)
+        {
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 sign_bit = _mm_set1_ps(-0.0f);
+
+            u32 i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 ax = _mm_loadu_ps(&a[i]);
+                __m128 ay = _mm_loadu_ps(&a[i + stride]);
+                __m128 az = _mm_loadu_ps(&a[i + stride * 2]);
+                __m128 aw = _mm_loadu_ps(&a[i + stride * 3]);
+                __m128 bx = _mm_loadu_ps(&b[i]);
+                __m128 by = _mm_loadu_ps(&b[i + stride]);
+                __m128 bz = _mm_loadu_ps(&b[i + stride * 2]);
+                __m128 bw = _mm_loadu_ps(&b[i + stride * 3]);
+                __m128 vt = _mm_loadu_ps(&t[i]);
+
+                __m128 d = _mm_mul_ps(ax, bx);
+                d = _mm_add_ps(d, _mm_mul_ps(ay, by));
+                d = _mm_add_ps(d, _mm_mul_ps(az, bz));
+                d = _mm_add_ps(d, _mm_mul_ps(aw, bw));
+
+                __m128 sign = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(d, zero), sign_bit), one);
+                __m128 ad = _mm_mul_ps(d, sign);
+
+                __m128 ka = _mm_mul_ps(ad, _mm_set1_ps(-1.43519f));
+                ka = _mm_add_ps(ka, _mm_set1_ps(3.55645f));
+                ka = _mm_mul_ps(ka, ad);
+                ka = _mm_add_ps(ka, _mm_set1_ps(-3.2452f));
+                ka = _mm_mul_ps(ka, ad);
+                ka = _mm_add_ps(ka, _mm_set1_ps(1.0904f));
+
+                __m128 kb = _mm_mul_ps(ad, _mm_set1_ps(0.215638f));
+                kb = _mm_add_ps(kb, _mm_set1_ps(-1.06021f));
+                kb = _mm_mul_ps(kb, ad);
+                kb = _mm_add_ps(kb, _mm_set1_ps(0.848013f));
+
+                __m128 h = _mm_sub_ps(vt, _mm_set1_ps(0.5f));
+                __m128 k = _mm_mul_ps(ka, h);
+                k = _mm_mul_ps(k, h);
+                k = _mm_add_ps(k, kb);
+
+                __m128 ct = _mm_mul_ps(vt, h);
+                ct = _mm_mul_ps(ct, _mm_sub_ps(vt, one));
+                ct = _mm_mul_ps(ct, k);
+                ct = _mm_add_ps(vt, ct);
+
+                __m128 wa = _mm_sub_ps(one, ct);
+                __m128 wb = _mm_mul_ps(ct, sign);
+
+                __m128 x = _mm_add_ps(_mm_mul_ps(ax, wa), _mm_mul_ps(bx, wb));
+                __m128 y = _mm_add_ps(_mm_mul_ps(ay, wa), _mm_mul_ps(by, wb));
+                __m128 z = _mm_add_ps(_mm_mul_ps(az, wa), _mm_mul_ps(bz, wb));
+                __m128 w = _mm_add_ps(_mm_mul_ps(aw, wa), _mm_mul_ps(bw, wb));
+
+                __m128 l = _mm_mul_ps(x, x);
+                l = _mm_add_ps(l, _mm_mul_ps(y, y));
+                l = _mm_add_ps(l, _mm_mul_ps(z, z));
+                l = _mm_add_ps(l, _mm_mul_ps(w, w));
+
+                __m128 rl = _mm_div_ps(one, _mm_sqrt_ps(l));
+
+                _mm_storeu_ps(&out[i], _mm_mul_ps(x, rl));
+                _mm_storeu_ps(&out[i + stride], _mm_mul_ps(y, rl));
+                _mm_storeu_ps(&out[i + stride * 2], _mm_mul_ps(z, rl));
+                _mm_storeu_ps(&out[i + stride * 3], _mm_mul_ps(w, rl));
+            }
+
+            slerp_keys_scalar(&a[i], &b[i], &t[i], &out[i], count - i, stride);
+        }
+
+        //
+        // avx2 256 implementation
+        //
+
+        CULL_TARGET("avx2")
+        static void lerp_keys_avx2(const f32* a, const f32* b, const f32* t, f32* out, u32 count)
+        {
+            const __m256 one = _mm256_set1_ps(1.0f);
+
+            u32 i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256 vt = _mm256_loadu_ps(&t[i]);
+                __m256 va = _mm256_mul_ps(_mm256_sub_ps(one, vt), _mm256_loadu_ps(&a[i]));
+                _mm256_storeu_ps(&out[i], _mm256_add_ps(va, _mm256_mul_ps(vt, _mm256_loadu_ps(&b[i]))));
+            }
+
+            lerp_keys_scalar(&a[i], &b[i], &t[i], &out[i], count - i);
+        }
+
+        CULL_TARGET("avx2")
+        static void slerp_keys_avx2(const f32* a, const f32* b, const f32* t, f32* out, u32 count, u32 stride)
+        {
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 one = _mm256_set1_ps(1.0f);
+            const __m256 sign_bit = _mm256_set1_ps(-0.0f);
+
+            u32 i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256 ax = _mm256_loadu_ps(&a[i]);
+                __m256 ay = _mm256_loadu_ps(&a[i + stride]);
+                __m256 az = _mm256_loadu_ps(&a[i + stride * 2]);
+                __m256 aw = _mm256_loadu_ps(&a[i + stride * 3]);
+                __m256 bx = _mm256_loadu_ps(&b[i]);
+                __m256 by = _mm256_loadu_ps(&b[i + stride]);
+                __m256 bz = _mm256_loadu_ps(&b[i + stride * 2]);
+                __m256 bw = _mm256_loadu_ps(&b[i + stride * 3]);
+                __m256 vt = _mm256_loadu_ps(&t[i]);
+
+                __m256 d = _mm256_mul_ps(ax, bx);
+                d = _mm256_add_ps(d, _mm256_mul_ps(ay, by));
+                d = _mm256_add_ps(d, _mm256_mul_ps(az, bz));
+                d = _mm256_add_ps(d, _mm256_mul_ps(aw, bw));
+
+                __m256 sign = _mm256_or_ps(_mm256_and_ps(_mm256_cmp_ps(d, zero, _CMP_LT_OQ), sign_bit), one);
+                __m256 ad = _mm256_mul_ps(d, sign);
+
+                __m256 ka = _mm256_mul_ps(ad, _mm256_set1_ps(-1.43519f));
+                ka = _mm256_add_ps(ka, _mm256_set1_ps(3.55645f));
+                ka = _mm256_mul_ps(ka, ad);
+                ka = _mm256_add_ps(ka, _mm256_set1_ps(-3.2452f));
+                ka = _mm256_mul_ps(ka, ad);
+                ka = _mm256_add_ps(ka, _mm256_set1_ps(1.0904f));
+
+                __m256 kb = _mm256_mul_ps(ad, _mm256_set1_ps(0.215638f));
+                kb = _mm256_add_ps(kb, _mm256_set1_ps(-1.06021f));
+                kb = _mm256_mul_ps(kb, ad);
+                kb = _mm256_add_ps(kb, _mm256_set1_ps(0.848013f));
+
+                __m256 h = _mm256_sub_ps(vt, _mm256_set1_ps(0.5f));
+                __m256 k = _mm256_mul_ps(ka, h);
+                k = _mm256_mul_ps(k, h);
+                k = _mm256_add_ps(k, kb);
+
+                __m256 ct = _mm256_mul_ps(vt, h);
+                ct = _mm256_mul_ps(ct, _mm256_sub_ps(vt, one));
+                ct = _mm256_mul_ps(ct, k);
+                ct = _mm256_add_ps(vt, ct);
+
+                __m256 wa = _mm256_sub_ps(one, ct);
+                __m256 wb = _mm256_mul_ps(ct, sign);
+
+                __m256 x = _mm256_add_ps(_mm256_mul_ps(ax, wa), _mm256_mul_ps(bx, wb));
+                __m256 y = _mm256_add_ps(_mm256_mul_ps(ay, wa), _mm256_mul_ps(by, wb));
+                __m256 z = _mm256_add_ps(_mm256_mul_ps(az, wa), _mm256_mul_ps(bz, wb));
+                __m256 w = _mm256_add_ps(_mm256_mul_ps(aw, wa), _mm256_mul_ps(bw, wb));
+
+                __m256 l = _mm256_mul_ps(x, x);
+                l = _mm256_add_ps(l, _mm256_mul_ps(y, y));
+                l = _mm256_add_ps(l, _mm256_mul_ps(z, z));
+                l = _mm256_add_ps(l, _mm256_mul_ps(w, w));
+
+                __m256 rl = _mm256_div_ps(one, _mm256_sqrt_ps(l));
+
+                _mm256_storeu_ps(&out[i], _mm256_mul_ps(x, rl));
+                _mm256_storeu_ps(&out[i + stride], _mm256_mul_ps(y, rl));
+                _mm256_storeu_ps(&out[i + stride * 2], _mm256_mul_ps(z, rl));
+                _mm256_storeu_ps(&out[i + stride * 3], _mm256_mul_ps(w, rl));
+            }
+
+            slerp_keys_scalar(&a[i], &b[i], &t[i], &out[i], count - i, stride);
+        }
+#endif
+
+        //
+        // arm neon simd 128 implementation
+        //
+
+#if CULL_NEON
+        static void lerp_keys_neon(const f32* a, const f32* b, const f32* t, f32* out, u32 count)
+        {
+            const float32x4_t one = vdupq_n_f32(1.0f);
+
+            u32 i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                float32x4_t vt = vld1q_f32(&t[i]);
+                float32x4_t va = vmulq_f32(vsubq_f32(one, vt), vld1q_f32(&a[i]));
+                vst1q_f32(&out[i], vaddq_f32(va, vmulq_f32(vt, vld1q_f32(&b[i]))));
+            }
+
+            lerp_keys_scalar(&a[i], &b[i], &t[i], &out[i], count - i);
+        }
+
+#if defined(__aarch64__)
+        static void slerp_keys_neon(const f32* a, const f32* b, const f32* t, f32* out, u32 count, u32 stride)
+        {
+            const float32x4_t zero = vdupq_n_f32(0.0f);
+            const float32x4_t one = vdupq_n_f32(1.0f);
+            const uint32x4_t  sign_bit = vdupq_n_u32(0x80000000);
+
+            u32 i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                float32x4_t ax = vld1q_f32(&a[i]);
+                float32x4_t ay = vld1q_f32(&a[i + stride]);
+                float32x4_t az = vld1q_f32(&a[i + stride * 2]);
+                float32x4_t aw = vld1q_f32(&a[i + stride * 3]);
+                float32x4_t bx = vld1q_f32(&b[i]);
+                float32x4_t by = vld1q_f32(&b[i + stride]);
+                float32x4_t bz = vld1q_f32(&b[i + stride * 2]);
+                float32x4_t bw = vld1q_f32(&b[i + stride * 3]);
+                float32x4_t vt = vld1q_f32(&t[i]);
+
+                float32x4_t d = vmulq_f32(ax, bx);
+                d = vaddq_f32(d, vmulq_f32(ay, by));
+                d = vaddq_f32(d, vmulq_f32(az, bz));
+                d = vaddq_f32(d, vmulq_f32(aw, bw));
+
+                uint32x4_t  neg = vandq_u32(vcltq_f32(d, zero), sign_bit);
+                float32x4_t sign = vreinterpretq_f32_u32(vorrq_u32(neg, vreinterpretq_u32_f32(one)));
+                float32x4_t ad = vmulq_f32(d, sign);
+
+                float32x4_t ka = vmulq_f32(ad, vdupq_n_f32(-1.43519f));
+                ka = vaddq_f32(ka, vdupq_n_f32(3.55645f));
+                ka = vmulq_f32(ka, ad);
+                ka = vaddq_f32(ka, vdupq_n_f32(-3.2452f));
+                ka = vmulq_f32(ka, ad);
+                ka = vaddq_f32(ka, vdupq_n_f32(1.0904f));
+
+                float32x4_t kb = vmulq_f32(ad, vdupq_n_f32(0.215638f));
+                kb = vaddq_f32(kb, vdupq_n_f32(-1.06021f));
+                kb = vmulq_f32(kb, ad);
+                kb = vaddq_f32(kb, vdupq_n_f32(0.848013f));
+
+                float32x4_t h = vsubq_f32(vt, vdupq_n_f32(0.5f));
+                float32x4_t k = vmulq_f32(ka, h);
+                k = vmulq_f32(k, h);
+                k = vaddq_f32(k, kb);
+
+                float32x4_t ct = vmulq_f32(vt, h);
+                ct = vmulq_f32(ct, vsubq_f32(vt, one));
+                ct = vmulq_f32(ct, k);
+                ct = vaddq_f32(vt, ct);
+
+                float32x4_t wa = vsubq_f32(one, ct);
+                float32x4_t wb = vmulq_f32(ct, sign);
+
+                float32x4_t x = vaddq_f32(vmulq_f32(ax, wa), vmulq_f32(bx, wb));
+                float32x4_t y = vaddq_f32(vmulq_f32(ay, wa), vmulq_f32(by, wb));
+                float32x4_t z = vaddq_f32(vmulq_f32(az, wa), vmulq_f32(bz, wb));
+                float32x4_t w = vaddq_f32(vmulq_f32(aw, wa), vmulq_f32(bw, wb));
+
+                float32x4_t l = vmulq_f32(x, x);
+                l = vaddq_f32(l, vmulq_f32(y, y));
+                l = vaddq_f32(l, vmulq_f32(z, z));
+                l = vaddq_f32(l, vmulq_f32(w, w));
+
+                float32x4_t rl = vdivq_f32(one, vsqrtq_f32(l));
+
+                vst1q_f32(&out[i], vmulq_f32(x, rl));
+                vst1q_f32(&out[i + stride], vmulq_f32(y, rl));
+                vst1q_f32(&out[i + stride * 2], vmulq_f32(z, rl));
+                vst1q_f32(&out[i + stride * 3], vmulq_f32(w, rl));
+            }
+
+            slerp_keys_scalar(&a[i], &b[i], &t[i], &out[i], count - i, stride);
+        }
+#else
+        // armv7 neon has no divide or square root
+        static void slerp_keys_neon(const f32* a, const f32* b, const f32* t, f32* out, u32 count, u32 stride)
+        {
+            slerp_keys_scalar(a, b, t, out, count, stride);
+        }
+#endif
+#endif
+
+        //
+        // dispatch
+        //
+
+        // levels without their own kernels use the next narrowest, avx-512 runs the avx2 kernels
+        static bool init_anim_impls()
+        {
+            for (u32 i = 0; i < e_simd::COUNT; ++i)
+                s_anim_impls[i] = {lerp_keys_scalar, slerp_keys_scalar};
+
+#if CULL_X86
+            s_anim_impls[e_simd::sse2] = {lerp_keys_sse2, slerp_keys_sse2};
+            s_anim_impls[e_simd::avx2] = {lerp_keys_avx2, slerp_keys_avx2};
+            s_anim_impls[e_simd::avx512] = {lerp_keys_avx2, slerp_keys_avx2};
+#elif CULL_NEON
+            s_anim_impls[e_simd::neon] = {lerp_keys_neon, slerp_keys_neon};
+#endif
+
+            return true;
+        }
+
+        // keys are interpolated at the simd level culling runs at, so set_simd_level switches both
+        static const anim_impl& get_anim_impl()
+        {
+            static bool s_initialised = init_anim_impls();
+            (void)s_initialised;
+            return s_anim_impls[get_simd_level()];
+        }
+
+        void lerp_keys(const f32* a, const f32* b, const f32* t, f32* out, u32 count)
+        {
+            get_anim_impl().lerp_keys(a, b, t, out, count);
+        }
+
+        void slerp_keys(const f32* a, const f32* b, const f32* t, f32* out, u32 count, u32 stride)
+        {
+            get_anim_impl().slerp_keys(a, b, t, out, count, stride);
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "types.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        // interpolate count pairs of animation keys with simd, at the level get_simd_level in ecs_cull.h returns.
+        // lerp_keys writes (1 - t) * a + t * b. slerp_keys takes quaternions as 4 streams of x, y, z and w each stride
+        // floats apart and interpolates along the shortest path. it is a polynomial-corrected nlerp rather than an
+        // exact slerp, t is corrected for the angle between the keys before a normalised lerp, and the error stays
+        // under 1e-3 rad of slerp at any angle which the slerp_keys error test in ecs_bench checks for every simd
+        // level. out may alias a or b.
+        void lerp_keys(const f32* a, const f32* b, const f32* t, f32* out, u32 count);
+        void slerp_keys(const f32* a, const f32* b, const f32* t, f32* out, u32 count, u32 stride);
+    }
+}
@@ -0,0 +1,607 @@
+#include "ecs_cull.h"
+
+#include "timer.h"
+#include "threads.h"
+#include "ecs_resources.h"
+#include "ecs_scene.h"
+#include "ecs_utilities.h"
+#include "ecs_simd.h"
+
+#include <algorithm>
+
+using namespace::pen;
+
+namespace put
+{
+    namespace ecs
+    {
+        namespace
+        {
+            // leaves are grown by a fraction of the entities largest extent, the minimum gives points some slack too
+            const f32 k_bvh_margin = 0.1f;
+            const f32 k_bvh_min_margin = 0.01f;
+
+            // when more than 1 / k_bvh_rebuild_ratio of the leaves need inserting the tree is rebuilt top down
+            const u32 k_bvh_rebuild_ratio = 2;
+
+            // traversal stack size, trees are kept balanced so this is far deeper than they get
+            const u32 k_bvh_max_depth = 128;
+
+            // traversal stack flag for nodes which are inside every plane
+            const u32 k_bvh_inside = 1u << 31;
+
+            struct bvh_aabb
+            {
+                vec3f min;
+                vec3f max;
+
+                bool overlaps(const vec3f& bmin, const vec3f& bmax) const
+                {
+                    return bmin.x <= max.x && bmin.y <= max.y && bmin.z <= max.z && bmax.x >= min.x && bmax.y >= min.y &&
+                           bmax.z >= min.z;
+                }
+            };
+
+            struct bvh_sphere
+            {
+                vec3f pos;
+                f32   radius_sq;
+
+                bool overlaps(const vec3f& bmin, const vec3f& bmax) const
+                {
+                    // squared distance from the centre to the closest point of the box
+                    f32 d = 0.0f;
+                    for (u32 i = 0; i < 3; ++i)
+                    {
+                        f32 v = pos[i] < bmin[i] ? bmin[i] - pos[i] : (pos[i] > bmax[i] ? pos[i] - bmax[i] : 0.0f);
+                        d += v * v;
+                    }
+
+                    return d <= radius_sq;
+                }
+            };
+
+            struct bvh_ray
+            {
+                vec3f origin;
+                vec3f inv_dir;
+                f32   max_t;
+
+                bool overlaps(const vec3f& bmin, const vec3f& bmax) const
+                {
+                    // slabs
+                    f32 t_near = 0.0f;
+                    f32 t_far = max_t;
+                    for (u32 i = 0; i < 3; ++i)
+                    {
+                        f32 t0 = (bmin[i] - origin[i]) * inv_dir[i];
+                        f32 t1 = (bmax[i] - origin[i]) * inv_dir[i];
+                        t_near = std::max<f32>(t_near, std::min<f32>(t0, t1));
+                        t_far = std::min<f32>(t_far, std::max<f32>(t0, t1));
+                    }
+
+                    return t_near <= t_far;
+                }
+            };
+        } // namespace
+
+        static pen_inline bool bvh_accept(const ecs_scene* scene, u32 e, u64 accept, u64 reject)
+        {
+            if (!(accept | reject))
+                return true;
+
+            u64 flags = scene->entities[e];
+            return (flags & accept) == accept && !(flags & reject);
+        }
+
+        static pen_inline f32 bvh_area(const vec3f& min, const vec3f& max)
+        {
+            vec3f d = max - min;
+            return d.x * d.y + d.y * d.z + d.z * d.x;
+        }
+
+        static pen_inline void bvh_entity_bounds(const ecs_scene* scene, u32 e, vec3f& min, vec3f& max)
+        {
+            const cmp_pos_extent& pe = scene->pos_extent[e];
+            min = vec3f(pe.pos.x - pe.extent.x, pe.pos.y - pe.extent.y, pe.pos.z - pe.extent.z);
+            max = vec3f(pe.pos.x + pe.extent.x, pe.pos.y + pe.extent.y, pe.pos.z + pe.extent.z);
+        }
+
+        static pen_inline bool bvh_contains(const bvh_node& node, const vec3f& min, const vec3f& max)
+        {
+            return node.min.x <= min.x && node.min.y <= min.y && node.min.z <= min.z && node.max.x >= max.x &&
+                   node.max.y >= max.y && node.max.z >= max.z;
+        }
+
+        static s32 bvh_alloc_node(bvh_tree& bvh)
+        {
+            s32 n = bvh.free_list;
+            if (n != -1)
+            {
+                bvh.free_list = bvh.nodes[n].parent;
+            }
+            else
+            {
+                if (bvh.num_nodes == bvh.node_capacity)
+                {
+                    bvh.node_capacity = std::max<u32>(bvh.node_capacity * 2, 64);
+                    bvh.nodes = (bvh_node*)pen::memory_realloc(bvh.nodes, bvh.node_capacity * sizeof(bvh_node));
+                }
+
+                n = bvh.num_nodes++;
+            }
+
+            bvh_node& node = bvh.nodes[n];
+            node.parent = -1;
+            node.child[0] = -1;
+            node.child[1] = -1;
+            node.height = 0;
+            return n;
+        }
+
+        static void bvh_free_node(bvh_tree& bvh, s32 n)
+        {
+            bvh.nodes[n].parent = bvh.free_list;
+            bvh.nodes[n].height = -1;
+            bvh.free_list = n;
+        }
+
+        static s32 bvh_alloc_leaf(bvh_tree& bvh, const ecs_scene* scene, u32 e)
+        {
+            s32 n = bvh_alloc_node(bvh);
+
+            // fattened so small movements do not need a reinsert
+            bvh_node&             leaf = bvh.nodes[n];
+            const cmp_pos_extent& pe = scene->pos_extent[e];
+            f32                   m = std::max<f32>(pe.extent.x, std::max<f32>(pe.extent.y, pe.extent.z));
+            m = m * k_bvh_margin + k_bvh_min_margin;
+
+            bvh_entity_bounds(scene, e, leaf.min, leaf.max);
+            leaf.min -= vec3f(m);
+            leaf.max += vec3f(m);
+            leaf.child[0] = e;
+
+            bvh.leaves[e] = n;
+            return n;
+        }
+
+        static pen_inline void bvh_fit(bvh_node* nodes, bvh_node& node)
+        {
+            const bvh_node& c0 = nodes[node.child[0]];
+            const bvh_node& c1 = nodes[node.child[1]];
+            node.min = min_union(c0.min, c1.min);
+            node.max = max_union(c0.max, c1.max);
+            node.height = 1 + std::max<s32>(c0.height, c1.height);
+        }
+
+        // when the children of a differ in height by more than 1 the taller child is rotated up, returns the node which
+        // now sits where a was
+        static s32 bvh_balance(bvh_tree& bvh, s32 ia)
+        {
+            bvh_node* nodes = bvh.nodes;
+            bvh_node& a = nodes[ia];
+            if (a.height == 0)
+                return ia;
+
+            s32 ib = a.child[0];
+            s32 ic = a.child[1];
+            s32 balance = nodes[ic].height - nodes[ib].height;
+            if (balance >= -1 && balance <= 1)
+                return ia;
+
+            // u is the child which moves up, its shorter child moves down to a in place of u
+            u32 side = balance > 1 ? 1 : 0;
+            s32 iu = a.child[side];
+            bvh_node& u = nodes[iu];
+
+            s32 iu0 = u.child[0];
+            s32 iu1 = u.child[1];
+            s32 keep = nodes[iu0].height > nodes[iu1].height ? iu0 : iu1;
+            s32 give = keep == iu0 ? iu1 : iu0;
+
+            u.child[0] = ia;
+            u.child[1] = keep;
+            u.parent = a.parent;
+            a.parent = iu;
+
+            if (u.parent != -1)
+            {
+                bvh_node& p = nodes[u.parent];
+                p.child[p.child[0] == ia ? 0 : 1] = iu;
+            }
+            else
+            {
+                bvh.root = iu;
+            }
+
+            a.child[side] = give;
+            nodes[give].parent = ia;
+
+            bvh_fit(nodes, a);
+            bvh_fit(nodes, u);
+            return iu;
+        }
+
+        // walks from n to the root rebalancing and refitting bounds
+        static void bvh_refit(bvh_tree& bvh, s32 n)
+        {
+            while (n != -1)
+            {
+                n = bvh_balance(bvh, n);
+                bvh_fit(bvh.nodes, bvh.nodes[n]);
+                n = bvh.nodes[n].parent;
+            }
+        }
+
+        static void bvh_insert_leaf(bvh_tree& bvh, s32 leaf)
+        {
+            if (bvh.root == -1)
+            {
+                bvh.root = leaf;
+                bvh.nodes[leaf].parent = -1;
+                return;
+            }
+
+            // descend to the sibling which adds the least surface area to the tree
+            vec3f lmin = bvh.nodes[leaf].min;
+            vec3f lmax = bvh.nodes[leaf].max;
+            s32   sibling = bvh.root;
+            while (bvh.nodes[sibling].height > 0)
+            {
+                const bvh_node& node = bvh.nodes[sibling];
+                f32             area = bvh_area(node.min, node.max);
+                f32             combined = bvh_area(min_union(node.min, lmin), max_union(node.max, lmax));
+
+                // pairing here creates a parent of the combined area, going lower grows this node by the difference
+                f32 cost = 2.0f * combined;
+                f32 inherited = 2.0f * (combined - area);
+
+                f32 child_cost[2];
+                for (u32 c = 0; c < 2; ++c)
+                {
+                    const bvh_node& child = bvh.nodes[node.child[c]];
+                    child_cost[c] = bvh_area(min_union(child.min, lmin), max_union(child.max, lmax)) + inherited;
+                    if (child.height > 0)
+                        child_cost[c] -= bvh_area(child.min, child.max);
+                }
+
+                if (cost < child_cost[0] && cost < child_cost[1])
+                    break;
+
+                sibling = child_cost[0] < child_cost[1] ? node.child[0] : node.child[1];
+            }
+
+            // new parent of the sibling and leaf
+            s32 parent = bvh_alloc_node(bvh);
+            s32 old_parent = bvh.nodes[sibling].parent;
+
+            bvh_node& p = bvh.nodes[parent];
+            p.parent = old_parent;
+            p.child[0] = sibling;
+            p.child[1] = leaf;
+
+            if (old_parent != -1)
+            {
+                bvh_node& op = bvh.nodes[old_parent];
+                op.child[op.child[0] == sibling ? 0 : 1] = parent;
+            }
+            else
+            {
+                bvh.root = parent;
+            }
+
+            bvh.nodes[sibling].parent = parent;
+            bvh.nodes[leaf].parent = parent;
+
+            bvh_refit(bvh, parent);
+        }
+
+        static void bvh_remove_leaf(bvh_tree& bvh, s32 leaf)
+        {
+            if (leaf == bvh.root)
+            {
+                bvh.root = -1;
+                return;
+            }
+
+            // the sibling takes the place of the parent
+            s32 parent = bvh.nodes[leaf].parent;
+            s32 grand_parent = bvh.nodes[parent].parent;
+            s32 sibling = bvh.nodes[parent].child[bvh.nodes[parent].child[0] == leaf ? 1 : 0];
+
+            bvh.nodes[sibling].parent = grand_parent;
+            bvh_free_node(bvh, parent);
+
+            if (grand_parent == -1)
+            {
+                bvh.root = sibling;
+                return;
+            }
+
+            bvh_node& gp = bvh.nodes[grand_parent];
+            gp.child[gp.child[0] == parent ? 0 : 1] = sibling;
+            bvh_refit(bvh, grand_parent);
+        }
+
+        // spreads the low 10 bits of v out to every third bit
+        static pen_inline u64 morton_expand(u32 v)
+        {
+            u64 x = v & 0x3ff;
+            x = (x | (x << 16)) & 0x30000ff;
+            x = (x | (x << 8)) & 0x300f00f;
+            x = (x | (x << 4)) & 0x30c30c3;
+            x = (x | (x << 2)) & 0x9249249;
+            return x;
+        }
+
+        // entities are sorted along a morton curve so halving the sorted range splits space, node capacity must be
+        // reserved up front
+        static s32 bvh_build(bvh_tree& bvh, const ecs_scene* scene, const u32* entities, u32 count)
+        {
+            if (count == 1)
+                return bvh_alloc_leaf(bvh, scene, entities[0]);
+
+            u32 mid = count / 2;
+            s32 n = bvh_alloc_node(bvh);
+            s32 c0 = bvh_build(bvh, scene, entities, mid);
+            s32 c1 = bvh_build(bvh, scene, entities + mid, count - mid);
+
+            bvh_node& node = bvh.nodes[n];
+            node.child[0] = c0;
+            node.child[1] = c1;
+            bvh.nodes[c0].parent = n;
+            bvh.nodes[c1].parent = n;
+            bvh_fit(bvh.nodes, node);
+
+            return n;
+        }
+
+        void update_bvh(ecs_scene* scene)
+        {
+            static const u64 k_member = e_cmp::allocated | e_cmp::geometry;
+
+            f64 start = pen::get_time_us();
+
+            bvh_tree& bvh = scene->bvh;
+            u32       num = (u32)scene->num_entities;
+
+            if (bvh.capacity < scene->soa_size)
+            {
+                u32 cap = scene->soa_size;
+                bvh.leaves = (s32*)pen::memory_realloc(bvh.leaves, cap * sizeof(s32));
+                bvh.pending = (u32*)pen::memory_realloc(bvh.pending, cap * sizeof(u32));
+
+                for (u32 i = bvh.capacity; i < cap; ++i)
+                    bvh.leaves[i] = -1;
+
+                bvh.capacity = cap;
+            }
+
+            // remove entities which lost their geometry, queue new ones and ones which moved out of their fat bounds
+            u32 scan = std::max<u32>(num, bvh.num_scanned);
+            u32 num_pending = 0;
+            for (u32 n = 0; n < scan; ++n)
+            {
+                s32  leaf = bvh.leaves[n];
+                bool member = n < num && (scene->entities[n] & k_member) == k_member;
+
+                if (leaf == -1)
+                {
+                    if (member)
+                        bvh.pending[num_pending++] = n;
+
+                    continue;
+                }
+
+                if (member)
+                {
+                    if (!(scene->dirty_flags[n] & e_dirty::bounds))
+                        continue;
+
+                    vec3f min, max;
+                    bvh_entity_bounds(scene, n, min, max);
+                    if (bvh_contains(bvh.nodes[leaf], min, max))
+                        continue;
+
+                    bvh.pending[num_pending++] = n;
+                }
+
+                bvh_remove_leaf(bvh, leaf);
+                bvh_free_node(bvh, leaf);
+                bvh.leaves[n] = -1;
+                --bvh.num_leaves;
+            }
+
+            bvh.num_scanned = num;
+            scene->num_bvh_reinserts = num_pending;
+
+            if (num_pending * k_bvh_rebuild_ratio > bvh.num_leaves + num_pending)
+            {
+                // most of the tree is changing, building from scratch is quicker and gives a better tree
+                if (bvh.key_capacity < num)
+                {
+                    bvh.key_capacity = num;
+                    bvh.keys = (u64*)pen::memory_realloc(bvh.keys, num * 2 * sizeof(u64));
+                    bvh.values = (u32*)pen::memory_realloc(bvh.values, num * 2 * sizeof(u32));
+                }
+
+                u64* keys = bvh.keys;
+                u32* values = bvh.values;
+
+                const cull_bounds& cb = scene->bounds;
+
+                u32   count = 0;
+                vec3f lo = vec3f(FLT_MAX);
+                vec3f hi = vec3f(-FLT_MAX);
+                for (u32 n = 0; n < num; ++n)
+                {
+                    if ((scene->entities[n] & k_member) != k_member)
+                        continue;
+
+                    vec3f p = vec3f(cb.pos_x[n], cb.pos_y[n], cb.pos_z[n]);
+                    lo = min_union(lo, p);
+                    hi = max_union(hi, p);
+                    bvh.pending[count++] = n;
+                }
+
+                // quantise centres to a 1024^3 grid over their bounds
+                vec3f scale = hi - lo;
+                for (u32 a = 0; a < 3; ++a)
+                    scale[a] = scale[a] > 0.0f ? 1023.0f / scale[a] : 0.0f;
+
+                for (u32 i = 0; i < count; ++i)
+                {
+                    u32 n = bvh.pending[i];
+                    u32 qx = (u32)((cb.pos_x[n] - lo.x) * scale.x);
+                    u32 qy = (u32)((cb.pos_y[n] - lo.y) * scale.y);
+                    u32 qz = (u32)((cb.pos_z[n] - lo.z) * scale.z);
+                    keys[i] = morton_expand(qx) | (morton_expand(qy) << 1) | (morton_expand(qz) << 2);
+                    values[i] = n;
+                }
+
+                radix_sort(keys, values, count, keys + bvh.key_capacity, values + bvh.key_capacity);
+
+                bvh.root = -1;
+                bvh.free_list = -1;
+                bvh.num_nodes = 0;
+                bvh.num_leaves = count;
+
+                if (bvh.node_capacity < count * 2)
+                {
+                    bvh.node_capacity = count * 2;
+                    bvh.nodes = (bvh_node*)pen::memory_realloc(bvh.nodes, bvh.node_capacity * sizeof(bvh_node));
+                }
+
+                if (count > 0)
+                    bvh.root = bvh_build(bvh, scene, values, count);
+            }
+            else
+            {
+                for (u32 i = 0; i < num_pending; ++i)
+                    bvh_insert_leaf(bvh, bvh_alloc_leaf(bvh, scene, bvh.pending[i]));
+
+                bvh.num_leaves += num_pending;
+            }
+
+            scene->update_timings[e_update_stage::bvh] = (pen::get_time_us() - start) / 1000.0;
+        }
+
+        template <typename T>
+        static void bvh_query(const ecs_scene* scene, const T& shape, u32** entities_out, u64 accept, u64 reject)
+        {
+            const bvh_tree& bvh = scene->bvh;
+            if (bvh.root == -1)
+                return;
+
+            s32 stack[k_bvh_max_depth];
+            u32 sp = 0;
+            stack[sp++] = bvh.root;
+
+            while (sp > 0)
+            {
+                const bvh_node& node = bvh.nodes[stack[--sp]];
+                if (!shape.overlaps(node.min, node.max))
+                    continue;
+
+                if (node.height == 0)
+                {
+                    u32 e = node.child[0];
+                    if (!bvh_accept(scene, e, accept, reject))
+                        continue;
+
+                    // leaves are fattened so test the entities own bounds
+                    vec3f min, max;
+                    bvh_entity_bounds(scene, e, min, max);
+                    if (shape.overlaps(min, max))
+                        sb_push(*entities_out, e);
+
+                    continue;
+                }
+
+                PEN_ASSERT(sp + 2 <= k_bvh_max_depth);
+                stack[sp++] = node.child[1];
+                stack[sp++] = node.child[0];
+            }
+        }
+
+        void bvh_query_frustum(const ecs_scene* scene, const frustum& frust, u32** entities_out, u64 accept, u64 reject)
+        {
+            const bvh_tree& bvh = scene->bvh;
+            if (bvh.root == -1)
+                return;
+
+            cull_planes planes;
+            get_cull_planes(frust, planes);
+
+            node_cull_func node_cull = get_cull_impl().node;
+
+            // leaves of nodes inside every plane are visible, the rest get the same per entity test as
+            // frustum_cull_aabb after the descent
+            static thread_local u32* s_candidates = nullptr;
+            if (s_candidates)
+                stb__sbn(s_candidates) = 0;
+
+            u32 stack[k_bvh_max_depth];
+            u32 sp = 0;
+            stack[sp++] = (u32)bvh.root;
+
+            while (sp > 0)
+            {
+                u32             top = stack[--sp];
+                u32             inside = top & k_bvh_inside;
+                const bvh_node& node = bvh.nodes[top & ~k_bvh_inside];
+
+                if (!inside)
+                {
+                    u32 result = node_cull(planes, node);
+                    if (result == e_node_cull::outside)
+                        continue;
+
+                    if (result == e_node_cull::inside)
+                        inside = k_bvh_inside;
+                }
+
+                if (node.height == 0)
+                {
+                    u32 e = node.child[0];
+                    if (!bvh_accept(scene, e, accept, reject))
+                        continue;
+
+                    if (inside)
+                        sb_push(*entities_out, e);
+                    else
+                        sb_push(s_candidates, e);
+
+                    continue;
+                }
+
+                PEN_ASSERT(sp + 2 <= k_bvh_max_depth);
+                stack[sp++] = (u32)node.child[1] | inside;
+                stack[sp++] = (u32)node.child[0] | inside;
+            }
+
+            frustum_cull_aabb(scene, frust, s_candidates, sb_count(s_candidates), entities_out);
+        }
+
+        void bvh_query_aabb(const ecs_scene* scene, const vec3f& min, const vec3f& max, u32** entities_out, u64 accept,
+                            u64 reject)
+        {
+            bvh_aabb shape = {min, max};
+            bvh_query(scene, shape, entities_out, accept, reject);
+        }
+
+        void bvh_query_sphere(const ecs_scene* scene, const vec3f& pos, f32 radius, u32** entities_out, u64 accept,
+                              u64 reject)
+        {
+            bvh_sphere shape = {pos, radius * radius};
+            bvh_query(scene, shape, entities_out, accept, reject);
+        }
+
+        void bvh_query_ray(const ecs_scene* scene, const vec3f& origin, const vec3f& dir, f32 max_t, u32** entities_out,
+                           u64 accept, u64 reject)
+        {
+            bvh_ray shape = {origin, vec3f(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z), max_t};
+            bvh_query(scene, shape, entities_out, accept, reject);
+        }
+    }
+}
@@ -1,12 +1,12 @@
 #include "ecs_cull.h"
 
 #include "timer.h"
+#include "threads.h"
+#include "ecs_resources.h"
 #include "ecs_scene.h"
+#include "ecs_simd.h"
 
-#if __SSE2__ || __AVX2__ || __AVX__
-#include <xmmintrin.h>
-#include <immintrin.h>
-#endif
+#include <algorithm>
 
 using namespace::pen;
 
@@ -14,534 +14,1396 @@ namespace put
 {
     namespace ecs
     {
+        namespace
+        {
+            // below this many entities a cull is cheaper than waking the workers
+            const u32 k_cull_batch_size = 16384;
+            const u32 k_cull_parallel_min = k_cull_batch_size * 2;
+            const u32 k_cull_max_batches = 64;
+
+            struct cull_job
+            {
+                cull_func          func;
+                const ecs_scene*   scene;
+                const cull_planes* planes;
+                const u32*         entities_in;
+                u32*               entities_out;
+                u32                batch_size;
+                u32*               batch_counts;
+            };
+
+            struct multi_cull_job
+            {
+                multi_cull_func    func;
+                const ecs_scene*   scene;
+                const cull_planes* planes;
+                u32                num_frusta;
+                const u32*         entities;
+                u64*               masks;
+                u32                batch_size;
+            };
+
+            cull_impl  s_cull_impls[e_simd::COUNT];
+            u32        s_simd_supported = 0;
+            simd_level s_simd_level = e_simd::scalar;
+
+            // left packing of the visible lanes of 8 wide masks
+            u8 s_compress_lut[256][8];
+            u8 s_compress_count[256];
+        } // namespace
+
+        void get_cull_planes(const frustum& frust, cull_planes& planes)
+        {
+            for (u32 p = 0; p < 6; ++p)
+            {
+                planes.nx[p] = frust.n[p].x;
+                planes.ny[p] = frust.n[p].y;
+                planes.nz[p] = frust.n[p].z;
+                planes.ax[p] = fabs(frust.n[p].x);
+                planes.ay[p] = fabs(frust.n[p].y);
+                planes.az[p] = fabs(frust.n[p].z);
+                planes.d[p] = maths::plane_distance(frust.p[p], frust.n[p]);
+            }
+
+            for (u32 p = 6; p < 8; ++p)
+            {
+                planes.nx[p] = planes.ny[p] = planes.nz[p] = 0.0f;
+                planes.ax[p] = planes.ay[p] = planes.az[p] = 0.0f;
+                planes.d[p] = -FLT_MAX;
+            }
+        }
+
         //
         // scalar float implementation
         //
 
-        void frustum_cull_aabb_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        // an entity is outside a plane when dot(pos, n) + d > radius, for an aabb the radius is dot(extent, abs(n)).
+        // the simd versions below evaluate exactly the same operations in the same order.
+        template <bool k_sphere>
+        static pen_inline bool outside_scalar(const cull_planes& planes, const f32* pe)
+        {
+            bool outside = false;
+            for (u32 p = 0; p < 6; ++p)
+            {
+                f32 d = pe[0] * planes.nx[p];
+                d = d + pe[1] * planes.ny[p];
+                d = d + pe[2] * planes.nz[p];
+                d = d + planes.d[p];
+
+                f32 r = pe[7];
+                if (!k_sphere)
+                {
+                    r = pe[4] * planes.ax[p];
+                    r = r + pe[5] * planes.ay[p];
+                    r = r + pe[6] * planes.az[p];
+                }
+
+                outside |= d > r;
+            }
+
+            return outside;
+        }
+
+        template <bool k_sphere>
+        static u32 cull_scalar(const ecs_scene* scene, const cull_planes& planes, const u32* entities, u32 count, u32* out)
         {
-            const frustum& frust = cam->camera_frustum;
+            const f32* pos_extent = (const f32*)scene->pos_extent.data;
 
-            u32 n = sb_count(entities_in);
-            for (u32 i = 0; i < n; ++i)
+            u32 c = 0;
+            for (u32 i = 0; i < count; ++i)
             {
-                u32 e = entities_in[i];
+                u32  e = entities[i];
+                bool outside = outside_scalar<k_sphere>(planes, pos_extent + e * k_pos_extent_stride);
 
-                vec3f pos = scene->pos_extent[e].pos.xyz;
-                vec3f extent = scene->pos_extent[e].extent.xyz;
+                // branchless, c never passes i so this stays inside out
+                out[c] = e;
+                c += outside ? 0 : 1;
+            }
 
-                bool inside = true;
-                for (s32 p = 0; p < 6; ++p)
-                {
-                    vec3f sign_flip = sgn(frust.n[p]) * -1.0f;
-                    f32 pd = maths::plane_distance(frust.p[p], frust.n[p]);
-                    f32 d2 = dot(pos + extent * sign_flip, frust.n[p]);
+            return c;
+        }
 
-                    if (d2 > -pd)
-                    {
-                        inside = false;
-                    }
-                }
+        // the bounds of each entity are read once and tested against every frustum
+        static void cull_multi_scalar(const ecs_scene* scene, const cull_planes* planes, u32 num_frusta,
+                                      const u32* entities, u32 count, u64* masks)
+        {
+            const f32* pos_extent = (const f32*)scene->pos_extent.data;
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                const f32* pe = pos_extent + entities[i] * k_pos_extent_stride;
+
+                u64 mask = 0;
+                for (u32 f = 0; f < num_frusta; ++f)
+                    mask |= (u64)(outside_scalar<false>(planes[f], pe) ? 0 : 1) << f;
+
+                masks[i] = mask;
+            }
+        }
+
+        // a node is inside a plane when dot(pos, n) + d < -radius, nodes inside every plane need no further tests
+        static u32 cull_node_scalar(const cull_planes& planes, const bvh_node& node)
+        {
+            f32 cx = (node.min.x + node.max.x) * 0.5f;
+            f32 cy = (node.min.y + node.max.y) * 0.5f;
+            f32 cz = (node.min.z + node.max.z) * 0.5f;
+            f32 ex = (node.max.x - node.min.x) * 0.5f;
+            f32 ey = (node.max.y - node.min.y) * 0.5f;
+            f32 ez = (node.max.z - node.min.z) * 0.5f;
+
+            bool outside = false;
+            bool inside = true;
+            for (u32 p = 0; p < 6; ++p)
+            {
+                f32 d = cx * planes.nx[p];
+                d = d + cy * planes.ny[p];
+                d = d + cz * planes.nz[p];
+                d = d + planes.d[p];
+
+                f32 r = ex * planes.ax[p];
+                r = r + ey * planes.ay[p];
+                r = r + ez * planes.az[p];
+
+                outside |= d > r;
+                inside &= d < -r;
+            }
+
+            if (outside)
+                return e_node_cull::outside;
+
+            return inside ? e_node_cull::inside : e_node_cull::intersect;
+        }
 
-                if (inside)
+        // pixel centres are at + 0.5, the simd versions add the lane index to x in the same order
+        static void raster_row_scalar(f32* row, const occluder_tri& t, u32 y, u32 x0, u32 x1)
+        {
+            f32 py = (f32)y + 0.5f;
+            f32 eby0 = t.eb[0] * py;
+            f32 eby1 = t.eb[1] * py;
+            f32 eby2 = t.eb[2] * py;
+            f32 zby = t.zb * py;
+
+            for (u32 x = x0; x < x1; x += 4)
+            {
+                f32 bx = (f32)x + 0.5f;
+                for (u32 l = 0; l < 4; ++l)
                 {
-                    sb_push(*entities_out, e);
+                    f32 px = bx + (f32)l;
+                    f32 e0 = t.ea[0] * px + eby0 + t.ec[0];
+                    f32 e1 = t.ea[1] * px + eby1 + t.ec[1];
+                    f32 e2 = t.ea[2] * px + eby2 + t.ec[2];
+                    f32 z = t.za * px + zby + t.zc;
+
+                    if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f && z > row[x + l])
+                        row[x + l] = z;
                 }
             }
         }
 
-        void frustum_cull_sphere_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        // corner c of the box is pos + extent * sign, where bit 0, 1 and 2 of c pick the sign of x, y and z
+        static bool project_box_scalar(const f32* vp, const f32* pe, f32 near_w, occludee_rect& r)
         {
-            const frustum& camera_frustum = cam->camera_frustum;
+            const f32 hw = (f32)k_occlusion_width * 0.5f;
+            const f32 hh = (f32)k_occlusion_height * 0.5f;
+
+            r.min_x = r.min_y = FLT_MAX;
+            r.max_x = r.max_y = -FLT_MAX;
+            r.depth = 0.0f;
 
-            u32 n = sb_count(entities_in);
-            for (u32 i = 0; i < n; ++i)
+            for (u32 c = 0; c < 8; ++c)
             {
-                u32 e = entities_in[i];
+                f32 x = (c & 1) ? pe[0] + pe[4] : pe[0] - pe[4];
+                f32 y = (c & 2) ? pe[1] + pe[5] : pe[1] - pe[5];
+                f32 z = (c & 4) ? pe[2] + pe[6] : pe[2] - pe[6];
+
+                f32 cx = vp[0] * x + vp[1] * y + vp[2] * z + vp[3];
+                f32 cy = vp[4] * x + vp[5] * y + vp[6] * z + vp[7];
+                f32 cw = vp[12] * x + vp[13] * y + vp[14] * z + vp[15];
+                if (!(cw >= near_w))
+                    return false;
+
+                f32 rw = 1.0f / cw;
+                f32 sx = cx * rw * hw + hw;
+                f32 sy = cy * rw * hh + hh;
+
+                r.min_x = std::min<f32>(r.min_x, sx);
+                r.max_x = std::max<f32>(r.max_x, sx);
+                r.min_y = std::min<f32>(r.min_y, sy);
+                r.max_y = std::max<f32>(r.max_y, sy);
+                r.depth = std::max<f32>(r.depth, rw);
+            }
+
+            return true;
+        }
+
+        //
+        // sse2 128 implementation
+        //
 
-                vec3f pos = scene->pos_extent[e].pos.xyz;
-                f32   radius = scene->pos_extent[e].extent.w;
+        // runs of consecutive entities stream from the soa bounds, anything else gathers pos_extent which keeps an
+        // entity in a single cache line
+#if CULL_X86
+        CULL_TARGET("sse2")
+        static inline __m128 load_bounds4(const f32* a, u32 first)
+        {
+            return (first & 3) ? _mm_loadu_ps(&a[first]) : _mm_load_ps(&a[first]);
+        }
+
+        // the bounds of entities e[0] to e[3] as soa
+        CULL_TARGET("sse2")
+        static inline void load_entities4(const ecs_scene* scene, const u32* e, __m128& px, __m128& py, __m128& pz,
+                                          __m128& ex, __m128& ey, __m128& ez, __m128& er)
+        {
+            const f32*         pos_extent = (const f32*)scene->pos_extent.data;
+            const cull_bounds& b = scene->bounds;
+
+            u32     first = e[0];
+            __m128i ids = _mm_loadu_si128((const __m128i*)e);
+            __m128i run = _mm_add_epi32(_mm_set1_epi32(first), _mm_setr_epi32(0, 1, 2, 3));
+
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(ids, run)) == 0xffff)
+            {
+                px = load_bounds4(b.pos_x, first);
+                py = load_bounds4(b.pos_y, first);
+                pz = load_bounds4(b.pos_z, first);
+                ex = load_bounds4(b.extent_x, first);
+                ey = load_bounds4(b.extent_y, first);
+                ez = load_bounds4(b.extent_z, first);
+                er = load_bounds4(b.radius, first);
+            }
+            else
+            {
+                const f32* pe0 = pos_extent + e[0] * k_pos_extent_stride;
+                const f32* pe1 = pos_extent + e[1] * k_pos_extent_stride;
+                const f32* pe2 = pos_extent + e[2] * k_pos_extent_stride;
+                const f32* pe3 = pos_extent + e[3] * k_pos_extent_stride;
+
+                // aos to soa
+                px = _mm_loadu_ps(pe0);
+                py = _mm_loadu_ps(pe1);
+                pz = _mm_loadu_ps(pe2);
+                __m128 pw = _mm_loadu_ps(pe3);
+                _MM_TRANSPOSE4_PS(px, py, pz, pw);
+
+                ex = _mm_loadu_ps(pe0 + 4);
+                ey = _mm_loadu_ps(pe1 + 4);
+                ez = _mm_loadu_ps(pe2 + 4);
+                er = _mm_loadu_ps(pe3 + 4);
+                _MM_TRANSPOSE4_PS(ex, ey, ez, er);
+            }
+        }
 
-                bool inside = true;
-                for (s32 p = 0; p < 6; ++p)
+        template <bool k_sphere>
+        CULL_TARGET("sse2")
+        static u32 cull_sse2(const ecs_scene* scene, const cull_planes& planes, const u32* entities, u32 count, u32* out)
+        {
+            __m128 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], pd[6];
+            for (u32 p = 0; p < 6; ++p)
+            {
+                nx[p] = _mm_set1_ps(planes.nx[p]);
+                ny[p] = _mm_set1_ps(planes.ny[p]);
+                nz[p] = _mm_set1_ps(planes.nz[p]);
+                ax[p] = _mm_set1_ps(planes.ax[p]);
+                ay[p] = _mm_set1_ps(planes.ay[p]);
+                az[p] = _mm_set1_ps(planes.az[p]);
+                pd[p] = _mm_set1_ps(planes.d[p]);
+            }
+
+            u32 c = 0;
+            u32 i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                const u32* e = &entities[i];
+
+                __m128 px, py, pz, ex, ey, ez, er;
+                load_entities4(scene, e, px, py, pz, ex, ey, ez, er);
+
+                __m128 outside = _mm_setzero_ps();
+                for (u32 p = 0; p < 6; ++p)
                 {
-                    f32 d = maths::point_plane_distance(pos, camera_frustum.p[p], camera_frustum.n[p]);
+                    __m128 d = _mm_mul_ps(px, nx[p]);
+                    d = _mm_add_ps(d, _mm_mul_ps(py, ny[p]));
+                    d = _mm_add_ps(d, _mm_mul_ps(pz, nz[p]));
+                    d = _mm_add_ps(d, pd[p]);
 
-                    if (d > radius)
+                    __m128 r = er;
+                    if (!k_sphere)
                     {
-                        inside = false;
-                        break;
+                        r = _mm_mul_ps(ex, ax[p]);
+                        r = _mm_add_ps(r, _mm_mul_ps(ey, ay[p]));
+                        r = _mm_add_ps(r, _mm_mul_ps(ez, az[p]));
                     }
+
+                    outside = _mm_or_ps(outside, _mm_cmpgt_ps(d, r));
                 }
 
-                if (inside)
+                u32 visible = ~_mm_movemask_ps(outside);
+                for (u32 j = 0; j < 4; ++j)
                 {
-                    sb_push(*entities_out, e);
+                    out[c] = e[j];
+                    c += (visible >> j) & 1;
                 }
             }
+
+            return c + cull_scalar<k_sphere>(scene, planes, &entities[i], count - i, &out[c]);
         }
 
-        void filter_entities_scalar(const ecs_scene* scene, u32** entities_out)
+        // the inside lanes of each frustum are widened to 64 bits and set its bit in the masks of 4 entities
+        CULL_TARGET("sse2")
+        static void cull_multi_sse2(const ecs_scene* scene, const cull_planes* planes, u32 num_frusta,
+                                    const u32* entities, u32 count, u64* masks)
         {
-            u32 accept_entities = e_cmp::geometry | e_cmp::material;
-            u32 reject_entities = e_cmp::sub_instance;
+            u32 i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 px, py, pz, ex, ey, ez, er;
+                load_entities4(scene, &entities[i], px, py, pz, ex, ey, ez, er);
 
-            for (u32 i = 0; i < scene->num_entities; ++i)
+                __m128i m01 = _mm_setzero_si128();
+                __m128i m23 = _mm_setzero_si128();
+                for (u32 f = 0; f < num_frusta; ++f)
+                {
+                    const cull_planes& cp = planes[f];
+
+                    __m128 outside = _mm_setzero_ps();
+                    for (u32 p = 0; p < 6; ++p)
+                    {
+                        __m128 d = _mm_mul_ps(px, _mm_set1_ps(cp.nx[p]));
+                        d = _mm_add_ps(d, _mm_mul_ps(py, _mm_set1_ps(cp.ny[p])));
+                        d = _mm_add_ps(d, _mm_mul_ps(pz, _mm_set1_ps(cp.nz[p])));
+                        d = _mm_add_ps(d, _mm_set1_ps(cp.d[p]));
+
+                        __m128 r = _mm_mul_ps(ex, _mm_set1_ps(cp.ax[p]));
+                        r = _mm_add_ps(r, _mm_mul_ps(ey, _mm_set1_ps(cp.ay[p])));
+                        r = _mm_add_ps(r, _mm_mul_ps(ez, _mm_set1_ps(cp.az[p])));
+
+                        outside = _mm_or_ps(outside, _mm_cmpgt_ps(d, r));
+                    }
+
+                    __m128i o = _mm_castps_si128(outside);
+                    __m128i bit = _mm_set1_epi64x((s64)((u64)1 << f));
+                    m01 = _mm_or_si128(m01, _mm_andnot_si128(_mm_unpacklo_epi32(o, o), bit));
+                    m23 = _mm_or_si128(m23, _mm_andnot_si128(_mm_unpackhi_epi32(o, o), bit));
+                }
+
+                _mm_storeu_si128((__m128i*)&masks[i], m01);
+                _mm_storeu_si128((__m128i*)&masks[i + 2], m23);
+            }
+
+            cull_multi_scalar(scene, planes, num_frusta, &entities[i], count - i, &masks[i]);
+        }
+
+        // the 8 padded planes as two halves
+        CULL_TARGET("sse2")
+        static u32 cull_node_sse2(const cull_planes& planes, const bvh_node& node)
+        {
+            __m128 cx = _mm_set1_ps((node.min.x + node.max.x) * 0.5f);
+            __m128 cy = _mm_set1_ps((node.min.y + node.max.y) * 0.5f);
+            __m128 cz = _mm_set1_ps((node.min.z + node.max.z) * 0.5f);
+            __m128 ex = _mm_set1_ps((node.max.x - node.min.x) * 0.5f);
+            __m128 ey = _mm_set1_ps((node.max.y - node.min.y) * 0.5f);
+            __m128 ez = _mm_set1_ps((node.max.z - node.min.z) * 0.5f);
+
+            const __m128 sign = _mm_set1_ps(-0.0f);
+
+            __m128 outside = _mm_setzero_ps();
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (u32 h = 0; h < 8; h += 4)
             {
-                // entity flags accept
-                if ((scene->entities[i] & accept_entities) != accept_entities)
-                    continue;
+                __m128 d = _mm_mul_ps(cx, _mm_loadu_ps(&planes.nx[h]));
+                d = _mm_add_ps(d, _mm_mul_ps(cy, _mm_loadu_ps(&planes.ny[h])));
+                d = _mm_add_ps(d, _mm_mul_ps(cz, _mm_loadu_ps(&planes.nz[h])));
+                d = _mm_add_ps(d, _mm_loadu_ps(&planes.d[h]));
 
-                // entity flags reject
-                if (reject_entities)
-                    if (scene->entities[i] & reject_entities)
-                        continue;
+                __m128 r = _mm_mul_ps(ex, _mm_loadu_ps(&planes.ax[h]));
+                r = _mm_add_ps(r, _mm_mul_ps(ey, _mm_loadu_ps(&planes.ay[h])));
+                r = _mm_add_ps(r, _mm_mul_ps(ez, _mm_loadu_ps(&planes.az[h])));
 
-                sb_push(*entities_out, i);
+                outside = _mm_or_ps(outside, _mm_cmpgt_ps(d, r));
+                inside = _mm_and_ps(inside, _mm_cmplt_ps(d, _mm_xor_ps(r, sign)));
             }
+
+            if (_mm_movemask_ps(outside))
+                return e_node_cull::outside;
+
+            return _mm_movemask_ps(inside) == 0xf ? e_node_cull::inside : e_node_cull::intersect;
         }
 
-        //
-        // sse2 128 implementation
-        //
-#if __SSE__ || __AVX__
-        void frustum_cull_aabb_simd128(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        // 4 pixels per iteration, rows are 16 byte aligned and x0 is a multiple of 4. the wider levels use this too,
+        // most occluder triangles span only a few groups of 4 so longer vectors would mostly be masked off.
+        CULL_TARGET("sse2")
+        static void raster_row_sse2(f32* row, const occluder_tri& t, u32 y, u32 x0, u32 x1)
+        {
+            f32 py = (f32)y + 0.5f;
+
+            __m128 ea0 = _mm_set1_ps(t.ea[0]);
+            __m128 ea1 = _mm_set1_ps(t.ea[1]);
+            __m128 ea2 = _mm_set1_ps(t.ea[2]);
+            __m128 eby0 = _mm_set1_ps(t.eb[0] * py);
+            __m128 eby1 = _mm_set1_ps(t.eb[1] * py);
+            __m128 eby2 = _mm_set1_ps(t.eb[2] * py);
+            __m128 ec0 = _mm_set1_ps(t.ec[0]);
+            __m128 ec1 = _mm_set1_ps(t.ec[1]);
+            __m128 ec2 = _mm_set1_ps(t.ec[2]);
+            __m128 za = _mm_set1_ps(t.za);
+            __m128 zby = _mm_set1_ps(t.zb * py);
+            __m128 zc = _mm_set1_ps(t.zc);
+
+            const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+            const __m128 zero = _mm_setzero_ps();
+
+            for (u32 x = x0; x < x1; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps((f32)x + 0.5f), lane);
+
+                __m128 e0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ea0, px), eby0), ec0);
+                __m128 e1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ea1, px), eby1), ec1);
+                __m128 e2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ea2, px), eby2), ec2);
+                __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(za, px), zby), zc);
+
+                __m128 covered = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero));
+                covered = _mm_and_ps(covered, _mm_cmpge_ps(e2, zero));
+
+                __m128 d = _mm_load_ps(&row[x]);
+                d = _mm_or_ps(_mm_and_ps(covered, _mm_max_ps(d, z)), _mm_andnot_ps(covered, d));
+                _mm_store_ps(&row[x], d);
+            }
+        }
+
+        // corners 0-3 and 4-7 in two registers
+        CULL_TARGET("sse2")
+        static bool project_box_sse2(const f32* vp, const f32* pe, f32 near_w, occludee_rect& r)
         {
-            const frustum& frust = cam->camera_frustum;
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 hw = _mm_set1_ps((f32)k_occlusion_width * 0.5f);
+            const __m128 hh = _mm_set1_ps((f32)k_occlusion_height * 0.5f);
+
+            // pos + -extent is exactly pos - extent, so flipping the sign of extent per lane matches the scalar corners
+            const __m128 sign_x = _mm_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+            const __m128 sign_y = _mm_setr_ps(-0.0f, -0.0f, 0.0f, 0.0f);
+            const __m128 sign_z = _mm_set1_ps(-0.0f);
+
+            __m128 pz = _mm_set1_ps(pe[2]);
+            __m128 ez = _mm_set1_ps(pe[6]);
+            __m128 x = _mm_add_ps(_mm_set1_ps(pe[0]), _mm_xor_ps(_mm_set1_ps(pe[4]), sign_x));
+            __m128 y = _mm_add_ps(_mm_set1_ps(pe[1]), _mm_xor_ps(_mm_set1_ps(pe[5]), sign_y));
+            __m128 z[2] = {_mm_add_ps(pz, _mm_xor_ps(ez, sign_z)), _mm_add_ps(pz, ez)};
+
+            __m128 min_x = _mm_set1_ps(FLT_MAX);
+            __m128 min_y = min_x;
+            __m128 max_x = _mm_set1_ps(-FLT_MAX);
+            __m128 max_y = max_x;
+            __m128 depth = _mm_setzero_ps();
+            __m128 in_front = _mm_setzero_ps();
+
+            for (u32 h = 0; h < 2; ++h)
+            {
+                __m128 cx = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(vp[0]), x), _mm_mul_ps(_mm_set1_ps(vp[1]), y));
+                cx = _mm_add_ps(_mm_add_ps(cx, _mm_mul_ps(_mm_set1_ps(vp[2]), z[h])), _mm_set1_ps(vp[3]));
+                __m128 cy = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(vp[4]), x), _mm_mul_ps(_mm_set1_ps(vp[5]), y));
+                cy = _mm_add_ps(_mm_add_ps(cy, _mm_mul_ps(_mm_set1_ps(vp[6]), z[h])), _mm_set1_ps(vp[7]));
+                __m128 cw = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(vp[12]), x), _mm_mul_ps(_mm_set1_ps(vp[13]), y));
+                cw = _mm_add_ps(_mm_add_ps(cw, _mm_mul_ps(_mm_set1_ps(vp[14]), z[h])), _mm_set1_ps(vp[15]));
+
+                in_front = _mm_or_ps(in_front, _mm_cmpnge_ps(cw, _mm_set1_ps(near_w)));
+
+                __m128 rw = _mm_div_ps(one, cw);
+                __m128 sx = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cx, rw), hw), hw);
+                __m128 sy = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cy, rw), hh), hh);
+
+                min_x = _mm_min_ps(min_x, sx);
+                max_x = _mm_max_ps(max_x, sx);
+                min_y = _mm_min_ps(min_y, sy);
+                max_y = _mm_max_ps(max_y, sy);
+                depth = _mm_max_ps(depth, rw);
+            }
 
-            // pad to 4
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 4);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+            if (_mm_movemask_ps(in_front))
+                return false;
 
-            // sphere radius and position
-            __m128 posx;
-            __m128 posy;
-            __m128 posz;
-            __m128 extx;
-            __m128 exty;
-            __m128 extz;
+            f32 v[5][4];
+            _mm_storeu_ps(v[0], min_x);
+            _mm_storeu_ps(v[1], min_y);
+            _mm_storeu_ps(v[2], max_x);
+            _mm_storeu_ps(v[3], max_y);
+            _mm_storeu_ps(v[4], depth);
 
-            // plane normal
-            __m128 pnx[6];
-            __m128 pny[6];
-            __m128 pnz[6];
+            r.min_x = std::min<f32>(std::min<f32>(v[0][0], v[0][1]), std::min<f32>(v[0][2], v[0][3]));
+            r.min_y = std::min<f32>(std::min<f32>(v[1][0], v[1][1]), std::min<f32>(v[1][2], v[1][3]));
+            r.max_x = std::max<f32>(std::max<f32>(v[2][0], v[2][1]), std::max<f32>(v[2][2], v[2][3]));
+            r.max_y = std::max<f32>(std::max<f32>(v[3][0], v[3][1]), std::max<f32>(v[3][2], v[3][3]));
+            r.depth = std::max<f32>(std::max<f32>(v[4][0], v[4][1]), std::max<f32>(v[4][2], v[4][3]));
 
-            // plane distance
-            __m128 pd[6];
-            __m128 pd_neg[6];
+            return true;
+        }
 
-            // plane sign flip
-            __m128 sfx[6];
-            __m128 sfy[6];
-            __m128 sfz[6];
+        //
+        // avx2 256 implementation
+        //
 
-            f32 result[4];
-            u32 e[4];
+        CULL_TARGET("avx2")
+        static inline __m256 load_bounds8(const f32* a, u32 first)
+        {
+            return (first & 7) ? _mm256_loadu_ps(&a[first]) : _mm256_load_ps(&a[first]);
+        }
 
-            // load camera planes
-            for (s32 p = 0; p < 6; ++p)
+        // the bounds of entities e[0] to e[7] as soa, spheres only load the radius and aabbs the extents. returns the ids.
+        template <bool k_sphere>
+        CULL_TARGET("avx2")
+        static inline __m256i load_entities8(const ecs_scene* scene, const u32* e, __m256& px, __m256& py, __m256& pz,
+                                             __m256& ex, __m256& ey, __m256& ez, __m256& er)
+        {
+            const f32*         pos_extent = (const f32*)scene->pos_extent.data;
+            const cull_bounds& b = scene->bounds;
+
+            u32     first = e[0];
+            __m256i ids = _mm256_loadu_si256((const __m256i*)e);
+            __m256i run = _mm256_add_epi32(_mm256_set1_epi32(first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+            ex = _mm256_setzero_ps();
+            ey = ex;
+            ez = ex;
+            er = ex;
+
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(ids, run)) == -1)
             {
-                f32 ppd = maths::plane_distance(frust.p[p], frust.n[p]);
-                pnx[p] = _mm_set1_ps(frust.n[p].x);
-                pny[p] = _mm_set1_ps(frust.n[p].y);
-                pnz[p] = _mm_set1_ps(frust.n[p].z);
-                pd[p] = _mm_set1_ps(ppd);
-                pd_neg[p] = _mm_set1_ps(-ppd);
+                px = load_bounds8(b.pos_x, first);
+                py = load_bounds8(b.pos_y, first);
+                pz = load_bounds8(b.pos_z, first);
 
-                sfx[p] = _mm_set1_ps(sgn(frust.n[p].x) * -1.0f);
-                sfy[p] = _mm_set1_ps(sgn(frust.n[p].y) * -1.0f);
-                sfz[p] = _mm_set1_ps(sgn(frust.n[p].z) * -1.0f);
+                if (k_sphere)
+                {
+                    er = load_bounds8(b.radius, first);
+                }
+                else
+                {
+                    ex = load_bounds8(b.extent_x, first);
+                    ey = load_bounds8(b.extent_y, first);
+                    ez = load_bounds8(b.extent_z, first);
+                }
             }
-
-            u32 n = sb_count(entities_in);
-            for (u32 i = 0; i < n; i += 4)
+            else
             {
-                // unpack entities
-                for (u32 j = 0; j < 4; ++j)
-                    e[j] = entities_in[i + j];
+                __m256i offsets = _mm256_slli_epi32(ids, 3);
 
-                auto& p0 = scene->pos_extent[e[0]].pos;
-                auto& p1 = scene->pos_extent[e[1]].pos;
-                auto& p2 = scene->pos_extent[e[2]].pos;
-                auto& p3 = scene->pos_extent[e[3]].pos;
-                auto& e0 = scene->pos_extent[e[0]].extent;
-                auto& e1 = scene->pos_extent[e[1]].extent;
-                auto& e2 = scene->pos_extent[e[2]].extent;
-                auto& e3 = scene->pos_extent[e[3]].extent;
+                px = _mm256_i32gather_ps(pos_extent + 0, offsets, 4);
+                py = _mm256_i32gather_ps(pos_extent + 1, offsets, 4);
+                pz = _mm256_i32gather_ps(pos_extent + 2, offsets, 4);
 
-                posx = _mm_set_ps(p0.x, p1.x, p2.x, p3.x);
-                posy = _mm_set_ps(p0.y, p1.y, p2.y, p3.y);
-                posz = _mm_set_ps(p0.z, p1.z, p2.z, p3.z);
+                if (k_sphere)
+                {
+                    er = _mm256_i32gather_ps(pos_extent + 7, offsets, 4);
+                }
+                else
+                {
+                    ex = _mm256_i32gather_ps(pos_extent + 4, offsets, 4);
+                    ey = _mm256_i32gather_ps(pos_extent + 5, offsets, 4);
+                    ez = _mm256_i32gather_ps(pos_extent + 6, offsets, 4);
+                }
+            }
+
+            return ids;
+        }
 
-                extx = _mm_set_ps(e0.x, e1.x, e2.x, e3.x);
-                exty = _mm_set_ps(e0.y, e1.y, e2.y, e3.y);
-                extz = _mm_set_ps(e0.z, e1.z, e2.z, e3.z);
+        template <bool k_sphere>
+        CULL_TARGET("avx2")
+        static u32 cull_avx2(const ecs_scene* scene, const cull_planes& planes, const u32* entities, u32 count, u32* out)
+        {
+            __m256 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], pd[6];
+            for (u32 p = 0; p < 6; ++p)
+            {
+                nx[p] = _mm256_set1_ps(planes.nx[p]);
+                ny[p] = _mm256_set1_ps(planes.ny[p]);
+                nz[p] = _mm256_set1_ps(planes.nz[p]);
+                ax[p] = _mm256_set1_ps(planes.ax[p]);
+                ay[p] = _mm256_set1_ps(planes.ay[p]);
+                az[p] = _mm256_set1_ps(planes.az[p]);
+                pd[p] = _mm256_set1_ps(planes.d[p]);
+            }
 
-                __m128 inside = _mm_set1_ps(0.0f);
+            u32 c = 0;
+            u32 i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256  px, py, pz, ex, ey, ez, er;
+                __m256i ids = load_entities8<k_sphere>(scene, &entities[i], px, py, pz, ex, ey, ez, er);
 
-                for (s32 p = 0; p < 6; ++p)
+                __m256 outside = _mm256_setzero_ps();
+                for (u32 p = 0; p < 6; ++p)
                 {
-                    // get distance to plane
-                    // dot product with plane normal and also add plane distance
-                    __m128 dd = _mm_fmadd_ps(posx, pnx[p], pd[p]);
-                    dd = _mm_fmadd_ps(posy, pny[p], dd);
-                    dd = _mm_fmadd_ps(posz, pnz[p], dd);
-
-                    // pos + extent * sign_flip
-                    __m128 dpx = _mm_fmadd_ps(extx, sfx[p], posx);
-                    __m128 dpy = _mm_fmadd_ps(exty, sfy[p], posy);
-                    __m128 dpz = _mm_fmadd_ps(extz, sfz[p], posz);
-
-                    // dot(pos + extent * sign_flip, frust.n[p]);
-                    __m128 r = _mm_mul_ps(dpx, pnx[p]);
-                    r = _mm_fmadd_ps(dpy, pny[p], r);
-                    r = _mm_fmadd_ps(dpz, pnz[p], r);
-
-                    // if(r > -pd) inside = false
-                    __m128 ge = _mm_cmpge_ps(r, pd_neg[p]);
-                    inside = _mm_add_ps(ge, inside);
+                    __m256 d = _mm256_mul_ps(px, nx[p]);
+                    d = _mm256_add_ps(d, _mm256_mul_ps(py, ny[p]));
+                    d = _mm256_add_ps(d, _mm256_mul_ps(pz, nz[p]));
+                    d = _mm256_add_ps(d, pd[p]);
+
+                    __m256 r = er;
+                    if (!k_sphere)
+                    {
+                        r = _mm256_mul_ps(ex, ax[p]);
+                        r = _mm256_add_ps(r, _mm256_mul_ps(ey, ay[p]));
+                        r = _mm256_add_ps(r, _mm256_mul_ps(ez, az[p]));
+                    }
+
+                    outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, r, _CMP_GT_OQ));
                 }
 
-                _mm_store_ps(result, inside);
-                for (u32 j = 0; j < 4; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[3 - j]);
+                // left pack the visible ids and store all 8 lanes, c <= i so the store stays inside out
+                u32     visible = ~_mm256_movemask_ps(outside) & 0xff;
+                __m256i perm = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)s_compress_lut[visible]));
+                _mm256_storeu_si256((__m256i*)&out[c], _mm256_permutevar8x32_epi32(ids, perm));
+                c += s_compress_count[visible];
             }
+
+            return c + cull_scalar<k_sphere>(scene, planes, &entities[i], count - i, &out[c]);
         }
 
-        void frustum_cull_sphere_simd128(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        // as sse2 with the masks of 8 entities in two registers, avx-512 uses this too
+        CULL_TARGET("avx2")
+        static void cull_multi_avx2(const ecs_scene* scene, const cull_planes* planes, u32 num_frusta,
+                                    const u32* entities, u32 count, u64* masks)
         {
-            const frustum& frust = cam->camera_frustum;
+            u32 i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256 px, py, pz, ex, ey, ez, er;
+                load_entities8<false>(scene, &entities[i], px, py, pz, ex, ey, ez, er);
 
-            // pad to 4
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 4);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+                __m256i m03 = _mm256_setzero_si256();
+                __m256i m47 = _mm256_setzero_si256();
+                for (u32 f = 0; f < num_frusta; ++f)
+                {
+                    const cull_planes& cp = planes[f];
 
-            // sphere radius and position
-            __m128 radius;
-            __m128 posx;
-            __m128 posy;
-            __m128 posz;
+                    __m256 outside = _mm256_setzero_ps();
+                    for (u32 p = 0; p < 6; ++p)
+                    {
+                        __m256 d = _mm256_mul_ps(px, _mm256_broadcast_ss(&cp.nx[p]));
+                        d = _mm256_add_ps(d, _mm256_mul_ps(py, _mm256_broadcast_ss(&cp.ny[p])));
+                        d = _mm256_add_ps(d, _mm256_mul_ps(pz, _mm256_broadcast_ss(&cp.nz[p])));
+                        d = _mm256_add_ps(d, _mm256_broadcast_ss(&cp.d[p]));
 
-            // plane normal
-            __m128 pnx[6];
-            __m128 pny[6];
-            __m128 pnz[6];
+                        __m256 r = _mm256_mul_ps(ex, _mm256_broadcast_ss(&cp.ax[p]));
+                        r = _mm256_add_ps(r, _mm256_mul_ps(ey, _mm256_broadcast_ss(&cp.ay[p])));
+                        r = _mm256_add_ps(r, _mm256_mul_ps(ez, _mm256_broadcast_ss(&cp.az[p])));
 
-            // plane distance
-            __m128 pd[6];
+                        outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, r, _CMP_GT_OQ));
+                    }
 
-            f32 result[4];
-            u32 e[4];
+                    __m256i o = _mm256_castps_si256(outside);
+                    __m256i bit = _mm256_set1_epi64x((s64)((u64)1 << f));
+                    __m256i o03 = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(o));
+                    __m256i o47 = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(o, 1));
+                    m03 = _mm256_or_si256(m03, _mm256_andnot_si256(o03, bit));
+                    m47 = _mm256_or_si256(m47, _mm256_andnot_si256(o47, bit));
+                }
+
+                _mm256_storeu_si256((__m256i*)&masks[i], m03);
+                _mm256_storeu_si256((__m256i*)&masks[i + 4], m47);
+            }
 
-            // load camera planes
-            for (s32 p = 0; p < 6; ++p)
+            cull_multi_scalar(scene, planes, num_frusta, &entities[i], count - i, &masks[i]);
+        }
+
+        // all 8 padded planes in one register, avx-512 uses this too as a wider register would be half empty
+        CULL_TARGET("avx2")
+        static u32 cull_node_avx2(const cull_planes& planes, const bvh_node& node)
+        {
+            __m256 cx = _mm256_set1_ps((node.min.x + node.max.x) * 0.5f);
+            __m256 cy = _mm256_set1_ps((node.min.y + node.max.y) * 0.5f);
+            __m256 cz = _mm256_set1_ps((node.min.z + node.max.z) * 0.5f);
+            __m256 ex = _mm256_set1_ps((node.max.x - node.min.x) * 0.5f);
+            __m256 ey = _mm256_set1_ps((node.max.y - node.min.y) * 0.5f);
+            __m256 ez = _mm256_set1_ps((node.max.z - node.min.z) * 0.5f);
+
+            __m256 d = _mm256_mul_ps(cx, _mm256_loadu_ps(planes.nx));
+            d = _mm256_add_ps(d, _mm256_mul_ps(cy, _mm256_loadu_ps(planes.ny)));
+            d = _mm256_add_ps(d, _mm256_mul_ps(cz, _mm256_loadu_ps(planes.nz)));
+            d = _mm256_add_ps(d, _mm256_loadu_ps(planes.d));
+
+            __m256 r = _mm256_mul_ps(ex, _mm256_loadu_ps(planes.ax));
+            r = _mm256_add_ps(r, _mm256_mul_ps(ey, _mm256_loadu_ps(planes.ay)));
+            r = _mm256_add_ps(r, _mm256_mul_ps(ez, _mm256_loadu_ps(planes.az)));
+
+            if (_mm256_movemask_ps(_mm256_cmp_ps(d, r, _CMP_GT_OQ)))
+                return e_node_cull::outside;
+
+            __m256 neg_r = _mm256_xor_ps(r, _mm256_set1_ps(-0.0f));
+            return _mm256_movemask_ps(_mm256_cmp_ps(d, neg_r, _CMP_LT_OQ)) == 0xff ? e_node_cull::inside
+                                                                                  : e_node_cull::intersect;
+        }
+
+        //
+        // avx-512 implementation
+        //
+
+        CULL_TARGET("avx512f")
+        static inline __m512 load_bounds16(const f32* a, u32 first)
+        {
+            return (first & 15) ? _mm512_loadu_ps(&a[first]) : _mm512_load_ps(&a[first]);
+        }
+
+        template <bool k_sphere>
+        CULL_TARGET("avx512f")
+        static u32 cull_avx512(const ecs_scene* scene, const cull_planes& planes, const u32* entities, u32 count, u32* out)
+        {
+            const f32*         pos_extent = (const f32*)scene->pos_extent.data;
+            const cull_bounds& b = scene->bounds;
+
+            __m512 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], pd[6];
+            for (u32 p = 0; p < 6; ++p)
             {
-                f32 ppd = maths::plane_distance(frust.p[p], frust.n[p]);
-                pnx[p] = _mm_set1_ps(frust.n[p].x);
-                pny[p] = _mm_set1_ps(frust.n[p].y);
-                pnz[p] = _mm_set1_ps(frust.n[p].z);
-                pd[p] = _mm_set1_ps(ppd);
+                nx[p] = _mm512_set1_ps(planes.nx[p]);
+                ny[p] = _mm512_set1_ps(planes.ny[p]);
+                nz[p] = _mm512_set1_ps(planes.nz[p]);
+                ax[p] = _mm512_set1_ps(planes.ax[p]);
+                ay[p] = _mm512_set1_ps(planes.ay[p]);
+                az[p] = _mm512_set1_ps(planes.az[p]);
+                pd[p] = _mm512_set1_ps(planes.d[p]);
             }
 
-            u32 n = sb_count(entities_in);
-            for (u32 i = 0; i < n; i += 4)
+            const __m512i iota = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+            u32 c = 0;
+            u32 i = 0;
+            for (; i + 16 <= count; i += 16)
             {
-                // unpack entities
-                for (u32 j = 0; j < 4; ++j)
-                    e[j] = entities_in[i + j];
+                u32     first = entities[i];
+                __m512i ids = _mm512_loadu_si512((const void*)&entities[i]);
+                __m512i run = _mm512_add_epi32(_mm512_set1_epi32(first), iota);
 
-                // load entities values
-                auto& p0 = scene->pos_extent[e[0]].pos;
-                auto& p1 = scene->pos_extent[e[1]].pos;
-                auto& p2 = scene->pos_extent[e[2]].pos;
-                auto& p3 = scene->pos_extent[e[3]].pos;
-                auto& r0 = scene->pos_extent[e[0]].extent;
-                auto& r1 = scene->pos_extent[e[1]].extent;
-                auto& r2 = scene->pos_extent[e[2]].extent;
-                auto& r3 = scene->pos_extent[e[3]].extent;
+                __m512 px, py, pz;
+                __m512 ex = _mm512_setzero_ps(), ey = ex, ez = ex, er = ex;
+                if (_mm512_cmpeq_epi32_mask(ids, run) == 0xffff)
+                {
+                    px = load_bounds16(b.pos_x, first);
+                    py = load_bounds16(b.pos_y, first);
+                    pz = load_bounds16(b.pos_z, first);
 
-                radius = _mm_set_ps(r0.w, r1.w, r2.w, r3.w);
+                    if (k_sphere)
+                    {
+                        er = load_bounds16(b.radius, first);
+                    }
+                    else
+                    {
+                        ex = load_bounds16(b.extent_x, first);
+                        ey = load_bounds16(b.extent_y, first);
+                        ez = load_bounds16(b.extent_z, first);
+                    }
+                }
+                else
+                {
+                    __m512i offsets = _mm512_slli_epi32(ids, 3);
 
-                posx = _mm_set_ps(p0.x, p1.x, p2.x, p3.x);
-                posy = _mm_set_ps(p0.y, p1.y, p2.y, p3.y);
-                posz = _mm_set_ps(p0.z, p1.z, p2.z, p3.z);
+                    px = _mm512_i32gather_ps(offsets, pos_extent + 0, 4);
+                    py = _mm512_i32gather_ps(offsets, pos_extent + 1, 4);
+                    pz = _mm512_i32gather_ps(offsets, pos_extent + 2, 4);
 
-                __m128 inside = _mm_set1_ps(0.0f);
+                    if (k_sphere)
+                    {
+                        er = _mm512_i32gather_ps(offsets, pos_extent + 7, 4);
+                    }
+                    else
+                    {
+                        ex = _mm512_i32gather_ps(offsets, pos_extent + 4, 4);
+                        ey = _mm512_i32gather_ps(offsets, pos_extent + 5, 4);
+                        ez = _mm512_i32gather_ps(offsets, pos_extent + 6, 4);
+                    }
+                }
 
-                for (s32 p = 0; p < 6; ++p)
+                __mmask16 outside = 0;
+                for (u32 p = 0; p < 6; ++p)
                 {
-                    // get distance to plane
-                    // dot product with plane normal and also add plane distance
-                    __m128 dd = _mm_fmadd_ps(posx, pnx[p], pd[p]);
-                    dd = _mm_fmadd_ps(posy, pny[p], dd);
-                    dd = _mm_fmadd_ps(posz, pnz[p], dd);
-
-                    // compare if dd is greater than radius, if so we are outside
-                    __m128 ge = _mm_cmpge_ps(dd, radius);
-                    inside = _mm_add_ps(ge, inside);
+                    __m512 d = _mm512_mul_ps(px, nx[p]);
+                    d = _mm512_add_ps(d, _mm512_mul_ps(py, ny[p]));
+                    d = _mm512_add_ps(d, _mm512_mul_ps(pz, nz[p]));
+                    d = _mm512_add_ps(d, pd[p]);
+
+                    __m512 r = er;
+                    if (!k_sphere)
+                    {
+                        r = _mm512_mul_ps(ex, ax[p]);
+                        r = _mm512_add_ps(r, _mm512_mul_ps(ey, ay[p]));
+                        r = _mm512_add_ps(r, _mm512_mul_ps(ez, az[p]));
+                    }
+
+                    outside |= _mm512_cmp_ps_mask(d, r, _CMP_GT_OQ);
                 }
 
-                _mm_store_ps(result, inside);
-                for (u32 j = 0; j < 4; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[3 - j]);
+                // compress in register and store all 16 lanes, cheaper than compressstoreu on some cores
+                u32 visible = ~outside & 0xffff;
+                _mm512_storeu_si512((void*)&out[c], _mm512_maskz_compress_epi32((__mmask16)visible, ids));
+                c += s_compress_count[visible & 0xff] + s_compress_count[visible >> 8];
             }
+
+            return c + cull_scalar<k_sphere>(scene, planes, &entities[i], count - i, &out[c]);
         }
 #endif
 
         //
-        // avx 256 implementation
+        // arm neon simd 128 implementation
         //
-#if __AVX2__
-        void frustum_cull_sphere_simd256(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+
+#if CULL_NEON
+        // the bounds of entities e[0] to e[3] as soa
+        static inline void load_entities4(const ecs_scene* scene, const u32* e, float32x4_t& px, float32x4_t& py,
+                                          float32x4_t& pz, float32x4_t& ex, float32x4_t& ey, float32x4_t& ez,
+                                          float32x4_t& er)
         {
-            const frustum& frust = cam->camera_frustum;
+            const f32*         pos_extent = (const f32*)scene->pos_extent.data;
+            const cull_bounds& b = scene->bounds;
 
-            // pad to 8
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 8);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+            u32 first = e[0];
+            if (e[1] == first + 1 && e[2] == first + 2 && e[3] == first + 3)
+            {
+                px = vld1q_f32(&b.pos_x[first]);
+                py = vld1q_f32(&b.pos_y[first]);
+                pz = vld1q_f32(&b.pos_z[first]);
+                ex = vld1q_f32(&b.extent_x[first]);
+                ey = vld1q_f32(&b.extent_y[first]);
+                ez = vld1q_f32(&b.extent_z[first]);
+                er = vld1q_f32(&b.radius[first]);
+            }
+            else
+            {
+                const f32* pe0 = pos_extent + e[0] * k_pos_extent_stride;
+                const f32* pe1 = pos_extent + e[1] * k_pos_extent_stride;
+                const f32* pe2 = pos_extent + e[2] * k_pos_extent_stride;
+                const f32* pe3 = pos_extent + e[3] * k_pos_extent_stride;
+
+                // aos to soa, rows 0 2 and 1 3 interleave to x0 x1 x2 x3, y.., z.., w..
+                float32x4x2_t t0 = vzipq_f32(vld1q_f32(pe0), vld1q_f32(pe2));
+                float32x4x2_t t1 = vzipq_f32(vld1q_f32(pe1), vld1q_f32(pe3));
+                float32x4x2_t xy = vzipq_f32(t0.val[0], t1.val[0]);
+                float32x4x2_t zw = vzipq_f32(t0.val[1], t1.val[1]);
+                px = xy.val[0];
+                py = xy.val[1];
+                pz = zw.val[0];
+
+                t0 = vzipq_f32(vld1q_f32(pe0 + 4), vld1q_f32(pe2 + 4));
+                t1 = vzipq_f32(vld1q_f32(pe1 + 4), vld1q_f32(pe3 + 4));
+                xy = vzipq_f32(t0.val[0], t1.val[0]);
+                zw = vzipq_f32(t0.val[1], t1.val[1]);
+                ex = xy.val[0];
+                ey = xy.val[1];
+                ez = zw.val[0];
+                er = zw.val[1];
+            }
+        }
 
-            // splat constants
-            __m256 zero = _mm256_set1_ps(0.0f);
+        template <bool k_sphere>
+        static u32 cull_neon(const ecs_scene* scene, const cull_planes& planes, const u32* entities, u32 count, u32* out)
+        {
+            float32x4_t nx[6], ny[6], nz[6], ax[6], ay[6], az[6], pd[6];
+            for (u32 p = 0; p < 6; ++p)
+            {
+                nx[p] = vdupq_n_f32(planes.nx[p]);
+                ny[p] = vdupq_n_f32(planes.ny[p]);
+                nz[p] = vdupq_n_f32(planes.nz[p]);
+                ax[p] = vdupq_n_f32(planes.ax[p]);
+                ay[p] = vdupq_n_f32(planes.ay[p]);
+                az[p] = vdupq_n_f32(planes.az[p]);
+                pd[p] = vdupq_n_f32(planes.d[p]);
+            }
 
-            // sphere radius and position
-            __m256 radius;
-            __m256 posx;
-            __m256 posy;
-            __m256 posz;
+            u32 c = 0;
+            u32 i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                const u32* e = &entities[i];
 
-            // plane normal
-            __m256 pnx[6];
-            __m256 pny[6];
-            __m256 pnz[6];
+                float32x4_t px, py, pz, ex, ey, ez, er;
+                load_entities4(scene, e, px, py, pz, ex, ey, ez, er);
 
-            // plane distance
-            __m256 pd[6];
+                uint32x4_t outside = vdupq_n_u32(0);
+                for (u32 p = 0; p < 6; ++p)
+                {
+                    // separate multiply and add, vmlaq may be fused on some targets
+                    float32x4_t d = vmulq_f32(px, nx[p]);
+                    d = vaddq_f32(d, vmulq_f32(py, ny[p]));
+                    d = vaddq_f32(d, vmulq_f32(pz, nz[p]));
+                    d = vaddq_f32(d, pd[p]);
+
+                    float32x4_t r = er;
+                    if (!k_sphere)
+                    {
+                        r = vmulq_f32(ex, ax[p]);
+                        r = vaddq_f32(r, vmulq_f32(ey, ay[p]));
+                        r = vaddq_f32(r, vmulq_f32(ez, az[p]));
+                    }
 
-            f32 result[8];
-            u32 e[8];
+                    outside = vorrq_u32(outside, vcgtq_f32(d, r));
+                }
 
-            // load camera planes
-            for (s32 p = 0; p < 6; ++p)
-            {
-                f32 ppd = maths::plane_distance(frust.p[p], frust.n[p]);
-                pnx[p] = _mm256_set1_ps(frust.n[p].x);
-                pny[p] = _mm256_set1_ps(frust.n[p].y);
-                pnz[p] = _mm256_set1_ps(frust.n[p].z);
-                pd[p] = _mm256_set1_ps(ppd);
+                out[c] = e[0];
+                c += vgetq_lane_u32(outside, 0) ? 0 : 1;
+                out[c] = e[1];
+                c += vgetq_lane_u32(outside, 1) ? 0 : 1;
+                out[c] = e[2];
+                c += vgetq_lane_u32(outside, 2) ? 0 : 1;
+                out[c] = e[3];
+                c += vgetq_lane_u32(outside, 3) ? 0 : 1;
             }
 
-            u32 n = sb_count(entities_in);
-            for (u32 i = 0; i < n; i += 8)
+            return c + cull_scalar<k_sphere>(scene, planes, &entities[i], count - i, &out[c]);
+        }
+
+        // the inside lanes of each frustum are widened to 64 bits and set its bit in the masks of 4 entities
+        static void cull_multi_neon(const ecs_scene* scene, const cull_planes* planes, u32 num_frusta,
+                                    const u32* entities, u32 count, u64* masks)
+        {
+            u32 i = 0;
+            for (; i + 4 <= count; i += 4)
             {
-                // unpack entities
-                for (u32 j = 0; j < 8; ++j)
-                    e[j] = entities_in[i + j];
-
-                // load entities values
-                auto& p0 = scene->pos_extent[e[0]].pos;
-                auto& p1 = scene->pos_extent[e[1]].pos;
-                auto& p2 = scene->pos_extent[e[2]].pos;
-                auto& p3 = scene->pos_extent[e[3]].pos;
-                auto& p4 = scene->pos_extent[e[4]].pos;
-                auto& p5 = scene->pos_extent[e[5]].pos;
-                auto& p6 = scene->pos_extent[e[6]].pos;
-                auto& p7 = scene->pos_extent[e[7]].pos;
-                auto& r0 = scene->pos_extent[e[0]].extent;
-                auto& r1 = scene->pos_extent[e[1]].extent;
-                auto& r2 = scene->pos_extent[e[2]].extent;
-                auto& r3 = scene->pos_extent[e[3]].extent;
-                auto& r4 = scene->pos_extent[e[4]].extent;
-                auto& r5 = scene->pos_extent[e[5]].extent;
-                auto& r6 = scene->pos_extent[e[6]].extent;
-                auto& r7 = scene->pos_extent[e[7]].extent;
-
-                radius = _mm256_set_ps(r0.w, r1.w, r2.w, r3.w, r4.w, r5.w, r6.w, r7.w);
-
-                posx = _mm256_set_ps(p0.x, p1.x, p2.x, p3.x, p4.x, p5.x, p6.x, p7.x);
-                posy = _mm256_set_ps(p0.y, p1.y, p2.y, p3.y, p4.y, p5.y, p6.y, p7.y);
-                posz = _mm256_set_ps(p0.z, p1.z, p2.z, p3.z, p4.z, p5.z, p6.z, p7.z);
-
-                __m256 inside = _mm256_set1_ps(0.0f);
-
-                for (s32 p = 0; p < 6; ++p)
+                float32x4_t px, py, pz, ex, ey, ez, er;
+                load_entities4(scene, &entities[i], px, py, pz, ex, ey, ez, er);
+
+                uint64x2_t m01 = vdupq_n_u64(0);
+                uint64x2_t m23 = vdupq_n_u64(0);
+                for (u32 f = 0; f < num_frusta; ++f)
                 {
-                    // get distance to plane
-                    // dot product with plane normal and also add plane distance
-                    __m256 dd = _mm256_fmadd_ps(posx, pnx[p], pd[p]);
-                    dd = _mm256_fmadd_ps(posy, pny[p], dd);
-                    dd = _mm256_fmadd_ps(posz, pnz[p], dd);
-
-                    __m256 diff = _mm256_sub_ps(dd, radius);
-                    diff = _mm256_max_ps(diff, zero);
-                    inside = _mm256_add_ps(diff, inside);
+                    const cull_planes& cp = planes[f];
+
+                    uint32x4_t outside = vdupq_n_u32(0);
+                    for (u32 p = 0; p < 6; ++p)
+                    {
+                        // separate multiply and add, vmlaq may be fused on some targets
+                        float32x4_t d = vmulq_f32(px, vdupq_n_f32(cp.nx[p]));
+                        d = vaddq_f32(d, vmulq_f32(py, vdupq_n_f32(cp.ny[p])));
+                        d = vaddq_f32(d, vmulq_f32(pz, vdupq_n_f32(cp.nz[p])));
+                        d = vaddq_f32(d, vdupq_n_f32(cp.d[p]));
+
+                        float32x4_t r = vmulq_f32(ex, vdupq_n_f32(cp.ax[p]));
+                        r = vaddq_f32(r, vmulq_f32(ey, vdupq_n_f32(cp.ay[p])));
+                        r = vaddq_f32(r, vmulq_f32(ez, vdupq_n_f32(cp.az[p])));
+
+                        outside = vorrq_u32(outside, vcgtq_f32(d, r));
+                    }
+
+                    int32x4_t  o = vreinterpretq_s32_u32(outside);
+                    uint64x2_t bit = vdupq_n_u64((u64)1 << f);
+                    m01 = vorrq_u64(m01, vbicq_u64(bit, vreinterpretq_u64_s64(vmovl_s32(vget_low_s32(o)))));
+                    m23 = vorrq_u64(m23, vbicq_u64(bit, vreinterpretq_u64_s64(vmovl_s32(vget_high_s32(o)))));
                 }
 
-                _mm256_store_ps(result, inside);
-                for (u32 j = 0; j < 8; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[7 - j]);
+                vst1q_u64(&masks[i], m01);
+                vst1q_u64(&masks[i + 2], m23);
             }
+
+            cull_multi_scalar(scene, planes, num_frusta, &entities[i], count - i, &masks[i]);
         }
 
-        void frustum_cull_aabb_simd256(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        static u32 cull_node_neon(const cull_planes& planes, const bvh_node& node)
         {
-            const frustum& frust = cam->camera_frustum;
+            float32x4_t cx = vdupq_n_f32((node.min.x + node.max.x) * 0.5f);
+            float32x4_t cy = vdupq_n_f32((node.min.y + node.max.y) * 0.5f);
+            float32x4_t cz = vdupq_n_f32((node.min.z + node.max.z) * 0.5f);
+            float32x4_t ex = vdupq_n_f32((node.max.x - node.min.x) * 0.5f);
+            float32x4_t ey = vdupq_n_f32((node.max.y - node.min.y) * 0.5f);
+            float32x4_t ez = vdupq_n_f32((node.max.z - node.min.z) * 0.5f);
+
+            uint32x4_t outside = vdupq_n_u32(0);
+            uint32x4_t inside = vdupq_n_u32(0xffffffff);
+            for (u32 h = 0; h < 8; h += 4)
+            {
+                float32x4_t d = vmulq_f32(cx, vld1q_f32(&planes.nx[h]));
+                d = vaddq_f32(d, vmulq_f32(cy, vld1q_f32(&planes.ny[h])));
+                d = vaddq_f32(d, vmulq_f32(cz, vld1q_f32(&planes.nz[h])));
+                d = vaddq_f32(d, vld1q_f32(&planes.d[h]));
 
-            // pad to 8
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 8);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+                float32x4_t r = vmulq_f32(ex, vld1q_f32(&planes.ax[h]));
+                r = vaddq_f32(r, vmulq_f32(ey, vld1q_f32(&planes.ay[h])));
+                r = vaddq_f32(r, vmulq_f32(ez, vld1q_f32(&planes.az[h])));
 
-            // splat constants
-            __m256 zero = _mm256_set1_ps(0.0f);
+                outside = vorrq_u32(outside, vcgtq_f32(d, r));
+                inside = vandq_u32(inside, vcltq_f32(d, vnegq_f32(r)));
+            }
 
-            // sphere radius and position
-            __m256 posx;
-            __m256 posy;
-            __m256 posz;
-            __m256 extx;
-            __m256 exty;
-            __m256 extz;
+            uint32x2_t o = vorr_u32(vget_low_u32(outside), vget_high_u32(outside));
+            if (vget_lane_u32(o, 0) | vget_lane_u32(o, 1))
+                return e_node_cull::outside;
 
-            // plane normal
-            __m256 pnx[6];
-            __m256 pny[6];
-            __m256 pnz[6];
+            uint32x2_t i = vand_u32(vget_low_u32(inside), vget_high_u32(inside));
+            return (vget_lane_u32(i, 0) & vget_lane_u32(i, 1)) ? e_node_cull::inside : e_node_cull::intersect;
+        }
 
-            // sign flip
-            __m256 sfx[6];
-            __m256 sfy[6];
-            __m256 sfz[6];
+        // boxes are projected with the scalar version, armv7 neon has no divide and 8 corners gain little from it
+        static void raster_row_neon(f32* row, const occluder_tri& t, u32 y, u32 x0, u32 x1)
+        {
+            f32 py = (f32)y + 0.5f;
+
+            float32x4_t ea0 = vdupq_n_f32(t.ea[0]);
+            float32x4_t ea1 = vdupq_n_f32(t.ea[1]);
+            float32x4_t ea2 = vdupq_n_f32(t.ea[2]);
+            float32x4_t eby0 = vdupq_n_f32(t.eb[0] * py);
+            float32x4_t eby1 = vdupq_n_f32(t.eb[1] * py);
+            float32x4_t eby2 = vdupq_n_f32(t.eb[2] * py);
+            float32x4_t ec0 = vdupq_n_f32(t.ec[0]);
+            float32x4_t ec1 = vdupq_n_f32(t.ec[1]);
+            float32x4_t ec2 = vdupq_n_f32(t.ec[2]);
+            float32x4_t za = vdupq_n_f32(t.za);
+            float32x4_t zby = vdupq_n_f32(t.zb * py);
+            float32x4_t zc = vdupq_n_f32(t.zc);
+
+            static const f32  k_lane[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+            const float32x4_t lane = vld1q_f32(k_lane);
+            const float32x4_t zero = vdupq_n_f32(0.0f);
+
+            for (u32 x = x0; x < x1; x += 4)
+            {
+                float32x4_t px = vaddq_f32(vdupq_n_f32((f32)x + 0.5f), lane);
 
-            // plane distance
-            __m256 pd[6];
-            __m256 pd_neg[6];
+                float32x4_t e0 = vaddq_f32(vaddq_f32(vmulq_f32(ea0, px), eby0), ec0);
+                float32x4_t e1 = vaddq_f32(vaddq_f32(vmulq_f32(ea1, px), eby1), ec1);
+                float32x4_t e2 = vaddq_f32(vaddq_f32(vmulq_f32(ea2, px), eby2), ec2);
+                float32x4_t z = vaddq_f32(vaddq_f32(vmulq_f32(za, px), zby), zc);
 
-            f32 result[8];
-            u32 e[8];
+                uint32x4_t covered = vandq_u32(vcgeq_f32(e0, zero), vcgeq_f32(e1, zero));
+                covered = vandq_u32(covered, vcgeq_f32(e2, zero));
+                covered = vandq_u32(covered, vcgtq_f32(z, vld1q_f32(&row[x])));
 
-            // load camera planes
-            for (s32 p = 0; p < 6; ++p)
+                vst1q_f32(&row[x], vbslq_f32(covered, z, vld1q_f32(&row[x])));
+            }
+        }
+#endif
+
+        //
+        // run time detection and dispatch
+        //
+
+#if CULL_X86
+        static void cpuid(u32 leaf, u32 sub_leaf, u32* regs)
+        {
+#if defined(_MSC_VER)
+            __cpuidex((int*)regs, (int)leaf, (int)sub_leaf);
+#else
+            __cpuid_count(leaf, sub_leaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+        }
+
+        static u64 xgetbv()
+        {
+#if defined(_MSC_VER)
+            return _xgetbv(0);
+#else
+            u32 lo, hi;
+            __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            return ((u64)hi << 32) | lo;
+#endif
+        }
+#endif
+
+        static u32 detect_simd_support()
+        {
+            u32 supported = 1 << e_simd::scalar;
+
+#if CULL_X86
+            u32 regs[4];
+            cpuid(0, 0, regs);
+            u32 max_leaf = regs[0];
+
+            cpuid(1, 0, regs);
+            if (regs[3] & (1 << 26))
+                supported |= 1 << e_simd::sse2;
+
+            // the os must also save the wider register state on context switches
+            bool osxsave = regs[2] & (1 << 27);
+            bool avx = regs[2] & (1 << 28);
+            if (osxsave && avx && max_leaf >= 7)
             {
-                f32 ppd = maths::plane_distance(frust.p[p], frust.n[p]);
-                pnx[p] = _mm256_set1_ps(frust.n[p].x);
-                pny[p] = _mm256_set1_ps(frust.n[p].y);
-                pnz[p] = _mm256_set1_ps(frust.n[p].z);
-                pd[p] = _mm256_set1_ps(ppd);
-                pd_neg[p] = _mm256_set1_ps(-ppd);
+                u64 xcr0 = xgetbv();
+                cpuid(7, 0, regs);
 
-                sfx[p] = _mm256_set1_ps(sgn(frust.n[p].x) * -1.0f);
-                sfy[p] = _mm256_set1_ps(sgn(frust.n[p].y) * -1.0f);
-                sfz[p] = _mm256_set1_ps(sgn(frust.n[p].z) * -1.0f);
+                // ymm
+                if ((xcr0 & 0x6) == 0x6 && (regs[1] & (1 << 5)))
+                    supported |= 1 << e_simd::avx2;
+
+                // ymm, zmm and opmask, the avx-512 level also runs avx2 code
+                if ((xcr0 & 0xe6) == 0xe6 && (regs[1] & (1 << 16)) && (supported & (1 << e_simd::avx2)))
+                    supported |= 1 << e_simd::avx512;
             }
+#elif CULL_NEON
+            supported |= 1 << e_simd::neon;
+#endif
 
-            // n is number of entities + padding for alignment
-            u32 n = sb_count(entities_in);
-            for (u32 i = 0; i < n; i += 8)
+            return supported;
+        }
+
+        static bool simd_level_available(simd_level level)
+        {
+            return (s_simd_supported & (1 << level)) && s_cull_impls[level].aabb;
+        }
+
+        static bool init_simd()
+        {
+            for (u32 m = 0; m < 256; ++m)
             {
-                // unpack entities
+                u32 c = 0;
                 for (u32 j = 0; j < 8; ++j)
-                    e[j] = entities_in[i + j];
-
-                // load entities values
-                auto& p0 = scene->pos_extent[e[0]].pos;
-                auto& p1 = scene->pos_extent[e[1]].pos;
-                auto& p2 = scene->pos_extent[e[2]].pos;
-                auto& p3 = scene->pos_extent[e[3]].pos;
-                auto& p4 = scene->pos_extent[e[4]].pos;
-                auto& p5 = scene->pos_extent[e[5]].pos;
-                auto& p6 = scene->pos_extent[e[6]].pos;
-                auto& p7 = scene->pos_extent[e[7]].pos;
-                auto& e0 = scene->pos_extent[e[0]].extent;
-                auto& e1 = scene->pos_extent[e[1]].extent;
-                auto& e2 = scene->pos_extent[e[2]].extent;
-                auto& e3 = scene->pos_extent[e[3]].extent;
-                auto& e4 = scene->pos_extent[e[4]].extent;
-                auto& e5 = scene->pos_extent[e[5]].extent;
-                auto& e6 = scene->pos_extent[e[6]].extent;
-                auto& e7 = scene->pos_extent[e[7]].extent;
-
-                posx = _mm256_set_ps(p0.x, p1.x, p2.x, p3.x, p4.x, p5.x, p6.x, p7.x);
-                posy = _mm256_set_ps(p0.y, p1.y, p2.y, p3.y, p4.y, p5.y, p6.y, p7.y);
-                posz = _mm256_set_ps(p0.z, p1.z, p2.z, p3.z, p4.z, p5.z, p6.z, p7.z);
-                extx = _mm256_set_ps(e0.x, e1.x, e2.x, e3.x, e4.x, e5.x, e6.x, e7.x);
-                exty = _mm256_set_ps(e0.y, e1.y, e2.y, e3.y, e4.y, e5.y, e6.y, e7.y);
-                extz = _mm256_set_ps(e0.z, e1.z, e2.z, e3.z, e4.z, e5.z, e6.z, e7.z);
-
-                __m256 inside = _mm256_set1_ps(0.0f);
-
-                for (s32 p = 0; p < 6; ++p)
+                    if (m & (1 << j))
+                        s_compress_lut[m][c++] = (u8)j;
+
+                for (u32 j = c; j < 8; ++j)
+                    s_compress_lut[m][j] = 0;
+
+                s_compress_count[m] = (u8)c;
+            }
+
+            s_cull_impls[e_simd::scalar] = {"scalar", cull_scalar<false>, cull_scalar<true>, cull_multi_scalar,
+                                            cull_node_scalar, raster_row_scalar, project_box_scalar};
+            s_cull_impls[e_simd::sse2] = {"sse2"};
+            s_cull_impls[e_simd::avx2] = {"avx2"};
+            s_cull_impls[e_simd::avx512] = {"avx512"};
+            s_cull_impls[e_simd::neon] = {"neon"};
+
+#if CULL_X86
+            s_cull_impls[e_simd::sse2] = {"sse2", cull_sse2<false>, cull_sse2<true>, cull_multi_sse2, cull_node_sse2,
+                                          raster_row_sse2, project_box_sse2};
+            s_cull_impls[e_simd::avx2] = {"avx2", cull_avx2<false>, cull_avx2<true>, cull_multi_avx2, cull_node_avx2,
+                                          raster_row_sse2, project_box_sse2};
+            s_cull_impls[e_simd::avx512] = {"avx512", cull_avx512<false>, cull_avx512<true>, cull_multi_avx2,
+                                            cull_node_avx2, raster_row_sse2, project_box_sse2};
+#elif CULL_NEON
+            s_cull_impls[e_simd::neon] = {"neon", cull_neon<false>, cull_neon<true>, cull_multi_neon, cull_node_neon,
+                                          raster_row_neon, project_box_scalar};
+#endif
+
+            s_simd_supported = detect_simd_support();
+
+            // fastest first
+            static const simd_level k_preference[] = {e_simd::avx512, e_simd::avx2, e_simd::neon, e_simd::sse2};
+            for (u32 i = 0; i < PEN_ARRAY_SIZE(k_preference); ++i)
+            {
+                if (simd_level_available(k_preference[i]))
                 {
-                    // get distance to plane
-                    // dot product with plane normal and also add plane distance
-                    __m256 dd = _mm256_fmadd_ps(posx, pnx[p], pd[p]);
-                    dd = _mm256_fmadd_ps(posy, pny[p], dd);
-                    dd = _mm256_fmadd_ps(posz, pnz[p], dd);
-
-                    // pos + extent * sign_flip
-                    __m256 dpx = _mm256_fmadd_ps(extx, sfx[p], posx);
-                    __m256 dpy = _mm256_fmadd_ps(exty, sfy[p], posy);
-                    __m256 dpz = _mm256_fmadd_ps(extz, sfz[p], posz);
-
-                    // dot(pos + extent * sign_flip, frust.n[p]);
-                    __m256 r = _mm256_mul_ps(dpx, pnx[p]);
-                    r = _mm256_fmadd_ps(dpy, pny[p], r);
-                    r = _mm256_fmadd_ps(dpz, pnz[p], r);
-
-                    // if(r > -pd) inside = false
-                    __m256 diff = _mm256_sub_ps(r, pd_neg[p]);
-                    diff = _mm256_max_ps(diff, zero);
-                    inside = _mm256_add_ps(diff, inside);
+                    s_simd_level = k_preference[i];
+                    break;
                 }
+            }
 
-                _mm256_store_ps(result, inside);
-                for (u32 j = 0; j < 8; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[7 - j]);
+            return true;
+        }
+
+        void simd_init()
+        {
+            static bool s_initialised = init_simd();
+            (void)s_initialised;
+        }
+
+        bool is_simd_level_supported(simd_level level)
+        {
+            simd_init();
+            return simd_level_available(level);
+        }
+
+        simd_level get_simd_level()
+        {
+            simd_init();
+            return s_simd_level;
+        }
+
+        bool set_simd_level(simd_level level)
+        {
+            if (!is_simd_level_supported(level))
+                return false;
+
+            s_simd_level = level;
+            return true;
+        }
+
+        const c8* get_simd_level_name(simd_level level)
+        {
+            simd_init();
+            return s_cull_impls[level].name;
+        }
+
+        const cull_impl& get_cull_impl()
+        {
+            simd_init();
+            return s_cull_impls[s_simd_level];
+        }
+
+        static void cull_batches(u32 start, u32 end, void* user_data)
+        {
+            cull_job* job = (cull_job*)user_data;
+
+            // parallel_for can hand over the whole range in one call when it runs serially
+            for (u32 b = start; b < end; b += job->batch_size)
+            {
+                u32 count = std::min<u32>(job->batch_size, end - b);
+                job->batch_counts[b / job->batch_size] =
+                    job->func(job->scene, *job->planes, &job->entities_in[b], count, &job->entities_out[b]);
             }
         }
-#endif
-        //
-        // Arm neon simd 128 implementation
-        //
 
-#ifdef __ARM_NEON__
-        void frustum_cull_aabb_simd128(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        static void cull(cull_func func, const ecs_scene* scene, const cull_planes& planes, const u32* entities_in,
+                         u32 count, u32** entities_out, bool parallel)
         {
+            if (count == 0)
+                return;
+
+            // room for every entity, trimmed to what was visible after
+            u32  base = sb_count(*entities_out);
+            u32* out = sb_add(*entities_out, count);
+            u32  written = 0;
+
+            if (!parallel || count < k_cull_parallel_min)
+            {
+                written = func(scene, planes, entities_in, count, out);
+            }
+            else
+            {
+                // each batch culls into its own range of out, then the ranges are packed together
+                u32 batch_counts[k_cull_max_batches];
+                u32 batch_size = std::max<u32>(k_cull_batch_size, (count + k_cull_max_batches - 1) / k_cull_max_batches);
+                u32 num_batches = (count + batch_size - 1) / batch_size;
 
+                cull_job job = {func, scene, &planes, entities_in, out, batch_size, batch_counts};
+                pen::jobs_parallel_for(count, batch_size, cull_batches, &job);
+
+                written = batch_counts[0];
+                for (u32 b = 1; b < num_batches; ++b)
+                {
+                    memmove(&out[written], &out[b * batch_size], batch_counts[b] * sizeof(u32));
+                    written += batch_counts[b];
+                }
+            }
+
+            stb__sbn(*entities_out) = base + written;
         }
 
-        void frustum_cull_sphere_simd128(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        static void cull(cull_func func, const ecs_scene* scene, const camera* cam, const u32* entities_in, u32 count,
+                         u32** entities_out, bool parallel)
         {
+            cull_planes planes;
+            get_cull_planes(cam->camera_frustum, planes);
+            cull(func, scene, planes, entities_in, count, entities_out, parallel);
+        }
 
+        void frustum_cull_aabb_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
+        {
+            cull(cull_scalar<false>, scene, cam, entities_in, sb_count(entities_in), entities_out, false);
         }
-#endif
-        void frustum_cull_simd_init()
+
+        void frustum_cull_sphere_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
         {
+            cull(cull_scalar<true>, scene, cam, entities_in, sb_count(entities_in), entities_out, false);
+        }
+
+        void filter_entities_scalar(const ecs_scene* scene, u32** entities_out)
+        {
+            u32 accept_entities = e_cmp::geometry | e_cmp::material;
+            u32 reject_entities = e_cmp::sub_instance;
+
+            for (u32 i = 0; i < scene->num_entities; ++i)
+            {
+                // entity flags accept
+                if ((scene->entities[i] & accept_entities) != accept_entities)
+                    continue;
+
+                // entity flags reject
+                if (reject_entities)
+                    if (scene->entities[i] & reject_entities)
+                        continue;
 
+                sb_push(*entities_out, i);
+            }
         }
 
         void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
         {
-            frustum_cull_aabb_scalar(scene, cam, entities_in, entities_out);
-            //frustum_cull_aabb_simd256(scene, cam, entities_in, entities_out);
+            frustum_cull_aabb(scene, cam, entities_in, sb_count(entities_in), entities_out);
         }
 
         void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
         {
-            frustum_cull_sphere_scalar(scene, cam, entities_in, entities_out);
-            //frustum_cull_sphere_simd256(scene, cam, entities_in, entities_out);
+            frustum_cull_sphere(scene, cam, entities_in, sb_count(entities_in), entities_out);
+        }
+
+        void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, const u32* entities, u32 count, u32** entities_out)
+        {
+            simd_init();
+            cull(s_cull_impls[s_simd_level].aabb, scene, cam, entities, count, entities_out, true);
         }
-        
+
+        void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, const u32* entities, u32 count,
+                                 u32** entities_out)
+        {
+            simd_init();
+            cull(s_cull_impls[s_simd_level].sphere, scene, cam, entities, count, entities_out, true);
+        }
+
+        void frustum_cull_aabb(const ecs_scene* scene, const frustum& frust, const u32* entities, u32 count,
+                               u32** entities_out)
+        {
+            simd_init();
+
+            cull_planes planes;
+            get_cull_planes(frust, planes);
+            cull(s_cull_impls[s_simd_level].aabb, scene, planes, entities, count, entities_out, true);
+        }
+
+        static void multi_cull_batches(u32 start, u32 end, void* user_data)
+        {
+            multi_cull_job* job = (multi_cull_job*)user_data;
+
+            for (u32 b = start; b < end; b += job->batch_size)
+            {
+                u32 count = std::min<u32>(job->batch_size, end - b);
+                job->func(job->scene, job->planes, job->num_frusta, &job->entities[b], count, &job->masks[b]);
+            }
+        }
+
+        void frustum_cull_aabb_multi(const ecs_scene* scene, const frustum* frusta, u32 num_frusta, const u32* entities,
+                                     u32 count, u64* masks_out)
+        {
+            PEN_ASSERT(num_frusta <= e_cull_limits::max_frusta);
+
+            if (count == 0)
+                return;
+
+            simd_init();
+
+            cull_planes planes[e_cull_limits::max_frusta];
+            for (u32 f = 0; f < num_frusta; ++f)
+                get_cull_planes(frusta[f], planes[f]);
+
+            multi_cull_func func = s_cull_impls[s_simd_level].multi;
+
+            // the cost of an entity grows with the frusta, so batches shrink to keep the work per batch the same
+            u32 work = count * std::max<u32>(num_frusta, 1);
+            if (work < k_cull_parallel_min)
+            {
+                func(scene, planes, num_frusta, entities, count, masks_out);
+                return;
+            }
+
+            u32 batch_size = std::max<u32>(k_cull_batch_size / std::max<u32>(num_frusta, 1), 1024);
+            batch_size = std::max<u32>(batch_size, (count + k_cull_max_batches - 1) / k_cull_max_batches);
+
+            multi_cull_job job = {func, scene, planes, num_frusta, entities, masks_out, batch_size};
+            pen::jobs_parallel_for(count, batch_size, multi_cull_batches, &job);
+        }
+
+        u32 gather_visible_entities(const u32* entities, const u64* masks, u32 count, u64 frusta_bits, u32** entities_out)
+        {
+            if (count == 0)
+                return 0;
+
+            u32  base = sb_count(*entities_out);
+            u32* out = sb_add(*entities_out, count);
+
+            // branchless like cull_scalar, c never passes i
+            u32 c = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                out[c] = entities[i];
+                c += (masks[i] & frusta_bits) == frusta_bits ? 1 : 0;
+            }
+
+            stb__sbn(*entities_out) = base + c;
+            return c;
+        }
+
         void debug_culling()
         {
             // debug culling
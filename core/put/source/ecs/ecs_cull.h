@@ -1,3 +1,5 @@
+#pragma once
+
 #include "types.h"
 #include "camera.h"
 
@@ -8,18 +10,105 @@ namespace put
     namespace ecs
     {
         struct ecs_scene;
+        struct light_clusters;
+
+        namespace e_simd
+        {
+            enum simd_t
+            {
+                scalar,
+                sse2,
+                avx2,
+                avx512,
+                neon,
+                COUNT
+            };
+        }
+        typedef e_simd::simd_t simd_level;
 
-        // run time detect of simd extensions and setup function pointers to the fastest implementation
+        namespace e_cull_limits
+        {
+            enum cull_limits_t
+            {
+                max_frusta = 64 // bits in a frustum_cull_aabb_multi mask
+            };
+        }
+
+        // run time detect of simd extensions and setup function pointers to the fastest implementation, this is called
+        // on first use so calling it up front is optional.
         void simd_init();
-        
+
+        // the implementation frustum_cull_xxx dispatch to. set_simd_level is for testing and benchmarking, it returns
+        // false if the cpu or the build does not support level. all levels give identical results.
+        simd_level get_simd_level();
+        bool       set_simd_level(simd_level level);
+        bool       is_simd_level_supported(simd_level level);
+        const c8*  get_simd_level_name(simd_level level);
+
         // frustum_cull_xxx_scalar versions scalar float cross platform implementations,
         void filter_entities_scalar(const ecs_scene* scene, u32** filtered_entities_out);
         void frustum_cull_aabb_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
         void frustum_cull_sphere_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
 
-        // frustum_cull_xxx functions are replaced by simd where available and fall back to scalar if no simd is available
+        // frustum_cull_xxx functions are replaced by simd where available and fall back to scalar if no simd is available,
+        // large entity lists are split into batches and culled on the job workers. visible entities are appended to
+        // entities_out in the order of entities_in.
         void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
         void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
+
+        // as above for entities which are not in a stretchy buffer
+        void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, const u32* entities, u32 count, u32** entities_out);
+        void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, const u32* entities, u32 count,
+                                 u32** entities_out);
+
+        // as above with planes which don't come from a camera, a plane with a zero normal culls nothing
+        void frustum_cull_aabb(const ecs_scene* scene, const frustum& frust, const u32* entities, u32 count,
+                               u32** entities_out);
+
+        // culls entities against several frusta in one pass over their bounds, so views which cull the same entities
+        // read them once. bit f of masks_out[i] is set when entities[i] is inside frusta[f], the same entities
+        // frustum_cull_aabb would return for that frustum alone. masks_out must hold count entries and num_frusta must
+        // not be more than e_cull_limits::max_frusta.
+        void frustum_cull_aabb_multi(const ecs_scene* scene, const frustum* frusta, u32 num_frusta, const u32* entities,
+                                     u32 count, u64* masks_out);
+
+        // appends entities whose mask has every bit of frusta_bits set to entities_out keeping their order, returns how
+        // many were appended
+        u32 gather_visible_entities(const u32* entities, const u64* masks, u32 count, u64 frusta_bits, u32** entities_out);
+
+        // keeps scene->bvh, a dynamic aabb tree over the bounds of entities with geometry, in step with the scene.
+        // update_scene calls this after the bounds pass, only entities which moved out of their fattened leaf are
+        // reinserted and when most of the tree changes it is rebuilt instead.
+        void update_bvh(ecs_scene* scene);
+
+        // bvh queries append the entities whose bounds intersect to entities_out in tree order, only entities with every
+        // flag in accept and none in reject are returned. the frustum query tests nodes against all planes at once with
+        // simd and returns the same entities frustum_cull_aabb would. rays cover origin + dir * t for t in [0, max_t].
+        void bvh_query_frustum(const ecs_scene* scene, const frustum& frust, u32** entities_out, u64 accept = 0,
+                               u64 reject = 0);
+        void bvh_query_aabb(const ecs_scene* scene, const vec3f& min, const vec3f& max, u32** entities_out, u64 accept = 0,
+                            u64 reject = 0);
+        void bvh_query_sphere(const ecs_scene* scene, const vec3f& pos, f32 radius, u32** entities_out, u64 accept = 0,
+                              u64 reject = 0);
+        void bvh_query_ray(const ecs_scene* scene, const vec3f& origin, const vec3f& dir, f32 max_t, u32** entities_out,
+                           u64 accept = 0, u64 reject = 0);
+
+        // looks up the position only mesh of renderables whose geometry changed, so views can pick occluders without
+        // searching the geometry resources. update_scene calls this after update_renderables.
+        void update_occluders(ecs_scene* scene);
+
+        // software occlusion culling for perspective cameras. the largest of entities which have an occluder mesh are
+        // rasterised into a low resolution depth buffer with 8x8 tiles of farthest depth on top, then the screen bounds
+        // of each entity are tested against the tiles and only the pixels of tiles which are not fully in front of it.
+        // rasterising and testing run on the job workers. entities is compacted in place keeping its order, the number
+        // still visible is returned.
+        u32 occlusion_cull(const ecs_scene* scene, const camera* cam, u32* entities, u32 count);
+
+        // bins the point and spot lights of scene->packed_lights into the clusters of a perspective camera. the cluster
+        // range of each light is found on the job workers then each depth slice is counted and filled on its own worker,
+        // lights are listed in packed order in every cluster. orthographic cameras are not clustered and return false.
+        bool bin_lights(const ecs_scene* scene, const camera* cam, light_clusters& clusters);
+        void free_light_clusters(light_clusters& clusters);
     }
 }
 
@@ -3,6 +3,7 @@
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
 #include "ecs/ecs_editor.h"
+#include "ecs/ecs_cull.h"
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_utilities.h"
 
@@ -559,33 +560,22 @@ namespace put
                         pm = e_select_mode::add;
                     }
 
-                    for (s32 node = 0; node < scene->num_entities; ++node)
+                    frustum select_frustum;
+                    for (s32 i = 0; i < 6; ++i)
                     {
-                        if (!(scene->entities[node] & e_cmp::allocated))
-                            continue;
-
-                        if (!(scene->entities[node] & e_cmp::geometry))
-                            continue;
+                        select_frustum.n[i] = n[i];
+                        select_frustum.p[i] = p[i];
+                    }
 
-                        bool selected = true;
-                        for (s32 i = 0; i < 6; ++i)
-                        {
-                            vec3f& min = scene->bounding_volumes[node].transformed_min_extents;
-                            vec3f& max = scene->bounding_volumes[node].transformed_max_extents;
+                    static u32* s_selected = nullptr;
+                    if (s_selected)
+                        stb__sbn(s_selected) = 0;
 
-                            u32 c = maths::aabb_vs_plane(min, max, p[i], n[i]);
-                            if (c == maths::INFRONT)
-                            {
-                                selected = false;
-                                break;
-                            }
-                        }
+                    bvh_query_frustum(scene, select_frustum, &s_selected, e_cmp::allocated | e_cmp::geometry);
 
-                        if (selected)
-                        {
-                            add_selection(scene, node, e_select_mode::add_multi);
-                        }
-                    }
+                    u32 num_selected = sb_count(s_selected);
+                    for (u32 i = 0; i < num_selected; ++i)
+                        add_selection(scene, s_selected[i], e_select_mode::add_multi);
 
                     sb_clear(scene->selection_list);
                     stb__sbgrow(scene->selection_list, scene->num_entities);
@@ -817,6 +807,8 @@ namespace put
                 memcpy(cmp[node_index], ns.components[i], cmp.size);
             }
 
+            scene->dirty_flags[node_index] = e_dirty::all;
+
             node_state& us = s_editor_nodes[node_index].action_state[e_editor_actions::undo];
             node_state& rs = s_editor_nodes[node_index].action_state[e_editor_actions::redo];
 
@@ -2051,6 +2043,7 @@ namespace put
 
                             f32* f3 = &scene->material_data[si].data[cb_offset];
                             memcpy(f3, f1, tc_size);
+                            scene->dirty_flags[si] |= e_dirty::material;
                         }
                     }
 
@@ -2112,6 +2105,7 @@ namespace put
                     if (ImGui::Button("Reset Root Motion"))
                     {
                         scene->local_matrices[selected_index].create_identity();
+                        scene->dirty_flags[selected_index] |= e_dirty::world_matrix;
                     }
 
                     s32 num_anims = sb_count(scene->anim_controller[selected_index].handles);
@@ -2275,6 +2269,7 @@ namespace put
                     {
                         s32 s = selected_index;
                         scene->world_matrices[s] = mat4::create_identity();
+                        scene->dirty_flags[s] |= e_dirty::world_matrix;
                     }
                 }
                 else
@@ -0,0 +1,227 @@
+#include "ecs_cull.h"
+
+#include "timer.h"
+#include "threads.h"
+#include "ecs_resources.h"
+#include "ecs_scene.h"
+
+#include <algorithm>
+
+using namespace::pen;
+
+namespace put
+{
+    namespace ecs
+    {
+        namespace
+        {
+            // lights per job when finding their cluster ranges
+            const u32 k_light_range_batch = 256;
+
+            struct light_bin_job
+            {
+                const light_set* lights;
+                light_clusters*  clusters;
+                const frustum*   frust;
+                mat4             view_proj;
+                f32              near_plane;
+                f32              far_plane;
+            };
+        } // namespace
+
+        static pen_inline u32 light_cluster_slice(const light_cluster_info& info, f32 depth)
+        {
+            if (depth <= info.depth.x)
+                return 0;
+
+            return std::min<u32>((u32)(log2f(depth / info.depth.x) * info.depth.y), e_light_cluster::grid_z - 1);
+        }
+
+        static pen_inline u32 light_cluster_tile(f32 ndc, u32 num_tiles)
+        {
+            s32 t = (s32)floorf((ndc * 0.5f + 0.5f) * (f32)num_tiles);
+            return (u32)std::min<s32>(std::max<s32>(t, 0), num_tiles - 1);
+        }
+
+        // the clusters a light touches, z0 > z1 for lights outside the frustum. the screen rect is the projected box
+        // around the light's sphere, so it is conservative and matches what the shader finds for any pixel inside it.
+        static void light_cluster_ranges(u32 start, u32 end, void* user_data)
+        {
+            light_bin_job*            job = (light_bin_job*)user_data;
+            const light_cluster_info& info = job->clusters->info;
+            const frustum&            f = *job->frust;
+
+            for (u32 i = start; i < end; ++i)
+            {
+                u8* r = &job->clusters->light_ranges[i * 6];
+                r[4] = 1;
+                r[5] = 0;
+
+                const vec4f& b = job->lights->bounds[job->lights->num_dir + i];
+                vec3f        pos = b.xyz;
+                f32          rad = b.w;
+
+                bool outside = false;
+                for (u32 p = 0; p < 6; ++p)
+                    outside |= dot(f.n[p], pos - f.p[p]) > rad;
+
+                f32 depth = dot(pos, info.depth_plane.xyz) + info.depth_plane.w;
+                if (outside || depth + rad < job->near_plane || depth - rad > job->far_plane)
+                    continue;
+
+                // corners behind the eye can't be projected, the light covers the whole screen
+                vec2f ndc_min = vec2f(-1.0f, -1.0f);
+                vec2f ndc_max = vec2f(1.0f, 1.0f);
+                if (depth - rad > 0.0f)
+                {
+                    ndc_min = vec2f(FLT_MAX, FLT_MAX);
+                    ndc_max = vec2f(-FLT_MAX, -FLT_MAX);
+                    for (u32 c = 0; c < 8; ++c)
+                    {
+                        vec3f corner = pos + vec3f((c & 1) ? rad : -rad, (c & 2) ? rad : -rad, (c & 4) ? rad : -rad);
+                        vec4f cp = job->view_proj.transform_vector(vec4f(corner, 1.0f));
+                        if (cp.w <= 0.0f)
+                        {
+                            ndc_min = vec2f(-1.0f, -1.0f);
+                            ndc_max = vec2f(1.0f, 1.0f);
+                            break;
+                        }
+
+                        vec2f ndc = cp.xy / cp.w;
+                        ndc_min = min_union(ndc_min, ndc);
+                        ndc_max = max_union(ndc_max, ndc);
+                    }
+                }
+
+                r[0] = (u8)light_cluster_tile(ndc_min.x, e_light_cluster::grid_x);
+                r[1] = (u8)light_cluster_tile(ndc_max.x, e_light_cluster::grid_x);
+                r[2] = (u8)light_cluster_tile(ndc_min.y, e_light_cluster::grid_y);
+                r[3] = (u8)light_cluster_tile(ndc_max.y, e_light_cluster::grid_y);
+                r[4] = (u8)light_cluster_slice(info, depth - rad);
+                r[5] = (u8)light_cluster_slice(info, depth + rad);
+            }
+        }
+
+        // depth slices are independent so each is counted and filled on its own worker, first pass counts the lights
+        // of each cluster and the second writes them at the offsets the counts were summed into
+        template <bool fill>
+        static void light_cluster_slices(u32 start, u32 end, void* user_data)
+        {
+            light_bin_job*  job = (light_bin_job*)user_data;
+            light_clusters& lc = *job->clusters;
+
+            static const u32 k_slice_size = e_light_cluster::grid_x * e_light_cluster::grid_y;
+            u32              num_lights = job->lights->num_point + job->lights->num_spot;
+
+            for (u32 z = start; z < end; ++z)
+            {
+                u32* grid = &lc.grid[z * k_slice_size * 2];
+
+                u32 cursor[k_slice_size];
+                for (u32 c = 0; c < k_slice_size; ++c)
+                    cursor[c] = fill ? grid[c * 2] : 0;
+
+                for (u32 i = 0; i < num_lights; ++i)
+                {
+                    const u8* r = &lc.light_ranges[i * 6];
+                    if (z < r[4] || z > r[5])
+                        continue;
+
+                    for (u32 y = r[2]; y <= r[3]; ++y)
+                    {
+                        for (u32 x = r[0]; x <= r[1]; ++x)
+                        {
+                            u32 c = y * e_light_cluster::grid_x + x;
+                            if (fill)
+                                lc.indices[cursor[c]] = job->lights->num_dir + i;
+                            ++cursor[c];
+                        }
+                    }
+                }
+
+                if (!fill)
+                    for (u32 c = 0; c < k_slice_size; ++c)
+                        grid[c * 2 + 1] = cursor[c];
+            }
+        }
+
+        bool bin_lights(const ecs_scene* scene, const camera* cam, light_clusters& clusters)
+        {
+            if (cam->flags & e_camera_flags::orthographic)
+                return false;
+
+            f64 start = pen::get_time_us();
+
+            const light_set& ls = scene->packed_lights;
+            const frustum&   f = cam->camera_frustum;
+
+            // view depth is measured along the frustum from the near plane, the same as the shader
+            vec3f near_centre = (f.corners[0][0] + f.corners[0][1] + f.corners[0][2] + f.corners[0][3]) * 0.25f;
+            vec3f far_centre = (f.corners[1][0] + f.corners[1][1] + f.corners[1][2] + f.corners[1][3]) * 0.25f;
+            vec3f forward = normalised(far_centre - near_centre);
+
+            light_cluster_info& info = clusters.info;
+            info.view_projection = cam->proj * cam->view;
+            info.depth_plane = vec4f(forward, cam->near_plane - dot(forward, near_centre));
+            info.grid = vec4f(e_light_cluster::grid_x, e_light_cluster::grid_y, e_light_cluster::grid_z, ls.num_dir);
+            info.depth = vec4f(cam->near_plane, e_light_cluster::grid_z / log2f(cam->far_plane / cam->near_plane), 0.0f,
+                               0.0f);
+
+            u32 num_lights = ls.num_point + ls.num_spot;
+            if (num_lights > clusters.range_capacity)
+            {
+                clusters.range_capacity = num_lights;
+                clusters.light_ranges = (u8*)pen::memory_realloc(clusters.light_ranges, num_lights * 6);
+            }
+
+            light_bin_job job;
+            job.lights = &ls;
+            job.clusters = &clusters;
+            job.frust = &f;
+            job.view_proj = info.view_projection;
+            job.near_plane = cam->near_plane;
+            job.far_plane = cam->far_plane;
+
+            pen::jobs_parallel_for(num_lights, k_light_range_batch, light_cluster_ranges, &job);
+            pen::jobs_parallel_for(e_light_cluster::grid_z, 1, light_cluster_slices<false>, &job);
+
+            // counts to offsets
+            u32 total = 0;
+            clusters.max_cluster_lights = 0;
+            for (u32 c = 0; c < e_light_cluster::count; ++c)
+            {
+                u32 count = clusters.grid[c * 2 + 1];
+                clusters.grid[c * 2] = total;
+                clusters.max_cluster_lights = std::max<u32>(clusters.max_cluster_lights, count);
+                total += count;
+            }
+
+            if (total > clusters.index_capacity)
+            {
+                clusters.index_capacity = std::max<u32>(total, clusters.index_capacity * 2);
+                clusters.indices = (u32*)pen::memory_realloc(clusters.indices, clusters.index_capacity * sizeof(u32));
+            }
+
+            pen::jobs_parallel_for(e_light_cluster::grid_z, 1, light_cluster_slices<true>, &job);
+
+            clusters.num_indices = total;
+            clusters.num_lights = 0;
+            for (u32 i = 0; i < num_lights; ++i)
+                clusters.num_lights += clusters.light_ranges[i * 6 + 4] <= clusters.light_ranges[i * 6 + 5];
+
+            clusters.ms = (pen::get_time_us() - start) / 1000.0;
+            return true;
+        }
+
+        void free_light_clusters(light_clusters& clusters)
+        {
+            pen::memory_free(clusters.indices);
+            pen::memory_free(clusters.light_ranges);
+            clusters.indices = nullptr;
+            clusters.light_ranges = nullptr;
+            clusters.index_capacity = 0;
+            clusters.range_capacity = 0;
+            clusters.num_indices = 0;
+        }
+    }
+}
@@ -0,0 +1,538 @@
+#include "ecs_cull.h"
+
+#include "timer.h"
+#include "threads.h"
+#include "ecs_resources.h"
+#include "ecs_scene.h"
+#include "ecs_simd.h"
+
+#include <algorithm>
+
+using namespace::pen;
+
+namespace put
+{
+    namespace ecs
+    {
+        namespace
+        {
+            // meshes with more triangles than this cost more to rasterise than they are likely to save
+            const u32 k_max_occluder_mesh_tris = 4096;
+
+            // occluders are the largest visible entities, up to a count and a budget of source triangles
+            const u32 k_max_occluders = 64;
+            const u32 k_max_occluder_tris = 16384;
+            const f32 k_min_occluder_size = 0.05f; // bounding radius / distance
+
+            // triangles are clipped to the near plane and a guard band around the screen, which keeps the edge functions
+            // small enough for float precision. a clipped triangle can become several, 2 are reserved per source triangle
+            // and anything past that is dropped, occluding less is always safe.
+            const f32 k_occlusion_guard_band = 4.0f;
+            const u32 k_occluder_tris_per_source = 2;
+            const u32 k_max_clip_verts = 16;
+
+            // horizontal strips of the buffer rasterised in parallel, each covers whole rows of tiles
+            const u32 k_occlusion_bands = 8;
+            const u32 k_occlusion_band_rows = k_occlusion_height / k_occlusion_bands;
+
+            const u32 k_occluder_setup_batch = 4;
+            const u32 k_occlusion_test_batch = 256;
+
+            struct occluder
+            {
+                u32 entity;
+                f32 size;
+                u32 first_tri; // into occlusion_buffer::tris
+                u32 num_tris;
+            };
+
+            // per thread as views are culled in parallel
+            struct occlusion_buffer
+            {
+                f32*          depth = nullptr;
+                f32*          hiz = nullptr; // farthest depth of each tile
+                occluder*     occluders = nullptr;
+                occluder_tri* tris = nullptr;
+                u32           tri_capacity = 0;
+                u8*           visible = nullptr;
+                u32           visible_capacity = 0;
+            };
+
+            struct occlusion_job
+            {
+                const ecs_scene*  scene;
+                const cull_impl*  impl;
+                occlusion_buffer* buffer;
+                mat4              view_proj;
+                f32               vp[16]; // rows of view_proj
+                f32               near_w;
+                u32               num_occluders;
+                const u32*        entities;
+            };
+
+            struct clip_vertex
+            {
+                f32 x, y, w;
+            };
+        } // namespace
+
+        static pen_inline u32 mesh_index(const pmm_renderable* mesh, u32 i)
+        {
+            if (mesh->index_type == PEN_FORMAT_R16_UINT)
+                return ((const u16*)mesh->cpu_index_buffer)[i];
+
+            return ((const u32*)mesh->cpu_index_buffer)[i];
+        }
+
+        // clip space distance to the near plane then the left, right, bottom and top of the guard band, inside is >= 0
+        static pen_inline f32 occlusion_clip_distance(const clip_vertex& v, u32 plane, f32 near_w)
+        {
+            const f32 g = k_occlusion_guard_band;
+            switch (plane)
+            {
+                case 0:
+                    return v.w - near_w;
+                case 1:
+                    return v.x + g * v.w;
+                case 2:
+                    return g * v.w - v.x;
+                case 3:
+                    return v.y + g * v.w;
+                default:
+                    return g * v.w - v.y;
+            }
+        }
+
+        static pen_inline u32 occlusion_outcode(const clip_vertex& v, f32 near_w)
+        {
+            u32 code = 0;
+            for (u32 p = 0; p < 5; ++p)
+                if (occlusion_clip_distance(v, p, near_w) < 0.0f)
+                    code |= 1 << p;
+
+            return code;
+        }
+
+        // projects a clipped triangle to pixels and sets up its edge functions and depth plane, returns false if it can't
+        // cover any pixels
+        static bool occlusion_setup_tri(const clip_vertex& v0, const clip_vertex& v1, const clip_vertex& v2,
+                                        occluder_tri& t)
+        {
+            const f32 hw = (f32)k_occlusion_width * 0.5f;
+            const f32 hh = (f32)k_occlusion_height * 0.5f;
+
+            const clip_vertex* v[3] = {&v0, &v1, &v2};
+
+            f32 x[3], y[3], z[3];
+            for (u32 i = 0; i < 3; ++i)
+            {
+                f32 rw = 1.0f / v[i]->w;
+                x[i] = v[i]->x * rw * hw + hw;
+                y[i] = v[i]->y * rw * hh + hh;
+                z[i] = rw;
+            }
+
+            // wind so covered pixels are on the positive side of every edge
+            f32 area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+            if (area < 0.0f)
+            {
+                std::swap(x[1], x[2]);
+                std::swap(y[1], y[2]);
+                std::swap(z[1], z[2]);
+                area = -area;
+            }
+
+            if (!(area > 0.0f))
+                return false;
+
+            f32 x0 = std::max<f32>(floorf(std::min<f32>(x[0], std::min<f32>(x[1], x[2]))), 0.0f);
+            f32 x1 = std::min<f32>(ceilf(std::max<f32>(x[0], std::max<f32>(x[1], x[2]))), (f32)k_occlusion_width);
+            f32 y0 = std::max<f32>(floorf(std::min<f32>(y[0], std::min<f32>(y[1], y[2]))), 0.0f);
+            f32 y1 = std::min<f32>(ceilf(std::max<f32>(y[0], std::max<f32>(y[1], y[2]))), (f32)k_occlusion_height);
+            if (!(x0 < x1) || !(y0 < y1))
+                return false;
+
+            t.x0 = (u32)x0 & ~3u;
+            t.x1 = (u32)x1;
+            t.y0 = (u32)y0;
+            t.y1 = (u32)y1;
+
+            for (u32 e = 0; e < 3; ++e)
+            {
+                u32 n = (e + 1) % 3;
+                t.ea[e] = y[e] - y[n];
+                t.eb[e] = x[n] - x[e];
+                t.ec[e] = -(t.ea[e] * x[e] + t.eb[e] * y[e]);
+            }
+
+            // 1 / w is linear in screen space, it is shifted by half a pixel of slope so the value at a pixel centre is
+            // the farthest the triangle gets anywhere in that pixel
+            f32 rcp_area = 1.0f / area;
+            t.za = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) * rcp_area;
+            t.zb = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) * rcp_area;
+            t.zc = z[0] - t.za * x[0] - t.zb * y[0] - (fabsf(t.za) + fabsf(t.zb)) * 0.5f;
+
+            return true;
+        }
+
+        // clips a clip space triangle to the near plane and guard band and sets up the pieces, returns how many of
+        // max_out were written
+        static u32 occlusion_clip_tri(const clip_vertex& a, const clip_vertex& b, const clip_vertex& c, f32 near_w,
+                                      occluder_tri* out, u32 max_out)
+        {
+            u32 ca = occlusion_outcode(a, near_w);
+            u32 cb = occlusion_outcode(b, near_w);
+            u32 cc = occlusion_outcode(c, near_w);
+
+            if (ca & cb & cc)
+                return 0;
+
+            if (!(ca | cb | cc))
+                return occlusion_setup_tri(a, b, c, out[0]) ? 1 : 0;
+
+            // sutherland hodgman against only the planes the triangle crosses
+            clip_vertex poly[2][k_max_clip_verts];
+            poly[0][0] = a;
+            poly[0][1] = b;
+            poly[0][2] = c;
+
+            u32 crossed = ca | cb | cc;
+            u32 n = 3;
+            u32 cur = 0;
+            for (u32 p = 0; p < 5 && n >= 3; ++p)
+            {
+                if (!(crossed & (1 << p)))
+                    continue;
+
+                const clip_vertex* in = poly[cur];
+                clip_vertex*       res = poly[cur ^ 1];
+
+                u32 m = 0;
+                for (u32 i = 0; i < n && m + 2 <= k_max_clip_verts; ++i)
+                {
+                    const clip_vertex& v0 = in[i];
+                    const clip_vertex& v1 = in[(i + 1) % n];
+
+                    f32 d0 = occlusion_clip_distance(v0, p, near_w);
+                    f32 d1 = occlusion_clip_distance(v1, p, near_w);
+
+                    if (d0 >= 0.0f)
+                        res[m++] = v0;
+
+                    if ((d0 >= 0.0f) != (d1 >= 0.0f))
+                    {
+                        f32 t = d0 / (d0 - d1);
+                        res[m++] = {v0.x + (v1.x - v0.x) * t, v0.y + (v1.y - v0.y) * t, v0.w + (v1.w - v0.w) * t};
+                    }
+                }
+
+                n = m;
+                cur ^= 1;
+            }
+
+            // fan
+            u32 count = 0;
+            for (u32 i = 1; i + 1 < n && count < max_out; ++i)
+                count += occlusion_setup_tri(poly[cur][0], poly[cur][i], poly[cur][i + 1], out[count]) ? 1 : 0;
+
+            return count;
+        }
+
+        static void occlusion_setup_occluders(u32 start, u32 end, void* user_data)
+        {
+            occlusion_job*   job = (occlusion_job*)user_data;
+            const ecs_scene* scene = job->scene;
+
+            // clip space vertices of the current mesh
+            static thread_local clip_vertex* s_clip = nullptr;
+            static thread_local u32          s_clip_capacity = 0;
+
+            for (u32 o = start; o < end; ++o)
+            {
+                occluder&             oc = job->buffer->occluders[o];
+                const pmm_renderable* mesh = scene->occluders.mesh[oc.entity];
+
+                if (s_clip_capacity < mesh->num_vertices)
+                {
+                    s_clip_capacity = mesh->num_vertices;
+                    s_clip = (clip_vertex*)pen::memory_realloc(s_clip, s_clip_capacity * sizeof(clip_vertex));
+                }
+
+                // only x, y and w are needed, depth is 1 / w
+                mat4  wvp = job->view_proj * scene->world_matrices[oc.entity];
+                vec4f rx = wvp.get_row(0);
+                vec4f ry = wvp.get_row(1);
+                vec4f rw = wvp.get_row(3);
+
+                const u8* vb = (const u8*)mesh->cpu_vertex_buffer;
+                for (u32 i = 0; i < mesh->num_vertices; ++i, vb += mesh->vertex_size)
+                {
+                    const f32* p = (const f32*)vb;
+                    s_clip[i].x = rx.x * p[0] + rx.y * p[1] + rx.z * p[2] + rx.w;
+                    s_clip[i].y = ry.x * p[0] + ry.y * p[1] + ry.z * p[2] + ry.w;
+                    s_clip[i].w = rw.x * p[0] + rw.y * p[1] + rw.z * p[2] + rw.w;
+                }
+
+                occluder_tri* out = &job->buffer->tris[oc.first_tri];
+                u32           max_tris = mesh->num_indices / 3 * k_occluder_tris_per_source;
+                u32           c = 0;
+                for (u32 i = 0; i + 3 <= mesh->num_indices && c < max_tris; i += 3)
+                {
+                    const clip_vertex& a = s_clip[mesh_index(mesh, i)];
+                    const clip_vertex& b = s_clip[mesh_index(mesh, i + 1)];
+                    const clip_vertex& v = s_clip[mesh_index(mesh, i + 2)];
+                    c += occlusion_clip_tri(a, b, v, job->near_w, &out[c], max_tris - c);
+                }
+
+                oc.num_tris = c;
+            }
+        }
+
+        static void occlusion_raster_bands(u32 start, u32 end, void* user_data)
+        {
+            occlusion_job*    job = (occlusion_job*)user_data;
+            occlusion_buffer* ob = job->buffer;
+            raster_row_func   raster_row = job->impl->raster_row;
+
+            for (u32 b = start; b < end; ++b)
+            {
+                u32  y0 = b * k_occlusion_band_rows;
+                u32  y1 = y0 + k_occlusion_band_rows;
+                f32* depth = ob->depth;
+
+                pen::memory_zero(&depth[y0 * k_occlusion_width], k_occlusion_band_rows * k_occlusion_width * sizeof(f32));
+
+                for (u32 o = 0; o < job->num_occluders; ++o)
+                {
+                    const occluder& oc = ob->occluders[o];
+                    for (u32 i = 0; i < oc.num_tris; ++i)
+                    {
+                        const occluder_tri& t = ob->tris[oc.first_tri + i];
+
+                        u32 ty1 = std::min<u32>(t.y1, y1);
+                        for (u32 y = std::max<u32>(t.y0, y0); y < ty1; ++y)
+                            raster_row(&depth[y * k_occlusion_width], t, y, t.x0, t.x1);
+                    }
+                }
+
+                // farthest depth of each tile
+                for (u32 ty = y0 / k_occlusion_tile; ty < y1 / k_occlusion_tile; ++ty)
+                {
+                    for (u32 tx = 0; tx < k_occlusion_tiles_x; ++tx)
+                    {
+                        const f32* tile = &depth[ty * k_occlusion_tile * k_occlusion_width + tx * k_occlusion_tile];
+
+                        f32 farthest = FLT_MAX;
+                        for (u32 y = 0; y < k_occlusion_tile; ++y)
+                            for (u32 x = 0; x < k_occlusion_tile; ++x)
+                                farthest = std::min<f32>(farthest, tile[y * k_occlusion_width + x]);
+
+                        ob->hiz[ty * k_occlusion_tiles_x + tx] = farthest;
+                    }
+                }
+            }
+        }
+
+        // an entity is occluded when every pixel its screen bounds touch has an occluder strictly nearer than the nearest
+        // corner of its aabb, tiles whose farthest depth is nearer than that are passed without reading their pixels
+        static bool occlusion_test(const occlusion_job* job, u32 e)
+        {
+            const ecs_scene* scene = job->scene;
+
+            // the master's bounds don't cover its instances
+            if (scene->entities[e] & e_cmp::master_instance)
+                return true;
+
+            // crossing the near plane
+            occludee_rect r;
+            const f32*    pe = (const f32*)scene->pos_extent.data + e * k_pos_extent_stride;
+            if (!job->impl->project_box(job->vp, pe, job->near_w, r))
+                return true;
+
+            // off screen is left to the frustum cull
+            f32 fx0 = std::max<f32>(floorf(r.min_x), 0.0f);
+            f32 fx1 = std::min<f32>(ceilf(r.max_x), (f32)k_occlusion_width);
+            f32 fy0 = std::max<f32>(floorf(r.min_y), 0.0f);
+            f32 fy1 = std::min<f32>(ceilf(r.max_y), (f32)k_occlusion_height);
+            if (!(fx0 < fx1) || !(fy0 < fy1))
+                return true;
+
+            u32 x0 = (u32)fx0;
+            u32 x1 = (u32)fx1;
+            u32 y0 = (u32)fy0;
+            u32 y1 = (u32)fy1;
+
+            const occlusion_buffer* ob = job->buffer;
+            const u32               k = k_occlusion_tile;
+
+            for (u32 ty = y0 / k; ty <= (y1 - 1) / k; ++ty)
+            {
+                for (u32 tx = x0 / k; tx <= (x1 - 1) / k; ++tx)
+                {
+                    if (ob->hiz[ty * k_occlusion_tiles_x + tx] > r.depth)
+                        continue;
+
+                    u32 py1 = std::min<u32>(y1, (ty + 1) * k);
+                    u32 px0 = std::max<u32>(x0, tx * k);
+                    u32 px1 = std::min<u32>(x1, (tx + 1) * k);
+                    for (u32 y = std::max<u32>(y0, ty * k); y < py1; ++y)
+                        for (u32 x = px0; x < px1; ++x)
+                            if (ob->depth[y * k_occlusion_width + x] <= r.depth)
+                                return true;
+                }
+            }
+
+            return false;
+        }
+
+        static void occlusion_test_entities(u32 start, u32 end, void* user_data)
+        {
+            occlusion_job* job = (occlusion_job*)user_data;
+            for (u32 i = start; i < end; ++i)
+                job->buffer->visible[i] = occlusion_test(job, job->entities[i]) ? 1 : 0;
+        }
+
+        static bool occluder_larger(const occluder& a, const occluder& b)
+        {
+            return a.size > b.size;
+        }
+
+        void update_occluders(ecs_scene* scene)
+        {
+            occluder_set& os = scene->occluders;
+            if (os.capacity < scene->soa_size)
+            {
+                u32 cap = scene->soa_size;
+                os.mesh = (const pmm_renderable**)pen::memory_realloc(os.mesh, cap * sizeof(pmm_renderable*));
+                os.id_geometry = (hash_id*)pen::memory_realloc(os.id_geometry, cap * sizeof(hash_id));
+                pen::memory_zero(&os.mesh[os.capacity], (cap - os.capacity) * sizeof(pmm_renderable*));
+                pen::memory_zero(&os.id_geometry[os.capacity], (cap - os.capacity) * sizeof(hash_id));
+                os.capacity = cap;
+            }
+
+            const renderable_set& rs = scene->renderables;
+            for (u32 i = 0; i < rs.count; ++i)
+            {
+                u32     e = rs.list[i];
+                hash_id id = scene->id_geometry[e];
+                if (id == os.id_geometry[e])
+                    continue;
+
+                os.id_geometry[e] = id;
+                os.mesh[e] = nullptr;
+
+                // skinned meshes don't stay in their bind pose
+                geometry_resource* gr = get_geometry_resource(id);
+                if (!gr || gr->p_skin)
+                    continue;
+
+                const pmm_renderable& r = gr->renderable[e_pmm_renderable::position_only];
+                if (!r.cpu_vertex_buffer || !r.cpu_index_buffer || r.num_indices / 3 > k_max_occluder_mesh_tris)
+                    continue;
+
+                os.mesh[e] = &r;
+            }
+        }
+
+        u32 occlusion_cull(const ecs_scene* scene, const camera* cam, u32* entities, u32 count)
+        {
+            // depth is 1 / w, which is the same everywhere with an orthographic projection
+            if (count == 0 || !scene->occluders.mesh || (cam->flags & e_camera_flags::orthographic))
+                return count;
+
+            static thread_local occlusion_buffer s_buffer;
+            occlusion_buffer&                    ob = s_buffer;
+            if (!ob.depth)
+            {
+                ob.depth = (f32*)pen::memory_alloc_align(k_occlusion_width * k_occlusion_height * sizeof(f32), 16);
+                ob.hiz = (f32*)pen::memory_alloc(k_occlusion_tiles_x * k_occlusion_tiles_y * sizeof(f32));
+            }
+
+            occlusion_job job;
+            job.scene = scene;
+            job.impl = &get_cull_impl();
+            job.buffer = &ob;
+            job.view_proj = cam->proj * cam->view;
+            job.near_w = cam->near_plane;
+            job.num_occluders = 0;
+            job.entities = entities;
+
+            for (u32 r = 0; r < 4; ++r)
+            {
+                vec4f row = job.view_proj.get_row(r);
+                job.vp[r * 4 + 0] = row.x;
+                job.vp[r * 4 + 1] = row.y;
+                job.vp[r * 4 + 2] = row.z;
+                job.vp[r * 4 + 3] = row.w;
+            }
+
+            // visible entities with an occluder mesh which are big enough on screen
+            if (ob.occluders)
+                stb__sbn(ob.occluders) = 0;
+
+            const f32* pos_extent = (const f32*)scene->pos_extent.data;
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 e = entities[i];
+                if (!scene->occluders.mesh[e] || (scene->entities[e] & (e_cmp::master_instance | e_cmp::skinned)))
+                    continue;
+
+                const f32* pe = pos_extent + e * k_pos_extent_stride;
+                f32        w = job.vp[12] * pe[0] + job.vp[13] * pe[1] + job.vp[14] * pe[2] + job.vp[15];
+                f32        size = pe[7] / std::max<f32>(w, job.near_w);
+                if (size < k_min_occluder_size)
+                    continue;
+
+                occluder oc = {e, size, 0, 0};
+                sb_push(ob.occluders, oc);
+            }
+
+            // the largest first, within the triangle budget
+            u32 num_candidates = sb_count(ob.occluders);
+            std::sort(ob.occluders, ob.occluders + num_candidates, occluder_larger);
+
+            u32 num_tris = 0;
+            for (u32 i = 0; i < num_candidates && job.num_occluders < k_max_occluders; ++i)
+            {
+                occluder oc = ob.occluders[i];
+                u32      tris = scene->occluders.mesh[oc.entity]->num_indices / 3;
+                if (num_tris + tris > k_max_occluder_tris)
+                    continue;
+
+                oc.first_tri = num_tris * k_occluder_tris_per_source;
+                ob.occluders[job.num_occluders++] = oc;
+                num_tris += tris;
+            }
+
+            if (job.num_occluders == 0)
+                return count;
+
+            u32 tri_capacity = num_tris * k_occluder_tris_per_source;
+            if (ob.tri_capacity < tri_capacity)
+            {
+                ob.tris = (occluder_tri*)pen::memory_realloc(ob.tris, tri_capacity * sizeof(occluder_tri));
+                ob.tri_capacity = tri_capacity;
+            }
+
+            if (ob.visible_capacity < count)
+            {
+                ob.visible = (u8*)pen::memory_realloc(ob.visible, count);
+                ob.visible_capacity = count;
+            }
+
+            // occluders to screen space triangles, rasterise bands of the buffer, then test every entity
+            pen::jobs_parallel_for(job.num_occluders, k_occluder_setup_batch, occlusion_setup_occluders, &job);
+            pen::jobs_parallel_for(k_occlusion_bands, 1, occlusion_raster_bands, &job);
+            pen::jobs_parallel_for(count, k_occlusion_test_batch, occlusion_test_entities, &job);
+
+            u32 c = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                entities[c] = entities[i];
+                c += job.buffer->visible[i];
+            }
+
+            return c;
+        }
+    }
+}
@@ -2,6 +2,7 @@
 // Copyright 2014 - 2019 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
+#include "ecs/ecs_anim.h"
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_utilities.h"
 
@@ -32,6 +33,9 @@ namespace
     // constants
     static const u32 k_matrix_floats = 16;
     static const u32 k_extent_floats = 3;
+    static const u32 k_pma_clip_version = 3; // compressed by optimise_pma, tracks written field by field
+    static const u32 k_pma_version = 3;      // the latest version read_pma understands
+    static const u32 k_pma_track_size = 40;  // bytes of an anim_track in a pma
 
     namespace e_pmm_transform
     {
@@ -118,15 +122,13 @@ namespace
     std::vector<material_resource*> s_material_resources;
     std::vector<animation_resource> s_animation_resources;
 
-    bool parse_pmm_contents(const c8* filename, pmm_contents& contents)
+    // reads a pmm and its table of contents without logging, so it can be called from any thread
+    bool read_pmm_contents(const c8* filename, pmm_contents& contents)
     {
         // read in file from disk
         pen_error err = pen::filesystem_read_file_to_buffer(filename, &contents.file_data, contents.file_size);
         if (err != PEN_ERR_OK || contents.file_size == 0)
-        {
-            dev_ui::log_level(dev_ui::console_level::error, "[error] load pmm - failed to find file: %s", filename);
             return false;
-        }
 
         // start reading file
         const u32* p_u32reader = (u32*)contents.file_data;
@@ -161,6 +163,15 @@ namespace
         return true;
     }
 
+    bool parse_pmm_contents(const c8* filename, pmm_contents& contents)
+    {
+        if (read_pmm_contents(filename, contents))
+            return true;
+
+        dev_ui::log_level(dev_ui::console_level::error, "[error] load pmm - failed to find file: %s", filename);
+        return false;
+    }
+
     bool parse_pmm_geometry(pmm_contents& contents, std::vector<pmm_geometry>& geom)
     {
         // load geometry resources
@@ -248,17 +259,31 @@ namespace
         return true;
     }
 
-    void load_pmm_geometry(const c8* filename, pmm_contents& contents)
+    // frees the decoded buffers of geometry which is not made into a resource
+    void free_pmm_geometry_data(pmm_geometry& gg)
     {
-        std::vector<pmm_geometry> geom;
-        parse_pmm_geometry(contents, geom);
+        for (pmm_submesh& sm : gg.submeshes)
+        {
+            pen::memory_free(sm.joint_data);
+            pen::memory_free(sm.pos_data);
+            pen::memory_free(sm.vertex_data);
+            pen::memory_free(sm.pos_index_data);
+            pen::memory_free(sm.index_data);
+        }
 
-        for (u32 g = 0; g < contents.num_geometry; ++g)
+        gg.submeshes.clear();
+    }
+
+    // makes geometry resources and their gpu buffers from decoded geometry, geometry which already exists is freed
+    void create_pmm_geometry_resources(const c8* filename, const std::vector<Str>& geometry_names,
+                                       std::vector<pmm_geometry>& geom)
+    {
+        for (u32 g = 0; g < geom.size(); ++g)
         {
             // generate hash
             pmm_geometry& gg = geom[g];
 
-            const c8*        gname = contents.geometry_names[g].c_str();
+            const c8*        gname = geometry_names[g].c_str();
             pen::hash_murmur hm;
             hm.begin(0);
             hm.add(filename, pen::string_length(filename));
@@ -266,9 +291,16 @@ namespace
             hash_id geom_hash = hm.end();
 
             // check for existing
-            for (s32 g = 0; g < s_geometry_resources.size(); ++g)
-                if (geom_hash == s_geometry_resources[g]->geom_hash)
-                    return;
+            bool exists = false;
+            for (s32 r = 0; r < s_geometry_resources.size(); ++r)
+                if (geom_hash == s_geometry_resources[r]->geom_hash)
+                    exists = true;
+
+            if (exists)
+            {
+                free_pmm_geometry_data(gg);
+                continue;
+            }
 
             for (u32 submesh = 0; submesh < geom[g].submeshes.size(); ++submesh)
             {
@@ -298,13 +330,18 @@ namespace
                 // assign skinning
                 if (sm.skinned)
                 {
+                    // bone palettes are built per scene, the skin only keeps the bind pose of each joint
+                    u32 num_joints = sm.num_joint_floats / k_matrix_floats;
+
                     p_geometry->p_skin = (cmp_skin*)pen::memory_alloc(sizeof(cmp_skin));
-                    p_geometry->p_skin->bone_cbuffer = PEN_INVALID_HANDLE;
                     p_geometry->p_skin->bind_shape_matrix = sm.bind_shape_matrix;
-                    p_geometry->p_skin->num_joints = sm.num_joint_floats / k_matrix_floats;
-                    memset(p_geometry->p_skin->joint_bind_matrices, 0x0, sizeof(p_geometry->p_skin->joint_bind_matrices));
-                    memcpy(p_geometry->p_skin->joint_bind_matrices, sm.joint_data, sm.joint_data_size);
+                    p_geometry->p_skin->num_joints = num_joints;
+                    p_geometry->p_skin->joint_bind_matrices = (mat4*)pen::memory_alloc(sizeof(mat4) * num_joints);
+                    memcpy(p_geometry->p_skin->joint_bind_matrices, sm.joint_data, sizeof(mat4) * num_joints);
                 }
+
+                pen::memory_free(sm.joint_data);
+                sm.joint_data = nullptr;
                 
                 pmm_renderable& vr = p_geometry->renderable[e_pmm_renderable::full_vertex_buffer];
                 pmm_renderable& pr = p_geometry->renderable[e_pmm_renderable::position_only];
@@ -350,6 +387,13 @@ namespace
         }
     }
 
+    void load_pmm_geometry(const c8* filename, pmm_contents& contents)
+    {
+        std::vector<pmm_geometry> geom;
+        parse_pmm_geometry(contents, geom);
+        create_pmm_geometry_resources(filename, contents.geometry_names, geom);
+    }
+
     void load_material_resource(const c8* filename, const c8* material_name, const void* data)
     {
         pen::hash_murmur hm;
@@ -968,6 +1012,7 @@ namespace put
             scene->geometry_names[node_index] = gr->geometry_name;
             scene->id_geometry[node_index] = gr->hash;
             scene->entities[node_index] |= e_cmp::geometry;
+            scene->dirty_flags[node_index] = e_dirty::all;
 
             if (gr->p_skin)
                 scene->entities[node_index] |= e_cmp::skinned;
@@ -1036,6 +1081,7 @@ namespace put
             bcp.data = nullptr;
 
             scene->materials[node_index].material_cbuffer = pen::renderer_create_buffer(bcp);
+            scene->dirty_flags[node_index] |= e_dirty::material;
         }
 
         void instantiate_model_cbuffer(ecs_scene* scene, s32 node_index)
@@ -1048,6 +1094,7 @@ namespace put
             bcp.data = nullptr;
 
             scene->cbuffer[node_index] = pen::renderer_create_buffer(bcp);
+            scene->dirty_flags[node_index] |= e_dirty::draw_call;
         }
 
         void instantiate_model_pre_skin(ecs_scene* scene, s32 node_index)
@@ -1100,6 +1147,7 @@ namespace put
                 build_heirarchy_node_list(scene, node_index, joint_indices);
 
                 controller.joints_offset = -1;
+                controller.bone_offset = -1;
                 for (s32 jj = 0; jj < joint_indices.size(); ++jj)
                 {
                     s32 jnode = joint_indices[jj];
@@ -1310,6 +1358,7 @@ namespace put
             }
 
             instantiate_material_cbuffer(scene, node_index, cbuffer_size);
+            scene->dirty_flags[node_index] |= e_dirty::material;
 
             // material samplers
             if (!(scene->state_flags[node_index] & e_state::samplers_initialised))
@@ -1359,51 +1408,488 @@ namespace put
             }
         }
 
-        anim_handle load_pma(const c8* filename)
+        void build_anim_key_lookup(soa_anim& soa)
         {
-            Str pd = put::dev_ui::get_program_preference_filename("project_dir");
+            for (u32 c = 0; c < soa.num_channels; ++c)
+            {
+                anim_channel& channel = soa.channels[c];
+                u32           num_frames = channel.num_frames;
+                if (num_frames == 0)
+                    continue;
+
+                f32 first = soa.info[0][c].time;
+                f32 last = soa.info[num_frames - 1][c].time;
+
+                delete[] channel.key_lookup;
+                channel.key_start = first;
+                channel.key_scale = last > first ? (f32)num_frames / (last - first) : 0.0f;
+                channel.key_lookup = new u32[num_frames];
+
+                // the last key in an earlier bucket, found with the same sums as the lookup so rounding can't skip a key
+                u32 k = 0;
+                for (u32 b = 0; b < num_frames; ++b)
+                {
+                    while (k + 1 < num_frames && anim_key_bucket(channel, soa.info[k + 1][c].time) < b)
+                        ++k;
 
-            Str stipped_filename = pen::str_replace_string(filename, pd.c_str(), "");
+                    channel.key_lookup[b] = k;
+                }
+            }
+        }
 
-            hash_id filename_hash = PEN_HASH(stipped_filename.c_str());
+        // v quantised to a u16 fraction of [base, base + extent]
+        static u16 quantise_anim_value(f32 v, f32 base, f32 extent)
+        {
+            if (!(extent > 0.0f))
+                return 0;
 
-            // search for existing
-            s32 num_anims = s_animation_resources.size();
-            for (s32 i = 0; i < num_anims; ++i)
+            f32 f = (v - base) / extent * 65535.0f + 0.5f;
+            return (u16)std::min<f32>(std::max<f32>(f, 0.0f), 65535.0f);
+        }
+
+        // smallest three, the largest component is made positive by negating the quaternion then dropped and its index
+        // kept in the top bits of the first two components
+        static void encode_anim_quat(const f32* q, u16* v)
+        {
+            u32 largest = 0;
+            for (u32 i = 1; i < 4; ++i)
+                if (fabs(q[i]) > fabs(q[largest]))
+                    largest = i;
+
+            f32 len = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+            f32 scale = len > 0.0f ? (q[largest] < 0.0f ? -1.0f : 1.0f) / len : 0.0f;
+
+            u32 j = 0;
+            for (u32 i = 0; i < 4; ++i)
+            {
+                if (i == largest)
+                    continue;
+
+                f32 f = (q[i] * scale + 0.70710678f) / 1.41421356f * 32767.0f + 0.5f;
+                v[j++] = (u16)std::min<f32>(std::max<f32>(f, 0.0f), 32767.0f);
+            }
+
+            v[0] |= (largest & 1) << 15;
+            v[1] |= (largest >> 1) << 15;
+        }
+
+        // angle in radians between the rotations of 2 quaternions which need not be normalised, from the chord between
+        // them since acos of their dot product loses small angles to float precision
+        static f32 anim_quat_angle(const f32* a, const f32* b)
+        {
+            f32 la = sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2] + a[3] * a[3]);
+            f32 lb = sqrtf(b[0] * b[0] + b[1] * b[1] + b[2] * b[2] + b[3] * b[3]);
+            if (!(la > 0.0f) || !(lb > 0.0f))
+                return 0.0f;
+
+            f32 d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+            f32 sb = d < 0.0f ? -1.0f / lb : 1.0f / lb;
+
+            f32 chord = 0.0f;
+            for (u32 i = 0; i < 4; ++i)
+            {
+                f32 c = a[i] / la - b[i] * sb;
+                chord += c * c;
+            }
+
+            return 4.0f * asinf(std::min<f32>(sqrtf(chord) * 0.5f, 1.0f));
+        }
+
+        struct anim_track_source
+        {
+            const soa_anim* soa;
+            u32             channel;
+            u32             num_frames;
+            u32             elements[4]; // into the channel data of each frame
+            u32             num_elements;
+
+            f32 value(u32 frame, u32 i) const
+            {
+                return soa->data[frame][soa->info[frame][channel].offset + elements[i]];
+            }
+
+            f32 time(u32 frame) const
+            {
+                return soa->info[frame][channel].time;
+            }
+        };
+
+        // how far decoded key i is from its source when interpolated from decoded keys a and b
+        static f32 anim_key_error(const anim_track_source& src, const u16* times, const f32* decoded, u32 a, u32 b,
+                                  u32 i, bool quaternion)
+        {
+            f32 t = times[b] > times[a] ? (f32)(times[i] - times[a]) / (f32)(times[b] - times[a]) : 0.0f;
+
+            const f32* ka = &decoded[a * 4];
+            const f32* kb = &decoded[b * 4];
+            if (quaternion)
             {
-                if (s_animation_resources[i].id_name == filename_hash)
+                f32 q[4];
+                f32 s[4];
+                slerp_keys(ka, kb, &t, q, 1, 1);
+                for (u32 j = 0; j < 4; ++j)
+                    s[j] = src.value(i, j);
+
+                return anim_quat_angle(q, s);
+            }
+
+            f32 error = 0.0f;
+            for (u32 j = 0; j < src.num_elements; ++j)
+                error = std::max<f32>(error, fabs(ka[j] + (kb[j] - ka[j]) * t - src.value(i, j)));
+
+            return error;
+        }
+
+        // appends a track, keys within error of the first become a constant track and keys which interpolating the kept
+        // keys either side of them reproduces within error are dropped
+        static void add_anim_track(const anim_track_source& src, u32 anim_flags, f32 length, f32 error, bool quaternion,
+                                   anim_track** tracks, u16** keys)
+        {
+            u32 n = src.num_frames;
+            PEN_ASSERT(n <= 65535);
+
+            anim_track track;
+            memset(&track, 0x0, sizeof(anim_track));
+            track.flags = quaternion ? e_anim_track::quaternion : 0;
+            track.anim_flags = (u8)anim_flags;
+            track.num_components = quaternion ? 0 : (u8)src.num_elements;
+
+            // range of the values and whether they ever leave the first key
+            f32  vmin[4];
+            f32  vmax[4];
+            bool constant = true;
+            for (u32 i = 0; i < src.num_elements; ++i)
+                vmin[i] = vmax[i] = src.value(0, i);
+
+            for (u32 k = 1; k < n; ++k)
+            {
+                if (quaternion)
                 {
-                    return (anim_handle)i;
+                    f32 q0[4], qk[4];
+                    for (u32 i = 0; i < 4; ++i)
+                    {
+                        q0[i] = src.value(0, i);
+                        qk[i] = src.value(k, i);
+                    }
+
+                    constant &= anim_quat_angle(q0, qk) <= error;
+                    continue;
+                }
+
+                for (u32 i = 0; i < src.num_elements; ++i)
+                {
+                    f32 v = src.value(k, i);
+                    vmin[i] = std::min<f32>(vmin[i], v);
+                    vmax[i] = std::max<f32>(vmax[i], v);
+                    constant &= fabs(v - src.value(0, i)) <= error;
                 }
             }
 
-            void* anim_file;
-            u32   anim_file_size;
+            for (u32 i = 0; i < src.num_elements; ++i)
+                track.base[i] = src.value(0, i);
 
-            pen_error err = pen::filesystem_read_file_to_buffer(filename, &anim_file, anim_file_size);
+            if (constant)
+            {
+                track.flags |= e_anim_track::constant;
+                sb_push(*tracks, track);
+                return;
+            }
 
-            if (err != PEN_ERR_OK || anim_file_size == 0)
+            // quantise and decode every key so the reduction measures the error the sampler will see
+            u32  nc = quaternion ? 3 : src.num_elements;
+            u16* times = nullptr;
+            u16* values = nullptr;
+            f32* decoded = nullptr;
+            u32* kept = nullptr;
+
+            for (u32 i = 0; i < nc && !quaternion; ++i)
             {
-                // TODO error dialog
-                return PEN_INVALID_HANDLE;
+                track.base[i] = vmin[i];
+                track.extent[i] = vmax[i] - vmin[i];
             }
 
-            const u32* p_u32reader = (u32*)anim_file;
+            for (u32 k = 0; k < n; ++k)
+            {
+                sb_push(times, length > 0.0f ? quantise_anim_value(src.time(k), 0.0f, length) : 0);
 
-            u32 version = *p_u32reader++;
+                f32 d[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                u16 v[3];
+                if (quaternion)
+                {
+                    f32 q[4];
+                    for (u32 i = 0; i < 4; ++i)
+                        q[i] = src.value(k, i);
 
-            if (version < 1)
+                    encode_anim_quat(q, v);
+                    decode_anim_quat(v, d);
+                }
+                else
+                {
+                    for (u32 i = 0; i < nc; ++i)
+                    {
+                        v[i] = quantise_anim_value(src.value(k, i), track.base[i], track.extent[i]);
+                        d[i] = track.base[i] + track.extent[i] * (f32)v[i] / 65535.0f;
+                    }
+                }
+
+                for (u32 i = 0; i < nc; ++i)
+                    sb_push(values, v[i]);
+
+                for (u32 i = 0; i < 4; ++i)
+                    sb_push(decoded, d[i]);
+            }
+
+            // greedily extend the span from the last kept key until a key inside it is out of tolerance
+            u32 a = 0;
+            sb_push(kept, a);
+            for (u32 b = 2; b < n; ++b)
             {
-                pen::memory_free(anim_file);
-                return PEN_INVALID_HANDLE;
+                bool within = true;
+                for (u32 i = a + 1; i < b && within; ++i)
+                    within = anim_key_error(src, times, decoded, a, b, i, quaternion) <= error;
+
+                if (!within)
+                {
+                    a = b - 1;
+                    sb_push(kept, a);
+                }
+            }
+            sb_push(kept, n - 1);
+
+            track.num_keys = (u16)sb_count(kept);
+            track.offset = sb_count(*keys);
+
+            for (u32 k = 0; k < track.num_keys; ++k)
+                sb_push(*keys, times[kept[k]]);
+
+            for (u32 k = 0; k < track.num_keys; ++k)
+                for (u32 i = 0; i < nc; ++i)
+                    sb_push(*keys, values[kept[k] * nc + i]);
+
+            sb_push(*tracks, track);
+
+            sb_free(times);
+            sb_free(values);
+            sb_free(decoded);
+            sb_free(kept);
+        }
+
+        void compress_anim_clip(const soa_anim& soa, f32 length, const anim_compress_params& params, anim_clip& clip)
+        {
+            anim_track* tracks = nullptr;
+            u16*        keys = nullptr;
+
+            clip.num_channels = soa.num_channels;
+            clip.length = length;
+            clip.channel_tracks = new u32[soa.num_channels + 1];
+
+            for (u32 c = 0; c < soa.num_channels; ++c)
+            {
+                const anim_channel& channel = soa.channels[c];
+                clip.channel_tracks[c] = sb_count(tracks);
+
+                if (channel.num_frames == 0)
+                    continue;
+
+                // translate and scale components with and without keys of their own, and each quaternion
+                anim_track_source vec[2][2];
+                anim_track_source quats[3];
+                u32               num_quats = 0;
+                memset(vec, 0x0, sizeof(vec));
+
+                for (u32 e = 0; e < channel.element_count;)
+                {
+                    anim_track_source base;
+                    base.soa = &soa;
+                    base.channel = c;
+                    base.num_frames = channel.num_frames;
+                    base.num_elements = 0;
+
+                    u32 eo = channel.element_offset[e];
+                    if (eo == e_anim_output::quaternion)
+                    {
+                        quats[num_quats] = base;
+                        for (u32 i = 0; i < 4; ++i)
+                            quats[num_quats].elements[i] = e + i;
+
+                        quats[num_quats++].num_elements = 4;
+                        e += 4;
+                        continue;
+                    }
+
+                    // components which never leave their first key are grouped into a constant track
+                    base.elements[base.num_elements++] = e;
+
+                    f32  error = eo < e_anim_output::scale_x ? params.translation_error : params.scale_error;
+                    bool constant = true;
+                    for (u32 k = 1; k < channel.num_frames && constant; ++k)
+                        constant = fabs(base.value(k, 0) - base.value(0, 0)) <= error;
+
+                    anim_track_source& group = vec[eo < e_anim_output::scale_x ? 0 : 1][constant ? 1 : 0];
+                    if (group.num_elements == 0)
+                        group = base;
+                    else
+                        group.elements[group.num_elements++] = e;
+
+                    ++e;
+                }
+
+                for (u32 g = 0; g < 2; ++g)
+                {
+                    f32 error = g == 0 ? params.translation_error : params.scale_error;
+                    for (u32 k = 0; k < 2; ++k)
+                    {
+                        anim_track_source& src = vec[g][k];
+                        if (src.num_elements == 0)
+                            continue;
+
+                        size_t first = sb_count(tracks);
+                        add_anim_track(src, 0, length, error, false, &tracks, &keys);
+
+                        for (u32 i = 0; i < src.num_elements; ++i)
+                            tracks[first].element_offset[i] = (u8)channel.element_offset[src.elements[i]];
+                    }
+                }
+
+                for (u32 q = 0; q < num_quats; ++q)
+                    add_anim_track(quats[q], channel.flags, length, params.rotation_error, true, &tracks, &keys);
+            }
+
+            clip.num_tracks = sb_count(tracks);
+            clip.channel_tracks[soa.num_channels] = clip.num_tracks;
+            clip.tracks = new anim_track[clip.num_tracks];
+            memcpy(clip.tracks, tracks, clip.num_tracks * sizeof(anim_track));
+
+            clip.num_keys = sb_count(keys);
+            clip.keys = new u16[clip.num_keys];
+            memcpy(clip.keys, keys, clip.num_keys * sizeof(u16));
+
+            sb_free(tracks);
+            sb_free(keys);
+        }
+
+        void free_anim_clip(anim_clip& clip)
+        {
+            delete[] clip.channel_tracks;
+            delete[] clip.tracks;
+            delete[] clip.keys;
+            clip = anim_clip();
+        }
+
+        size_t get_anim_memory(const soa_anim& soa)
+        {
+            size_t bytes = soa.num_channels * sizeof(anim_channel);
+
+            u32 max_frames = 0;
+            for (u32 c = 0; c < soa.num_channels; ++c)
+            {
+                max_frames = std::max<u32>(max_frames, soa.channels[c].num_frames);
+                if (soa.channels[c].key_lookup)
+                    bytes += soa.channels[c].num_frames * sizeof(u32);
+            }
+
+            // per frame stretchy buffers of values and info, with their headers
+            for (u32 t = 0; t < max_frames; ++t)
+            {
+                bytes += sizeof(f32*) + sizeof(anim_info*);
+                if (soa.data[t])
+                    bytes += sb_count(soa.data[t]) * sizeof(f32) + 2 * sizeof(int);
+                if (soa.info[t])
+                    bytes += sb_count(soa.info[t]) * sizeof(anim_info) + 2 * sizeof(int);
             }
 
-            s_animation_resources.push_back(animation_resource());
-            animation_resource& new_animation = s_animation_resources.back();
+            return bytes;
+        }
 
-            new_animation.name = stipped_filename;
-            new_animation.id_name = filename_hash;
+        size_t get_anim_memory(const anim_clip& clip)
+        {
+            return (clip.num_channels + 1) * sizeof(u32) + clip.num_tracks * sizeof(anim_track) +
+                   clip.num_keys * sizeof(u16);
+        }
 
+        // tracks are written field by field so the file does not depend on the padding of anim_track
+        static void write_pma_track(const anim_track& track, std::ofstream& ofs)
+        {
+            ofs.write((const c8*)&track.flags, sizeof(u8));
+            ofs.write((const c8*)&track.anim_flags, sizeof(u8));
+            ofs.write((const c8*)&track.num_components, sizeof(u8));
+            ofs.write((const c8*)&track.element_offset[0], sizeof(track.element_offset));
+            ofs.write((const c8*)&track.num_keys, sizeof(u16));
+            ofs.write((const c8*)&track.offset, sizeof(u32));
+            ofs.write((const c8*)&track.base[0], sizeof(track.base));
+            ofs.write((const c8*)&track.extent[0], sizeof(track.extent));
+        }
+
+        static void read_pma_track(const u8*& p_reader, anim_track& track)
+        {
+            auto read = [&p_reader](void* dst, size_t size) {
+                memcpy(dst, p_reader, size);
+                p_reader += size;
+            };
+
+            read(&track.flags, sizeof(u8));
+            read(&track.anim_flags, sizeof(u8));
+            read(&track.num_components, sizeof(u8));
+            read(&track.element_offset[0], sizeof(track.element_offset));
+            read(&track.num_keys, sizeof(u16));
+            read(&track.offset, sizeof(u32));
+            read(&track.base[0], sizeof(track.base));
+            read(&track.extent[0], sizeof(track.extent));
+        }
+
+        // reads the channel names and compressed clip of a version 3 pma, the channels carry no keys of their own
+        static void load_pma_clip(const u32* p_u32reader, animation_resource& new_animation)
+        {
+            u32 num_channels = *p_u32reader++;
+
+            new_animation.num_channels = num_channels;
+            new_animation.channels = new animation_channel[num_channels];
+
+            for (u32 i = 0; i < num_channels; ++i)
+            {
+                animation_channel& channel = new_animation.channels[i];
+                memset(channel.offset, 0x0, sizeof(channel.offset));
+                memset(channel.scale, 0x0, sizeof(channel.scale));
+                memset(channel.rotation, 0x0, sizeof(channel.rotation));
+
+                channel.target_name = read_parsable_string(&p_u32reader);
+                channel.target = PEN_HASH(channel.target_name.c_str());
+                channel.num_frames = 0;
+                channel.times = nullptr;
+                channel.matrices = nullptr;
+                channel.interpolation = nullptr;
+            }
+
+            anim_clip* clip = new anim_clip;
+            clip->num_channels = num_channels;
+            clip->length = *(f32*)p_u32reader++;
+            clip->num_tracks = *p_u32reader++;
+            clip->num_keys = *p_u32reader++;
+
+            clip->channel_tracks = new u32[num_channels + 1];
+            memcpy(clip->channel_tracks, p_u32reader, (num_channels + 1) * sizeof(u32));
+            p_u32reader += num_channels + 1;
+
+            static_assert(k_pma_track_size % sizeof(u32) == 0, "tracks must keep the reader u32 aligned");
+            clip->tracks = new anim_track[clip->num_tracks];
+
+            const u8* p_track_reader = (const u8*)p_u32reader;
+            for (u32 t = 0; t < clip->num_tracks; ++t)
+                read_pma_track(p_track_reader, clip->tracks[t]);
+            p_u32reader += clip->num_tracks * k_pma_track_size / sizeof(u32);
+
+            clip->keys = new u16[clip->num_keys];
+            memcpy(clip->keys, p_u32reader, clip->num_keys * sizeof(u16));
+
+            // instances size their samplers and targets from the soa channel count
+            new_animation.length = clip->length;
+            new_animation.soa.num_channels = num_channels;
+            new_animation.clip = clip;
+        }
+
+        // reads the channels of a version 1 pma and bakes them into soa
+        static void load_pma_channels(const u32* p_u32reader, animation_resource& new_animation)
+        {
             u32 num_channels = *p_u32reader++;
 
             new_animation.num_channels = num_channels;
@@ -1422,6 +1908,8 @@ namespace put
                 u32 num_sources = *p_u32reader++;
 
                 // null arrays
+                new_animation.channels[i].times = nullptr;
+                new_animation.channels[i].interpolation = nullptr;
                 new_animation.channels[i].matrices = nullptr;
                 for (u32 o = 0; o < 3; ++o)
                 {
@@ -1584,9 +2072,6 @@ namespace put
                 max_frames = std::max<u32>(new_animation.channels[i].num_frames, max_frames);
             }
 
-            // free file mem
-            pen::memory_free(anim_file);
-
             // bake animations into soa.
 
             // allocate vertical arrays
@@ -1678,8 +2163,152 @@ namespace put
                 }
             }
 
+            build_anim_key_lookup(soa);
+        }
+
+        // frees what load_pma_channels allocates
+        static void free_pma_channels(animation_resource& anim)
+        {
+            for (u32 c = 0; c < anim.num_channels; ++c)
+            {
+                animation_channel& channel = anim.channels[c];
+                delete[] channel.times;
+                delete[] channel.interpolation;
+                delete[] (f32*)channel.matrices;
+
+                for (u32 i = 0; i < 3; ++i)
+                {
+                    delete[] channel.offset[i];
+                    delete[] channel.scale[i];
+                    delete[] channel.rotation[i];
+                }
+            }
+            delete[] anim.channels;
+
+            soa_anim& soa = anim.soa;
+            u32       max_frames = 0;
+            for (u32 c = 0; c < soa.num_channels; ++c)
+            {
+                max_frames = std::max<u32>(max_frames, soa.channels[c].num_frames);
+                delete[] soa.channels[c].key_lookup;
+            }
+
+            for (u32 t = 0; t < max_frames; ++t)
+            {
+                sb_free(soa.data[t]);
+                sb_free(soa.info[t]);
+            }
+
+            delete[] soa.channels;
+            delete[] soa.data;
+            delete[] soa.info;
+        }
+
+        // the name and id of a pma, which is stored relative to the project dir
+        static hash_id get_pma_id(const c8* filename, Str& stripped_filename)
+        {
+            Str pd = put::dev_ui::get_program_preference_filename("project_dir");
+
+            stripped_filename = pen::str_replace_string(filename, pd.c_str(), "");
+            return PEN_HASH(stripped_filename.c_str());
+        }
+
+        static anim_handle find_animation_resource(hash_id id_name)
+        {
+            s32 num_anims = s_animation_resources.size();
+            for (s32 i = 0; i < num_anims; ++i)
+                if (s_animation_resources[i].id_name == id_name)
+                    return (anim_handle)i;
+
+            return PEN_INVALID_HANDLE;
+        }
+
+        // frees what load_pma_clip or load_pma_channels allocates
+        static void free_animation_resource(animation_resource& anim)
+        {
+            if (anim.clip)
+            {
+                free_anim_clip(*anim.clip);
+                delete anim.clip;
+                delete[] anim.channels;
+            }
+            else
+            {
+                free_pma_channels(anim);
+            }
+
+            anim = animation_resource();
+        }
+
+        bool read_pma(const c8* filename, animation_resource& anim)
+        {
+            void* anim_file;
+            u32   anim_file_size;
+
+            pen_error err = pen::filesystem_read_file_to_buffer(filename, &anim_file, anim_file_size);
+
+            if (err != PEN_ERR_OK || anim_file_size == 0)
+            {
+                // TODO error dialog
+                return false;
+            }
+
+            const u32* p_u32reader = (u32*)anim_file;
+
+            u32 version = *p_u32reader++;
+
+            // version 2 clips were written with the in memory layout of anim_track, re-run optimise_pma on them
+            if (version < 1 || version > k_pma_version || (version > 1 && version < k_pma_clip_version))
+            {
+                PEN_LOG("[error] %s has unsupported pma version %i", filename, version);
+                pen::memory_free(anim_file);
+                return false;
+            }
+
+            if (version >= k_pma_clip_version)
+                load_pma_clip(p_u32reader, anim);
+            else
+                load_pma_channels(p_u32reader, anim);
+
+            pen::memory_free(anim_file);
+            return true;
+        }
+
+        anim_handle add_animation_resource(const c8* filename, animation_resource& anim)
+        {
+            Str     stripped_filename;
+            hash_id filename_hash = get_pma_id(filename, stripped_filename);
+
+            anim_handle existing = find_animation_resource(filename_hash);
+            if (is_valid(existing))
+            {
+                free_animation_resource(anim);
+                return existing;
+            }
+
+            anim.name = stripped_filename;
+            anim.id_name = filename_hash;
+            s_animation_resources.push_back(anim);
+
             return (anim_handle)s_animation_resources.size() - 1;
         }
+
+        anim_handle load_pma(const c8* filename)
+        {
+            Str     stripped_filename;
+            hash_id filename_hash = get_pma_id(filename, stripped_filename);
+
+            // search for existing
+            anim_handle existing = find_animation_resource(filename_hash);
+            if (is_valid(existing))
+                return existing;
+
+            animation_resource new_animation;
+            if (!read_pma(filename, new_animation))
+                return PEN_INVALID_HANDLE;
+
+            return add_animation_resource(filename, new_animation);
+        }
         
         struct mesh_opt
         {
@@ -1957,8 +2586,59 @@ namespace put
 
         void optimise_pma(const c8* input_filename, const c8* output_filename)
         {
-        
-            // todo
+            void* anim_file;
+            u32   anim_file_size;
+
+            pen_error err = pen::filesystem_read_file_to_buffer(input_filename, &anim_file, anim_file_size);
+            if (err != PEN_ERR_OK || anim_file_size == 0)
+            {
+                PEN_LOG("[error] failed to read %s", input_filename);
+                return;
+            }
+
+            const u32* p_u32reader = (u32*)anim_file;
+            u32        version = *p_u32reader++;
+            if (version != 1)
+            {
+                PEN_LOG("%s is already optimised", input_filename);
+                pen::memory_free(anim_file);
+                return;
+            }
+
+            animation_resource anim;
+            load_pma_channels(p_u32reader, anim);
+            pen::memory_free(anim_file);
+
+            anim_clip clip;
+            compress_anim_clip(anim.soa, anim.length, anim_compress_params(), clip);
+
+            PEN_LOG("    tracks: %i, keys: %i", clip.num_tracks, clip.num_keys);
+            PEN_LOG("    memory: %llu, old %llu", (u64)get_anim_memory(clip), (u64)get_anim_memory(anim.soa));
+
+            std::ofstream ofs(output_filename, std::ofstream::binary);
+            ofs.write((const c8*)&k_pma_clip_version, sizeof(u32));
+            ofs.write((const c8*)&anim.num_channels, sizeof(u32));
+
+            for (u32 c = 0; c < anim.num_channels; ++c)
+                write_parsable_string_u32(anim.channels[c].target_name, ofs);
+
+            ofs.write((const c8*)&clip.length, sizeof(f32));
+            ofs.write((const c8*)&clip.num_tracks, sizeof(u32));
+            ofs.write((const c8*)&clip.num_keys, sizeof(u32));
+            ofs.write((const c8*)clip.channel_tracks, (clip.num_channels + 1) * sizeof(u32));
+            for (u32 t = 0; t < clip.num_tracks; ++t)
+                write_pma_track(clip.tracks[t], ofs);
+            ofs.write((const c8*)clip.keys, clip.num_keys * sizeof(u16));
+
+            // keep the file a whole number of u32
+            u16 pad = 0;
+            if (clip.num_keys & 1)
+                ofs.write((const c8*)&pad, sizeof(u16));
+
+            ofs.close();
+
+            free_anim_clip(clip);
+            free_pma_channels(anim);
         }
 
         s32 load_pmm(const c8* filename, ecs_scene* scene, u32 load_flags)
@@ -2003,6 +2683,55 @@ namespace put
             return root;
         }
 
+        struct pmm_geometry_file
+        {
+            Str                       filename;
+            std::vector<Str>          geometry_names;
+            std::vector<pmm_geometry> geometry;
+        };
+
+        pmm_geometry_file* read_pmm_geometry(const c8* filename)
+        {
+            pmm_contents contents;
+            if (!read_pmm_contents(filename, contents))
+            {
+                pen::memory_free(contents.file_data);
+                return nullptr;
+            }
+
+            pmm_geometry_file* file = new pmm_geometry_file;
+            file->filename = filename;
+            file->geometry_names = contents.geometry_names;
+            parse_pmm_geometry(contents, file->geometry);
+
+            pen::memory_free(contents.file_data);
+            return file;
+        }
+
+        size_t get_pmm_geometry_size(const pmm_geometry_file* file)
+        {
+            size_t size = 0;
+            for (const pmm_geometry& gg : file->geometry)
+                for (const pmm_submesh& sm : gg.submeshes)
+                    size += sm.pos_data_size + sm.vertex_data_size + sm.pos_index_data_size + sm.index_data_size;
+
+            return size;
+        }
+
+        void create_pmm_geometry(pmm_geometry_file* file)
+        {
+            create_pmm_geometry_resources(file->filename.c_str(), file->geometry_names, file->geometry);
+            delete file;
+        }
+
+        void free_pmm_geometry(pmm_geometry_file* file)
+        {
+            for (pmm_geometry& gg : file->geometry)
+                free_pmm_geometry_data(gg);
+
+            delete file;
+        }
+
         s32 load_pmv(const c8* filename, ecs_scene* scene)
         {
             pen::json pmv = pen::json::load_from_file(filename);
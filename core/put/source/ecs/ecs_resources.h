@@ -97,6 +97,15 @@ namespace put
             };
         }
 
+        namespace e_anim_track
+        {
+            enum anim_track_t
+            {
+                quaternion = 1 << 0, // otherwise 1 to 3 translate or scale components
+                constant = 1 << 1    // no keys, the value is held in base
+            };
+        }
+
         namespace e_pmm_load_flags
         {
             enum pmm_load_flags_t
@@ -126,14 +135,30 @@ namespace put
             u32 offset;
         };
 
+        // key_lookup divides the time of the keys into num_frames even buckets, each holding a key at or before the
+        // first key inside it, so finding the key for a time steps over at most the keys of one bucket.
         struct anim_channel
         {
-            u32 num_frames;
-            u32 element_count;
-            u32 element_offset[21];
-            u32 flags = 0;
+            u32  num_frames;
+            u32  element_count;
+            u32  element_offset[21];
+            u32  flags = 0;
+            f32  key_start = 0.0f; // time of the first key
+            f32  key_scale = 0.0f; // buckets per second
+            u32* key_lookup = nullptr;
         };
 
+        // the key_lookup bucket time t falls in
+        pen_inline u32 anim_key_bucket(const anim_channel& channel, f32 t)
+        {
+            f32 b = (t - channel.key_start) * channel.key_scale;
+            if (!(b > 0.0f))
+                return 0;
+
+            u32 last = channel.num_frames - 1;
+            return b < (f32)last ? (u32)b : last;
+        }
+
         struct soa_anim
         {
             u32           num_channels = 0;
@@ -142,6 +167,62 @@ namespace put
             f32**         data = nullptr; // [frame][sampler offset]
         };
 
+        // a compressed track is a quaternion or the translate or scale components of a channel which share keys.
+        // key times are u16 fractions of the clip length, vector keys are u16 fractions of base + extent and quaternion
+        // keys keep the 3 smallest components in 15 bits each. the values of a track follow its times in
+        // anim_clip::keys, interleaved per key.
+        struct anim_track
+        {
+            u8  flags;             // e_anim_track
+            u8  anim_flags;        // e_anim_flags given to the target
+            u8  num_components;    // of a vector track
+            u8  element_offset[3]; // into anim_target::t
+            u16 num_keys;
+            u32 offset; // of the key times in anim_clip::keys
+            f32 base[4];
+            f32 extent[3];
+        };
+
+        // runtime clip with constant tracks removed and keys which can be interpolated from their neighbours within the
+        // error tolerance dropped, optimise_pma builds these offline and load_pma reads them.
+        struct anim_clip
+        {
+            u32         num_channels = 0;
+            u32         num_tracks = 0;
+            u32         num_keys = 0;
+            f32         length = 0.0f;
+            u32*        channel_tracks = nullptr; // first track of each channel, num_channels + 1 entries
+            anim_track* tracks = nullptr;
+            u16*        keys = nullptr;
+        };
+
+        struct anim_compress_params
+        {
+            f32 translation_error = 0.0005f;
+            f32 scale_error = 0.0005f;
+            f32 rotation_error = 0.0005f; // radians
+        };
+
+        // a key of a quaternion track, the dropped component is the largest and is rebuilt positive
+        pen_inline void decode_anim_quat(const u16* v, f32* q)
+        {
+            static const f32 k_range = 1.41421356f / 32767.0f;
+
+            u32 largest = (v[0] >> 15) | ((v[1] >> 15) << 1);
+            f32 sum = 0.0f;
+            u32 j = 0;
+            for (u32 i = 0; i < 4; ++i)
+            {
+                if (i == largest)
+                    continue;
+
+                q[i] = (f32)(v[j++] & 0x7fff) * k_range - 0.70710678f;
+                sum += q[i] * q[i];
+            }
+
+            q[largest] = sum < 1.0f ? sqrtf(1.0f - sum) : 0.0f;
+        }
+
         struct anim_sampler
         {
             u32 pos;
@@ -160,15 +241,17 @@ namespace put
 
         struct anim_instance
         {
-            u32            flags = 0;
-            soa_anim       soa;
-            f32            time = 0.0f;
-            f32            length = 0.0f; // length in time
-            anim_target*   targets = nullptr;
-            cmp_transform* joints = nullptr;
-            anim_sampler*  samplers = nullptr;
-            vec3f          root_translation;
-            vec3f          root_delta = vec3f::zero();
+            u32              flags = 0;
+            soa_anim         soa;
+            const anim_clip* clip = nullptr;       // sampled instead of soa when the resource is compressed
+            u16*             track_keys = nullptr; // sb, the key each track of clip was at last update
+            f32              time = 0.0f;
+            f32              length = 0.0f; // length in time
+            anim_target*     targets = nullptr;
+            cmp_transform*   joints = nullptr;
+            anim_sampler*    samplers = nullptr;
+            vec3f            root_translation;
+            vec3f            root_delta = vec3f::zero();
         };
 
         struct animation_channel
@@ -198,7 +281,8 @@ namespace put
             f32 length;
             Str name;
 
-            soa_anim soa;
+            soa_anim   soa;
+            anim_clip* clip = nullptr;
         };
         
         struct pmm_renderable // resouce may contain full vb and position only
@@ -265,17 +349,88 @@ namespace put
             f32 x, y, z, w;
         };
 
+        // save_scene writes a mappable scene container, load_scene reads containers and the stream format of version 9
+        // and earlier which save_scene_stream still writes
         void save_scene(const c8* filename, ecs_scene* scene);
+        void save_scene_stream(const c8* filename, ecs_scene* scene);
         void save_sub_scene(ecs_scene* scene, u32 root);
         void load_scene(const c8* filename, ecs_scene* scene, bool merge = false);
 
+        // streams the entities of a saved scene into scene next to the ones it has, like load_scene with merge, while
+        // update_scene keeps running. the file is parsed and its geometry and animations are decoded on the job
+        // workers, then each update update_scene_streams creates at most resources_per_update of the gpu resources and
+        // adds entities chunk_size at a time until budget_ms is used up. unloading removes the entities in chunks the
+        // same way and cancels a stream which is still loading. callback is called from update_scene_streams when a
+        // stream is ready, unloaded or failed, the handle is released after unloaded or failed. scenes saved with
+        // save_scene_stream are added in a single update. clear_scene and destroy_scene release the streams of a scene
+        // without calling back.
+        namespace e_scene_stream_state
+        {
+            enum scene_stream_state_t
+            {
+                parsing,
+                resources,
+                committing,
+                ready,
+                unloading,
+                unloaded,
+                failed
+            };
+        }
+        typedef e_scene_stream_state::scene_stream_state_t scene_stream_state;
+
+        typedef void (*scene_stream_callback)(ecs_scene* scene, u32 stream, scene_stream_state state, void* user_data);
+
+        struct scene_stream_params
+        {
+            u32                   chunk_size = 1024;
+            u32                   resources_per_update = 4; // pmm files and textures
+            f64                   budget_ms = 2.0;          // each update takes at least one step
+            scene_stream_callback callback = nullptr;
+            void*                 user_data = nullptr;
+        };
+
+        u32  load_scene_async(const c8* filename, ecs_scene* scene, const scene_stream_params& params = {});
+        void unload_scene_async(u32 stream);
+        void update_scene_streams(ecs_scene* scene); // update_scene calls this before its systems
+
+        scene_stream_state get_scene_stream_state(u32 stream);
+        f32                get_scene_stream_progress(u32 stream); // 0 to 1
+        bool               get_scene_stream_entities(u32 stream, u32& start, u32& end);
+
         s32 load_pmm(const c8* model_scene_name, ecs_scene* scene = nullptr, u32 load_flags = e_pmm_load_flags::all);
         s32 load_pma(const c8* model_scene_name);
         s32 load_pmv(const c8* filename, ecs_scene* scene);
 
+        // load_pmm geometry and load_pma split in two for streaming. the read functions only read and decode a file so
+        // they can run on any thread, they return null or false when it is missing. create_pmm_geometry makes the
+        // geometry resources and gpu buffers on the main thread and frees file, free_pmm_geometry frees it unused.
+        // add_animation_resource returns the existing handle and frees anim when filename has been loaded meanwhile.
+        struct pmm_geometry_file;
+        pmm_geometry_file* read_pmm_geometry(const c8* filename);
+        size_t             get_pmm_geometry_size(const pmm_geometry_file* file);
+        void               create_pmm_geometry(pmm_geometry_file* file);
+        void               free_pmm_geometry(pmm_geometry_file* file);
+        bool               read_pma(const c8* filename, animation_resource& anim);
+        anim_handle        add_animation_resource(const c8* filename, animation_resource& anim);
+
+        // builds the key lookup of every channel, load_pma calls this and anything else which bakes soa_anim data must
+        // call it before the clip is sampled
+        void build_anim_key_lookup(soa_anim& soa);
+
         void optimise_pmm(const c8* input_filename, const c8* output_filename);
+
+        // writes a compressed version of a pma, which load_pma samples through anim_instance::clip instead of soa
         void optimise_pma(const c8* input_filename, const c8* output_filename);
 
+        // compresses the baked keys of soa into clip, the arrays of clip are allocated and freed with free_anim_clip
+        void compress_anim_clip(const soa_anim& soa, f32 length, const anim_compress_params& params, anim_clip& clip);
+        void free_anim_clip(anim_clip& clip);
+
+        // bytes used by the keys and tables of a clip
+        size_t get_anim_memory(const soa_anim& soa);
+        size_t get_anim_memory(const anim_clip& clip);
+
         void instantiate_rigid_body(ecs_scene* scene, u32 node_index);
         void instantiate_compound_rigid_body(ecs_scene* scene, u32 parent, u32* children, u32 num_children);
         void instantiate_constraint(ecs_scene* scene, u32 node_index);
@@ -4,6 +4,8 @@
 
 #include <fstream>
 #include <functional>
+#include <unordered_map>
+#include <vector>
 
 #include "console.h"
 #include "data_struct.h"
@@ -16,8 +18,10 @@
 #include "str/Str.h"
 #include "str_utilities.h"
 #include "timer.h"
+#include "threads.h"
 #include "input.h"
 
+#include "ecs/ecs_anim.h"
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_scene.h"
 #include "ecs/ecs_utilities.h"
@@ -78,6 +82,41 @@ namespace put
                 PEN_ASSERT(0);
         }
 
+        static void resize_cull_bounds(ecs_scene* scene, u32 size)
+        {
+            static const u32 k_num_arrays = 7;
+
+            cull_bounds& b = scene->bounds;
+            u32          capacity = PEN_ALIGN(size, cull_bounds::k_pad);
+
+            if (capacity == b.capacity)
+                return;
+
+            // one allocation split into arrays, capacity is padded so each array starts aligned
+            f32*  prev[k_num_arrays] = {b.pos_x, b.pos_y, b.pos_z, b.extent_x, b.extent_y, b.extent_z, b.radius};
+            f32** arrays[k_num_arrays] = {&b.pos_x, &b.pos_y, &b.pos_z, &b.extent_x, &b.extent_y, &b.extent_z, &b.radius};
+
+            f32* mem = nullptr;
+            if (capacity)
+            {
+                mem = (f32*)pen::memory_alloc_align(capacity * k_num_arrays * sizeof(f32), cull_bounds::k_align);
+                pen::memory_zero(mem, capacity * k_num_arrays * sizeof(f32));
+            }
+
+            u32 keep = std::min<u32>(b.capacity, capacity);
+            for (u32 i = 0; i < k_num_arrays; ++i)
+            {
+                *arrays[i] = mem ? &mem[i * capacity] : nullptr;
+                if (keep)
+                    memcpy(*arrays[i], prev[i], keep * sizeof(f32));
+            }
+
+            if (prev[0])
+                pen::memory_free_align(prev[0]);
+
+            b.capacity = capacity;
+        }
+
         void resize_scene_buffers(ecs_scene* scene, s32 size)
         {
             u32 new_size = scene->soa_size + size;
@@ -107,9 +146,14 @@ namespace put
             }
 
             scene->soa_size = new_size;
+            resize_cull_bounds(scene, new_size);
             initialise_free_list(scene);
         }
 
+        static void free_auto_instance_views(ecs_scene* scene);
+        static void free_view_scratches(ecs_scene* scene);
+        static void free_anim_scratch(ecs_scene* scene);
+
         void free_scene_buffers(ecs_scene* scene, bool cmp_mem_only = 0)
         {
             // Remove entites for sub systems (physics, rendering, etc)
@@ -130,6 +174,98 @@ namespace put
                 cmp.data = nullptr;
             }
 
+            resize_cull_bounds(scene, 0);
+
+            renderable_set& rs = scene->renderables;
+            pen::memory_free(rs.list);
+            pen::memory_free(rs.merge);
+            pen::memory_free(rs.added);
+            pen::memory_free(rs.state);
+            rs = renderable_set();
+
+            bvh_tree& bvh = scene->bvh;
+            pen::memory_free(bvh.nodes);
+            pen::memory_free(bvh.leaves);
+            pen::memory_free(bvh.pending);
+            pen::memory_free(bvh.keys);
+            pen::memory_free(bvh.values);
+            bvh = bvh_tree();
+
+            occluder_set& os = scene->occluders;
+            pen::memory_free(os.mesh);
+            pen::memory_free(os.id_geometry);
+            os = occluder_set();
+
+            shadow_cache& sc = scene->shadow_map_cache;
+            for (u32 i = 0; i < sb_count(sc.slices); ++i)
+                sb_free(sc.slices[i].casters);
+            for (u32 i = 0; i < sb_count(sc.omni_slices); ++i)
+                sb_free(sc.omni_slices[i].casters);
+            for (u32 i = 0; i < sb_count(sc.views); ++i)
+            {
+                sb_free(sc.views[i]->versions);
+                delete sc.views[i];
+            }
+            sb_free(sc.slices);
+            sb_free(sc.omni_slices);
+            sb_free(sc.views);
+            sb_free(sc.masks);
+            sc = shadow_cache();
+
+            view_cull_cache& vc = scene->view_culls;
+            sb_free(vc.frusta);
+            sb_free(vc.masks);
+            vc = view_cull_cache();
+
+            component_lists& cl = scene->cmp_lists;
+            for (u32 i = 0; i < e_cmp_list::COUNT; ++i)
+                sb_free(cl.list[i]);
+            sb_free(cl.merge);
+            sb_free(cl.changed);
+            pen::memory_free(cl.state);
+            cl = component_lists();
+
+            light_set& ls = scene->packed_lights;
+            pen::memory_free(ls.data);
+            pen::memory_free(ls.bounds);
+            sb_free(ls.area_entities);
+            if (is_valid(ls.buffer))
+                pen::renderer_release_buffer(ls.buffer);
+            ls = light_set();
+
+            for (u32 i = 0; i < sb_count(scene->light_cluster_views); ++i)
+            {
+                light_cluster_view* lcv = scene->light_cluster_views[i];
+                free_light_clusters(lcv->clusters);
+
+                u32 buffers[] = {lcv->info_buffer, lcv->grid_buffer, lcv->index_buffer};
+                for (u32 b : buffers)
+                    if (is_valid(b))
+                        pen::renderer_release_buffer(b);
+
+                delete lcv;
+            }
+            sb_free(scene->light_cluster_views);
+            scene->light_cluster_views = nullptr;
+
+            free_auto_instance_views(scene);
+            free_view_scratches(scene);
+            free_anim_scratch(scene);
+
+            bone_palette_set& bp = scene->bone_palettes;
+            pen::memory_free(bp.matrices);
+            pen::memory_free(bp.rigs);
+            pen::memory_free(bp.rebuild);
+            if (is_valid(bp.buffer))
+                pen::renderer_release_buffer(bp.buffer);
+            if (is_valid(bp.pre_skin_cbuffer))
+                pen::renderer_release_buffer(bp.pre_skin_cbuffer);
+            bp = bone_palette_set();
+
+            pen::memory_free(scene->transform_batch_extents);
+            scene->transform_batch_extents = nullptr;
+            scene->transform_batch_capacity = 0;
+
             scene->soa_size = 0;
             scene->num_entities = 0;
         }
@@ -191,8 +327,11 @@ namespace put
             zero_entity_components(scene, node_index);
         }
 
+        static void release_scene_streams(ecs_scene* scene);
+
         void clear_scene(ecs_scene* scene)
         {
+            release_scene_streams(scene);
             free_scene_buffers(scene);
             resize_scene_buffers(scene);
         }
@@ -206,6 +345,8 @@ namespace put
                 generic_cmp_array& cmp = scene->get_component_array(i);
                 memcpy(cmp[dst], cmp[src], cmp.size);
             }
+
+            scene->dirty_flags[dst] = e_dirty::all;
         }
 
         void swap_entities(ecs_scene* scene, u32 a, s32 b)
@@ -274,6 +415,8 @@ namespace put
             vec3f translation = p_sn->local_matrices[dst].get_translation();
             p_sn->local_matrices[dst].set_translation(translation + offset);
 
+            p_sn->dirty_flags[dst] = e_dirty::all;
+
             if (mode == e_clone_mode::instantiate)
             {
                 // todo, clone / instantiate constraint
@@ -305,16 +448,19 @@ namespace put
             svr_main.name = "ecs_render_scene";
             svr_main.id_name = PEN_HASH(svr_main.name.c_str());
             svr_main.render_function = &ecs::render_scene_view;
+            svr_main.parallel = true;
 
             put::scene_view_renderer svr_light_volumes;
             svr_light_volumes.name = "ecs_render_light_volumes";
             svr_light_volumes.id_name = PEN_HASH(svr_light_volumes.name.c_str());
             svr_light_volumes.render_function = &ecs::render_light_volumes;
+            svr_light_volumes.parallel = true;
 
             put::scene_view_renderer svr_shadow_maps;
             svr_shadow_maps.name = "ecs_render_shadow_maps";
             svr_shadow_maps.id_name = PEN_HASH(svr_shadow_maps.name.c_str());
             svr_shadow_maps.render_function = &ecs::render_shadow_views;
+            svr_shadow_maps.cached_function = &ecs::shadow_views_cached;
 
             put::scene_view_renderer svr_area_light_textures;
             svr_area_light_textures.name = "ecs_render_area_light_textures";
@@ -325,6 +471,7 @@ namespace put
             svr_omni_shadow_maps.name = "ecs_render_omni_shadow_maps";
             svr_omni_shadow_maps.id_name = PEN_HASH(svr_omni_shadow_maps.name.c_str());
             svr_omni_shadow_maps.render_function = &ecs::render_omni_shadow_views;
+            svr_omni_shadow_maps.cached_function = &ecs::omni_shadow_views_cached;
             
             put::scene_view_renderer svr_volume_gi;
             svr_volume_gi.name = "ecs_compute_volume_gi";
@@ -403,8 +550,17 @@ namespace put
 
         void destroy_scene(ecs_scene* scene)
         {
+            release_scene_streams(scene);
             free_scene_buffers(scene);
 
+            pen::memory_free(scene->hierarchy_depth);
+            pen::memory_free(scene->hierarchy_order);
+            pen::memory_free(scene->hierarchy_levels);
+            scene->hierarchy_depth = nullptr;
+            scene->hierarchy_order = nullptr;
+            scene->hierarchy_levels = nullptr;
+            scene->hierarchy_capacity = 0;
+
             // todo release resource refs
             // geom
             // anim
@@ -520,6 +676,397 @@ namespace put
             }
         }
 
+        void omni_shadow_camera_from_entity(camera& cam, const ecs_scene* scene, u32 n, u32 face)
+        {
+            cam.pos = scene->transforms[n].translation;
+            put::camera_create_cubemap(&cam, 0.1f, scene->lights[n].radius * 2.0f);
+            put::camera_set_cubemap_face(&cam, face);
+            put::camera_update_frustum(&cam);
+        }
+
+        //
+        // shadow slice cache
+        //
+
+        namespace
+        {
+            // array slices with no light behind them are only cleared, they keep this version once they have been
+            const u32 k_empty_shadow_slice = 0xffffffff;
+
+            const u32 k_shadow_caster_dirty = e_dirty::world_matrix | e_dirty::bounds | e_dirty::material;
+        } // namespace
+
+        static void resize_shadow_slices(shadow_slice*& slices, u32 count)
+        {
+            u32 cur = sb_count(slices);
+            if (count < cur)
+            {
+                for (u32 i = count; i < cur; ++i)
+                    sb_free(slices[i].casters);
+
+                stb__sbn(slices) = count;
+                return;
+            }
+
+            for (u32 i = cur; i < count; ++i)
+            {
+                shadow_slice ss = {0};
+                sb_push(slices, ss);
+            }
+        }
+
+        void invalidate_shadow_cache(ecs_scene* scene)
+        {
+            shadow_cache& sc = scene->shadow_map_cache;
+            for (u32 i = 0; i < sb_count(sc.views); ++i)
+            {
+                u32 num_versions = sb_count(sc.views[i]->versions);
+                if (num_versions)
+                    pen::memory_zero(sc.views[i]->versions, num_versions * sizeof(u32));
+            }
+        }
+
+        // skinned meshes deform when the palette of their rig is rebuilt without their own transform changing and
+        // instances move without their master
+        static bool shadow_caster_changed(const ecs_scene* scene, u32 n)
+        {
+            if (scene->entities[n] & (e_cmp::skinned | e_cmp::pre_skinned))
+            {
+                u32 rig = scene->entities[n] & e_cmp::sub_geometry ? scene->parents[n] : n;
+                if (scene->dirty_flags[rig] & e_dirty::bone_palette)
+                    return true;
+            }
+
+            if (scene->dirty_flags[n] & k_shadow_caster_dirty)
+                return true;
+
+            if (scene->entities[n] & e_cmp::master_instance)
+            {
+                u32 num_instances = scene->master_instances[n].num_instances;
+                for (u32 i = 0; i < num_instances; ++i)
+                    if (scene->dirty_flags[n + 1 + i] & k_shadow_caster_dirty)
+                        return true;
+            }
+
+            return false;
+        }
+
+        // receivers are the renderable extents within reach of the light. anything which shadows them lies between them
+        // and the light, so the sides of the extents the extrusion toward the light crosses are dropped and renderables
+        // inside the rest are the candidate casters of every slice of the light. returns false when nothing is in reach.
+        static bool shadow_receivers_frustum(const ecs_scene* scene, u32 n, const vec3f& light_pos, frustum& receivers)
+        {
+            const cmp_light& light = scene->lights[n];
+            bool             dir = light.type == e_light_type::dir;
+
+            vec3f emin = scene->renderable_extents.min;
+            vec3f emax = scene->renderable_extents.max;
+
+            if (dir)
+            {
+                // the same constraint shadow_camera_from_entity fits to
+                if (mag2(scene->shadow_extent_constraints.min - scene->shadow_extent_constraints.max))
+                {
+                    emin = max_union(scene->shadow_extent_constraints.min, emin);
+                    emax = min_union(scene->shadow_extent_constraints.max, emax);
+                }
+            }
+            else
+            {
+                emin = max_union(emin, light_pos - vec3f(light.radius));
+                emax = min_union(emax, light_pos + vec3f(light.radius));
+            }
+
+            for (u32 a = 0; a < 3; ++a)
+                if (emin[a] > emax[a])
+                    return false;
+
+            // direction lights point toward the light
+            vec3f to_light = dir ? normalised(light.direction) : vec3f::zero();
+
+            for (u32 a = 0; a < 3; ++a)
+            {
+                vec3f axis = vec3f::zero();
+                axis[a] = 1.0f;
+
+                bool keep_min = dir ? to_light[a] >= 0.0f : light_pos[a] >= emin[a];
+                bool keep_max = dir ? to_light[a] <= 0.0f : light_pos[a] <= emax[a];
+
+                receivers.n[a * 2] = keep_min ? -axis : vec3f::zero();
+                receivers.p[a * 2] = keep_min ? emin : vec3f::zero();
+                receivers.n[a * 2 + 1] = keep_max ? axis : vec3f::zero();
+                receivers.p[a * 2 + 1] = keep_max ? emax : vec3f::zero();
+            }
+
+            return true;
+        }
+
+        // the light frustum without the plane on the light's side, casters behind the near plane still shadow
+        static frustum shadow_light_volume(const ecs_scene* scene, u32 n, const camera& cam)
+        {
+            const frustum& f = cam.camera_frustum;
+            frustum        light_volume = f;
+
+            u32 light_side = 4;
+            if (scene->lights[n].type == e_light_type::dir)
+            {
+                vec3f to_light = scene->lights[n].direction;
+                light_side = dot(f.p[4], to_light) > dot(f.p[5], to_light) ? 4 : 5;
+            }
+
+            light_volume.n[light_side] = vec3f::zero();
+            light_volume.p[light_side] = vec3f::zero();
+
+            return light_volume;
+        }
+
+        // bumps the version of the slice if what it would render is not the same as last update
+        static void update_shadow_slice_version(ecs_scene* scene, shadow_slice& slice, u32 n, const mat4& view_proj)
+        {
+            u32 num_casters = sb_count(slice.casters);
+
+            pen::hash_murmur hm;
+            hm.begin(0);
+            hm.add(&view_proj, sizeof(mat4));
+            hm.add(&scene->lights[n], sizeof(cmp_light));
+            if (num_casters)
+                hm.add(slice.casters, num_casters * sizeof(u32));
+            u32 hash = hm.end();
+
+            bool changed = slice.version == 0 || slice.light != n || slice.hash != hash;
+            for (u32 i = 0; i < num_casters && !changed; ++i)
+                changed = shadow_caster_changed(scene, slice.casters[i]);
+
+            slice.light = n;
+            slice.hash = hash;
+
+            if (changed)
+                slice.version = scene->shadow_map_cache.next_version++;
+        }
+
+        // a slice casts from the renderables inside both the receivers of its light and its light volume
+        struct shadow_slice_cull
+        {
+            shadow_slice* slice;
+            u32           light;
+            mat4          view_proj;
+            u64           frusta_bits; // receivers and light volume in the sweep, 0 when nothing receives
+        };
+
+        struct shadow_slice_batch
+        {
+            frustum           frusta[e_cull_limits::max_frusta];
+            shadow_slice_cull culls[e_cull_limits::max_frusta];
+            u32               num_frusta = 0;
+            u32               num_culls = 0;
+        };
+
+        static void add_shadow_slice_culls(shadow_slice_batch& batch, const ecs_scene* scene, u32 n, const vec3f& light_pos,
+                                           const camera* cams, u32 num_cams, shadow_slice* slices)
+        {
+            frustum receivers;
+            u64     receivers_bit = 0;
+            if (shadow_receivers_frustum(scene, n, light_pos, receivers))
+            {
+                receivers_bit = (u64)1 << batch.num_frusta;
+                batch.frusta[batch.num_frusta++] = receivers;
+            }
+
+            for (u32 c = 0; c < num_cams; ++c)
+            {
+                shadow_slice_cull& sc = batch.culls[batch.num_culls++];
+                sc.slice = &slices[c];
+                sc.light = n;
+                sc.view_proj = cams[c].proj * cams[c].view;
+                sc.frusta_bits = 0;
+
+                if (receivers_bit)
+                {
+                    sc.frusta_bits = receivers_bit | (u64)1 << batch.num_frusta;
+                    batch.frusta[batch.num_frusta++] = shadow_light_volume(scene, n, cams[c]);
+                }
+            }
+        }
+
+        // update_scene calls this while the dirty flags of the frame are still set. the receivers of every light and
+        // the light volume of every slice are culled together, so the renderables are read once per batch of up to
+        // e_cull_limits::max_frusta frusta instead of once per light and once per slice.
+        static void update_shadow_slices(ecs_scene* scene)
+        {
+            static const u32 k_slice_lights = e_light_flags::shadow_map | e_light_flags::global_illumination;
+
+            shadow_cache& cache = scene->shadow_map_cache;
+
+            const u32* lights = scene->cmp_lists.list[e_cmp_list::light];
+            u32        num_lights = sb_count(lights);
+
+            u32 num_slices = 0;
+            u32 num_omni_lights = 0;
+            for (u32 i = 0; i < num_lights; ++i)
+            {
+                u32 n = lights[i];
+                if (scene->lights[n].flags & k_slice_lights)
+                    ++num_slices;
+
+                if (scene->lights[n].flags & e_light_flags::omni_shadow_map)
+                    ++num_omni_lights;
+            }
+
+            resize_shadow_slices(cache.slices, num_slices);
+            resize_shadow_slices(cache.omni_slices, num_omni_lights * 6);
+
+            if (num_slices == 0 && num_omni_lights == 0)
+                return;
+
+            const u32* renderables = scene->renderables.list;
+            u32        num_renderables = scene->renderables.count;
+
+            if (sb_count(cache.masks) < num_renderables)
+                sb_add(cache.masks, num_renderables - sb_count(cache.masks));
+
+            u64* masks = cache.masks;
+
+            shadow_slice_batch batch;
+
+            u32 si = 0;
+            u32 oi = 0;
+            for (u32 i = 0; i < num_lights;)
+            {
+                batch.num_frusta = 0;
+                batch.num_culls = 0;
+
+                // as many lights as fit, a light needs its receivers and a light volume per slice
+                for (; i < num_lights; ++i)
+                {
+                    u32 n = lights[i];
+                    u32 flags = scene->lights[n].flags;
+
+                    u32 needed = 0;
+                    if (flags & k_slice_lights)
+                        needed += 2;
+
+                    if (flags & e_light_flags::omni_shadow_map)
+                        needed += 7;
+
+                    if (batch.num_frusta + needed > e_cull_limits::max_frusta)
+                        break;
+
+                    if (flags & k_slice_lights)
+                    {
+                        camera cam;
+                        shadow_camera_from_entity(cam, scene, n);
+                        add_shadow_slice_culls(batch, scene, n, scene->world_matrices[n].get_translation(), &cam, 1,
+                                               &cache.slices[si]);
+                        si += 1;
+                    }
+
+                    if (flags & e_light_flags::omni_shadow_map)
+                    {
+                        camera cams[6];
+                        for (u32 face = 0; face < 6; ++face)
+                            omni_shadow_camera_from_entity(cams[face], scene, n, face);
+
+                        add_shadow_slice_culls(batch, scene, n, scene->transforms[n].translation, cams, 6,
+                                               &cache.omni_slices[oi]);
+                        oi += 6;
+                    }
+                }
+
+                if (batch.num_frusta > 0)
+                    frustum_cull_aabb_multi(scene, batch.frusta, batch.num_frusta, renderables, num_renderables, masks);
+
+                for (u32 c = 0; c < batch.num_culls; ++c)
+                {
+                    shadow_slice_cull& sc = batch.culls[c];
+                    shadow_slice&      slice = *sc.slice;
+
+                    if (slice.casters)
+                        stb__sbn(slice.casters) = 0;
+
+                    if (sc.frusta_bits)
+                        gather_visible_entities(renderables, masks, num_renderables, sc.frusta_bits, &slice.casters);
+
+                    update_shadow_slice_version(scene, slice, sc.light, sc.view_proj);
+                }
+            }
+        }
+
+        static shadow_view_cache& get_shadow_view_cache(ecs_scene* scene, const scene_view& view)
+        {
+            shadow_cache& sc = scene->shadow_map_cache;
+
+            // a view's entry is only added the first time it renders, entries are never moved
+            static pen::mutex* s_mutex = pen::mutex_create();
+            pen::mutex_lock(s_mutex);
+
+            shadow_view_cache* vc = nullptr;
+            for (u32 i = 0; i < sb_count(sc.views); ++i)
+            {
+                if (sc.views[i]->id_view == view.id_view)
+                {
+                    vc = sc.views[i];
+                    break;
+                }
+            }
+
+            if (!vc)
+            {
+                vc = new shadow_view_cache();
+                vc->id_view = view.id_view;
+                sb_push(sc.views, vc);
+            }
+
+            pen::mutex_unlock(s_mutex);
+
+            // only the view itself grows its versions
+            while (sb_count(vc->versions) < view.num_arrays)
+                sb_push(vc->versions, 0);
+
+            return *vc;
+        }
+
+        static u32 shadow_slice_version(const shadow_slice* slices, u32 index)
+        {
+            return index < sb_count(slices) ? slices[index].version : k_empty_shadow_slice;
+        }
+
+        static bool shadow_slice_cached(const scene_view& view, const shadow_slice* slices)
+        {
+            ecs_scene* scene = view.scene;
+            if (scene->view_flags & e_scene_view_flags::hide)
+                return false;
+
+            shadow_view_cache& vc = get_shadow_view_cache(scene, view);
+            if (vc.versions[view.array_index] != shadow_slice_version(slices, view.array_index))
+                return false;
+
+            scene->frame_shadow_slices_reused++;
+            return true;
+        }
+
+        static void shadow_slice_rendered(const scene_view& view, const shadow_slice* slices)
+        {
+            ecs_scene* scene = view.scene;
+
+            // hidden scenes are cleared, the slice is drawn again once they are shown
+            u32 version = 0;
+            if (!(scene->view_flags & e_scene_view_flags::hide))
+                version = shadow_slice_version(slices, view.array_index);
+
+            get_shadow_view_cache(scene, view).versions[view.array_index] = version;
+            scene->frame_shadow_slices_rendered++;
+        }
+
+        bool shadow_views_cached(const scene_view& view)
+        {
+            return shadow_slice_cached(view, view.scene->shadow_map_cache.slices);
+        }
+
+        bool omni_shadow_views_cached(const scene_view& view)
+        {
+            return shadow_slice_cached(view, view.scene->shadow_map_cache.omni_slices);
+        }
+
         void render_shadow_views(const scene_view& view)
         {
             ecs_scene* scene = view.scene;
@@ -537,18 +1084,14 @@ namespace put
                 cb_view = pen::renderer_create_buffer(bcp);
             }
 
-            static mat4 shadow_matrices[e_scene_limits::max_shadow_maps];
-            u32         shadow_index = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            // slices are built by update_scene with their casters culled, array_index is the slice
+            static mat4         shadow_matrices[e_scene_limits::max_shadow_maps];
+            const shadow_cache& sc = scene->shadow_map_cache;
+            u32                 shadow_index = view.array_index;
+            if (shadow_index < sb_count(sc.slices) && !(scene->view_flags & e_scene_view_flags::hide))
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
-                if (!(scene->lights[n].flags & (e_light_flags::shadow_map | e_light_flags::global_illumination)))
-                    continue;
-
-                if (shadow_index++ != view.array_index)
-                    continue;
+                const shadow_slice& slice = sc.slices[shadow_index];
+                u32                 n = slice.light;
 
                 // create a shadow camera
                 camera cam;
@@ -575,7 +1118,7 @@ namespace put
                 }
 
                 pen::renderer_update_buffer(cb_view, &shadow_vp, sizeof(mat4));
-                shadow_matrices[shadow_index - 1] = shadow_vp;
+                shadow_matrices[shadow_index] = shadow_vp;
                 vv.cb_view = cb_view;
                 
                 // colour shadow maps
@@ -601,9 +1144,11 @@ namespace put
                     pen::renderer_set_constant_buffer(cb_light, 10, pen::CBUFFER_BIND_PS);
                 }
 
-                render_scene_view(vv);
+                render_scene_entities(vv, slice.casters, sb_count(slice.casters));
             }
 
+            shadow_slice_rendered(view, sc.slices);
+
             // update cbuffer
             if (is_valid(scene->shadow_map_buffer))
             {
@@ -632,23 +1177,14 @@ namespace put
                 cb_light = pen::renderer_create_buffer(bcp);
             }
 
-            u32 target_omni_light_index = view.array_index / 6;
-            u32 array_face = view.array_index % 6;
-            u32 omni_light_index = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            // 6 slices per light, one per cubemap face
+            const shadow_cache& sc = scene->shadow_map_cache;
+            if (view.array_index < sb_count(sc.omni_slices) && !(scene->view_flags & e_scene_view_flags::hide))
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
-                if (!(scene->lights[n].flags & e_light_flags::omni_shadow_map))
-                    continue;
-
-                if (omni_light_index++ != target_omni_light_index)
-                    continue;
+                const shadow_slice& slice = sc.omni_slices[view.array_index];
+                u32                 n = slice.light;
 
-                cam_omni_shadow.pos = scene->transforms[n].translation;
-                put::camera_create_cubemap(&cam_omni_shadow, 0.1f, scene->lights[n].radius * 2.0f);
-                put::camera_set_cubemap_face(&cam_omni_shadow, array_face);
+                omni_shadow_camera_from_entity(cam_omni_shadow, scene, n, view.array_index % 6);
                 put::camera_update_shader_constants(&cam_omni_shadow);
 
                 light_data ld;
@@ -660,8 +1196,10 @@ namespace put
                 vv.camera = &cam_omni_shadow;
                 vv.cb_view = cam_omni_shadow.cbuffer;
 
-                render_scene_view(vv);
+                render_scene_entities(vv, slice.casters, sb_count(slice.casters));
             }
+
+            shadow_slice_rendered(view, sc.omni_slices);
         }
 
         void render_light_volumes(const scene_view& view)
@@ -689,8 +1227,11 @@ namespace put
             static hash_id id_disable_depth = PEN_HASH("disabled");
             u32            depth_disabled = pmfx::get_render_state(id_disable_depth, pmfx::e_render_state::depth_stencil);
 
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            // the list is from the last update, entities may have been deleted since
+            const u32* lights = scene->cmp_lists.list[e_cmp_list::light];
+            for (u32 i = 0; i < sb_count(lights); ++i)
             {
+                u32 n = lights[i];
                 if (!(scene->entities[n] & e_cmp::light))
                     continue;
 
@@ -811,9 +1352,11 @@ namespace put
             info.scene_size.xyz = vec3f(min(max_dim, 128.0f));
 
             // get inv shadow matrices
-            u32 i = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            const u32* lights = scene->cmp_lists.list[e_cmp_list::light];
+            u32        i = 0;
+            for (u32 l = 0; l < sb_count(lights); ++l)
             {
+                u32 n = lights[l];
                 if (!(scene->entities[n] & e_cmp::light))
                     continue;
 
@@ -848,1722 +1391,4703 @@ namespace put
             pen::renderer_set_texture(0, 0, 2, pen::TEXTURE_BIND_CS);
         }
         
-        void render_scene_view(const scene_view& view)
+        // 64 bit draw sort keys, most significant field first, state fields are folded to fit so they only group.
+        // opaque: layer 1 | shader 6 | technique 6 | permutation 8 | material 12 | vertex buffer 12 | depth 19
+        // alpha:  layer 1 | depth 19 (inverted) | shader 6 | technique 6 | permutation 8 | material 12 | vertex buffer 12
+        static const u32 k_sort_depth_bits = 19;
+        static const u64 k_sort_depth_max = (1 << k_sort_depth_bits) - 1;
+        static const u64 k_sort_alpha_layer = 1ull << 63;
+
+        struct draw_state
         {
-            // PEN_PERF_SCOPE_PRINT(render_scene_view);
-            
-            ecs_scene* scene = view.scene;
-            if (scene->view_flags & e_scene_view_flags::hide)
-                return;
-            
-            // view
-            pen::renderer_set_constant_buffer(view.cb_view, 0, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+            u32     shader = -1;
+            u32     technique = -1;
+            u32     permutation = -1;
+            hash_id material = -1;
+            u32     vb = -1;
+            u32     ib = -1;
+        };
 
-            // fwd lights
-            if (view.render_flags & pmfx::e_scene_render_flags::forward_lit)
-            {
-                pen::renderer_set_constant_buffer(scene->forward_light_buffer, 3, pen::CBUFFER_BIND_PS);
-                pen::renderer_set_constant_buffer(scene->shadow_map_buffer, 4, pen::CBUFFER_BIND_PS);
-                pen::renderer_set_constant_buffer(scene->area_light_buffer, 6, pen::CBUFFER_BIND_PS);
+        // per view because views can be recorded in parallel, capacity follows the largest frame of the view and is
+        // released with the scene
+        struct view_scratch
+        {
+            hash_id id_view = 0;
+            u64*    sort_keys = nullptr;
+            u64*    sort_tmp_keys = nullptr;
+            u32*    sort_tmp_entities = nullptr;
+            u32     sort_capacity = 0;
+            u32*    culled_entities = nullptr; // sb, reset rather than freed so views don't allocate
+            u64*    cull_masks = nullptr;      // for cameras which moved after the view cull sweep
+            u32     cull_mask_capacity = 0;
+        };
 
-                // ltc lookups
-                static u32 ltc_mat = put::load_texture("data/textures/ltc/ltc_mat.dds");
-                static u32 ltc_mag = put::load_texture("data/textures/ltc/ltc_amp.dds");
+        static view_scratch* get_view_scratch(ecs_scene* scene, const scene_view& view)
+        {
+            // a view's entry is only added the first time it renders, entries are never moved
+            static pen::mutex* s_mutex = pen::mutex_create();
+            pen::mutex_lock(s_mutex);
 
-                static hash_id id_clamp_linear = PEN_HASH("clamp_linear");
-                u32            clamp_linear = pmfx::get_render_state(id_clamp_linear, pmfx::e_render_state::sampler);
+            view_scratch* vs = nullptr;
+            for (u32 i = 0; i < sb_count(scene->view_scratches); ++i)
+            {
+                if (scene->view_scratches[i]->id_view == view.id_view)
+                {
+                    vs = scene->view_scratches[i];
+                    break;
+                }
+            }
 
-                pen::renderer_set_texture(ltc_mat, clamp_linear, 13, pen::TEXTURE_BIND_PS);
-                pen::renderer_set_texture(ltc_mag, clamp_linear, 12, pen::TEXTURE_BIND_PS);
+            if (!vs)
+            {
+                vs = new view_scratch();
+                vs->id_view = view.id_view;
+                sb_push(scene->view_scratches, vs);
             }
 
-            // sdf shadows
-            pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            pen::mutex_unlock(s_mutex);
+            return vs;
+        }
+
+        static void free_view_scratches(ecs_scene* scene)
+        {
+            for (u32 i = 0; i < sb_count(scene->view_scratches); ++i)
             {
-                if (!(scene->entities[n] & e_cmp::sdf_shadow))
-                    continue;
+                view_scratch* vs = scene->view_scratches[i];
+                pen::memory_free(vs->sort_keys);
+                pen::memory_free(vs->sort_tmp_keys);
+                pen::memory_free(vs->sort_tmp_entities);
+                sb_free(vs->culled_entities);
+                pen::memory_free(vs->cull_masks);
+                delete vs;
+            }
 
-                cmp_shadow& shadow = scene->shadows[n];
+            sb_free(scene->view_scratches);
+            scene->view_scratches = nullptr;
+        }
 
-                if (is_valid(shadow.texture_handle))
-                    pen::renderer_set_texture(shadow.texture_handle, shadow.sampler_state, e_global_textures::sdf_shadow,
-                                              pen::TEXTURE_BIND_PS);
+        static pen_inline const cmp_geometry* draw_geometry(const ecs_scene* scene, const scene_view& view, u32 n)
+        {
+            if (!(scene->entities[n] & e_cmp::skinned))
+                if (view.render_flags & pmfx::e_scene_render_flags::shadow_map)
+                    return &scene->position_geometries[n];
 
-                // info for sdf
-                pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
-            }
-            
-            // gi volume
-            pen::renderer_set_constant_buffer(scene->gi_volume_buffer, 11, pen::CBUFFER_BIND_PS);
-            
-            // filter and cull
-            u32* filtered_entities = nullptr;
-            u32* culled_entities = nullptr;
-            filter_entities_scalar(scene, &filtered_entities);
-            frustum_cull_aabb_scalar(scene, view.camera, filtered_entities, &culled_entities);
+            return &scene->geometries[n];
+        }
 
-            // track to prevent redundant state changes.
-            u32 cur_shader = -1;
-            u32 cur_technique = -1;
-            u32 cur_permutation = -1;
-            u32 cur_vb = -1;
-            u32 cur_ib = -1;
-            u32 vc = sb_count(culled_entities);
+        static pen_inline void get_draw_state(const ecs_scene* scene, const scene_view& view, u32 n, draw_state& ds)
+        {
+            const cmp_geometry* geom = draw_geometry(scene, view, n);
 
-            // render
-            for(u32 i = 0; i < vc; ++i)
+            if (!is_valid(view.pmfx_shader))
             {
-                u32 n = culled_entities[i];
-                
-                cmp_geometry* p_geom = &scene->geometries[n];
-                if (!(scene->entities[n] & e_cmp::skinned))
-                    if(view.render_flags & pmfx::e_scene_render_flags::shadow_map)
-                        p_geom = &scene->position_geometries[n];
+                ds.shader = scene->materials[n].shader;
+                ds.technique = scene->materials[n].technique_index;
+            }
+            else
+            {
+                ds.shader = view.pmfx_shader;
+                ds.technique = view.id_technique;
+            }
 
-                cmp_material* p_mat = &scene->materials[n];
-                u32           permutation = scene->material_permutation[n];
+            ds.permutation = scene->material_permutation[n];
+            ds.material = scene->id_material[n];
+            ds.vb = geom->vertex_buffer;
+            ds.ib = geom->index_buffer;
+        }
 
-                // set shader / technique only if we need to change
-                if(p_mat->shader != cur_shader || p_mat->technique_index != cur_technique || permutation != cur_permutation)
-                {
-                    if (!is_valid(view.pmfx_shader))
-                    {
-                        // per entity material
-                        pmfx::set_technique(p_mat->shader, p_mat->technique_index);
-                        cur_shader = p_mat->shader;
-                        cur_technique = p_mat->technique_index;
-                        cur_permutation = permutation;
-                    }
-                    else
-                    {
-                        // per pass material but with permutation specialisation (instanced, skinned etc)
-                        pmfx::set_technique_perm(view.pmfx_shader, view.id_technique, permutation);
-                        cur_shader = view.pmfx_shader;
-                        cur_technique = view.id_technique;
-                        cur_permutation = permutation;
-                    }
-                    
-                    // if we change pipeline, we need to rebind buffers
-                    cur_vb = -1;
-                    cur_ib = -1;
-                }
+        static pen_inline u64 fold_bits(u64 v, u32 bits)
+        {
+            u64 mask = (1ull << bits) - 1;
+            u64 r = 0;
+            while (v)
+            {
+                r ^= v & mask;
+                v >>= bits;
+            }
+            return r;
+        }
 
-                // update skin
-                if (scene->entities[n] & e_cmp::skinned && !(scene->entities[n] & e_cmp::sub_geometry))
-                {
-                    static mat4 bb[85];
-                    if (p_geom->p_skin->bone_cbuffer == PEN_INVALID_HANDLE)
-                    {
-                        pen::buffer_creation_params bcp;
-                        bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                        bcp.buffer_size = sizeof(mat4) * 85;
-                        bcp.data = nullptr;
+        static u64 draw_sort_key(const ecs_scene* scene, const scene_view& view, u32 n)
+        {
+            draw_state ds;
+            get_draw_state(scene, view, n, ds);
 
-                        p_geom->p_skin->bone_cbuffer = pen::renderer_create_buffer(bcp);
-                    }
+            u64 state = fold_bits(ds.shader, 6);
+            state = (state << 6) | fold_bits(ds.technique, 6);
+            state = (state << 8) | fold_bits(ds.permutation, 8);
+            state = (state << 12) | fold_bits(ds.material, 12);
+            state = (state << 12) | fold_bits(ds.vb, 12);
 
-                    s32 joints_offset = scene->anim_controller_v2[n].joints_offset;
-                    for (s32 i = 0; i < p_geom->p_skin->num_joints; ++i)
-                        bb[i] = scene->world_matrices[joints_offset + i] * p_geom->p_skin->joint_bind_matrices[i];
+            // distance to the camera normalised by the far plane
+            const camera* cam = view.camera;
+            f32           range = cam->far_plane > 0.0f ? cam->far_plane : 1.0f;
+            f32           d = mag(scene->pos_extent[n].pos.xyz - cam->pos) / range;
+            u64           depth = (u64)(min(max(d, 0.0f), 1.0f) * (f32)k_sort_depth_max);
 
-                    pen::renderer_update_buffer(p_geom->p_skin->bone_cbuffer, bb, sizeof(bb));
-                    pen::renderer_set_constant_buffer(p_geom->p_skin->bone_cbuffer, 2, pen::CBUFFER_BIND_VS);
-                }
+            bool alpha = (view.render_flags & pmfx::e_scene_render_flags::alpha_blended) ||
+                         (scene->render_flags[n] & pmfx::e_scene_render_flags::alpha_blended);
 
-                // set material cbs
-                u32 mcb = scene->materials[n].material_cbuffer;
-                if (is_valid(mcb))
-                {
-                    pen::renderer_set_constant_buffer(mcb, 7, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
-                }
+            // opaque front to back, alpha back to front
+            if (alpha)
+                return k_sort_alpha_layer | ((k_sort_depth_max - depth) << 44) | state;
 
-                // draw call cb
-                pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+            return (state << k_sort_depth_bits) | depth;
+        }
 
-                // set textures
-                if (p_mat)
-                {
-                    cmp_samplers& samplers = scene->samplers[n];
-                    for (u32 s = 0; s < e_pmfx_constants::max_technique_sampler_bindings; ++s)
-                    {
-                        if (!samplers.sb[s].handle)
-                            continue;
+        // number of shader, material or buffer changes drawing entities in order would make
+        static u32 count_state_changes(const ecs_scene* scene, const scene_view& view, const u32* entities, u32 count)
+        {
+            u32        changes = 0;
+            draw_state cur;
+            for (u32 i = 0; i < count; ++i)
+            {
+                draw_state ds;
+                get_draw_state(scene, view, entities[i], ds);
 
-                        pen::renderer_set_texture(samplers.sb[s].handle, samplers.sb[s].sampler_state,
-                                                  samplers.sb[s].sampler_unit, pen::TEXTURE_BIND_PS);
-                    }
-                }
+                if (ds.shader != cur.shader || ds.technique != cur.technique || ds.permutation != cur.permutation)
+                    changes++;
 
-                // set vertex buffer
-                if (scene->entities[n] & e_cmp::master_instance)
-                {
-                    u32 vbs[2] = {p_geom->vertex_buffer, scene->master_instances[n].instance_buffer};
-                    u32 strides[2] = {p_geom->vertex_size, scene->master_instances[n].instance_stride};
-                    u32 offsets[2] = {0};
+                if (ds.material != cur.material)
+                    changes++;
 
-                    pen::renderer_set_vertex_buffers(vbs, 2, 0, strides, offsets);
-                }
-                else
-                {
-                    if(cur_vb != p_geom->vertex_buffer)
-                    {
-                        pen::renderer_set_vertex_buffer(p_geom->vertex_buffer, 0, p_geom->vertex_size, 0);
-                        cur_vb = p_geom->vertex_buffer;
-                    }
-                }
+                if (ds.vb != cur.vb)
+                    changes++;
 
-                // set index buffer
-                if(cur_ib != p_geom->index_buffer)
-                {
-                    pen::renderer_set_index_buffer(p_geom->index_buffer, p_geom->index_type, 0);
-                    cur_ib = p_geom->index_buffer;
-                }
-                
-                // draw
+                if (ds.ib != cur.ib)
+                    changes++;
 
-                // instances
-                if (scene->entities[n] & e_cmp::master_instance)
+                cur = ds;
+            }
+
+            return changes;
+        }
+
+        static void sort_draws(view_scratch& vs, const ecs_scene* scene, const scene_view& view, u32* entities, u32 count)
+        {
+            if (count > vs.sort_capacity)
+            {
+                vs.sort_capacity = count;
+                vs.sort_keys = (u64*)pen::memory_realloc(vs.sort_keys, count * sizeof(u64));
+                vs.sort_tmp_keys = (u64*)pen::memory_realloc(vs.sort_tmp_keys, count * sizeof(u64));
+                vs.sort_tmp_entities = (u32*)pen::memory_realloc(vs.sort_tmp_entities, count * sizeof(u32));
+            }
+
+            for (u32 i = 0; i < count; ++i)
+                vs.sort_keys[i] = draw_sort_key(scene, view, entities[i]);
+
+            radix_sort(vs.sort_keys, entities, count, vs.sort_tmp_keys, vs.sort_tmp_entities);
+        }
+
+        // auto instancing batches runs of sorted draws which share geometry, technique and material data. instance data
+        // is the same cmp_draw_call layout authored instances use, so instanced permutations take colour from v2.
+        static const u32 k_min_auto_instances = 2;
+
+        struct instance_batch
+        {
+            u32 first;     // index into the sorted draw list
+            u32 count;
+            u32 offset;    // first instance in the instance buffer
+            u32 technique; // instanced technique index
+        };
+
+        // transient instance data rewritten each time a view draws batches, per view because views can be recorded in
+        // parallel. capacity follows the largest frame of the view and is released with the scene.
+        struct auto_instance_view
+        {
+            hash_id         id_view = 0;
+            instance_batch* batches = nullptr;
+            cmp_draw_call*  data = nullptr;
+            u32             batch_capacity = 0;
+            u32             capacity = 0;
+            u32             buffer = PEN_INVALID_HANDLE;
+            u32             buffer_capacity = 0;
+        };
+
+        static auto_instance_view* get_auto_instance_view(ecs_scene* scene, const scene_view& view)
+        {
+            // a view's entry is only added the first time it batches, entries are never moved
+            static pen::mutex* s_mutex = pen::mutex_create();
+            pen::mutex_lock(s_mutex);
+
+            auto_instance_view* aiv = nullptr;
+            for (u32 i = 0; i < sb_count(scene->auto_instance_views); ++i)
+            {
+                if (scene->auto_instance_views[i]->id_view == view.id_view)
                 {
-                    u32 num_instances = scene->master_instances[n].num_instances;
-                    pen::renderer_draw_indexed_instanced(num_instances, 0, p_geom->num_indices, 0, 0,
-                                                         PEN_PT_TRIANGLELIST);
-                    n += num_instances;
-                    continue;
+                    aiv = scene->auto_instance_views[i];
+                    break;
                 }
-
-                // single
-                pen::renderer_draw_indexed(p_geom->num_indices, 0, 0, PEN_PT_TRIANGLELIST);
             }
-            
-            if(filtered_entities)
+
+            if (!aiv)
             {
-                sb_free(filtered_entities);
+                aiv = new auto_instance_view();
+                aiv->id_view = view.id_view;
+                sb_push(scene->auto_instance_views, aiv);
             }
-            
-            if(culled_entities)
+
+            pen::mutex_unlock(s_mutex);
+            return aiv;
+        }
+
+        static void free_auto_instance_views(ecs_scene* scene)
+        {
+            for (u32 i = 0; i < sb_count(scene->auto_instance_views); ++i)
             {
-                sb_free(culled_entities);
+                auto_instance_view* aiv = scene->auto_instance_views[i];
+                pen::memory_free(aiv->batches);
+                pen::memory_free(aiv->data);
+
+                if (is_valid(aiv->buffer))
+                    pen::renderer_release_buffer(aiv->buffer);
+
+                delete aiv;
             }
+
+            sb_free(scene->auto_instance_views);
+            scene->auto_instance_views = nullptr;
         }
 
-        void update_animations(ecs_scene* scene, f32 dt)
+        static pen_inline bool can_auto_instance(const ecs_scene* scene, u32 n)
+        {
+            static const u64 reject = e_cmp::skinned | e_cmp::pre_skinned | e_cmp::master_instance | e_cmp::sub_geometry;
+            return !(scene->entities[n] & reject);
+        }
+
+        static bool same_instance_batch(const ecs_scene* scene, const scene_view& view, u32 a, u32 b)
+        {
+            const cmp_geometry* ga = draw_geometry(scene, view, a);
+            const cmp_geometry* gb = draw_geometry(scene, view, b);
+            if (ga->vertex_buffer != gb->vertex_buffer || ga->index_buffer != gb->index_buffer ||
+                ga->num_indices != gb->num_indices)
+                return false;
+
+            const cmp_material& ma = scene->materials[a];
+            const cmp_material& mb = scene->materials[b];
+            if (ma.shader != mb.shader || ma.technique_index != mb.technique_index ||
+                scene->material_permutation[a] != scene->material_permutation[b])
+                return false;
+
+            // the material cbuffer and samplers of the first entity are bound for the whole batch
+            if (ma.material_cbuffer_size != mb.material_cbuffer_size)
+                return false;
+
+            u32 material_size = std::min<u32>(ma.material_cbuffer_size, sizeof(cmp_material_data));
+            if (memcmp(&scene->material_data[a].data[0], &scene->material_data[b].data[0], material_size) != 0)
+                return false;
+
+            return memcmp(&scene->samplers[a], &scene->samplers[b], sizeof(cmp_samplers)) == 0;
+        }
+
+        static u32 instanced_technique(const ecs_scene* scene, const scene_view& view, u32 n)
         {
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32     permutation = scene->material_permutation[n];
+            u32     shader = scene->materials[n].shader;
+            hash_id id_technique = scene->material_resources[n].id_technique;
+            u32     technique = scene->materials[n].technique_index;
+
+            if (is_valid(view.pmfx_shader))
             {
-                if (!(scene->entities[n] & e_cmp::anim_controller))
-                    continue;
+                shader = view.pmfx_shader;
+                id_technique = view.id_technique;
+                technique = pmfx::get_technique_index_perm(shader, id_technique, permutation);
+            }
 
-                cmp_anim_controller_v2 controller = scene->anim_controller_v2[n];
+            // techniques without an instanced permutation mask the flag out and return the regular technique
+            u32 instanced = pmfx::get_technique_index_perm(shader, id_technique, permutation | e_shader_permutation::instanced);
+            if (instanced == technique)
+                return PEN_INVALID_HANDLE;
 
-                u32 num_anims = sb_count(controller.anim_instances);
-                for (u32 ai = 0; ai < num_anims; ++ai)
-                {
-                    anim_instance& instance = controller.anim_instances[ai];
+            return instanced;
+        }
 
-                    if (instance.flags & e_anim_flags::paused)
-                        continue;
+        // finds batches in the sorted draw list and uploads their instance data, returns the number of batches
+        static u32 build_instance_batches(auto_instance_view& ais, const ecs_scene* scene, const scene_view& view,
+                                          const u32* entities, u32 count)
+        {
 
-                    soa_anim& soa = instance.soa;
-                    u32       num_channels = soa.num_channels;
-                    f32       anim_t = instance.time;
+            u32 max_batches = count / k_min_auto_instances;
+            if (max_batches > ais.batch_capacity)
+            {
+                ais.batch_capacity = max_batches;
+                ais.batches = (instance_batch*)pen::memory_realloc(ais.batches, max_batches * sizeof(instance_batch));
+            }
 
-                    bool looped = false;
+            u32 num_batches = 0;
+            u32 num_instances = 0;
+            for (u32 i = 0; i < count;)
+            {
+                u32 n = entities[i];
+                u32 j = i + 1;
 
-                    // roll on time
-                    instance.time += dt;
-                    if (instance.time >= instance.length)
-                    {
-                        instance.time = 0.0f;
-                        looped = true;
-                    }
+                if (can_auto_instance(scene, n))
+                    while (j < count && can_auto_instance(scene, entities[j]) && same_instance_batch(scene, view, n, entities[j]))
+                        ++j;
 
-                    if (instance.flags & e_anim_flags::looped)
+                u32 run = j - i;
+                if (run >= k_min_auto_instances)
+                {
+                    u32 technique = instanced_technique(scene, view, n);
+                    if (is_valid(technique))
                     {
-                        instance.flags &= ~e_anim_flags::looped;
-                        looped = true;
+                        instance_batch b = {i, run, num_instances, technique};
+                        ais.batches[num_batches++] = b;
+                        num_instances += run;
                     }
+                }
 
-                    u32 num_joints = sb_count(instance.joints);
+                i = j;
+            }
 
-                    // reset rotations
-                    for (u32 j = 0; j < num_joints; ++j)
-                        instance.targets[j].q = quat(0.0f, 0.0f, 0.0f);
+            if (num_instances == 0)
+                return 0;
 
-                    for (s32 c = 0; c < num_channels; ++c)
-                    {
-                        anim_sampler& sampler = instance.samplers[c];
-                        anim_channel& channel = soa.channels[c];
+            if (num_instances > ais.capacity)
+            {
+                ais.capacity = num_instances;
+                ais.data = (cmp_draw_call*)pen::memory_realloc(ais.data, num_instances * sizeof(cmp_draw_call));
+            }
 
-                        if (sampler.joint == PEN_INVALID_HANDLE)
-                            continue;
+            for (u32 b = 0; b < num_batches; ++b)
+            {
+                const instance_batch& batch = ais.batches[b];
+                for (u32 k = 0; k < batch.count; ++k)
+                    ais.data[batch.offset + k] = scene->draw_call_data[entities[batch.first + k]];
+            }
 
-                        // find the frame we are on..
-                        for (; sampler.pos < channel.num_frames; sampler.pos++)
-                            if (anim_t <= soa.info[sampler.pos][c].time)
-                            {
-                                sampler.pos -= 1;
-                                break;
-                            }
+            // grow the gpu buffer, the old one is released with the usual frame delay
+            if (num_instances > ais.buffer_capacity)
+            {
+                if (is_valid(ais.buffer))
+                    pen::renderer_release_buffer(ais.buffer);
 
-                        //reset flag
-                        sampler.flags &= ~e_anim_flags::looped;
+                ais.buffer_capacity = std::max<u32>(num_instances, ais.buffer_capacity * 2);
 
-                        if (sampler.pos >= channel.num_frames || looped)
-                        {
-                            sampler.pos = 0;
-                            sampler.flags = e_anim_flags::looped;
-                        }
+                pen::buffer_creation_params bcp;
+                bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                bcp.bind_flags = PEN_BIND_VERTEX_BUFFER;
+                bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                bcp.buffer_size = sizeof(cmp_draw_call) * ais.buffer_capacity;
+                bcp.data = nullptr;
 
-                        u32 next = (sampler.pos + 1) % channel.num_frames;
+                ais.buffer = pen::renderer_create_buffer(bcp);
+            }
+
+            pen::renderer_update_buffer(ais.buffer, ais.data, num_instances * sizeof(cmp_draw_call));
+
+            return num_batches;
+        }
 
-                        // get anim data
-                        anim_info& info1 = soa.info[sampler.pos][c];
-                        anim_info& info2 = soa.info[next][c];
+        static light_cluster_view* get_light_cluster_view(ecs_scene* scene, const scene_view& view)
+        {
+            // a view's entry is only added the first time it renders, entries are never moved
+            static pen::mutex* s_mutex = pen::mutex_create();
+            pen::mutex_lock(s_mutex);
 
-                        f32* d1 = &soa.data[sampler.pos][info1.offset];
-                        f32* d2 = &soa.data[next][info2.offset];
+            light_cluster_view* lcv = nullptr;
+            for (u32 i = 0; i < sb_count(scene->light_cluster_views); ++i)
+            {
+                if (scene->light_cluster_views[i]->id_view == view.id_view)
+                {
+                    lcv = scene->light_cluster_views[i];
+                    break;
+                }
+            }
 
-                        f32 a = (anim_t - info1.time);
-                        f32 b = (info2.time - info1.time);
+            if (!lcv)
+            {
+                lcv = new light_cluster_view();
+                lcv->id_view = view.id_view;
 
-                        f32 it = min(max(a / b, 0.0f), 1.0f);
+                pen::buffer_creation_params bcp;
+                bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+                bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                bcp.buffer_size = sizeof(light_cluster_info);
+                bcp.stride = 0;
+                bcp.data = nullptr;
 
-                        sampler.prev_t = sampler.cur_t;
-                        sampler.cur_t = it;
+                lcv->info_buffer = pen::renderer_create_buffer(bcp);
 
-                        for (u32 e = 0; e < channel.element_count; ++e)
-                        {
-                            u32 eo = channel.element_offset[e];
-
-                            // slerp quats
-                            if (eo == e_anim_output::quaternion)
-                            {
-                                quat q1;
-                                quat q2;
-
-                                memcpy(&q1.v[0], &d1[e], 16);
-                                memcpy(&q2.v[0], &d2[e], 16);
-
-                                quat ql = slerp(q1, q2, it);
-
-                                instance.targets[sampler.joint].q = ql * instance.targets[sampler.joint].q;
-                                instance.targets[sampler.joint].flags |= channel.flags;
-                                e += 3;
-                            }
-                            else
-                            {
-                                // lerp translation / scale
-                                f32 lf = (1 - it) * d1[e] + it * d2[e];
-                                instance.targets[sampler.joint].t[eo] = lf;
-                            }
-                        }
-                    }
+                bcp.bind_flags = PEN_BIND_SHADER_RESOURCE;
+                bcp.buffer_size = sizeof(lcv->clusters.grid);
+                bcp.stride = sizeof(u32) * 2;
 
-                    // bake anim target into a cmp transform for joint
-                    u32 tj = PEN_INVALID_HANDLE;
-                    for (u32 j = 0; j < num_joints; ++j)
-                    {
-                        u32 jnode = controller.joint_indices[j];
+                lcv->grid_buffer = pen::renderer_create_buffer(bcp);
 
-                        if (scene->entities[jnode] & e_cmp::anim_trajectory)
-                        {
-                            tj = j;
-                            continue;
-                        }
+                sb_push(scene->light_cluster_views, lcv);
+            }
 
-                        f32* f = &instance.targets[j].t[0];
+            pen::mutex_unlock(s_mutex);
+            return lcv;
+        }
 
-                        instance.joints[j].translation = vec3f(f[e_anim_output::translate_x], f[e_anim_output::translate_y],
-                                                               f[e_anim_output::translate_z]);
+        // bins the lights for the camera of view once per update and binds the clusters, returns false for views
+        // which are lit with the forward light buffer instead
+        static bool bind_light_clusters(const scene_view& view)
+        {
+            ecs_scene*       scene = view.scene;
+            const light_set& ls = scene->packed_lights;
 
-                        instance.joints[j].scale =
-                            vec3f(f[e_anim_output::scale_x], f[e_anim_output::scale_y], f[e_anim_output::scale_z]);
+            if (!(scene->flags & e_scene_flags::clustered_lights) || !view.camera || !is_valid(ls.buffer))
+                return false;
 
-                        if (instance.targets[j].flags & e_anim_flags::baked_quaternion)
-                            instance.joints[j].rotation = instance.targets[j].q;
-                        else
-                            instance.joints[j].rotation = scene->initial_transform[jnode].rotation * instance.targets[j].q;
-                    }
+            light_cluster_view* lcv = get_light_cluster_view(scene, view);
+            light_clusters&     lc = lcv->clusters;
 
-                    // root motion.. todo rotation
-                    if (tj != PEN_INVALID_HANDLE)
-                    {
-                        f32*  f = &instance.targets[tj].t[0];
-                        vec3f tt = vec3f(f[0], f[1], f[2]);
+            if (lcv->version != ls.version)
+            {
+                if (!bin_lights(scene, view.camera, lc))
+                    return false;
 
-                        if (instance.samplers[0].flags & e_anim_flags::looped)
-                        {
-                            // inherit prev root motion
-                            instance.root_translation = tt;
-                        }
-                        else
-                        {
-                            instance.root_delta = tt - instance.root_translation;
-                            instance.root_translation = tt;
-                        }
-                    }
-                }
+                lcv->version = ls.version;
 
-                // for active controller.anim_instances, make trans, quat, scale
-                //      blend tree
-                if (num_anims > 0)
+                if (lc.num_indices > lcv->index_buffer_capacity)
                 {
-                    anim_instance& a = controller.anim_instances[controller.blend.anim_a];
-                    anim_instance& b = controller.anim_instances[controller.blend.anim_b];
-                    f32            t = controller.blend.ratio;
-
-                    u32 num_joints = sb_count(a.joints);
-                    for (u32 j = 0; j < num_joints; ++j)
-                    {
-                        u32 jnode = controller.joint_indices[j];
+                    if (is_valid(lcv->index_buffer))
+                        pen::renderer_release_buffer(lcv->index_buffer);
 
-                        cmp_transform& tc = scene->transforms[jnode];
-                        cmp_transform& ta = a.joints[j];
-                        cmp_transform& tb = b.joints[j];
+                    lcv->index_buffer_capacity = std::max<u32>(lc.num_indices, lcv->index_buffer_capacity * 2);
 
-                        if (scene->entities[jnode] & e_cmp::anim_trajectory)
-                        {
-                            vec3f lerp_delta = lerp(a.root_delta, b.root_delta, t);
+                    pen::buffer_creation_params bcp;
+                    bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                    bcp.bind_flags = PEN_BIND_SHADER_RESOURCE;
+                    bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                    bcp.buffer_size = sizeof(u32) * lcv->index_buffer_capacity;
+                    bcp.stride = sizeof(u32);
+                    bcp.data = nullptr;
 
-                            mat4 rot_mat;
-                            quat q = scene->initial_transform[jnode].rotation;
-                            q.get_matrix(rot_mat);
+                    lcv->index_buffer = pen::renderer_create_buffer(bcp);
+                }
 
-                            vec3f transform_translation = rot_mat.transform_vector(lerp_delta);
+                pen::renderer_update_buffer(lcv->info_buffer, &lc.info, sizeof(light_cluster_info));
+                pen::renderer_update_buffer(lcv->grid_buffer, lc.grid, sizeof(lc.grid));
+                if (lc.num_indices)
+                    pen::renderer_update_buffer(lcv->index_buffer, lc.indices, lc.num_indices * sizeof(u32));
 
-                            // apply root motion to the root controller, so we bring along the meshes
-                            scene->transforms[n].rotation = q;
-                            scene->transforms[n].translation += transform_translation;
-                            scene->entities[n] |= e_cmp::transform;
+                scene->frame_binned_lights += lc.num_lights;
+                scene->frame_light_binning_us += (u32)(lc.ms * 1000.0);
+            }
 
-                            continue;
-                        }
+            // every cluster is empty when no point or spot lights are in view
+            if (!is_valid(lcv->index_buffer))
+                return false;
 
-                        tc.translation = lerp(ta.translation, tb.translation, t);
-                        tc.rotation = slerp2(ta.rotation, tb.rotation, t);
-                        tc.scale = lerp(ta.scale, tb.scale, t);
+            static const u32 k_sb_flags = pen::SBUFFER_BIND_PS | pen::SBUFFER_BIND_READ;
+            pen::renderer_set_constant_buffer(lcv->info_buffer, 12, pen::CBUFFER_BIND_PS);
+            pen::renderer_set_structured_buffer(ls.buffer, 4, k_sb_flags);
+            pen::renderer_set_structured_buffer(lcv->grid_buffer, 5, k_sb_flags);
+            pen::renderer_set_structured_buffer(lcv->index_buffer, 6, k_sb_flags);
 
-                        scene->entities[jnode] |= e_cmp::transform;
-                    }
-                }
-            }
+            return true;
         }
 
-        void update(f32 dt)
+        static bool same_frustum(const frustum& a, const frustum& b)
         {
-            //PEN_PERF_SCOPE_PRINT(ecs_update);Oe
-            
-            // allow run time switching between dynamic and fixed timestep
-            static f32 fft = 1.0f / 60.0f;
-            bool       bdt = dev_ui::get_program_preference("dynamic_timestep").as_bool(true);
-            f32        ft = dev_ui::get_program_preference("fixed_timestep").as_f32(fft);
-            if (!bdt)
-            {
-                dt = ft;
-            }
-
-            for (auto& si : s_scenes)
-            {
-                update_scene(si.scene, dt);
-            }
+            // corners are not used to cull
+            return memcmp(a.n, b.n, sizeof(a.n)) == 0 && memcmp(a.p, b.p, sizeof(a.p)) == 0;
         }
 
-        std::vector<ecs_scene_instance>* get_scenes()
+        static s32 find_view_frustum(const view_cull_cache& vc, const frustum& f)
         {
-            return &s_scenes;
+            for (u32 i = 0; i < sb_count(vc.frusta); ++i)
+                if (same_frustum(vc.frusta[i], f))
+                    return i;
+
+            return -1;
         }
 
-        void update_scene(ecs_scene* scene, f32 dt)
+        void cull_scene_views(ecs_scene* scene)
         {
-            // static anim time to pass into draw calls etc..
-            f32 anim_time = pen::get_time_ms() / 1000.0f;
+            view_cull_cache& vc = scene->view_culls;
+            if (vc.swept || (scene->flags & e_scene_flags::bvh_cull))
+                return;
 
-            u32 num_controllers = sb_count(scene->controllers);
-            u32 num_extensions = sb_count(scene->extensions);
+            const u32* renderables = scene->renderables.list;
+            u32        num_renderables = scene->renderables.count;
 
-            // pre update controllers
-            for (u32 c = 0; c < num_controllers; ++c)
-                if (scene->controllers[c].update_func)
-                    scene->controllers[c].update_func(scene->controllers[c], scene, dt);
+            if (vc.frusta)
+                stb__sbn(vc.frusta) = 0;
 
-            if (scene->flags & e_scene_flags::pause_update)
-            {
-                physics::set_paused(1);
-            }
-            else
-            {
-                physics::set_paused(0);
-                update_animations(scene, dt);
-            }
+            camera** cams = pmfx::get_cameras();
+            for (u32 i = 0; i < sb_count(cams) && sb_count(vc.frusta) < e_cull_limits::max_frusta; ++i)
+                if (find_view_frustum(vc, cams[i]->camera_frustum) == -1)
+                    sb_push(vc.frusta, cams[i]->camera_frustum);
 
-            // extension component update
-            for (u32 e = 0; e < num_extensions; ++e)
-                if (scene->extensions[e].update_func)
-                    scene->extensions[e].update_func(scene->extensions[e], scene, dt);
+            sb_free(cams);
 
-            static pen::timer* timer = pen::timer_create();
-            pen::timer_start(timer);
+            if (sb_count(vc.masks) < num_renderables)
+                sb_add(vc.masks, num_renderables - sb_count(vc.masks));
 
-            // scene node transform
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            if (vc.frusta)
             {
-                // force physics entity to sync and ignore controlled transform
-                if (scene->state_flags[n] & e_state::sync_physics_transform)
-                {
-                    scene->state_flags[n] &= ~e_state::sync_physics_transform;
-                    scene->entities[n] &= ~e_cmp::transform;
-                }
-
-                // controlled transform
-                if (scene->entities[n] & e_cmp::transform)
-                {
-                    cmp_transform& t = scene->transforms[n];
+                frustum_cull_aabb_multi(scene, vc.frusta, sb_count(vc.frusta), renderables, num_renderables, vc.masks);
+                scene->frame_view_cull_sweeps++;
+            }
 
-                    // generate matrix from transform
-                    mat4 rot_mat;
-                    t.rotation.get_matrix(rot_mat);
+            vc.swept = true;
+        }
 
-                    mat4 translation_mat = mat::create_translation(t.translation);
+        // the sweep is only written before views are recorded in parallel, views recorded serially sweep the first time
+        static void cull_scene_view(view_scratch& vs, ecs_scene* scene, const camera* cam, u32** entities_out)
+        {
+            cull_scene_views(scene);
 
-                    mat4 scale_mat = mat::create_scale(t.scale);
+            const view_cull_cache& vc = scene->view_culls;
+            const frustum&         f = cam->camera_frustum;
+            const u32*             renderables = scene->renderables.list;
+            u32                    num_renderables = scene->renderables.count;
 
-                    scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
+            s32 bit = find_view_frustum(vc, f);
+            if (bit != -1)
+            {
+                gather_visible_entities(renderables, vc.masks, num_renderables, (u64)1 << bit, entities_out);
+                return;
+            }
 
-                    if (scene->entities[n] & e_cmp::physics)
-                    {
-                        if (scene->physics_data[n].type == e_physics_type::rigid_body)
-                        {
-                            cmp_transform& pt = scene->physics_offset[n];
-                            physics::set_transform(scene->physics_handles[n], t.translation + pt.translation, t.rotation);
-                            physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_angular_velocity);
-                            physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_linear_velocity);
-                        }
-                    }
+            if (num_renderables == 0)
+                return;
 
-                    // local matrix will be baked
-                    scene->entities[n] &= ~e_cmp::transform;
-                }
-                else if (scene->entities[n] & e_cmp::physics)
-                {
-                    if (!physics::has_rb_matrix(n))
-                        continue;
+            // the camera moved after the sweep, cull it alone into the view scratch without touching the shared masks
+            if (num_renderables > vs.cull_mask_capacity)
+            {
+                vs.cull_mask_capacity = num_renderables;
+                vs.cull_masks = (u64*)pen::memory_realloc(vs.cull_masks, num_renderables * sizeof(u64));
+            }
 
-                    cmp_transform& t = scene->transforms[n];
-                    cmp_transform& pt = scene->physics_offset[n];
+            frustum_cull_aabb_multi(scene, &f, 1, renderables, num_renderables, vs.cull_masks);
+            gather_visible_entities(renderables, vs.cull_masks, num_renderables, 1, entities_out);
+            scene->frame_view_cull_sweeps++;
+        }
 
-                    mat4 scale_mat = mat::create_scale(t.scale);
+        void render_scene_view(const scene_view& view)
+        {
+            // PEN_PERF_SCOPE_PRINT(render_scene_view);
+            
+            ecs_scene* scene = view.scene;
+            if (scene->view_flags & e_scene_view_flags::hide)
+                return;
 
-                    vec3f os = t.scale;
-                    t = physics::get_rb_transform(scene->physics_handles[n]);
-                    t.scale = os;
+            // cull renderables into the scratch of this view
+            view_scratch* vs = get_view_scratch(scene, view);
+            u32*&         culled_entities = vs->culled_entities;
+            if (culled_entities)
+                stb__sbn(culled_entities) = 0;
 
-                    mat4 rot_mat;
-                    t.rotation.get_matrix(rot_mat);
+            if (scene->flags & e_scene_flags::bvh_cull)
+            {
+                static const u64 k_accept = e_cmp::geometry | e_cmp::material;
+                bvh_query_frustum(scene, view.camera->camera_frustum, &culled_entities, k_accept, e_cmp::sub_instance);
+            }
+            else
+            {
+                cull_scene_view(*vs, scene, view.camera, &culled_entities);
+            }
 
-                    mat4 translation_mat = mat::create_translation(t.translation - pt.translation);
+            // remove what is in the frustum but hidden behind the biggest occluders
+            if ((view.render_flags & pmfx::e_scene_render_flags::occlusion_cull) && culled_entities)
+            {
+                f64 start = pen::get_time_us();
 
-                    scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
-                }
+                u32 in_frustum = sb_count(culled_entities);
+                u32 visible = occlusion_cull(scene, view.camera, culled_entities, in_frustum);
+                stb__sbn(culled_entities) = visible;
 
-                // heirarchical scene transform
-                u32 parent = scene->parents[n];
-                if (parent == n)
-                    scene->world_matrices[n] = scene->local_matrices[n];
-                else
-                    scene->world_matrices[n] = scene->world_matrices[parent] * scene->local_matrices[n];
+                scene->frame_occluded += in_frustum - visible;
+                scene->frame_occlusion_us += (u32)(pen::get_time_us() - start);
             }
 
-            // bounding volume transform
-            static vec3f corners[] = {vec3f(0.0f, 0.0f, 0.0f),
-
-                                      vec3f(1.0f, 0.0f, 0.0f), vec3f(0.0f, 1.0f, 0.0f), vec3f(0.0f, 0.0f, 1.0f),
-
-                                      vec3f(1.0f, 1.0f, 0.0f), vec3f(0.0f, 1.0f, 1.0f), vec3f(1.0f, 0.0f, 1.0f),
+            render_scene_entities(view, culled_entities, sb_count(culled_entities));
+        }
 
-                                      vec3f(1.0f, 1.0f, 1.0f)};
+        void render_scene_entities(const scene_view& view, u32* culled_entities, u32 vc)
+        {
+            ecs_scene* scene = view.scene;
 
-            scene->renderable_extents.min = vec3f::flt_max();
-            scene->renderable_extents.max = -vec3f::flt_max();
+            // view
+            pen::renderer_set_constant_buffer(view.cb_view, 0, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
 
-            // transform extents by transform
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            // fwd lights
+            u32 view_permutation = 0;
+            if (view.render_flags & pmfx::e_scene_render_flags::forward_lit)
             {
-                vec3f min = scene->bounding_volumes[n].min_extents;
-                vec3f max = scene->bounding_volumes[n].max_extents - min;
+                pen::renderer_set_constant_buffer(scene->forward_light_buffer, 3, pen::CBUFFER_BIND_PS);
+                pen::renderer_set_constant_buffer(scene->shadow_map_buffer, 4, pen::CBUFFER_BIND_PS);
+                pen::renderer_set_constant_buffer(scene->area_light_buffer, 6, pen::CBUFFER_BIND_PS);
 
-                vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
-                vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
+                // ltc lookups
+                static u32 ltc_mat = put::load_texture("data/textures/ltc/ltc_mat.dds");
+                static u32 ltc_mag = put::load_texture("data/textures/ltc/ltc_amp.dds");
 
-                if (scene->entities[n] & e_cmp::bone)
-                {
-                    tmin = tmax = scene->world_matrices[n].get_translation();
-                    continue;
-                }
+                static hash_id id_clamp_linear = PEN_HASH("clamp_linear");
+                u32            clamp_linear = pmfx::get_render_state(id_clamp_linear, pmfx::e_render_state::sampler);
 
-                tmax = -vec3f::flt_max();
-                tmin = vec3f::flt_max();
+                pen::renderer_set_texture(ltc_mat, clamp_linear, 13, pen::TEXTURE_BIND_PS);
+                pen::renderer_set_texture(ltc_mag, clamp_linear, 12, pen::TEXTURE_BIND_PS);
 
-                for (s32 c = 0; c < 8; ++c)
-                {
-                    vec3f p = scene->world_matrices[n].transform_vector(min + max * corners[c]);
+                // clustered views light with the lights binned into the cluster of each pixel
+                if (bind_light_clusters(view))
+                    view_permutation |= e_shader_permutation::clustered_lights;
+            }
 
-                    tmax = max_union(tmax, p);
-                    tmin = min_union(tmin, p);
-                }
+            // sdf shadows
+            pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
+            const u32* sdf_shadows = scene->cmp_lists.list[e_cmp_list::sdf_shadow];
+            for (u32 i = 0; i < sb_count(sdf_shadows); ++i)
+            {
+                u32 n = sdf_shadows[i];
+                if (!(scene->entities[n] & e_cmp::sdf_shadow))
+                    continue;
 
-                f32& trad = scene->bounding_volumes[n].radius;
-                trad = mag(tmax - tmin) * 0.5f;
-                
-                // pos extent for faster aabb and sphere culling
-                auto& pe = scene->pos_extent[n];
-                pe.pos.xyz = tmin + (tmax - tmin) * 0.5f;
-                pe.extent.xyz = tmax - pe.pos.xyz;
-                pe.extent.w = trad;
+                cmp_shadow& shadow = scene->shadows[n];
 
-                if (!(scene->entities[n] & e_cmp::geometry))
-                    continue;
+                if (is_valid(shadow.texture_handle))
+                    pen::renderer_set_texture(shadow.texture_handle, shadow.sampler_state, e_global_textures::sdf_shadow,
+                                              pen::TEXTURE_BIND_PS);
 
-                // also set scene extents
-                scene->renderable_extents.min = min_union(tmin, scene->renderable_extents.min);
-                scene->renderable_extents.max = max_union(tmax, scene->renderable_extents.max);
+                // info for sdf
+                pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
             }
+            
+            // gi volume
+            pen::renderer_set_constant_buffer(scene->gi_volume_buffer, 11, pen::CBUFFER_BIND_PS);
 
-            // reverse iterate over scene and expand parents extents by children
-            for (intptr_t n = scene->num_entities - 1; n > 0; --n)
+            // bone palettes of every rig, skinned draws find theirs with the offset in their draw call
+            if (is_valid(scene->bone_palettes.buffer))
+                pen::renderer_set_structured_buffer(scene->bone_palettes.buffer, e_global_textures::bone_palette,
+                                                    pen::SBUFFER_BIND_VS | pen::SBUFFER_BIND_READ);
+
+            // sort by state and depth
+            bool draw_stats = scene->flags & e_scene_flags::draw_stats;
+            if (draw_stats)
+                scene->frame_state_changes_unsorted += count_state_changes(scene, view, culled_entities, vc);
+
+            sort_draws(*get_view_scratch(scene, view), scene, view, culled_entities, vc);
+
+            if (draw_stats)
+                scene->frame_state_changes += count_state_changes(scene, view, culled_entities, vc);
+            scene->frame_draws += vc;
+
+            // batch matching draws into instanced draws
+            u32                 num_batches = 0;
+            u32                 next_batch = 0;
+            u32                 num_draw_calls = 0;
+            u32                 num_auto_instances = 0;
+            auto_instance_view* aiv = nullptr;
+            if (scene->flags & e_scene_flags::auto_instance)
             {
-                if (!(scene->entities[n] & e_cmp::allocated))
-                    continue;
+                aiv = get_auto_instance_view(scene, view);
+                num_batches = build_instance_batches(*aiv, scene, view, culled_entities, vc);
+            }
 
-                u32 p = scene->parents[n];
-                if (p == n)
-                    continue;
+            const instance_batch* batches = aiv ? aiv->batches : nullptr;
 
-                vec3f& parent_tmin = scene->bounding_volumes[p].transformed_min_extents;
-                vec3f& parent_tmax = scene->bounding_volumes[p].transformed_max_extents;
+            // track to prevent redundant state changes.
+            u32 cur_shader = -1;
+            u32 cur_technique = -1;
+            u32 cur_permutation = -1;
+            u32 cur_vb = -1;
+            u32 cur_ib = -1;
 
-                vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
-                vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
+            // render
+            for(u32 i = 0; i < vc; ++i)
+            {
+                u32 n = culled_entities[i];
+                
+                const cmp_geometry* p_geom = draw_geometry(scene, view, n);
+                cmp_material*       p_mat = &scene->materials[n];
+                u32                 permutation = scene->material_permutation[n];
+                u32                 technique = p_mat->technique_index;
 
-                if (scene->entities[p] & e_cmp::anim_controller)
+                const instance_batch* batch = nullptr;
+                if (next_batch < num_batches && batches[next_batch].first == i)
                 {
-                    vec3f pad = vec3f(0.0f);
-
-                    parent_tmin = min_union(parent_tmin, tmin - pad);
-                    parent_tmax = max_union(parent_tmax, tmax + pad);
+                    batch = &batches[next_batch++];
+                    permutation |= e_shader_permutation::instanced;
+                    technique = batch->technique;
                 }
-                else
+
+                // techniques without the view permutation mask it out and return the same technique
+                if (view_permutation)
                 {
-                    parent_tmin = min_union(parent_tmin, tmin);
-                    parent_tmax = max_union(parent_tmax, tmax);
+                    permutation |= view_permutation;
+                    if (!is_valid(view.pmfx_shader))
+                        technique = pmfx::get_technique_index_perm(p_mat->shader, scene->material_resources[n].id_technique,
+                                                                   permutation);
                 }
-            }
 
-            // Forward light buffer
-            static forward_light_buffer light_buffer;
-            s32                         pos = 0;
-            s32                         num_lights = 0;
+                // set shader / technique only if we need to change
+                if(p_mat->shader != cur_shader || technique != cur_technique || permutation != cur_permutation)
+                {
+                    if (!is_valid(view.pmfx_shader))
+                    {
+                        // per entity material
+                        pmfx::set_technique(p_mat->shader, technique);
+                        cur_shader = p_mat->shader;
+                        cur_technique = technique;
+                        cur_permutation = permutation;
+                    }
+                    else
+                    {
+                        // per pass material but with permutation specialisation (instanced, skinned etc)
+                        pmfx::set_technique_perm(view.pmfx_shader, view.id_technique, permutation);
+                        cur_shader = view.pmfx_shader;
+                        cur_technique = view.id_technique;
+                        cur_permutation = permutation;
+                    }
+                    
+                    // if we change pipeline, we need to rebind buffers
+                    cur_vb = -1;
+                    cur_ib = -1;
+                }
 
-            memset(&light_buffer, 0x0, sizeof(forward_light_buffer));
+                // set material cbs
+                u32 mcb = scene->materials[n].material_cbuffer;
+                if (is_valid(mcb))
+                {
+                    pen::renderer_set_constant_buffer(mcb, 7, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                }
 
-            // directional lights
-            s32 num_directions_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                // draw call cb
+                pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
 
-                cmp_light& l = scene->lights[n];
-                if (l.type != e_light_type::dir)
-                    continue;
+                // set textures
+                if (p_mat)
+                {
+                    cmp_samplers& samplers = scene->samplers[n];
+                    for (u32 s = 0; s < e_pmfx_constants::max_technique_sampler_bindings; ++s)
+                    {
+                        if (!samplers.sb[s].handle)
+                            continue;
 
-                // update bv and transform
-                scene->bounding_volumes[n].min_extents = -vec3f(FLT_MAX);
-                scene->bounding_volumes[n].max_extents = vec3f(FLT_MAX);
+                        pen::renderer_set_texture(samplers.sb[s].handle, samplers.sb[s].sampler_state,
+                                                  samplers.sb[s].sampler_unit, pen::TEXTURE_BIND_PS);
+                    }
+                }
 
-                if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
+                // auto instanced batch, offset into the transient instance buffer
+                if (batch)
+                {
+                    u32 vbs[2] = {p_geom->vertex_buffer, aiv->buffer};
+                    u32 strides[2] = {p_geom->vertex_size, (u32)sizeof(cmp_draw_call)};
+                    u32 offsets[2] = {0, batch->offset * (u32)sizeof(cmp_draw_call)};
 
-                // current directional light is a point light very far away
-                // with no attenuation..
-                bool sm = l.flags & e_light_flags::shadow_map;
-                vec3f light_pos = l.direction * k_dir_light_offset;
-                light_buffer.lights[pos].pos_radius = vec4f(light_pos, 0.0);
-                light_buffer.lights[pos].colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+                    pen::renderer_set_vertex_buffers(vbs, 2, 0, strides, offsets);
+                    cur_vb = -1;
 
-                ++num_directions_lights;
-                ++num_lights;
-                ++pos;
-            }
+                    if (cur_ib != p_geom->index_buffer)
+                    {
+                        pen::renderer_set_index_buffer(p_geom->index_buffer, p_geom->index_type, 0);
+                        cur_ib = p_geom->index_buffer;
+                    }
 
-            // point lights
-            s32 num_point_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                    pen::renderer_draw_indexed_instanced(batch->count, 0, p_geom->num_indices, 0, 0, PEN_PT_TRIANGLELIST);
+                    ++num_draw_calls;
+                    num_auto_instances += batch->count;
 
-                cmp_light& l = scene->lights[n];
-                if (l.type != e_light_type::point)
+                    // skip the rest of the batch
+                    i += batch->count - 1;
                     continue;
+                }
 
-                // update bv and transform
-                scene->bounding_volumes[n].min_extents = -vec3f::one();
-                scene->bounding_volumes[n].max_extents = vec3f::one();
+                // set vertex buffer
+                if (scene->entities[n] & e_cmp::master_instance)
+                {
+                    u32 vbs[2] = {p_geom->vertex_buffer, scene->master_instances[n].instance_buffer};
+                    u32 strides[2] = {p_geom->vertex_size, scene->master_instances[n].instance_stride};
+                    u32 offsets[2] = {0};
 
-                f32 rad = std::max<f32>(l.radius, 1.0f) * 2.0f;
-                scene->transforms[n].scale = vec3f(rad, rad, rad);
-                scene->entities[n] |= e_cmp::transform;
+                    pen::renderer_set_vertex_buffers(vbs, 2, 0, strides, offsets);
+                }
+                else
+                {
+                    if(cur_vb != p_geom->vertex_buffer)
+                    {
+                        pen::renderer_set_vertex_buffer(p_geom->vertex_buffer, 0, p_geom->vertex_size, 0);
+                        cur_vb = p_geom->vertex_buffer;
+                    }
+                }
 
-                if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
+                // set index buffer
+                if(cur_ib != p_geom->index_buffer)
+                {
+                    pen::renderer_set_index_buffer(p_geom->index_buffer, p_geom->index_type, 0);
+                    cur_ib = p_geom->index_buffer;
+                }
+                
+                // draw
 
-                cmp_transform& t = scene->transforms[n];
-
-                bool sm = l.flags & e_light_flags::omni_shadow_map;
-                light_buffer.lights[pos].pos_radius = vec4f(t.translation, l.radius);
-                light_buffer.lights[pos].colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+                // instances
+                if (scene->entities[n] & e_cmp::master_instance)
+                {
+                    u32 num_instances = scene->master_instances[n].num_instances;
+                    pen::renderer_draw_indexed_instanced(num_instances, 0, p_geom->num_indices, 0, 0,
+                                                         PEN_PT_TRIANGLELIST);
+                    ++num_draw_calls;
+                    n += num_instances;
+                    continue;
+                }
 
-                ++num_point_lights;
-                ++num_lights;
-                ++pos;
+                // single
+                pen::renderer_draw_indexed(p_geom->num_indices, 0, 0, PEN_PT_TRIANGLELIST);
+                ++num_draw_calls;
             }
 
-            // spot lights
-            s32 num_spot_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            scene->frame_draw_calls += num_draw_calls;
+            scene->frame_auto_instances += num_auto_instances;
+
+            // unbind clusters
+            if (view_permutation & e_shader_permutation::clustered_lights)
             {
-                if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
+                static const u32 k_sb_flags = pen::SBUFFER_BIND_PS | pen::SBUFFER_BIND_READ;
+                pen::renderer_set_structured_buffer(0, 4, k_sb_flags);
+                pen::renderer_set_structured_buffer(0, 5, k_sb_flags);
+                pen::renderer_set_structured_buffer(0, 6, k_sb_flags);
+            }
+        }
 
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+        // keys are found for every channel of a batch of controllers then interpolated together, so the simd kernels
+        // run over the whole batch instead of the few floats of one channel. per batch because batches run on the
+        // job workers, capacity follows the largest update and is released with the scene.
+        struct anim_sample_scratch
+        {
+            f32*          lerp_data;     // a, b, t and out, lerp_capacity floats each
+            f32**         lerp_targets;
+            f32*          slerp_data;    // a, b and out as 4 streams of slerp_capacity floats each, then t
+            anim_target** slerp_targets;
+            u32*          slerp_flags;
+            u32           lerp_capacity;
+            u32           slerp_capacity;
+        };
 
-                cmp_light& l = scene->lights[n];
+        struct anim_job
+        {
+            ecs_scene* scene;
+            const u32* controllers;
+            u32        batch_size;
+            f32        dt;
+        };
 
-                if (l.type != e_light_type::spot)
-                    continue;
+        static void free_anim_scratch(ecs_scene* scene)
+        {
+            for (u32 i = 0; i < scene->anim_scratch_count; ++i)
+            {
+                anim_sample_scratch& as = scene->anim_scratch[i];
+                pen::memory_free(as.lerp_data);
+                pen::memory_free(as.lerp_targets);
+                pen::memory_free(as.slerp_data);
+                pen::memory_free(as.slerp_targets);
+                pen::memory_free(as.slerp_flags);
+            }
 
-                // update bv and transform
-                scene->bounding_volumes[n].min_extents = -vec3f::one();
-                scene->bounding_volumes[n].max_extents = vec3f(1.0f, 0.0f, 1.0f);
+            pen::memory_free(scene->anim_scratch);
+            scene->anim_scratch = nullptr;
+            scene->anim_scratch_count = 0;
+        }
 
-                f32 angle = acos(1.0f - l.cos_cutoff);
-                f32 lo = tan(angle);
-                f32 range = l.radius;
+        // the last key before t, starting from the key found last update since playback moves less than a key most
+        // updates. returns num_frames when t is not inside the keys.
+        static pen_inline u32 find_anim_key(const soa_anim& soa, u32 c, f32 t, u32 cached)
+        {
+            const anim_channel& channel = soa.channels[c];
+            u32                 num_frames = channel.num_frames;
+            if (num_frames == 0 || !(t > soa.info[0][c].time) || t > soa.info[num_frames - 1][c].time)
+                return num_frames;
 
-                scene->transforms[n].scale = vec3f(lo * range, range, lo * range);
-                scene->entities[n] |= e_cmp::transform;
+            if (cached + 1 < num_frames && soa.info[cached][c].time < t && t <= soa.info[cached + 1][c].time)
+                return cached;
 
-                cmp_transform& t = scene->transforms[n];
+            u32 k = channel.key_lookup[anim_key_bucket(channel, t)];
+            while (soa.info[k + 1][c].time < t)
+                ++k;
 
-                vec3f dir = normalized(-scene->world_matrices[n].get_column(1).xyz);
+            return k;
+        }
 
-                bool sm = l.flags & e_light_flags::shadow_map;
-                light_buffer.lights[pos].pos_radius = vec4f(t.translation, l.radius);
-                light_buffer.lights[pos].dir_cutoff = vec4f(dir, l.cos_cutoff);
-                light_buffer.lights[pos].colour = vec4f(l.colour, sm ? 1.0 : 0.0);
-                light_buffer.lights[pos].data = vec4f(l.spot_falloff, 0.0f, 0.0f, 0.0f);
+        static void reserve_anim_scratch(anim_sample_scratch& as, u32 num_lerps, u32 num_slerps)
+        {
+            if (num_lerps > as.lerp_capacity)
+            {
+                as.lerp_capacity = num_lerps;
+                as.lerp_data = (f32*)pen::memory_realloc(as.lerp_data, num_lerps * 4 * sizeof(f32));
+                as.lerp_targets = (f32**)pen::memory_realloc(as.lerp_targets, num_lerps * sizeof(f32*));
+            }
 
-                ++num_spot_lights;
-                ++num_lights;
-                ++pos;
+            if (num_slerps > as.slerp_capacity)
+            {
+                as.slerp_capacity = num_slerps;
+                as.slerp_data = (f32*)pen::memory_realloc(as.slerp_data, num_slerps * 13 * sizeof(f32));
+                as.slerp_targets =
+                    (anim_target**)pen::memory_realloc(as.slerp_targets, num_slerps * sizeof(anim_target*));
+                as.slerp_flags = (u32*)pen::memory_realloc(as.slerp_flags, num_slerps * sizeof(u32));
             }
+        }
 
-            // info for loops
-            light_buffer.info = vec4f(num_directions_lights, num_point_lights, num_spot_lights, 0.0f);
+        // the key before t in the times of a compressed track, clamped so there is always a key after it
+        static pen_inline u32 find_clip_key(const u16* times, u32 num_keys, u16 t, u32 cached)
+        {
+            if (cached + 1 < num_keys && times[cached] <= t && t < times[cached + 1])
+                return cached;
 
-            pen::renderer_update_buffer(scene->forward_light_buffer, &light_buffer, sizeof(light_buffer));
+            u32 k = (u32)(std::upper_bound(times, times + num_keys, t) - times);
+            return std::min<u32>(k > 0 ? k - 1 : 0, num_keys - 2);
+        }
 
-            // Area light buffer
-            static area_light_buffer al_buffer;
+        // rolls on the time of the instance and resets the rotations its channels multiply into, returns true when it
+        // looped
+        static bool roll_anim_instance(anim_instance& instance, f32 dt)
+        {
+            bool looped = false;
 
-            static vec4f corners_al[] = {vec4f(-1.0, 0.0, -1.0, 1.0), vec4f(1.0, 0.0, -1.0, 1.0), vec4f(1.0, 0.0, 1.0, 1.0),
-                                         vec4f(-1.0, 0.0, 1.0, 1.0)};
+            // roll on time
+            instance.time += dt;
+            if (instance.time >= instance.length)
+            {
+                instance.time = 0.0f;
+                looped = true;
+            }
 
-            u32 num_area_lights = 0;
-            u32 num_constant_colour_area_lights = 0;
-            u32 num_textured_area_lights = 0;
-            // constant colour area light
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            if (instance.flags & e_anim_flags::looped)
             {
-                if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
+                instance.flags &= ~e_anim_flags::looped;
+                looped = true;
+            }
 
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+            // reset rotations
+            u32 num_joints = sb_count(instance.joints);
+            for (u32 j = 0; j < num_joints; ++j)
+                instance.targets[j].q = quat(0.0f, 0.0f, 0.0f);
 
-                cmp_light& l = scene->lights[n];
-                if (l.type != e_light_type::area)
+            return looped;
+        }
+
+        // rolls on the time of the instance and finds the keys of its channels, pushing what they interpolate to the
+        // scratch
+        static void sample_anim_instance(anim_instance& instance, f32 dt, anim_sample_scratch& as, u32& num_lerps,
+                                         u32& num_slerps)
+        {
+            soa_anim& soa = instance.soa;
+            u32       num_channels = soa.num_channels;
+            f32       anim_t = instance.time;
+            bool      looped = roll_anim_instance(instance, dt);
+
+            u32  lc = as.lerp_capacity;
+            f32* la = as.lerp_data;
+            f32* lb = la + lc;
+            f32* lt = lb + lc;
+
+            u32  sc = as.slerp_capacity;
+            f32* qa = as.slerp_data;
+            f32* qb = qa + sc * 4;
+            f32* qt = qa + sc * 12;
+
+            for (u32 c = 0; c < num_channels; ++c)
+            {
+                anim_sampler&       sampler = instance.samplers[c];
+                const anim_channel& channel = soa.channels[c];
+
+                if (sampler.joint == PEN_INVALID_HANDLE)
                     continue;
 
-                mat4& wm = scene->world_matrices[n];
-                for (u32 c = 0; c < 4; ++c)
-                    al_buffer.lights[num_area_lights].corners[c] = wm.transform_vector(corners_al[c]);
+                // find the frame we are on..
+                sampler.pos = find_anim_key(soa, c, anim_t, sampler.pos);
 
-                al_buffer.lights[num_area_lights].colour = vec4f(l.colour, num_textured_area_lights);
-                ++num_constant_colour_area_lights;
+                //reset flag
+                sampler.flags &= ~e_anim_flags::looped;
 
-                ++num_area_lights;
-            }
-            // textured / shader / animated area light
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
+                if (sampler.pos >= channel.num_frames || looped)
+                {
+                    sampler.pos = 0;
+                    sampler.flags = e_anim_flags::looped;
+                }
 
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                u32 next = (sampler.pos + 1) % channel.num_frames;
 
-                cmp_light& l = scene->lights[n];
-                if (l.type != e_light_type::area_ex)
-                    continue;
+                // get anim data
+                anim_info& info1 = soa.info[sampler.pos][c];
+                anim_info& info2 = soa.info[next][c];
 
-                mat4& wm = scene->world_matrices[n];
-                for (u32 c = 0; c < 4; ++c)
-                    al_buffer.lights[num_area_lights].corners[c] = wm.transform_vector(corners_al[c]);
+                f32* d1 = &soa.data[sampler.pos][info1.offset];
+                f32* d2 = &soa.data[next][info2.offset];
 
-                scene->draw_call_data[n].v1.y = (f32)anim_time; // time
-                al_buffer.lights[num_area_lights].colour = vec4f(l.colour, num_textured_area_lights);
-                scene->draw_call_data[n].v1.z = (f32)num_textured_area_lights;
-                ++num_textured_area_lights;
+                f32 a = (anim_t - info1.time);
+                f32 b = (info2.time - info1.time);
 
-                ++num_area_lights;
-            }
+                f32 it = min(max(a / b, 0.0f), 1.0f);
 
-            al_buffer.info.x = num_constant_colour_area_lights;
-            al_buffer.info.y = num_textured_area_lights;
+                sampler.prev_t = sampler.cur_t;
+                sampler.cur_t = it;
 
-            pen::renderer_update_buffer(scene->area_light_buffer, &al_buffer, sizeof(al_buffer));
+                anim_target& target = instance.targets[sampler.joint];
 
-            const pmfx::render_target* alrt = pmfx::get_render_target(PEN_HASH("area_light_textures"));
-            if (alrt)
-            {
-                if (alrt->num_arrays < num_area_lights)
+                for (u32 e = 0; e < channel.element_count; ++e)
                 {
-                    pmfx::rt_resize_params rrp;
-                    rrp.width = 640;
-                    rrp.height = 480;
-                    rrp.format = nullptr;
-                    rrp.num_arrays = std::max<u32>(num_area_lights, 1);
-                    rrp.num_mips = -1;
-                    rrp.collection = pen::TEXTURE_COLLECTION_ARRAY;
-                    pmfx::resize_render_target(PEN_HASH("area_light_textures"), rrp);
+                    u32 eo = channel.element_offset[e];
+
+                    // quats are slerped and applied in channel order
+                    if (eo == e_anim_output::quaternion)
+                    {
+                        u32 q = num_slerps++;
+                        for (u32 i = 0; i < 4; ++i)
+                        {
+                            qa[sc * i + q] = d1[e + i];
+                            qb[sc * i + q] = d2[e + i];
+                        }
+
+                        qt[q] = it;
+                        as.slerp_targets[q] = &target;
+                        as.slerp_flags[q] = channel.flags;
+                        e += 3;
+                    }
+                    else
+                    {
+                        // translation / scale
+                        u32 l = num_lerps++;
+                        la[l] = d1[e];
+                        lb[l] = d2[e];
+                        lt[l] = it;
+                        as.lerp_targets[l] = &target.t[eo];
+                    }
                 }
             }
+        }
 
-            // Distance field shadows
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (!(scene->entities[n] & e_cmp::sdf_shadow))
-                    continue;
+        // as sample_anim_instance for a compressed clip, keys are decoded into the same scratch so both kinds of
+        // instance interpolate together. constant translate and scale are written straight to the target.
+        static void sample_anim_clip(anim_instance& instance, f32 dt, anim_sample_scratch& as, u32& num_lerps,
+                                     u32& num_slerps)
+        {
+            static const f32 k_u16_scale = 1.0f / 65535.0f;
 
-                static distance_field_shadow_buffer sdf_buffer;
+            const anim_clip& clip = *instance.clip;
+            f32              anim_t = instance.time;
+            bool             looped = roll_anim_instance(instance, dt);
 
-                sdf_buffer.shadows.world_matrix = scene->world_matrices[n];
-                sdf_buffer.shadows.world_matrix_inverse = mat::inverse4x4(scene->world_matrices[n]);
+            // time in the units of the key times
+            f32 kt = clip.length > 0.0f ? min(max(anim_t / clip.length, 0.0f), 1.0f) * 65535.0f : 0.0f;
 
-                pen::renderer_update_buffer(scene->sdf_shadow_buffer, &sdf_buffer, sizeof(sdf_buffer));
-            }
+            u32  lc = as.lerp_capacity;
+            f32* la = as.lerp_data;
+            f32* lb = la + lc;
+            f32* lt = lb + lc;
 
-            // Shadow maps
+            u32  sc = as.slerp_capacity;
+            f32* qa = as.slerp_data;
+            f32* qb = qa + sc * 4;
+            f32* qt = qa + sc * 12;
 
-            // directional
-            u32 num_shadow_maps = 0;
-            u32 num_omni_shadow_maps = 0;
-            u32 num_gi_maps = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 c = 0; c < clip.num_channels; ++c)
             {
-                if (!(scene->entities[n] & e_cmp::light))
+                anim_sampler& sampler = instance.samplers[c];
+                if (sampler.joint == PEN_INVALID_HANDLE)
                     continue;
 
-                cmp_light& l = scene->lights[n];
-                
-                if (l.flags & e_light_flags::global_illumination)
-                    num_gi_maps++;
-                
-                if (l.flags & e_light_flags::shadow_map)
-                    num_shadow_maps++;
+                sampler.flags = looped ? e_anim_flags::looped : 0;
 
-                if (l.type == e_light_flags::omni_shadow_map)
-                    num_omni_shadow_maps++;
-            }
+                anim_target& target = instance.targets[sampler.joint];
 
-            // resize shadow maps..
-            const pmfx::render_target* sm = pmfx::get_render_target(PEN_HASH("shadow_map"));
-            if(sm)
-            {
-                if (sm->num_arrays < num_shadow_maps)
+                for (u32 tr = clip.channel_tracks[c]; tr < clip.channel_tracks[c + 1]; ++tr)
                 {
-                    pmfx::rt_resize_params rrp;
-                    rrp.width = sm->width;
-                    rrp.height = sm->height;
-                    rrp.format = nullptr;
-                    rrp.num_arrays = num_shadow_maps;
-                    rrp.num_mips = 1;
-                    rrp.collection = pen::TEXTURE_COLLECTION_ARRAY;
-                    pmfx::resize_render_target(PEN_HASH("shadow_map"), rrp);
+                    const anim_track& track = clip.tracks[tr];
+                    bool              quaternion = track.flags & e_anim_track::quaternion;
+
+                    if (track.flags & e_anim_track::constant)
+                    {
+                        if (quaternion)
+                        {
+                            // still slerped so rotations multiply in channel order
+                            u32 q = num_slerps++;
+                            for (u32 i = 0; i < 4; ++i)
+                                qa[sc * i + q] = qb[sc * i + q] = track.base[i];
+
+                            qt[q] = 0.0f;
+                            as.slerp_targets[q] = &target;
+                            as.slerp_flags[q] = track.anim_flags;
+                        }
+                        else
+                        {
+                            for (u32 i = 0; i < track.num_components; ++i)
+                                target.t[track.element_offset[i]] = track.base[i];
+                        }
+                        continue;
+                    }
+
+                    const u16* times = &clip.keys[track.offset];
+                    u32        k = find_clip_key(times, track.num_keys, (u16)kt, instance.track_keys[tr]);
+                    instance.track_keys[tr] = (u16)k;
+
+                    f32 span = (f32)(times[k + 1] - times[k]);
+                    f32 it = span > 0.0f ? min(max((kt - (f32)times[k]) / span, 0.0f), 1.0f) : 0.0f;
+
+                    const u16* values = times + track.num_keys;
+                    if (quaternion)
+                    {
+                        f32 q1[4];
+                        f32 q2[4];
+                        decode_anim_quat(&values[k * 3], q1);
+                        decode_anim_quat(&values[k * 3 + 3], q2);
+
+                        u32 q = num_slerps++;
+                        for (u32 i = 0; i < 4; ++i)
+                        {
+                            qa[sc * i + q] = q1[i];
+                            qb[sc * i + q] = q2[i];
+                        }
+
+                        qt[q] = it;
+                        as.slerp_targets[q] = &target;
+                        as.slerp_flags[q] = track.anim_flags;
+                    }
+                    else
+                    {
+                        u32        n = track.num_components;
+                        const u16* v = &values[k * n];
+                        for (u32 i = 0; i < n; ++i)
+                        {
+                            u32 l = num_lerps++;
+                            la[l] = track.base[i] + track.extent[i] * (f32)v[i] * k_u16_scale;
+                            lb[l] = track.base[i] + track.extent[i] * (f32)v[n + i] * k_u16_scale;
+                            lt[l] = it;
+                            as.lerp_targets[l] = &target.t[track.element_offset[i]];
+                        }
+                    }
                 }
             }
+        }
 
-            // resize omni directional
-            const pmfx::render_target* osm = pmfx::get_render_target(PEN_HASH("omni_shadow_map"));
-            if (osm)
+        // bake anim targets into a cmp transform for each joint
+        static void bake_anim_instance(ecs_scene* scene, const cmp_anim_controller_v2& controller, anim_instance& instance)
+        {
+            u32 num_joints = sb_count(instance.joints);
+
+            u32 tj = PEN_INVALID_HANDLE;
+            for (u32 j = 0; j < num_joints; ++j)
             {
-                if (osm->num_arrays < num_omni_shadow_maps * 6)
+                u32 jnode = controller.joint_indices[j];
+
+                if (scene->entities[jnode] & e_cmp::anim_trajectory)
                 {
-                    pmfx::rt_resize_params rrp;
-                    rrp.width = osm->width;
-                    rrp.height = osm->height;
-                    rrp.format = nullptr;
-                    rrp.num_arrays = num_omni_shadow_maps * 6;
-                    rrp.num_mips = 1;
-                    rrp.collection = pen::TEXTURE_COLLECTION_CUBE_ARRAY;
-                    pmfx::resize_render_target(PEN_HASH("omni_shadow_map"), rrp);
+                    tj = j;
+                    continue;
                 }
+
+                f32* f = &instance.targets[j].t[0];
+
+                instance.joints[j].translation =
+                    vec3f(f[e_anim_output::translate_x], f[e_anim_output::translate_y], f[e_anim_output::translate_z]);
+
+                instance.joints[j].scale =
+                    vec3f(f[e_anim_output::scale_x], f[e_anim_output::scale_y], f[e_anim_output::scale_z]);
+
+                if (instance.targets[j].flags & e_anim_flags::baked_quaternion)
+                    instance.joints[j].rotation = instance.targets[j].q;
+                else
+                    instance.joints[j].rotation = scene->initial_transform[jnode].rotation * instance.targets[j].q;
             }
-            
-            // resize gi maps
-            const pmfx::render_target* gism = pmfx::get_render_target(PEN_HASH("colour_shadow_map"));
-            if (gism)
+
+            // root motion.. todo rotation
+            if (tj != PEN_INVALID_HANDLE)
             {
-                if(gism->num_arrays < num_gi_maps)
+                f32*  f = &instance.targets[tj].t[0];
+                vec3f tt = vec3f(f[0], f[1], f[2]);
+
+                if (instance.samplers[0].flags & e_anim_flags::looped)
                 {
-                    pmfx::rt_resize_params rrp;
-                    rrp.width = gism->width;
-                    rrp.height = gism->height;
-                    rrp.format = nullptr;
-                    rrp.num_arrays = num_gi_maps;
-                    rrp.num_mips = 1;
-                    rrp.collection = pen::TEXTURE_COLLECTION_ARRAY;
-                    pmfx::resize_render_target(PEN_HASH("colour_shadow_map"), rrp);
-                    pmfx::resize_render_target(PEN_HASH("colour_shadow_map_depth"), rrp);
+                    // inherit prev root motion
+                    instance.root_translation = tt;
+                }
+                else
+                {
+                    instance.root_delta = tt - instance.root_translation;
+                    instance.root_translation = tt;
                 }
             }
-            
-            // Update pre skinned vertex buffers
-            static hash_id id_pre_skin_technique = PEN_HASH("pre_skin");
-            static u32     shader = pmfx::load_shader("forward_render");
-            if (pmfx::set_technique_perm(shader, id_pre_skin_technique))
+        }
+
+        // for active controller.anim_instances, make trans, quat, scale
+        //      blend tree
+        static void blend_anim_controller(ecs_scene* scene, u32 n, const cmp_anim_controller_v2& controller)
+        {
+            anim_instance& a = controller.anim_instances[controller.blend.anim_a];
+            anim_instance& b = controller.anim_instances[controller.blend.anim_b];
+            f32            t = controller.blend.ratio;
+
+            u32 num_joints = sb_count(a.joints);
+            for (u32 j = 0; j < num_joints; ++j)
             {
-                for (size_t n = 0; n < scene->num_entities; ++n)
-                {
-                    if (!(scene->entities[n] & e_cmp::pre_skinned))
-                        continue;
+                u32 jnode = controller.joint_indices[j];
 
-                    // update bone cbuffer
-                    cmp_geometry& geom = scene->geometries[n];
-                    if (geom.p_skin->bone_cbuffer == PEN_INVALID_HANDLE)
-                    {
-                        pen::buffer_creation_params bcp;
-                        bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                        bcp.buffer_size = sizeof(mat4) * 85;
-                        bcp.data = nullptr;
+                cmp_transform& tc = scene->transforms[jnode];
+                cmp_transform& ta = a.joints[j];
+                cmp_transform& tb = b.joints[j];
 
-                        geom.p_skin->bone_cbuffer = pen::renderer_create_buffer(bcp);
-                    }
+                if (scene->entities[jnode] & e_cmp::anim_trajectory)
+                {
+                    vec3f lerp_delta = lerp(a.root_delta, b.root_delta, t);
 
-                    static mat4 bb[85];
-                    s32         joints_offset = scene->anim_controller_v2[n].joints_offset;
-                    for (s32 i = 0; i < geom.p_skin->num_joints; ++i)
-                        bb[i] = scene->world_matrices[joints_offset + i] * geom.p_skin->joint_bind_matrices[i];
+                    mat4 rot_mat;
+                    quat q = scene->initial_transform[jnode].rotation;
+                    q.get_matrix(rot_mat);
 
-                    pen::renderer_update_buffer(geom.p_skin->bone_cbuffer, bb, sizeof(bb));
+                    vec3f transform_translation = rot_mat.transform_vector(lerp_delta);
 
-                    // bind stream out targets
-                    cmp_pre_skin& pre_skin = scene->pre_skin[n];
-                    pen::renderer_set_stream_out_target(geom.vertex_buffer);
-                    pen::renderer_set_vertex_buffer(pre_skin.vertex_buffer, 0, pre_skin.vertex_size, 0);
-                    pen::renderer_set_constant_buffer(geom.p_skin->bone_cbuffer, 2, pen::CBUFFER_BIND_VS);
+                    // apply root motion to the root controller, so we bring along the meshes
+                    scene->transforms[n].rotation = q;
+                    scene->transforms[n].translation += transform_translation;
+                    scene->entities[n] |= e_cmp::transform;
 
-                    // render point list
-                    pen::renderer_draw(pre_skin.num_verts, 0, PEN_PT_POINTLIST);
-                    pen::renderer_set_stream_out_target(0);
+                    continue;
                 }
+
+                tc.translation = lerp(ta.translation, tb.translation, t);
+                tc.rotation = slerp2(ta.rotation, tb.rotation, t);
+                tc.scale = lerp(ta.scale, tb.scale, t);
+
+                scene->entities[jnode] |= e_cmp::transform;
             }
+        }
 
-            // update draw call data
-            for (size_t n = 0; n < scene->num_entities; ++n)
+        // controllers only write their own instances, joints and root so batches of them are independent
+        static void update_anim_controllers(u32 start, u32 end, void* user_data)
+        {
+            anim_job*  job = (anim_job*)user_data;
+            ecs_scene* scene = job->scene;
+
+            // a channel interpolates at most translate and scale xyz and 3 quaternions, a compressed track at most 3
+            // components or 1 quaternion
+            u32 max_lerps = 0;
+            u32 max_slerps = 0;
+            for (u32 ci = start; ci < end; ++ci)
             {
-                if (scene->entities[n] & e_cmp::material)
+                const cmp_anim_controller_v2& controller = scene->anim_controller_v2[job->controllers[ci]];
+
+                u32 num_anims = sb_count(controller.anim_instances);
+                for (u32 ai = 0; ai < num_anims; ++ai)
                 {
-                    // per node material cbuffer
-                    if (is_valid(scene->materials[n].material_cbuffer))
-                        pen::renderer_update_buffer(scene->materials[n].material_cbuffer, &scene->material_data[n].data[0],
-                                                    scene->materials[n].material_cbuffer_size);
+                    const anim_instance& instance = controller.anim_instances[ai];
+                    if (instance.clip)
+                    {
+                        max_lerps += instance.clip->num_tracks * 3;
+                        max_slerps += instance.clip->num_tracks;
+                    }
+                    else
+                    {
+                        max_lerps += instance.soa.num_channels * 6;
+                        max_slerps += instance.soa.num_channels * 3;
+                    }
                 }
+            }
 
-                scene->draw_call_data[n].world_matrix = scene->world_matrices[n];
+            anim_sample_scratch& as = scene->anim_scratch[start / job->batch_size];
+            reserve_anim_scratch(as, max_lerps, max_slerps);
 
-                // store node index in v1.x
-                scene->draw_call_data[n].v1.x = (f32)n;
+            u32 num_lerps = 0;
+            u32 num_slerps = 0;
+            for (u32 ci = start; ci < end; ++ci)
+            {
+                const cmp_anim_controller_v2& controller = scene->anim_controller_v2[job->controllers[ci]];
 
-                if (is_invalid_or_null(scene->cbuffer[n]))
-                    continue;
+                u32 num_anims = sb_count(controller.anim_instances);
+                for (u32 ai = 0; ai < num_anims; ++ai)
+                {
+                    anim_instance& instance = controller.anim_instances[ai];
+                    if (instance.flags & e_anim_flags::paused)
+                        continue;
 
-                if (scene->entities[n] & e_cmp::sub_instance)
-                    continue;
+                    if (instance.clip)
+                        sample_anim_clip(instance, job->dt, as, num_lerps, num_slerps);
+                    else
+                        sample_anim_instance(instance, job->dt, as, num_lerps, num_slerps);
+                }
+            }
 
-                // skinned meshes have the world matrix baked into the bones
-                if (scene->entities[n] & e_cmp::skinned || scene->entities[n] & e_cmp::pre_skinned)
-                    scene->draw_call_data[n].world_matrix = mat4::create_identity();
+            // interpolate every key of the batch
+            u32  lc = as.lerp_capacity;
+            f32* lo = as.lerp_data + lc * 3;
+            lerp_keys(as.lerp_data, as.lerp_data + lc, as.lerp_data + lc * 2, lo, num_lerps);
 
-                mat4 invt = scene->world_matrices[n];
+            u32  sc = as.slerp_capacity;
+            f32* so = as.slerp_data + sc * 8;
+            slerp_keys(as.slerp_data, as.slerp_data + sc * 4, as.slerp_data + sc * 12, so, num_slerps, sc);
 
-                invt = invt.transposed();
-                invt = mat::inverse4x4(invt);
+            for (u32 l = 0; l < num_lerps; ++l)
+                *as.lerp_targets[l] = lo[l];
 
-                scene->draw_call_data[n].world_matrix_inv_transpose = invt;
+            for (u32 q = 0; q < num_slerps; ++q)
+            {
+                quat ql;
+                for (u32 i = 0; i < 4; ++i)
+                    ql.v[i] = so[sc * i + q];
 
-                // todo mark dirty?
-                pen::renderer_update_buffer(scene->cbuffer[n], &scene->draw_call_data[n], sizeof(cmp_draw_call));
+                anim_target& target = *as.slerp_targets[q];
+                target.q = ql * target.q;
+                target.flags |= as.slerp_flags[q];
             }
 
-            // update instance buffers
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 ci = start; ci < end; ++ci)
             {
-                if (!(scene->entities[n] & e_cmp::master_instance))
-                    continue;
+                u32                           n = job->controllers[ci];
+                const cmp_anim_controller_v2& controller = scene->anim_controller_v2[n];
 
-                cmp_master_instance& master = scene->master_instances[n];
+                u32 num_anims = sb_count(controller.anim_instances);
+                for (u32 ai = 0; ai < num_anims; ++ai)
+                {
+                    anim_instance& instance = controller.anim_instances[ai];
+                    if (instance.flags & e_anim_flags::paused)
+                        continue;
 
-                u32 instance_data_size = master.num_instances * master.instance_stride;
-                pen::renderer_update_buffer(master.instance_buffer, &scene->draw_call_data[n + 1], instance_data_size);
+                    bake_anim_instance(scene, controller, instance);
+                }
 
-                // stride over sub instances
-                n += scene->master_instances[n].num_instances;
+                if (num_anims > 0)
+                    blend_anim_controller(scene, n, controller);
             }
+        }
 
-            // update physics running 1 frame behind to allow the sets to take effect
-            physics::step(dt);
-            physics::physics_consume_command_buffer();
+        void update_animations(ecs_scene* scene, f32 dt)
+        {
+            static const u32 k_batch_size = 16;
 
-            // controllers post update
-            for (u32 c = 0; c < num_controllers; ++c)
-                if (scene->controllers[c].post_update_func)
-                    scene->controllers[c].post_update_func(scene->controllers[c], scene, dt);
+            f64 start = pen::get_time_us();
 
-            f64 elapsed = pen::timer_elapsed_ms(timer);
-            PEN_UNUSED(elapsed);
-            // PEN_LOG("scene update: %f(ms)", elapsed);
+            anim_job job;
+            job.scene = scene;
+            job.controllers = scene->cmp_lists.list[e_cmp_list::anim_controller];
+            job.batch_size = k_batch_size;
+            job.dt = dt;
+
+            u32 num_controllers = sb_count(job.controllers);
+            u32 num_batches = (num_controllers + k_batch_size - 1) / k_batch_size;
+            if (num_batches > scene->anim_scratch_count)
+            {
+                u32 size = num_batches * sizeof(anim_sample_scratch);
+                u32 used = scene->anim_scratch_count * sizeof(anim_sample_scratch);
+                scene->anim_scratch = (anim_sample_scratch*)pen::memory_realloc(scene->anim_scratch, size);
+                pen::memory_zero((u8*)scene->anim_scratch + used, size - used);
+                scene->anim_scratch_count = num_batches;
+            }
+
+            pen::jobs_parallel_for(num_controllers, k_batch_size, update_anim_controllers, &job);
+
+            scene->update_timings[e_update_stage::animation] = (pen::get_time_us() - start) / 1000.0;
         }
 
-        struct scene_header
+        void update(f32 dt)
         {
-            s32 header_size = sizeof(*this);
-            s32 version = ecs_scene::k_version;
-            u32 num_nodes = 0;
-            s32 num_components = 0;
-            s32 num_lookup_strings = 0;
-            s32 num_extensions = 0;
-            s32 num_base_components = 0;
-            s32 reserved_1[25] = {0};
-            u32 view_flags = 0;
-            s32 selected_index = 0;
-            s32 reserved_2[30] = {0};
-        };
+            //PEN_PERF_SCOPE_PRINT(ecs_update);Oe
+            
+            // allow run time switching between dynamic and fixed timestep
+            static f32 fft = 1.0f / 60.0f;
+            bool       bdt = dev_ui::get_program_preference("dynamic_timestep").as_bool(true);
+            f32        ft = dev_ui::get_program_preference("fixed_timestep").as_f32(fft);
+            if (!bdt)
+            {
+                dt = ft;
+            }
 
-        struct lookup_string
+            for (auto& si : s_scenes)
+            {
+                update_scene(si.scene, dt);
+            }
+        }
+
+        std::vector<ecs_scene_instance>* get_scenes()
         {
-            Str     name;
-            hash_id id;
+            return &s_scenes;
+        }
+
+        static const u32 k_hierarchy_skip_world = (1u << 31);
+        static const u32 k_hierarchy_parent = (1u << 30);
+        static const u32 k_hierarchy_depth_mask = ~(k_hierarchy_skip_world | k_hierarchy_parent);
+
+        struct transform_job
+        {
+            ecs_scene* scene;
+            const u32* entities;
+            u32        batch_size;
+            extents*   batch_extents;
+            a_u32*     num_world_matrix_updates;
         };
-        static lookup_string* s_lookup_strings = nullptr;
 
-        void write_lookup_string(const char* string, std::ofstream& ofs, const c8* strip_project_dir = nullptr)
+        static pen_inline void bake_local_matrix(ecs_scene* scene, u32 n)
         {
-            hash_id id = 0;
+            cmp_transform& t = scene->transforms[n];
 
-            Str stripped = string;
-            if (strip_project_dir)
+            // generate matrix from transform
+            mat4 rot_mat;
+            t.rotation.get_matrix(rot_mat);
+
+            mat4 translation_mat = mat::create_translation(t.translation);
+
+            mat4 scale_mat = mat::create_scale(t.scale);
+
+            scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
+        }
+
+        // physics commands are not thread safe, so physics entities are synced serially.
+        // returns false if the world matrix should not be updated this frame
+        static bool update_physics_transform(ecs_scene* scene, u32 n)
+        {
+            // controlled transform
+            if (scene->entities[n] & e_cmp::transform)
             {
-                stripped = pen::str_replace_string(stripped, strip_project_dir, "");
-                string = stripped.c_str();
+                bake_local_matrix(scene, n);
+
+                if (scene->physics_data[n].type == e_physics_type::rigid_body)
+                {
+                    cmp_transform& t = scene->transforms[n];
+                    cmp_transform& pt = scene->physics_offset[n];
+                    physics::set_transform(scene->physics_handles[n], t.translation + pt.translation, t.rotation);
+                    physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_angular_velocity);
+                    physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_linear_velocity);
+                }
+
+                // local matrix will be baked
+                scene->entities[n] &= ~e_cmp::transform;
+                return true;
             }
 
-            if (!string)
+            if (!physics::has_rb_matrix(n))
+                return false;
+
+            cmp_transform& t = scene->transforms[n];
+            cmp_transform& pt = scene->physics_offset[n];
+
+            mat4 scale_mat = mat::create_scale(t.scale);
+
+            vec3f os = t.scale;
+            t = physics::get_rb_transform(scene->physics_handles[n]);
+            t.scale = os;
+
+            mat4 rot_mat;
+            t.rotation.get_matrix(rot_mat);
+
+            mat4 translation_mat = mat::create_translation(t.translation - pt.translation);
+
+            scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
+            return true;
+        }
+
+        // counting sort of entities by depth in the tree, children are always below parents in the
+        // entity list (see set_entity_parent_validate) so depth can be found in a single pass.
+        static void build_hierarchy_levels(ecs_scene* scene)
+        {
+            u32 num = (u32)scene->num_entities;
+            if (scene->hierarchy_capacity < num + 2)
             {
-                ofs.write((const c8*)&id, sizeof(hash_id));
-                return;
+                u32 cap = scene->soa_size + 2;
+                scene->hierarchy_depth = (u32*)pen::memory_realloc(scene->hierarchy_depth, cap * sizeof(u32));
+                scene->hierarchy_order = (u32*)pen::memory_realloc(scene->hierarchy_order, cap * sizeof(u32));
+                scene->hierarchy_levels = (u32*)pen::memory_realloc(scene->hierarchy_levels, cap * sizeof(u32));
+                scene->hierarchy_capacity = cap;
             }
 
-            id = PEN_HASH(string);
-            ofs.write((const c8*)&id, sizeof(hash_id));
+            u32* depth = scene->hierarchy_depth;
+            u32* levels = scene->hierarchy_levels;
+            u32* order = scene->hierarchy_order;
 
-            u32 num_strings = sb_count(s_lookup_strings);
-            for (u32 i = 0; i < num_strings; ++i)
+            u32 max_depth = 0;
+            levels[0] = 0;
+            levels[1] = 0;
+
+            for (u32 n = 0; n < num; ++n)
             {
-                if (id == s_lookup_strings[i].id)
+                // force physics entity to sync and ignore controlled transform
+                if (scene->state_flags[n] & e_state::sync_physics_transform)
                 {
-                    return;
+                    scene->state_flags[n] &= ~e_state::sync_physics_transform;
+                    scene->entities[n] &= ~e_cmp::transform;
+                }
+
+                u32 skip = 0;
+                if (scene->entities[n] & e_cmp::physics)
+                {
+                    if (update_physics_transform(scene, n))
+                        scene->dirty_flags[n] |= e_dirty::world_matrix;
+                    else
+                        skip = k_hierarchy_skip_world;
+                }
+
+                u32 parent = scene->parents[n];
+                u32 d = 0;
+                if (parent < n)
+                {
+                    d = (depth[parent] & k_hierarchy_depth_mask) + 1;
+                    depth[parent] |= k_hierarchy_parent;
+                }
+
+                if (d > max_depth)
+                {
+                    max_depth = d;
+                    levels[d + 1] = 0;
                 }
+
+                levels[d + 1]++;
+                depth[n] = d | skip;
             }
 
-            lookup_string ls = {string, id};
-            sb_push(s_lookup_strings, ls);
+            // level start offsets
+            for (u32 d = 1; d <= max_depth + 1; ++d)
+                levels[d] += levels[d - 1];
+
+            // scatter, levels[d] becomes the end of level d, then shift back to starts
+            for (u32 n = 0; n < num; ++n)
+            {
+                u32 d = depth[n] & k_hierarchy_depth_mask;
+                order[levels[d]++] = n | (depth[n] & k_hierarchy_skip_world);
+            }
+
+            for (u32 d = max_depth + 1; d > 0; --d)
+                levels[d] = levels[d - 1];
+
+            levels[0] = 0;
+
+            scene->num_hierarchy_levels = num > 0 ? max_depth + 1 : 0;
         }
 
-        Str read_lookup_string(std::ifstream& ifs)
+        static void update_transforms_and_bounds(u32 start, u32 end, void* user_data)
+        {
+            static const vec3f corners[] = {vec3f(0.0f, 0.0f, 0.0f),
+
+                                            vec3f(1.0f, 0.0f, 0.0f), vec3f(0.0f, 1.0f, 0.0f), vec3f(0.0f, 0.0f, 1.0f),
+
+                                            vec3f(1.0f, 1.0f, 0.0f), vec3f(0.0f, 1.0f, 1.0f), vec3f(1.0f, 0.0f, 1.0f),
+
+                                            vec3f(1.0f, 1.0f, 1.0f)};
+
+            transform_job* job = (transform_job*)user_data;
+            ecs_scene*     scene = job->scene;
+            extents&       ext = job->batch_extents[start / job->batch_size];
+            u32            num_updates = 0;
+
+            for (u32 i = start; i < end; ++i)
+            {
+                u32 n = job->entities[i];
+
+                if (n & k_hierarchy_skip_world)
+                {
+                    n &= ~k_hierarchy_skip_world;
+                }
+                else
+                {
+                    // controlled transform, physics entities have already been baked
+                    if (scene->entities[n] & e_cmp::transform)
+                    {
+                        bake_local_matrix(scene, n);
+                        scene->entities[n] &= ~e_cmp::transform;
+                        scene->dirty_flags[n] |= e_dirty::world_matrix;
+                    }
+
+                    // parents are in an earlier level so their dirty state is final
+                    u32 parent = scene->parents[n];
+                    if (parent != n && (scene->dirty_flags[parent] & e_dirty::world_matrix))
+                        scene->dirty_flags[n] |= e_dirty::world_matrix;
+
+                    // heirarchical scene transform
+                    if (scene->dirty_flags[n] & e_dirty::world_matrix)
+                    {
+                        if (parent == n)
+                            scene->world_matrices[n] = scene->local_matrices[n];
+                        else
+                            scene->world_matrices[n] = scene->world_matrices[parent] * scene->local_matrices[n];
+
+                        scene->dirty_flags[n] |= e_dirty::draw_call;
+                        ++num_updates;
+                    }
+                }
+
+                vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
+                vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
+
+                // clean leaves keep last frames bounds, parents are always rebuilt because they are expanded by children
+                bool bounds_dirty = scene->dirty_flags[n] & e_dirty::world_matrix;
+                bounds_dirty |= (scene->hierarchy_depth[n] & k_hierarchy_parent) != 0;
+
+                if (!bounds_dirty)
+                {
+                    if (scene->entities[n] & e_cmp::geometry && !(scene->entities[n] & e_cmp::bone))
+                    {
+                        ext.min = min_union(tmin, ext.min);
+                        ext.max = max_union(tmax, ext.max);
+                    }
+                    continue;
+                }
+
+                // bounding volume transform
+                vec3f min = scene->bounding_volumes[n].min_extents;
+                vec3f max = scene->bounding_volumes[n].max_extents - min;
+
+                if (scene->entities[n] & e_cmp::bone)
+                {
+                    tmin = tmax = scene->world_matrices[n].get_translation();
+                    continue;
+                }
+
+                tmax = -vec3f::flt_max();
+                tmin = vec3f::flt_max();
+
+                for (s32 c = 0; c < 8; ++c)
+                {
+                    vec3f p = scene->world_matrices[n].transform_vector(min + max * corners[c]);
+
+                    tmax = max_union(tmax, p);
+                    tmin = min_union(tmin, p);
+                }
+
+                f32& trad = scene->bounding_volumes[n].radius;
+                trad = mag(tmax - tmin) * 0.5f;
+
+                // pos extent for faster aabb and sphere culling
+                auto& pe = scene->pos_extent[n];
+                pe.pos.xyz = tmin + (tmax - tmin) * 0.5f;
+                pe.extent.xyz = tmax - pe.pos.xyz;
+                pe.extent.w = trad;
+
+                // soa copy for the culling kernels
+                cull_bounds& cb = scene->bounds;
+                cb.pos_x[n] = pe.pos.x;
+                cb.pos_y[n] = pe.pos.y;
+                cb.pos_z[n] = pe.pos.z;
+                cb.extent_x[n] = pe.extent.x;
+                cb.extent_y[n] = pe.extent.y;
+                cb.extent_z[n] = pe.extent.z;
+                cb.radius[n] = pe.extent.w;
+
+                scene->dirty_flags[n] |= e_dirty::bounds;
+
+                if (!(scene->entities[n] & e_cmp::geometry))
+                    continue;
+
+                // also set scene extents
+                ext.min = min_union(tmin, ext.min);
+                ext.max = max_union(tmax, ext.max);
+            }
+
+            *job->num_world_matrix_updates += num_updates;
+        }
+
+        void update_scene_transforms(ecs_scene* scene)
+        {
+            static const u32 k_batch_size = 128;
+
+            f64 start = pen::get_time_us();
+
+            build_hierarchy_levels(scene);
+
+            f64 hierarchy_end = pen::get_time_us();
+
+            scene->renderable_extents.min = vec3f::flt_max();
+            scene->renderable_extents.max = -vec3f::flt_max();
+
+            // world matrices, bounding volumes and pos extents level by level, each level in parallel batches
+            a_u32 num_world_matrix_updates = {0};
+
+            transform_job job;
+            job.scene = scene;
+            job.batch_size = k_batch_size;
+            job.num_world_matrix_updates = &num_world_matrix_updates;
+
+            for (u32 l = 0; l < scene->num_hierarchy_levels; ++l)
+            {
+                u32 level_start = scene->hierarchy_levels[l];
+                u32 count = scene->hierarchy_levels[l + 1] - level_start;
+                u32 num_batches = (count + k_batch_size - 1) / k_batch_size;
+
+                if (num_batches > scene->transform_batch_capacity)
+                {
+                    scene->transform_batch_capacity = num_batches;
+                    scene->transform_batch_extents = (extents*)pen::memory_realloc(scene->transform_batch_extents,
+                                                                                   num_batches * sizeof(extents));
+                }
+
+                extents* batch_extents = scene->transform_batch_extents;
+
+                for (u32 b = 0; b < num_batches; ++b)
+                {
+                    batch_extents[b].min = vec3f::flt_max();
+                    batch_extents[b].max = -vec3f::flt_max();
+                }
+
+                job.entities = &scene->hierarchy_order[level_start];
+                job.batch_extents = batch_extents;
+
+                pen::jobs_parallel_for(count, k_batch_size, update_transforms_and_bounds, &job);
+
+                for (u32 b = 0; b < num_batches; ++b)
+                {
+                    scene->renderable_extents.min = min_union(batch_extents[b].min, scene->renderable_extents.min);
+                    scene->renderable_extents.max = max_union(batch_extents[b].max, scene->renderable_extents.max);
+                }
+            }
+
+            scene->num_world_matrix_updates = pen_atomic_load(num_world_matrix_updates);
+
+            f64 transforms_end = pen::get_time_us();
+
+            // reverse iterate over scene and expand parents extents by children
+            for (intptr_t n = scene->num_entities - 1; n > 0; --n)
+            {
+                if (!(scene->entities[n] & e_cmp::allocated))
+                    continue;
+
+                u32 p = scene->parents[n];
+                if (p == n)
+                    continue;
+
+                vec3f& parent_tmin = scene->bounding_volumes[p].transformed_min_extents;
+                vec3f& parent_tmax = scene->bounding_volumes[p].transformed_max_extents;
+
+                vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
+                vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
+
+                if (scene->entities[p] & e_cmp::anim_controller)
+                {
+                    vec3f pad = vec3f(0.0f);
+
+                    parent_tmin = min_union(parent_tmin, tmin - pad);
+                    parent_tmax = max_union(parent_tmax, tmax + pad);
+                }
+                else
+                {
+                    parent_tmin = min_union(parent_tmin, tmin);
+                    parent_tmax = max_union(parent_tmax, tmax);
+                }
+            }
+
+            f64 end = pen::get_time_us();
+
+            scene->update_timings[e_update_stage::hierarchy] = (hierarchy_end - start) / 1000.0;
+            scene->update_timings[e_update_stage::transforms] = (transforms_end - hierarchy_end) / 1000.0;
+            scene->update_timings[e_update_stage::parent_extents] = (end - transforms_end) / 1000.0;
+        }
+
+        static pen_inline bool is_renderable(u64 flags)
+        {
+            static const u64 k_accept = e_cmp::geometry | e_cmp::material;
+            static const u64 k_reject = e_cmp::sub_instance;
+
+            return (flags & k_accept) == k_accept && !(flags & k_reject);
+        }
+
+        static void update_renderables(ecs_scene* scene)
+        {
+            renderable_set& rs = scene->renderables;
+            u32             num = (u32)scene->num_entities;
+
+            if (rs.capacity < scene->soa_size)
+            {
+                u32 cap = scene->soa_size;
+                rs.list = (u32*)pen::memory_realloc(rs.list, cap * sizeof(u32));
+                rs.merge = (u32*)pen::memory_realloc(rs.merge, cap * sizeof(u32));
+                rs.added = (u32*)pen::memory_realloc(rs.added, cap * sizeof(u32));
+                rs.state = (u8*)pen::memory_realloc(rs.state, cap);
+                pen::memory_zero(&rs.state[rs.capacity], cap - rs.capacity);
+                rs.capacity = cap;
+            }
+
+            // diff flags against the last update, entities past num_entities have been removed
+            u32 scan = std::max<u32>(num, rs.num_scanned);
+            u32 num_added = 0;
+            u32 num_removed = 0;
+            for (u32 n = 0; n < scan; ++n)
+            {
+                u8 renderable = (n < num && is_renderable(scene->entities[n])) ? 1 : 0;
+                if (renderable == rs.state[n])
+                    continue;
+
+                rs.state[n] = renderable;
+
+                if (renderable)
+                    rs.added[num_added++] = n;
+                else
+                    ++num_removed;
+            }
+
+            rs.num_scanned = num;
+            scene->num_renderable_changes = num_added + num_removed;
+
+            if (num_added == 0 && num_removed == 0)
+                return;
+
+            // merge the added entities in order and drop the removed ones
+            u32 i = 0;
+            u32 a = 0;
+            u32 count = 0;
+            while (i < rs.count || a < num_added)
+            {
+                if (a == num_added || (i < rs.count && rs.list[i] < rs.added[a]))
+                {
+                    u32 n = rs.list[i++];
+                    if (rs.state[n])
+                        rs.merge[count++] = n;
+                }
+                else
+                {
+                    rs.merge[count++] = rs.added[a++];
+                }
+            }
+
+            std::swap(rs.list, rs.merge);
+            rs.count = count;
+        }
+
+        namespace
+        {
+            // component flag of each e_cmp_list
+            const u64 k_cmp_list_flags[] = {e_cmp::light, e_cmp::sdf_shadow, e_cmp::pre_skinned, e_cmp::master_instance,
+                                            e_cmp::anim_controller};
+            static_assert(PEN_ARRAY_SIZE(k_cmp_list_flags) == e_cmp_list::COUNT, "missing component list flag");
+        } // namespace
+
+        static pen_inline u8 cmp_list_state(u64 flags)
+        {
+            u8 state = 0;
+            for (u32 l = 0; l < e_cmp_list::COUNT; ++l)
+                if (flags & k_cmp_list_flags[l])
+                    state |= 1 << l;
+
+            return state;
+        }
+
+        void update_component_lists(ecs_scene* scene)
+        {
+            f64 start = pen::get_time_us();
+
+            component_lists& cl = scene->cmp_lists;
+            u32              num = (u32)scene->num_entities;
+
+            if (cl.capacity < scene->soa_size)
+            {
+                u32 cap = scene->soa_size;
+                cl.state = (u8*)pen::memory_realloc(cl.state, cap);
+                pen::memory_zero(&cl.state[cl.capacity], cap - cl.capacity);
+                cl.capacity = cap;
+            }
+
+            if (cl.changed)
+                stb__sbn(cl.changed) = 0;
+
+            // diff flags against the last update, entities past num_entities have been removed
+            u32 scan = std::max<u32>(num, cl.num_scanned);
+            u8  changed_lists = 0;
+            for (u32 n = 0; n < scan; ++n)
+            {
+                u8 state = n < num ? cmp_list_state(scene->entities[n]) : 0;
+                if (state == cl.state[n])
+                    continue;
+
+                changed_lists |= state ^ cl.state[n];
+                cl.state[n] = state;
+                sb_push(cl.changed, n);
+            }
+
+            cl.num_scanned = num;
+            cl.num_changes = sb_count(cl.changed);
+
+            // merge the changed entities into each list they affect, in order
+            for (u32 l = 0; l < e_cmp_list::COUNT; ++l)
+            {
+                if (!(changed_lists & (1 << l)))
+                    continue;
+
+                u32*&      list = cl.list[l];
+                const u32* changed = cl.changed;
+                u32        num_list = sb_count(list);
+                u32        num_changed = cl.num_changes;
+                u8         bit = 1 << l;
+
+                if (cl.merge)
+                    stb__sbn(cl.merge) = 0;
+
+                u32 i = 0;
+                u32 c = 0;
+                while (i < num_list || c < num_changed)
+                {
+                    u32 n;
+                    if (c == num_changed || (i < num_list && list[i] < changed[c]))
+                    {
+                        n = list[i++];
+                    }
+                    else
+                    {
+                        n = changed[c++];
+                        if (i < num_list && list[i] == n)
+                            ++i;
+                    }
+
+                    if (cl.state[n] & bit)
+                        sb_push(cl.merge, n);
+                }
+
+                std::swap(list, cl.merge);
+            }
+
+            scene->update_timings[e_update_stage::component_lists] = (pen::get_time_us() - start) / 1000.0;
+        }
+
+        //
+        // lights
+        //
+
+        namespace
+        {
+            // point_light_attenuation_cutoff reaches 0 at sqrt(5) * radius
+            const f32 k_point_light_reach = 2.2360680f;
+        } // namespace
+
+        // spot lights are binned as a cone as long as their radius, the same volume deferred rendering lights
+        static vec4f spot_light_bounds(const vec3f& pos, const vec3f& dir, f32 range, f32 cos_cutoff)
+        {
+            // pixels are lit when 1 - cos(angle to the axis) < cos_cutoff
+            f32 cos_angle = std::min<f32>(std::max<f32>(1.0f - cos_cutoff, 0.0f), 1.0f);
+            if (cos_angle <= 0.0f)
+                return vec4f(pos, range);
+
+            // narrow cones are bound by the sphere through the apex and rim, wide ones by the sphere around the rim
+            if (cos_angle >= 0.70710678f)
+            {
+                f32 r = range / (2.0f * cos_angle * cos_angle);
+                return vec4f(pos + dir * r, r);
+            }
+
+            f32 tan_angle = sqrt(1.0f - cos_angle * cos_angle) / cos_angle;
+            return vec4f(pos + dir * range, range * tan_angle);
+        }
+
+        void update_light_volumes(ecs_scene* scene)
+        {
+            const u32* lights = scene->cmp_lists.list[e_cmp_list::light];
+            u32        num_lights = sb_count(lights);
+
+            for (u32 i = 0; i < num_lights; ++i)
+            {
+                u32              n = lights[i];
+                const cmp_light& l = scene->lights[n];
+
+                vec3f scale;
+                if (l.type == e_light_type::point)
+                {
+                    f32 rad = std::max<f32>(l.radius, 1.0f) * 2.0f;
+                    scale = vec3f(rad, rad, rad);
+                }
+                else if (l.type == e_light_type::spot)
+                {
+                    f32 angle = acos(1.0f - l.cos_cutoff);
+                    f32 lo = tan(angle);
+                    f32 range = l.radius;
+                    scale = vec3f(lo * range, range, lo * range);
+                }
+                else
+                {
+                    continue;
+                }
+
+                cmp_transform& tr = scene->transforms[n];
+                if (tr.scale.x == scale.x && tr.scale.y == scale.y && tr.scale.z == scale.z)
+                    continue;
+
+                tr.scale = scale;
+                scene->entities[n] |= e_cmp::transform;
+            }
+        }
+
+        void update_lights(ecs_scene* scene)
+        {
+            f64 start = pen::get_time_us();
+
+            // sb per light type of entity and shadow slice pairs in entity order
+            static u32* s_buckets[e_light_type::area_ex + 1] = {0};
+            for (u32 t = 0; t <= e_light_type::area_ex; ++t)
+                if (s_buckets[t])
+                    stb__sbn(s_buckets[t]) = 0;
+
+            // shadow map slices are taken in entity order by shadow_map and global_illumination lights, and omni shadow
+            // cubemaps by omni_shadow_map lights, the same order update_shadow_slices builds them in
+            static const u32 k_slice_lights = e_light_flags::shadow_map | e_light_flags::global_illumination;
+
+            const u32* lights = scene->cmp_lists.list[e_cmp_list::light];
+            u32        num_lights = sb_count(lights);
+
+            u32 num_slices = 0;
+            u32 num_omni = 0;
+            for (u32 i = 0; i < num_lights; ++i)
+            {
+                u32              n = lights[i];
+                const cmp_light& l = scene->lights[n];
+                if (l.type > e_light_type::area_ex)
+                    continue;
+
+                u32 slice = -1;
+                if (l.flags & k_slice_lights)
+                    slice = num_slices++;
+
+                if (l.flags & e_light_flags::omni_shadow_map)
+                {
+                    u32 omni = num_omni++;
+                    if (l.type == e_light_type::point)
+                        slice = omni;
+                }
+
+                sb_push(s_buckets[l.type], n);
+                sb_push(s_buckets[l.type], slice);
+            }
+
+            light_set& ls = scene->packed_lights;
+            ls.num_dir = sb_count(s_buckets[e_light_type::dir]) / 2;
+            ls.num_point = sb_count(s_buckets[e_light_type::point]) / 2;
+            ls.num_spot = sb_count(s_buckets[e_light_type::spot]) / 2;
+            ls.count = ls.num_dir + ls.num_point + ls.num_spot;
+            ++ls.version;
+
+            if (ls.count > ls.capacity)
+            {
+                ls.capacity = std::max<u32>(ls.count, ls.capacity * 2);
+                ls.data = (light_data*)pen::memory_realloc(ls.data, ls.capacity * sizeof(light_data));
+                ls.bounds = (vec4f*)pen::memory_realloc(ls.bounds, ls.capacity * sizeof(vec4f));
+            }
+
+            u32 pos = 0;
+            for (u32 t = e_light_type::dir; t <= e_light_type::spot; ++t)
+            {
+                const u32* bucket = s_buckets[t];
+                u32        num = sb_count(bucket) / 2;
+
+                for (u32 i = 0; i < num; ++i, ++pos)
+                {
+                    u32              n = bucket[i * 2];
+                    f32              slice = (f32)(s32)bucket[i * 2 + 1];
+                    const cmp_light& l = scene->lights[n];
+                    cmp_transform&   tr = scene->transforms[n];
+                    light_data&      ld = ls.data[pos];
+
+                    ld.data = vec4f(0.0f, slice, (f32)t, 0.0f);
+
+                    if (t == e_light_type::dir)
+                    {
+                        scene->bounding_volumes[n].min_extents = -vec3f(FLT_MAX);
+                        scene->bounding_volumes[n].max_extents = vec3f(FLT_MAX);
+
+                        // current directional light is a point light very far away
+                        // with no attenuation..
+                        bool sm = l.flags & e_light_flags::shadow_map;
+                        ld.pos_radius = vec4f(l.direction * k_dir_light_offset, 0.0);
+                        ld.dir_cutoff = vec4f::zero();
+                        ld.colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+                        ls.bounds[pos] = vec4f(vec3f::zero(), FLT_MAX);
+                    }
+                    else if (t == e_light_type::point)
+                    {
+                        scene->bounding_volumes[n].min_extents = -vec3f::one();
+                        scene->bounding_volumes[n].max_extents = vec3f::one();
+
+                        bool sm = l.flags & e_light_flags::omni_shadow_map;
+                        ld.pos_radius = vec4f(tr.translation, l.radius);
+                        ld.dir_cutoff = vec4f::zero();
+                        ld.colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+                        ls.bounds[pos] = vec4f(tr.translation, l.radius * k_point_light_reach);
+                    }
+                    else
+                    {
+                        scene->bounding_volumes[n].min_extents = -vec3f::one();
+                        scene->bounding_volumes[n].max_extents = vec3f(1.0f, 0.0f, 1.0f);
+
+                        f32   range = l.radius;
+                        vec3f dir = normalized(-scene->world_matrices[n].get_column(1).xyz);
+
+                        bool sm = l.flags & e_light_flags::shadow_map;
+                        ld.pos_radius = vec4f(tr.translation, l.radius);
+                        ld.dir_cutoff = vec4f(dir, l.cos_cutoff);
+                        ld.colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+                        ld.data.x = l.spot_falloff;
+                        ls.bounds[pos] = spot_light_bounds(tr.translation, dir, range, l.cos_cutoff);
+                    }
+                }
+            }
+
+            // area lights are not packed, constant colour ones come first
+            if (ls.area_entities)
+                stb__sbn(ls.area_entities) = 0;
+
+            for (u32 t = e_light_type::area; t <= e_light_type::area_ex; ++t)
+            {
+                const u32* bucket = s_buckets[t];
+                u32        num = sb_count(bucket) / 2;
+                for (u32 i = 0; i < num; ++i)
+                    sb_push(ls.area_entities, bucket[i * 2]);
+
+                if (t == e_light_type::area)
+                    ls.num_area = num;
+            }
+
+            scene->update_timings[e_update_stage::lights] = (pen::get_time_us() - start) / 1000.0;
+        }
+
+        // rigs only write their own range of the palettes so batches of them are independent
+        static void build_bone_palettes(u32 start, u32 end, void* user_data)
+        {
+            ecs_scene*        scene = (ecs_scene*)user_data;
+            bone_palette_set& bp = scene->bone_palettes;
+
+            for (u32 i = start; i < end; ++i)
+            {
+                u32                           n = bp.rebuild[i];
+                const cmp_anim_controller_v2& controller = scene->anim_controller_v2[n];
+                const cmp_skin*               skin = scene->geometries[n].p_skin;
+
+                mat4*       palette = &bp.matrices[controller.bone_offset];
+                const mat4* joints = &scene->world_matrices[controller.joints_offset];
+                for (u32 j = 0; j < skin->num_joints; ++j)
+                    palette[j] = joints[j] * skin->joint_bind_matrices[j];
+            }
+        }
+
+        void update_bone_palettes(ecs_scene* scene)
+        {
+            f64 start = pen::get_time_us();
+
+            static const u32 k_batch_size = 16;
+            static const u64 k_rig_flags = e_cmp::skinned | e_cmp::pre_skinned;
+
+            bone_palette_set& bp = scene->bone_palettes;
+            const u32*        controllers = scene->cmp_lists.list[e_cmp_list::anim_controller];
+            u32               num_controllers = sb_count(controllers);
+
+            if (num_controllers > bp.rig_capacity)
+            {
+                bp.rig_capacity = std::max<u32>(num_controllers, bp.rig_capacity * 2);
+                bp.rigs = (u32*)pen::memory_realloc(bp.rigs, bp.rig_capacity * sizeof(u32));
+                bp.rebuild = (u32*)pen::memory_realloc(bp.rebuild, bp.rig_capacity * sizeof(u32));
+            }
+
+            // palettes are packed in controller order, a rig is rebuilt when any of its joints moved or when it moved
+            // in the packing because a rig before it was added or removed
+            bool offsets_changed = false;
+            bp.count = 0;
+            bp.num_rigs = 0;
+            bp.num_rebuild = 0;
+            for (u32 i = 0; i < num_controllers; ++i)
+            {
+                u32 n = controllers[i];
+                if (!(scene->entities[n] & k_rig_flags))
+                    continue;
+
+                cmp_anim_controller_v2& controller = scene->anim_controller_v2[n];
+                const cmp_skin*         skin = scene->geometries[n].p_skin;
+                if (!skin || !is_valid(controller.joints_offset))
+                    continue;
+
+                if (controller.joints_offset + skin->num_joints > scene->num_entities)
+                    continue;
+
+                bool rebuild = controller.bone_offset != bp.count;
+                if (rebuild)
+                {
+                    controller.bone_offset = bp.count;
+                    offsets_changed = true;
+                }
+
+                const u32* dirty = &scene->dirty_flags[controller.joints_offset];
+                for (u32 j = 0; j < skin->num_joints && !rebuild; ++j)
+                    rebuild = dirty[j] & e_dirty::world_matrix;
+
+                bp.rigs[bp.num_rigs++] = n;
+                if (rebuild)
+                {
+                    bp.rebuild[bp.num_rebuild++] = n;
+                    scene->dirty_flags[n] |= e_dirty::bone_palette;
+                }
+
+                bp.count += skin->num_joints;
+            }
+
+            if (bp.count > bp.capacity)
+            {
+                bp.capacity = std::max<u32>(bp.count, bp.capacity * 2);
+                bp.matrices = (mat4*)pen::memory_realloc(bp.matrices, bp.capacity * sizeof(mat4));
+            }
+
+            pen::jobs_parallel_for(bp.num_rebuild, k_batch_size, build_bone_palettes, scene);
+
+            // draw calls carry the offset, sub geometry takes it from its rig so every skinned entity is uploaded
+            if (offsets_changed)
+                for (u32 n = 0; n < scene->num_entities; ++n)
+                    if (scene->entities[n] & k_rig_flags)
+                        scene->dirty_flags[n] |= e_dirty::draw_call;
+
+            scene->num_palette_builds = bp.num_rebuild;
+            scene->update_timings[e_update_stage::bone_palettes] = (pen::get_time_us() - start) / 1000.0;
+        }
+
+        void update_scene(ecs_scene* scene, f32 dt)
+        {
+            // static anim time to pass into draw calls etc..
+            f32 anim_time = pen::get_time_ms() / 1000.0f;
+
+            u32 num_controllers = sb_count(scene->controllers);
+            u32 num_extensions = sb_count(scene->extensions);
+
+            // streamed entities are added first so every system sees them this update
+            update_scene_streams(scene);
+
+            // pre update controllers
+            for (u32 c = 0; c < num_controllers; ++c)
+                if (scene->controllers[c].update_func)
+                    scene->controllers[c].update_func(scene->controllers[c], scene, dt);
+
+            // systems below only visit the entities which have their component
+            update_component_lists(scene);
+            const component_lists& cl = scene->cmp_lists;
+
+            if (scene->flags & e_scene_flags::pause_update)
+            {
+                physics::set_paused(1);
+            }
+            else
+            {
+                physics::set_paused(0);
+                update_animations(scene, dt);
+            }
+
+            // extension component update
+            for (u32 e = 0; e < num_extensions; ++e)
+                if (scene->extensions[e].update_func)
+                    scene->extensions[e].update_func(scene->extensions[e], scene, dt);
+
+            static pen::timer* timer = pen::timer_create();
+            pen::timer_start(timer);
+
+            update_light_volumes(scene);
+            update_scene_transforms(scene);
+            update_renderables(scene);
+            update_bvh(scene);
+            update_occluders(scene);
+
+            // skinned casters are only re-rendered into shadow slices when their palette is rebuilt
+            update_bone_palettes(scene);
+            update_shadow_slices(scene);
+
+            // publish last frames render counters
+            scene->num_draws = pen_atomic_load(scene->frame_draws);
+            scene->num_draw_calls = pen_atomic_load(scene->frame_draw_calls);
+            scene->num_auto_instances = pen_atomic_load(scene->frame_auto_instances);
+            scene->num_state_changes = pen_atomic_load(scene->frame_state_changes);
+            scene->num_state_changes_unsorted = pen_atomic_load(scene->frame_state_changes_unsorted);
+            scene->num_occluded = pen_atomic_load(scene->frame_occluded);
+            scene->occlusion_ms = pen_atomic_load(scene->frame_occlusion_us) / 1000.0;
+            scene->num_shadow_slices_rendered = pen_atomic_load(scene->frame_shadow_slices_rendered);
+            scene->num_shadow_slices_reused = pen_atomic_load(scene->frame_shadow_slices_reused);
+            scene->num_binned_lights = pen_atomic_load(scene->frame_binned_lights);
+            scene->light_binning_ms = pen_atomic_load(scene->frame_light_binning_us) / 1000.0;
+            scene->num_view_cull_sweeps = pen_atomic_load(scene->frame_view_cull_sweeps);
+            scene->frame_draws = 0;
+            scene->frame_draw_calls = 0;
+            scene->frame_auto_instances = 0;
+            scene->frame_state_changes = 0;
+            scene->frame_state_changes_unsorted = 0;
+            scene->frame_occluded = 0;
+            scene->frame_occlusion_us = 0;
+            scene->frame_shadow_slices_rendered = 0;
+            scene->frame_shadow_slices_reused = 0;
+            scene->frame_binned_lights = 0;
+            scene->frame_light_binning_us = 0;
+            scene->frame_view_cull_sweeps = 0;
+
+            // the bounds have moved, views cull again
+            scene->view_culls.swept = false;
+
+            // lights
+            update_lights(scene);
+            light_set& ls = scene->packed_lights;
+
+            // Forward light buffer, light_set is packed in the same order so the first lights that fit are used
+            static forward_light_buffer light_buffer;
+            memset(&light_buffer, 0x0, sizeof(forward_light_buffer));
+
+            u32 num_lights = std::min<u32>(ls.count, e_scene_limits::max_forward_lights);
+            memcpy(&light_buffer.lights[0], ls.data, num_lights * sizeof(light_data));
+
+            // info for loops
+            u32 num_directions_lights = std::min<u32>(ls.num_dir, num_lights);
+            u32 num_point_lights = std::min<u32>(ls.num_point, num_lights - num_directions_lights);
+            u32 num_spot_lights = num_lights - num_directions_lights - num_point_lights;
+            light_buffer.info = vec4f(num_directions_lights, num_point_lights, num_spot_lights, 0.0f);
+
+            pen::renderer_update_buffer(scene->forward_light_buffer, &light_buffer, sizeof(light_buffer));
+
+            // every light for clustered views, the buffer grows when there are more
+            if ((scene->flags & e_scene_flags::clustered_lights) && ls.count)
+            {
+                if (ls.count > ls.buffer_capacity)
+                {
+                    if (is_valid(ls.buffer))
+                        pen::renderer_release_buffer(ls.buffer);
+
+                    ls.buffer_capacity = std::max<u32>(ls.count, ls.buffer_capacity * 2);
+
+                    pen::buffer_creation_params bcp;
+                    bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                    bcp.bind_flags = PEN_BIND_SHADER_RESOURCE;
+                    bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                    bcp.buffer_size = sizeof(light_data) * ls.buffer_capacity;
+                    bcp.stride = sizeof(light_data);
+                    bcp.data = nullptr;
+
+                    ls.buffer = pen::renderer_create_buffer(bcp);
+                }
+
+                pen::renderer_update_buffer(ls.buffer, ls.data, ls.count * sizeof(light_data));
+            }
+
+            // Area light buffer
+            static area_light_buffer al_buffer;
+
+            static vec4f corners_al[] = {vec4f(-1.0, 0.0, -1.0, 1.0), vec4f(1.0, 0.0, -1.0, 1.0), vec4f(1.0, 0.0, 1.0, 1.0),
+                                         vec4f(-1.0, 0.0, 1.0, 1.0)};
+
+            u32 num_area_lights = std::min<u32>(sb_count(ls.area_entities), e_scene_limits::max_area_lights);
+            u32 num_constant_colour_area_lights = std::min<u32>(ls.num_area, num_area_lights);
+            u32 num_textured_area_lights = 0;
+            for (u32 i = 0; i < num_area_lights; ++i)
+            {
+                u32              n = ls.area_entities[i];
+                const cmp_light& l = scene->lights[n];
+
+                mat4& wm = scene->world_matrices[n];
+                for (u32 c = 0; c < 4; ++c)
+                    al_buffer.lights[i].corners[c] = wm.transform_vector(corners_al[c]);
+
+                al_buffer.lights[i].colour = vec4f(l.colour, num_textured_area_lights);
+
+                // textured / shader / animated area light
+                if (i >= num_constant_colour_area_lights)
+                {
+                    scene->draw_call_data[n].v1.y = (f32)anim_time; // time
+                    scene->dirty_flags[n] |= e_dirty::draw_call;
+                    scene->draw_call_data[n].v1.z = (f32)num_textured_area_lights;
+                    ++num_textured_area_lights;
+                }
+            }
+
+            al_buffer.info.x = num_constant_colour_area_lights;
+            al_buffer.info.y = num_textured_area_lights;
+
+            pen::renderer_update_buffer(scene->area_light_buffer, &al_buffer, sizeof(al_buffer));
+
+            const pmfx::render_target* alrt = pmfx::get_render_target(PEN_HASH("area_light_textures"));
+            if (alrt)
+            {
+                if (alrt->num_arrays < num_area_lights)
+                {
+                    pmfx::rt_resize_params rrp;
+                    rrp.width = 640;
+                    rrp.height = 480;
+                    rrp.format = nullptr;
+                    rrp.num_arrays = std::max<u32>(num_area_lights, 1);
+                    rrp.num_mips = -1;
+                    rrp.collection = pen::TEXTURE_COLLECTION_ARRAY;
+                    pmfx::resize_render_target(PEN_HASH("area_light_textures"), rrp);
+                }
+            }
+
+            // Distance field shadows
+            f64 sdf_start = pen::get_time_us();
+            for (u32 i = 0; i < sb_count(cl.list[e_cmp_list::sdf_shadow]); ++i)
+            {
+                u32 n = cl.list[e_cmp_list::sdf_shadow][i];
+
+                static distance_field_shadow_buffer sdf_buffer;
+
+                sdf_buffer.shadows.world_matrix = scene->world_matrices[n];
+                sdf_buffer.shadows.world_matrix_inverse = mat::inverse4x4(scene->world_matrices[n]);
+
+                pen::renderer_update_buffer(scene->sdf_shadow_buffer, &sdf_buffer, sizeof(sdf_buffer));
+            }
+            scene->update_timings[e_update_stage::sdf_shadow] = (pen::get_time_us() - sdf_start) / 1000.0;
+
+            // Shadow maps
+
+            // directional
+            u32 num_shadow_maps = 0;
+            u32 num_omni_shadow_maps = 0;
+            u32 num_gi_maps = 0;
+            for (u32 i = 0; i < sb_count(cl.list[e_cmp_list::light]); ++i)
+            {
+                u32        n = cl.list[e_cmp_list::light][i];
+                cmp_light& l = scene->lights[n];
+                
+                if (l.flags & e_light_flags::global_illumination)
+                    num_gi_maps++;
+                
+                if (l.flags & e_light_flags::shadow_map)
+                    num_shadow_maps++;
+
+                if (l.type == e_light_flags::omni_shadow_map)
+                    num_omni_shadow_maps++;
+            }
+
+            // resize shadow maps..
+            const pmfx::render_target* sm = pmfx::get_render_target(PEN_HASH("shadow_map"));
+            if(sm)
+            {
+                if (sm->num_arrays < num_shadow_maps)
+                {
+                    pmfx::rt_resize_params rrp;
+                    rrp.width = sm->width;
+                    rrp.height = sm->height;
+                    rrp.format = nullptr;
+                    rrp.num_arrays = num_shadow_maps;
+                    rrp.num_mips = 1;
+                    rrp.collection = pen::TEXTURE_COLLECTION_ARRAY;
+                    pmfx::resize_render_target(PEN_HASH("shadow_map"), rrp);
+                    invalidate_shadow_cache(scene);
+                }
+            }
+
+            // resize omni directional
+            const pmfx::render_target* osm = pmfx::get_render_target(PEN_HASH("omni_shadow_map"));
+            if (osm)
+            {
+                if (osm->num_arrays < num_omni_shadow_maps * 6)
+                {
+                    pmfx::rt_resize_params rrp;
+                    rrp.width = osm->width;
+                    rrp.height = osm->height;
+                    rrp.format = nullptr;
+                    rrp.num_arrays = num_omni_shadow_maps * 6;
+                    rrp.num_mips = 1;
+                    rrp.collection = pen::TEXTURE_COLLECTION_CUBE_ARRAY;
+                    pmfx::resize_render_target(PEN_HASH("omni_shadow_map"), rrp);
+                    invalidate_shadow_cache(scene);
+                }
+            }
+            
+            // resize gi maps
+            const pmfx::render_target* gism = pmfx::get_render_target(PEN_HASH("colour_shadow_map"));
+            if (gism)
+            {
+                if(gism->num_arrays < num_gi_maps)
+                {
+                    pmfx::rt_resize_params rrp;
+                    rrp.width = gism->width;
+                    rrp.height = gism->height;
+                    rrp.format = nullptr;
+                    rrp.num_arrays = num_gi_maps;
+                    rrp.num_mips = 1;
+                    rrp.collection = pen::TEXTURE_COLLECTION_ARRAY;
+                    pmfx::resize_render_target(PEN_HASH("colour_shadow_map"), rrp);
+                    pmfx::resize_render_target(PEN_HASH("colour_shadow_map_depth"), rrp);
+                    invalidate_shadow_cache(scene);
+                }
+            }
+            
+            // bone palettes are uploaded once for every view, dynamic buffers are discarded when they are written so
+            // the whole buffer goes up when any rig was rebuilt
+            bone_palette_set& bp = scene->bone_palettes;
+
+            scene->num_bone_bytes_uploaded = 0;
+            if (bp.count && (bp.num_rebuild || bp.count > bp.buffer_capacity))
+            {
+                if (bp.count > bp.buffer_capacity)
+                {
+                    if (is_valid(bp.buffer))
+                        pen::renderer_release_buffer(bp.buffer);
+
+                    bp.buffer_capacity = std::max<u32>(bp.count, bp.buffer_capacity * 2);
+
+                    pen::buffer_creation_params bcp;
+                    bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                    bcp.bind_flags = PEN_BIND_SHADER_RESOURCE;
+                    bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                    bcp.buffer_size = sizeof(mat4) * bp.buffer_capacity;
+                    bcp.stride = sizeof(mat4);
+                    bcp.data = nullptr;
+
+                    bp.buffer = pen::renderer_create_buffer(bcp);
+                }
+
+                scene->num_bone_bytes_uploaded = bp.count * sizeof(mat4);
+                pen::renderer_update_buffer(bp.buffer, bp.matrices, scene->num_bone_bytes_uploaded);
+            }
+
+            // Update pre skinned vertex buffers
+            f64            pre_skin_start = pen::get_time_us();
+            static hash_id id_pre_skin_technique = PEN_HASH("pre_skin");
+            static u32     shader = pmfx::load_shader("forward_render");
+            u32            num_pre_skinned = sb_count(cl.list[e_cmp_list::pre_skinned]);
+            if (num_pre_skinned && is_valid(bp.buffer) && pmfx::set_technique_perm(shader, id_pre_skin_technique))
+            {
+                // the pre skin pass runs before draw calls are uploaded, it passes the bone offset in its own cbuffer
+                if (!is_valid(bp.pre_skin_cbuffer))
+                {
+                    pen::buffer_creation_params bcp;
+                    bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                    bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+                    bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                    bcp.buffer_size = sizeof(cmp_draw_call);
+                    bcp.data = nullptr;
+
+                    bp.pre_skin_cbuffer = pen::renderer_create_buffer(bcp);
+                }
+
+                pen::renderer_set_structured_buffer(bp.buffer, e_global_textures::bone_palette,
+                                                    pen::SBUFFER_BIND_VS | pen::SBUFFER_BIND_READ);
+
+                for (u32 pi = 0; pi < num_pre_skinned; ++pi)
+                {
+                    u32 n = cl.list[e_cmp_list::pre_skinned][pi];
+
+                    u32 bone_offset = scene->anim_controller_v2[n].bone_offset;
+                    if (!is_valid(bone_offset))
+                        continue;
+
+                    cmp_draw_call dc = scene->draw_call_data[n];
+                    dc.v1.w = (f32)bone_offset;
+                    pen::renderer_update_buffer(bp.pre_skin_cbuffer, &dc, sizeof(cmp_draw_call));
+
+                    // bind stream out targets
+                    cmp_geometry& geom = scene->geometries[n];
+                    cmp_pre_skin& pre_skin = scene->pre_skin[n];
+                    pen::renderer_set_stream_out_target(geom.vertex_buffer);
+                    pen::renderer_set_vertex_buffer(pre_skin.vertex_buffer, 0, pre_skin.vertex_size, 0);
+                    pen::renderer_set_constant_buffer(bp.pre_skin_cbuffer, 1, pen::CBUFFER_BIND_VS);
+
+                    // render point list
+                    pen::renderer_draw(pre_skin.num_verts, 0, PEN_PT_POINTLIST);
+                    pen::renderer_set_stream_out_target(0);
+                }
+            }
+            scene->update_timings[e_update_stage::pre_skin] = (pen::get_time_us() - pre_skin_start) / 1000.0;
+
+            // update draw call data
+            u32 num_draw_call_uploads = 0;
+            u32 num_material_uploads = 0;
+            for (size_t n = 0; n < scene->num_entities; ++n)
+            {
+                u32 dirty = scene->dirty_flags[n];
+
+                if (scene->entities[n] & e_cmp::material && dirty & e_dirty::material)
+                {
+                    // per node material cbuffer
+                    if (is_valid(scene->materials[n].material_cbuffer))
+                    {
+                        pen::renderer_update_buffer(scene->materials[n].material_cbuffer, &scene->material_data[n].data[0],
+                                                    scene->materials[n].material_cbuffer_size);
+                        ++num_material_uploads;
+                    }
+                }
+
+                if (!(dirty & e_dirty::draw_call))
+                    continue;
+
+                scene->draw_call_data[n].world_matrix = scene->world_matrices[n];
+
+                // store node index in v1.x
+                scene->draw_call_data[n].v1.x = (f32)n;
+
+                if (is_invalid_or_null(scene->cbuffer[n]))
+                    continue;
+
+                if (scene->entities[n] & e_cmp::sub_instance)
+                    continue;
+
+                // skinned meshes have the world matrix baked into the bones, sub geometry is skinned by the palette
+                // of the rig it was split from
+                if (scene->entities[n] & e_cmp::skinned || scene->entities[n] & e_cmp::pre_skinned)
+                {
+                    scene->draw_call_data[n].world_matrix = mat4::create_identity();
+
+                    u32 rig = scene->entities[n] & e_cmp::sub_geometry ? scene->parents[n] : n;
+                    u32 bone_offset = scene->anim_controller_v2[rig].bone_offset;
+                    scene->draw_call_data[n].v1.w = is_valid(bone_offset) ? (f32)bone_offset : 0.0f;
+                }
+
+                mat4 invt = scene->world_matrices[n];
+
+                invt = invt.transposed();
+                invt = mat::inverse4x4(invt);
+
+                scene->draw_call_data[n].world_matrix_inv_transpose = invt;
+
+                pen::renderer_update_buffer(scene->cbuffer[n], &scene->draw_call_data[n], sizeof(cmp_draw_call));
+                ++num_draw_call_uploads;
+            }
+
+            // update instance buffers
+            f64 instances_start = pen::get_time_us();
+            u32 num_instance_buffer_uploads = 0;
+            for (u32 mi = 0; mi < sb_count(cl.list[e_cmp_list::master_instance]); ++mi)
+            {
+                u32                  n = cl.list[e_cmp_list::master_instance][mi];
+                cmp_master_instance& master = scene->master_instances[n];
+
+                // only if any of the sub instances changed
+                bool dirty = false;
+                for (u32 i = 0; i < master.num_instances; ++i)
+                {
+                    if (scene->dirty_flags[n + 1 + i] & e_dirty::draw_call)
+                    {
+                        dirty = true;
+                        break;
+                    }
+                }
+
+                if (dirty)
+                {
+                    u32 instance_data_size = master.num_instances * master.instance_stride;
+                    pen::renderer_update_buffer(master.instance_buffer, &scene->draw_call_data[n + 1], instance_data_size);
+                    ++num_instance_buffer_uploads;
+                }
+            }
+            scene->update_timings[e_update_stage::instances] = (pen::get_time_us() - instances_start) / 1000.0;
+
+            // everything is clean until changed
+            pen::memory_zero(scene->dirty_flags.data, scene->num_entities * sizeof(u32));
+
+            scene->num_draw_call_uploads = num_draw_call_uploads;
+            scene->num_material_uploads = num_material_uploads;
+            scene->num_instance_buffer_uploads = num_instance_buffer_uploads;
+
+            // update physics running 1 frame behind to allow the sets to take effect
+            physics::step(dt);
+            physics::physics_consume_command_buffer();
+
+            // controllers post update
+            for (u32 c = 0; c < num_controllers; ++c)
+                if (scene->controllers[c].post_update_func)
+                    scene->controllers[c].post_update_func(scene->controllers[c], scene, dt);
+
+            f64 elapsed = pen::timer_elapsed_ms(timer);
+            PEN_UNUSED(elapsed);
+            // PEN_LOG("scene update: %f(ms)", elapsed);
+        }
+
+        struct scene_header
+        {
+            s32 header_size = sizeof(*this);
+            s32 version = ecs_scene::k_version;
+            u32 num_nodes = 0;
+            s32 num_components = 0;
+            s32 num_lookup_strings = 0;
+            s32 num_extensions = 0;
+            s32 num_base_components = 0;
+            s32 reserved_1[25] = {0};
+            u32 view_flags = 0;
+            s32 selected_index = 0;
+            s32 reserved_2[30] = {0};
+        };
+
+        struct lookup_string
+        {
+            Str     name;
+            hash_id id;
+        };
+        static lookup_string* s_lookup_strings = nullptr;
+
+        void write_lookup_string(const char* string, std::ofstream& ofs, const c8* strip_project_dir = nullptr)
+        {
+            hash_id id = 0;
+
+            Str stripped = string;
+            if (strip_project_dir)
+            {
+                stripped = pen::str_replace_string(stripped, strip_project_dir, "");
+                string = stripped.c_str();
+            }
+
+            if (!string)
+            {
+                ofs.write((const c8*)&id, sizeof(hash_id));
+                return;
+            }
+
+            id = PEN_HASH(string);
+            ofs.write((const c8*)&id, sizeof(hash_id));
+
+            u32 num_strings = sb_count(s_lookup_strings);
+            for (u32 i = 0; i < num_strings; ++i)
+            {
+                if (id == s_lookup_strings[i].id)
+                {
+                    return;
+                }
+            }
+
+            lookup_string ls = {string, id};
+            sb_push(s_lookup_strings, ls);
+        }
+
+        Str read_lookup_string(std::ifstream& ifs)
+        {
+            hash_id id;
+            ifs.read((c8*)&id, sizeof(hash_id));
+
+            u32 num_strings = sb_count(s_lookup_strings);
+            for (u32 i = 0; i < num_strings; ++i)
+            {
+                if (s_lookup_strings[i].id == id)
+                {
+                    return s_lookup_strings[i].name;
+                }
+            }
+
+            return "";
+        }
+
+        hash_id rehash_lookup_string(hash_id id)
+        {
+            u32 num_strings = sb_count(s_lookup_strings);
+            for (u32 i = 0; i < num_strings; ++i)
+            {
+                if (s_lookup_strings[i].id == id)
+                {
+                    return PEN_HASH(s_lookup_strings[i].name);
+                }
+            }
+
+            return 0;
+        }
+
+        void save_sub_scene(ecs_scene* scene, u32 root)
+        {
+            std::vector<s32> nodes;
+            build_heirarchy_node_list(scene, root, nodes);
+
+            u32 num = nodes.size();
+
+            ecs_scene sub_scene;
+
+            // create sub scene with same components
+            u32 num_ext = sb_count(scene->extensions);
+            for (u32 e = 0; e < num_ext; ++e)
+                scene->extensions[e].ext_func(&sub_scene);
+
+            resize_scene_buffers(&sub_scene, num);
+
+            for (u32 i = 0; i < num; ++i)
+            {
+                u32 ii = nodes[i];
+                if (ii == PEN_INVALID_HANDLE)
+                    continue;
+
+                u32 ni = sub_scene.num_entities;
+
+                for (u32 c = 0; c < scene->num_components; ++c)
+                {
+                    generic_cmp_array& src = scene->get_component_array(c);
+                    generic_cmp_array& dst = sub_scene.get_component_array(c);
+
+                    memcpy(dst[ni], src[ii], src.size);
+                }
+
+                sub_scene.parents[ni] -= root;
+                sub_scene.num_entities++;
+            }
+
+            Str fn = "";
+            fn.appendf("../../assets/scene/%s.pms", sub_scene.names[0].c_str());
+
+            save_scene(fn.c_str(), &sub_scene);
+
+            free_scene_buffers(&sub_scene, true);
+            unregister_ecs_extensions(&sub_scene);
+        }
+
+        // container version 1. every section and component array starts aligned so a mapped file can be read in place,
+        // strings are stored once and referred to by index and geometry resources are listed once for all their nodes.
+        static const u32 k_scene_container_magic = 0x63736d70; // pmsc
+        static const u32 k_scene_container_version = 1;
+        static const u32 k_scene_container_align = 16;
+        static const u32 k_no_string = -1;
+
+        namespace e_scene_section
+        {
+            enum scene_section_t
+            {
+                components,    // scene_container_component for each component, the arrays are placed separately
+                extensions,    // scene_container_extension for each extension
+                strings,       // scene_container_string for each unique string
+                string_data,   // null terminated strings
+                node_strings,  // name, geometry name and material name of each node
+                geometry,      // scene_container_geometry for each unique geometry resource
+                node_geometry, // geometry index of each node with e_cmp::geometry
+                animations,    // instance count of each node followed by the animation of each instance
+                materials,     // material, shader and technique of each node with e_cmp::material
+                shadows,       // volume of each node with e_cmp::sdf_shadow
+                samplers,      // texture and sampler state of each binding of nodes with e_cmp::samplers
+                cameras,       // scene_container_camera for each camera
+                COUNT
+            };
+        }
+
+        struct scene_container_section
+        {
+            u64 offset;
+            u64 size;
+        };
+
+        struct scene_container_header
+        {
+            u32                     magic = k_scene_container_magic;
+            u32                     container_version = k_scene_container_version;
+            u32                     header_size = sizeof(*this);
+            u32                     scene_version = ecs_scene::k_version;
+            u32                     num_nodes = 0;
+            u32                     num_components = 0;
+            u32                     num_base_components = 0;
+            u32                     num_extensions = 0;
+            u32                     view_flags = 0;
+            s32                     selected_index = 0;
+            u32                     reserved[6] = {0};
+            scene_container_section sections[e_scene_section::COUNT] = {};
+        };
+
+        struct scene_container_component
+        {
+            u32 size;
+            u32 reserved;
+            u64 offset;
+        };
+
+        struct scene_container_extension
+        {
+            u32 name;
+            u32 start_cmp;
+            u32 num_cmp;
+        };
+
+        struct scene_container_string
+        {
+            u32     offset;
+            u32     length;
+            hash_id id;
+        };
+
+        struct scene_container_geometry
+        {
+            u32 filename;
+            u32 geometry_name;
+            u32 submesh;
+        };
+
+        struct scene_container_camera
+        {
+            hash_id id;
+            vec3f   pos;
+            vec3f   focus;
+            vec2f   rot;
+            f32     fov;
+            f32     aspect;
+            f32     near_plane;
+            f32     far_plane;
+            f32     zoom;
+        };
+
+        // strings deduplicated by hash like the lookup strings of the stream format, found by a map instead of a search
+        struct scene_string_table
+        {
+            std::unordered_map<hash_id, u32> lookup;
+            std::vector<Str>                 strings;
+
+            u32 add(const c8* string, const c8* strip_project_dir = nullptr)
+            {
+                if (!string)
+                    return k_no_string;
+
+                Str stripped;
+                if (strip_project_dir)
+                {
+                    stripped = pen::str_replace_string(string, strip_project_dir, "");
+                    string = stripped.c_str();
+                }
+
+                hash_id id = PEN_HASH(string);
+                auto    it = lookup.find(id);
+                if (it != lookup.end())
+                    return it->second;
+
+                u32 index = (u32)strings.size();
+                lookup[id] = index;
+                strings.push_back(string);
+                return index;
+            }
+        };
+
+        static void align_scene_container(std::ofstream& ofs)
+        {
+            static const c8 k_zero[k_scene_container_align] = {0};
+
+            u64 pos = (u64)ofs.tellp();
+            u64 pad = (k_scene_container_align - pos % k_scene_container_align) % k_scene_container_align;
+            ofs.write(k_zero, pad);
+        }
+
+        static void write_scene_section(std::ofstream& ofs, scene_container_header& sh, u32 section, const void* data,
+                                        size_t size)
+        {
+            align_scene_container(ofs);
+            sh.sections[section].offset = (u64)ofs.tellp();
+            sh.sections[section].size = size;
+
+            if (size > 0)
+                ofs.write((const c8*)data, size);
+        }
+
+        template <typename T>
+        static void write_scene_section(std::ofstream& ofs, scene_container_header& sh, u32 section,
+                                        const std::vector<T>& v)
+        {
+            write_scene_section(ofs, sh, section, v.data(), v.size() * sizeof(T));
+        }
+
+        // the section as an array of T, null when it lies outside of the file
+        template <typename T>
+        static const T* get_scene_section(const u8* data, size_t data_size, const scene_container_header& sh,
+                                          u32 section, u32& count)
+        {
+            const scene_container_section& s = sh.sections[section];
+
+            count = 0;
+            if (s.offset > data_size || s.size > data_size - s.offset || s.offset % k_scene_container_align != 0)
+                return nullptr;
+
+            count = (u32)(s.size / sizeof(T));
+            return (const T*)(data + s.offset);
+        }
+
+        void save_scene(const c8* filename, ecs_scene* scene)
+        {
+            const c8* wd = pen::os_get_user_info().working_directory;
+            Str       project_dir = dev_ui::get_program_preference_filename("project_dir", wd);
+
+            std::ofstream ofs(filename, std::ofstream::binary);
+
+            // the header is written again once the sections are placed
+            scene_container_header sh;
+            sh.num_nodes = scene->num_entities;
+            sh.num_components = scene->num_components;
+            sh.num_base_components = scene->num_base_components;
+            sh.num_extensions = sb_count(scene->extensions);
+            sh.view_flags = scene->view_flags;
+            sh.selected_index = scene->selected_index;
+            ofs.write((const c8*)&sh, sizeof(scene_container_header));
+
+            scene_string_table st;
+            u32                num_nodes = scene->num_entities;
+
+            // component arrays
+            std::vector<scene_container_component> components(sh.num_components);
+            for (u32 i = 0; i < sh.num_components; ++i)
+            {
+                generic_cmp_array& cmp = scene->get_component_array(i);
+
+                align_scene_container(ofs);
+                components[i].size = cmp.size;
+                components[i].reserved = 0;
+                components[i].offset = (u64)ofs.tellp();
+                ofs.write((const c8*)cmp.data, (size_t)cmp.size * num_nodes);
+            }
+            write_scene_section(ofs, sh, e_scene_section::components, components);
+
+            // extensions
+            std::vector<scene_container_extension> extensions(sh.num_extensions);
+            for (u32 i = 0; i < sh.num_extensions; ++i)
+            {
+                extensions[i].name = st.add(scene->extensions[i].name.c_str());
+                extensions[i].start_cmp = get_extension_component_offset(scene, i);
+                extensions[i].num_cmp = scene->extensions[i].num_components;
+            }
+            write_scene_section(ofs, sh, e_scene_section::extensions, extensions);
+
+            // names
+            std::vector<u32> node_strings(num_nodes * 3);
+            for (u32 n = 0; n < num_nodes; ++n)
+            {
+                node_strings[n * 3 + 0] = st.add(scene->names[n].c_str());
+                node_strings[n * 3 + 1] = st.add(scene->geometry_names[n].c_str());
+                node_strings[n * 3 + 2] = st.add(scene->material_names[n].c_str());
+            }
+            write_scene_section(ofs, sh, e_scene_section::node_strings, node_strings);
+
+            // geometry, nodes sharing a resource share an entry
+            std::unordered_map<const geometry_resource*, u32> geometry_lookup;
+            std::vector<scene_container_geometry>              geometry;
+            std::vector<u32>                                   node_geometry;
+            for (u32 n = 0; n < num_nodes; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::geometry))
+                    continue;
+
+                geometry_resource* gr = get_geometry_resource(scene->id_geometry[n]);
+
+                auto it = geometry_lookup.find(gr);
+                if (it == geometry_lookup.end())
+                {
+                    scene_container_geometry g;
+                    g.filename = st.add(gr->filename.c_str(), project_dir.c_str());
+                    g.geometry_name = st.add(gr->geometry_name.c_str(), project_dir.c_str());
+                    g.submesh = gr->submesh_index;
+
+                    it = geometry_lookup.insert(std::make_pair(gr, (u32)geometry.size())).first;
+                    geometry.push_back(g);
+                }
+
+                node_geometry.push_back(it->second);
+            }
+            write_scene_section(ofs, sh, e_scene_section::geometry, geometry);
+            write_scene_section(ofs, sh, e_scene_section::node_geometry, node_geometry);
+
+            // animations
+            std::vector<u32> animations(num_nodes);
+            for (u32 n = 0; n < num_nodes; ++n)
+            {
+                u32 size = sb_count(scene->anim_controller_v2[n].anim_instances);
+                animations[n] = size;
+
+                // todo with anim controller v2, as the stream format
+                for (u32 i = 0; i < size; ++i)
+                    animations.push_back(st.add("placeholder", project_dir.c_str()));
+            }
+            write_scene_section(ofs, sh, e_scene_section::animations, animations);
+
+            // material
+            std::vector<u32> materials;
+            for (u32 n = 0; n < num_nodes; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::material))
+                    continue;
+
+                cmp_material&      mat = scene->materials[n];
+                material_resource& mat_res = scene->material_resources[n];
+
+                materials.push_back(st.add(mat_res.material_name.c_str()));
+                materials.push_back(st.add(pmfx::get_shader_name(mat.shader)));
+                materials.push_back(st.add(pmfx::get_technique_name(mat.shader, mat_res.id_technique)));
+            }
+            write_scene_section(ofs, sh, e_scene_section::materials, materials);
+
+            // shadow
+            std::vector<u32> shadows;
+            for (u32 n = 0; n < num_nodes; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::sdf_shadow))
+                    continue;
+
+                Str texture = put::get_texture_filename(scene->shadows[n].texture_handle);
+                shadows.push_back(st.add(texture.c_str(), project_dir.c_str()));
+            }
+            write_scene_section(ofs, sh, e_scene_section::shadows, shadows);
+
+            // sampler bindings
+            std::vector<u32> samplers;
+            for (u32 n = 0; n < num_nodes; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::samplers))
+                    continue;
+
+                for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
+                {
+                    const sampler_binding& sb = scene->samplers[n].sb[i];
+                    Str                    texture = put::get_texture_filename(sb.handle);
+                    Str                    state = pmfx::get_render_state_name(sb.sampler_state);
+
+                    samplers.push_back(st.add(texture.c_str(), project_dir.c_str()));
+                    samplers.push_back(st.add(state.c_str(), project_dir.c_str()));
+                }
+            }
+            write_scene_section(ofs, sh, e_scene_section::samplers, samplers);
+
+            // cameras
+            camera**                            cams = pmfx::get_cameras();
+            std::vector<scene_container_camera> cameras(sb_count(cams));
+            for (u32 i = 0; i < cameras.size(); ++i)
+            {
+                scene_container_camera& cc = cameras[i];
+                cc.id = PEN_HASH(cams[i]->name);
+                cc.pos = cams[i]->pos;
+                cc.focus = cams[i]->focus;
+                cc.rot = cams[i]->rot;
+                cc.fov = cams[i]->fov;
+                cc.aspect = cams[i]->aspect;
+                cc.near_plane = cams[i]->near_plane;
+                cc.far_plane = cams[i]->far_plane;
+                cc.zoom = cams[i]->zoom;
+            }
+            write_scene_section(ofs, sh, e_scene_section::cameras, cameras);
+
+            // string table last, once every section has added its strings
+            std::vector<scene_container_string> strings(st.strings.size());
+            std::vector<c8>                     string_data;
+            for (u32 i = 0; i < strings.size(); ++i)
+            {
+                const Str& s = st.strings[i];
+                strings[i].offset = (u32)string_data.size();
+                strings[i].length = s.length();
+                strings[i].id = PEN_HASH(s.c_str());
+                string_data.insert(string_data.end(), s.c_str(), s.c_str() + s.length() + 1);
+            }
+            write_scene_section(ofs, sh, e_scene_section::strings, strings);
+            write_scene_section(ofs, sh, e_scene_section::string_data, string_data);
+
+            // call extensions specific save
+            for (u32 i = 0; i < sh.num_extensions; ++i)
+                if (scene->extensions[i].save_func)
+                    scene->extensions[i].save_func(scene->extensions[i], scene);
+
+            ofs.seekp(0);
+            ofs.write((const c8*)&sh, sizeof(scene_container_header));
+            ofs.close();
+        }
+
+        void save_scene_stream(const c8* filename, ecs_scene* scene)
+        {
+            const c8* wd = pen::os_get_user_info().working_directory;
+            Str       project_dir = dev_ui::get_program_preference_filename("project_dir", wd);
+
+            std::ofstream ofs(filename, std::ofstream::binary);
+
+            sb_free(s_lookup_strings);
+            s_lookup_strings = nullptr;
+
+            // write basic components
+            for (u32 i = 0; i < scene->num_components; ++i)
+            {
+                generic_cmp_array& cmp = scene->get_component_array(i);
+                ofs.write((const c8*)cmp.data, cmp.size * scene->num_entities);
+            }
+
+            // specialisations ------------------------------------------------------------------------------
+
+            // names
+            for (s32 n = 0; n < scene->num_entities; ++n)
+            {
+                write_lookup_string(scene->names[n].c_str(), ofs);
+                write_lookup_string(scene->geometry_names[n].c_str(), ofs);
+                write_lookup_string(scene->material_names[n].c_str(), ofs);
+            }
+
+            // geometry
+            for (s32 n = 0; n < scene->num_entities; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::geometry))
+                    continue;
+
+                geometry_resource* gr = get_geometry_resource(scene->id_geometry[n]);
+
+                ofs.write((const c8*)&gr->submesh_index, sizeof(u32));
+
+                write_lookup_string(gr->filename.c_str(), ofs, project_dir.c_str());
+                write_lookup_string(gr->geometry_name.c_str(), ofs, project_dir.c_str());
+            }
+
+            // animations
+            for (s32 n = 0; n < scene->num_entities; ++n)
+            {
+                s32 size = 0;
+
+                if (scene->anim_controller_v2[n].anim_instances)
+                    size = sb_count(scene->anim_controller_v2[n].anim_instances);
+
+                ofs.write((const c8*)&size, sizeof(s32));
+
+                for (s32 i = 0; i < size; ++i)
+                {
+                    // todo with anim controller v2
+                    // auto* anim = get_animation_resource(scene->anim_controller_v2[n].anim_instances[i].);
+                    write_lookup_string("placeholder", ofs, project_dir.c_str());
+                }
+            }
+
+            // material
+            for (s32 n = 0; n < scene->num_entities; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::material))
+                    continue;
+
+                cmp_material&      mat = scene->materials[n];
+                material_resource& mat_res = scene->material_resources[n];
+
+                const char* shader_name = pmfx::get_shader_name(mat.shader);
+                const char* technique_name = pmfx::get_technique_name(mat.shader, mat_res.id_technique);
+
+                write_lookup_string(mat_res.material_name.c_str(), ofs);
+                write_lookup_string(shader_name, ofs);
+                write_lookup_string(technique_name, ofs);
+            }
+
+            // shadow
+            for (s32 n = 0; n < scene->num_entities; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::sdf_shadow))
+                    continue;
+
+                cmp_shadow& shadow = scene->shadows[n];
+
+                write_lookup_string(put::get_texture_filename(shadow.texture_handle).c_str(), ofs, project_dir.c_str());
+            }
+
+            // sampler bindings
+            for (s32 n = 0; n < scene->num_entities; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::samplers))
+                    continue;
+
+                cmp_samplers& samplers = scene->samplers[n];
+
+                for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
+                {
+                    write_lookup_string(put::get_texture_filename(samplers.sb[i].handle).c_str(), ofs, project_dir.c_str());
+                    write_lookup_string(pmfx::get_render_state_name(samplers.sb[i].sampler_state).c_str(), ofs,
+                                        project_dir.c_str());
+                }
+            }
+
+            // cameras
+            camera** cams = pmfx::get_cameras();
+            u32      num_cams = sb_count(cams);
+            for (u32 i = 0; i < num_cams; ++i)
+            {
+                write_lookup_string(cams[i]->name.c_str(), ofs);
+            }
+
+            // call extensions specific save
+            u32 num_extensions = sb_count(scene->extensions);
+            for (u32 i = 0; i < num_extensions; ++i)
+                if (scene->extensions[i].save_func)
+                    scene->extensions[i].save_func(scene->extensions[i], scene);
+
+            ofs.close();
+
+            std::ifstream infile(filename, std::ifstream::binary);
+
+            // get size of file
+            infile.seekg(0, infile.end);
+            u32 scene_data_size = (u32)infile.tellg();
+            infile.seekg(0);
+
+            // allocate memory for file content
+            c8* scene_data = new c8[scene_data_size];
+
+            // read content of infile
+            infile.read(scene_data, scene_data_size);
+
+            ofs = std::ofstream(filename, std::ofstream::binary);
+
+            // header
+            scene_header sh;
+            sh.num_nodes = scene->num_entities;
+            sh.view_flags = scene->view_flags;
+            sh.selected_index = scene->selected_index;
+            sh.num_components = scene->num_components;
+            sh.num_base_components = scene->num_base_components;
+            sh.num_lookup_strings = sb_count(s_lookup_strings);
+            sh.num_extensions = sb_count(scene->extensions);
+            ofs.write((const c8*)&sh, sizeof(scene_header));
+
+            // component sizes
+            for (u32 c = 0; c < sh.num_components; ++c)
+            {
+                ofs.write((const c8*)&scene->get_component_array(c).size, sizeof(u32));
+            }
+
+            // extensions
+            for (u32 i = 0; i < sh.num_extensions; ++i)
+            {
+                u32 co = get_extension_component_offset(scene, i);
+                write_lookup_string(scene->extensions[i].name.c_str(), ofs);
+                ofs.write((const c8*)&co, sizeof(u32));
+                ofs.write((const c8*)&scene->extensions[i].num_components, sizeof(u32));
+            }
+
+            // string lookups
+            for (u32 l = 0; l < sh.num_lookup_strings; ++l)
+            {
+                write_parsable_string(s_lookup_strings[l].name.c_str(), ofs);
+                ofs.write((const c8*)&s_lookup_strings[l].id, sizeof(hash_id));
+            }
+
+            // write camera info
+            ofs.write((const c8*)&num_cams, sizeof(u32));
+            for (u32 i = 0; i < num_cams; ++i)
+            {
+                hash_id id_cam = PEN_HASH(cams[i]->name);
+                ofs.write((const c8*)&id_cam, sizeof(hash_id));
+                ofs.write((const c8*)&cams[i]->pos, sizeof(vec3f));
+                ofs.write((const c8*)&cams[i]->focus, sizeof(vec3f));
+                ofs.write((const c8*)&cams[i]->rot, sizeof(vec2f));
+                ofs.write((const c8*)&cams[i]->fov, sizeof(f32));
+                ofs.write((const c8*)&cams[i]->aspect, sizeof(f32));
+                ofs.write((const c8*)&cams[i]->near_plane, sizeof(f32));
+                ofs.write((const c8*)&cams[i]->far_plane, sizeof(f32));
+                ofs.write((const c8*)&cams[i]->zoom, sizeof(f32));
+            }
+
+            // write scene data
+            ofs.write(scene_data, scene_data_size);
+            ofs.close();
+        }
+
+        // clears or extends scene for num_nodes loaded nodes and returns the first of them
+        static u32 begin_scene_load(const c8* filename, ecs_scene* scene, bool merge, u32 version, u32 num_nodes,
+                                    s32 selected_index)
+        {
+            scene->flags |= e_scene_flags::invalidate_scene_tree;
+
+            if (!merge)
+            {
+                scene->version = version;
+                scene->filename = filename;
+            }
+
+            scene->selected_index = selected_index;
+
+            u32 zero_offset = 0;
+            u32 new_num_nodes = num_nodes;
+
+            if (merge)
+            {
+                zero_offset = scene->num_entities;
+                new_num_nodes = scene->num_entities + num_nodes;
+            }
+            else
+            {
+                clear_scene(scene);
+            }
+
+            if (new_num_nodes > scene->soa_size)
+                resize_scene_buffers(scene, num_nodes);
+
+            scene->num_entities = new_num_nodes;
+
+            return zero_offset;
+        }
+
+        static bool is_scene_primitive(const Str& name)
+        {
+            static hash_id primitive_id = PEN_HASH("primitive");
+            return PEN_HASH(name.c_str()) == primitive_id;
+        }
+
+        // the id load_pmm gives a submesh of the geometry in filename
+        static hash_id get_scene_geometry_id(const Str& filename, const Str& geometry_name, u32 submesh)
+        {
+            pen::hash_murmur hm;
+            hm.begin(0);
+            hm.add(filename.c_str(), filename.length());
+            hm.add(geometry_name.c_str(), geometry_name.length());
+            hm.add(submesh);
+            return hm.end();
+        }
+
+        // finds or loads the geometry a node refers to, id_geometry is set for geometry loaded from pmm files and 0 for
+        // primitives which keep the id they were saved with
+        static geometry_resource* load_scene_geometry(const Str& project_dir, const Str& name, const Str& geometry_name,
+                                                      u32 submesh, hash_id& id_geometry)
+        {
+            id_geometry = 0;
+            if (is_scene_primitive(name))
+                return get_geometry_resource(PEN_HASH(geometry_name.c_str()));
+
+            Str filename = project_dir;
+            filename.append(name.c_str());
+
+            dev_console_log("[scene load] %s", name.c_str());
+            load_pmm(filename.c_str(), nullptr, e_pmm_load_flags::geometry);
+
+            id_geometry = get_scene_geometry_id(filename, geometry_name, submesh);
+            return get_geometry_resource(id_geometry);
+        }
+
+        // returns false and removes the geometry component when gr was not found
+        static bool instantiate_scene_geometry(ecs_scene* scene, u32 n, geometry_resource* gr, hash_id id_geometry,
+                                               const Str& project_dir, const Str& name)
+        {
+            if (id_geometry)
+                scene->id_geometry[n] = id_geometry;
+
+            if (!gr)
+            {
+                Str filename = project_dir;
+                filename.append(name.c_str());
+                dev_ui::log_level(dev_ui::console_level::error, "[error] geometry - cannot find pmm file: %s",
+                                  filename.c_str());
+
+                scene->entities[n] &= ~e_cmp::geometry;
+                return false;
+            }
+
+            instantiate_geometry(gr, scene, n);
+            instantiate_model_cbuffer(scene, n);
+
+            if (gr->p_skin)
+                instantiate_anim_controller_v2(scene, n);
+
+            return true;
+        }
+
+        static void instantiate_scene_rigid_bodies(ecs_scene* scene, u32 start, u32 end)
+        {
+            for (u32 n = start; n < end; ++n)
+                if (scene->entities[n] & e_cmp::physics)
+                    instantiate_rigid_body(scene, n);
+        }
+
+        // constraints refer to rigid bodies anywhere in the scene so they come after all of them
+        static void instantiate_scene_constraints(ecs_scene* scene, u32 start, u32 end)
+        {
+            for (u32 n = start; n < end; ++n)
+                if (scene->entities[n] & e_cmp::constraint)
+                    instantiate_constraint(scene, n);
+        }
+
+        static void instantiate_scene_physics(ecs_scene* scene, u32 start, u32 end)
+        {
+            instantiate_scene_rigid_bodies(scene, start, end);
+            instantiate_scene_constraints(scene, start, end);
+        }
+
+        static bool load_scene_animation(ecs_scene* scene, u32 n, const Str& project_dir, const Str& name)
+        {
+            Str anim_name = project_dir;
+            anim_name.append(name.c_str());
+
+            anim_handle h = load_pma(anim_name.c_str());
+
+            bool valid = is_valid(h);
+            if (!valid)
+            {
+                dev_ui::log_level(dev_ui::console_level::error, "[error] animation - cannot find pma file: %s",
+                                  anim_name.c_str());
+            }
+
+            bind_animation_to_rig(scene, h, n);
+            return valid;
+        }
+
+        static void load_scene_material(ecs_scene* scene, u32 n, const Str& material_name, const Str& shader,
+                                        const Str& technique)
+        {
+            cmp_material&      mat = scene->materials[n];
+            material_resource& mat_res = scene->material_resources[n];
+
+            // Invalidate stuff we need to recreate
+            memset(&mat_res.material_name, 0x0, sizeof(Str));
+            memset(&mat_res.shader_name, 0x0, sizeof(Str));
+            mat.material_cbuffer = PEN_INVALID_HANDLE;
+
+            mat_res.material_name = material_name;
+            mat_res.id_shader = PEN_HASH(shader.c_str());
+            mat_res.id_technique = PEN_HASH(technique.c_str());
+            mat_res.shader_name = shader;
+        }
+
+        static void load_scene_sdf_shadow(ecs_scene* scene, u32 n, const Str& volume_texture)
+        {
+            Str sdf_shadow_volume_file = pen::str_replace_string(volume_texture, ".dds", ".pmv");
+
+            dev_console_log("[scene load] %s", sdf_shadow_volume_file.c_str());
+            instantiate_sdf_shadow(sdf_shadow_volume_file.c_str(), scene, n);
+        }
+
+        static void load_scene_sampler(sampler_binding& sb, const Str& texture_name, const Str& sampler_state_name)
+        {
+            if (!texture_name.empty())
+            {
+                sb.handle = put::load_texture(texture_name.c_str());
+                sb.sampler_state = pmfx::get_render_state(PEN_HASH("wrap_linear"), pmfx::e_render_state::sampler);
+            }
+
+            if (!sampler_state_name.empty())
+                sb.sampler_state = pmfx::get_render_state(PEN_HASH(sampler_state_name), pmfx::e_render_state::sampler);
+        }
+
+        // the steps after every node has its resources, shared by both formats
+        static void end_scene_load(ecs_scene* scene, u32 start, u32 end, u32 num_extensions, bool merge, u32 view_flags,
+                                   bool error)
+        {
+            // read extensions
+            for (u32 i = 0; i < num_extensions; ++i)
+                if (scene->extensions[i].load_func)
+                    scene->extensions[i].load_func(scene->extensions[i], scene);
+
+            bake_material_handles();
+
+            // light geom
+            for (u32 n = start; n < end; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::light))
+                    continue;
+
+                instantiate_model_cbuffer(scene, n);
+            }
+
+            // invalidate physics debug cbuffer.. will recreate on demand
+            for (u32 n = start; n < end; ++n)
+                scene->physics_debug_cbuffer[n] = PEN_INVALID_HANDLE;
+
+            if (!merge)
+            {
+                scene->view_flags = view_flags;
+
+                // show bones and mats if we have an error, to aid deugging
+                if (error)
+                    scene->view_flags |= (e_scene_view_flags::matrix | e_scene_view_flags::bones);
+            }
+
+            initialise_free_list(scene);
+        }
+
+        struct scene_ext_components
+        {
+            hash_id id;
+            u32     start_cmp;
+            u32     num_cmp;
+        };
+
+        // the component array of scene which saved component i maps to or -1, allowing out of order or missing
+        // extension components
+        static u32 remap_scene_component(ecs_scene* scene, u32 i, u32 num_base_components,
+                                         const scene_ext_components* exts, u32 num_extensions)
+        {
+            if (i < num_base_components)
+                return i;
+
+            for (u32 e = 0; e < num_extensions; ++e)
+            {
+                u32 ext_i = i - exts[e].start_cmp;
+                if (i >= exts[e].start_cmp && ext_i < exts[e].num_cmp)
+                    return get_extension_component_offset_from_id(scene, exts[e].id) + ext_i;
+            }
+
+            return -1;
+        }
+
+        static void load_scene_camera(const scene_container_camera& cam)
+        {
+            // find camera and set
+            camera* _cam = pmfx::get_camera(cam.id);
+            if (!_cam)
+                return;
+
+            _cam->pos = cam.pos;
+            _cam->focus = cam.focus;
+            _cam->rot = cam.rot;
+            _cam->fov = cam.fov;
+            _cam->aspect = cam.aspect;
+            _cam->near_plane = cam.near_plane;
+            _cam->far_plane = cam.far_plane;
+            _cam->zoom = cam.zoom;
+        }
+
+        // the stream format of version 9 and earlier, read value by value with each lookup string searched for by hash
+        static void load_scene_stream(const c8* filename, ecs_scene* scene, bool merge)
+        {
+            bool      error = false;
+            const c8* wd = pen::os_get_user_info().working_directory;
+            Str       project_dir = dev_ui::get_program_preference_filename("project_dir", wd);
+
+            std::ifstream ifs(pen::os_path_for_resource(filename), std::ofstream::binary);
+
+            // header
+            scene_header sh;
+            ifs.read((c8*)&sh, sizeof(scene_header));
+
+            // version 9 adds extensions
+            if (sh.version < 9)
+                sh.num_base_components = sh.num_components;
+
+            // unpack header
+            u32 num_nodes = sh.num_nodes;
+            u32 zero_offset = begin_scene_load(filename, scene, merge, sh.version, num_nodes, sh.selected_index);
+            u32 end_node = zero_offset + num_nodes;
+
+            // read component sizes
+            u32* component_sizes = nullptr;
+            for (u32 i = 0; i < sh.num_components; ++i)
+            {
+                u32 size;
+                ifs.read((c8*)&size, sizeof(u32));
+                sb_push(component_sizes, size);
+            }
+
+            // extensions
+            scene_ext_components* exts = nullptr;
+            for (u32 i = 0; i < sh.num_extensions; ++i)
+            {
+                scene_ext_components ext;
+                ifs.read((c8*)&ext.id, sizeof(hash_id));
+                ifs.read((c8*)&ext.start_cmp, sizeof(u32));
+                ifs.read((c8*)&ext.num_cmp, sizeof(u32));
+
+                sb_push(exts, ext);
+            }
+
+            // read string lookups
+            sb_free(s_lookup_strings);
+            s_lookup_strings = nullptr;
+
+            for (u32 n = 0; n < sh.num_lookup_strings; ++n)
+            {
+                lookup_string ls;
+                ls.name = read_parsable_string(ifs);
+                ifs.read((c8*)&ls.id, sizeof(hash_id));
+
+                sb_push(s_lookup_strings, ls);
+            }
+
+            // rehash extension ids
+            for (u32 i = 0; i < sh.num_extensions; ++i)
+            {
+                exts[i].id = rehash_lookup_string(exts[i].id);
+            }
+
+            // read cameras
+            u32 num_cams;
+            ifs.read((c8*)&num_cams, sizeof(u32));
+
+            for (u32 i = 0; i < num_cams; ++i)
+            {
+                scene_container_camera cam;
+                ifs.read((c8*)&cam.id, sizeof(hash_id));
+                ifs.read((c8*)&cam.pos, sizeof(vec3f));
+                ifs.read((c8*)&cam.focus, sizeof(vec3f));
+                ifs.read((c8*)&cam.rot, sizeof(vec2f));
+                ifs.read((c8*)&cam.fov, sizeof(f32));
+                ifs.read((c8*)&cam.aspect, sizeof(f32));
+                ifs.read((c8*)&cam.near_plane, sizeof(f32));
+                ifs.read((c8*)&cam.far_plane, sizeof(f32));
+                ifs.read((c8*)&cam.zoom, sizeof(f32));
+
+                if (!merge)
+                    load_scene_camera(cam);
+            }
+
+            // read all components
+            for (u32 i = 0; i < sh.num_components; ++i)
+            {
+                u32 ri = remap_scene_component(scene, i, sh.num_base_components, exts, sh.num_extensions);
+
+                if (ri != -1)
+                {
+                    generic_cmp_array& cmp = scene->get_component_array(ri);
+
+                    if (cmp.size == component_sizes[i])
+                    {
+                        // read whole array
+                        c8* data_offset = (c8*)cmp.data + zero_offset * cmp.size;
+                        ifs.read(data_offset, cmp.size * num_nodes);
+                        continue;
+                    }
+                }
+
+                // skip arrays which are missing or changed size, here any fixup of the old data could be applied
+                ifs.seekg(component_sizes[i] * num_nodes, std::ios::cur);
+            }
+
+            // fixup parents for scene import / merge, and everything needs updating
+            for (u32 n = zero_offset; n < end_node; ++n)
+            {
+                scene->parents[n] += zero_offset;
+                scene->dirty_flags[n] = e_dirty::all;
+            }
+
+            // read specialisations
+            for (u32 n = zero_offset; n < end_node; ++n)
+            {
+                memset(&scene->names[n], 0x0, sizeof(Str));
+                memset(&scene->geometry_names[n], 0x0, sizeof(Str));
+                memset(&scene->material_names[n], 0x0, sizeof(Str));
+
+                scene->names[n] = read_lookup_string(ifs);
+                scene->geometry_names[n] = read_lookup_string(ifs);
+                scene->material_names[n] = read_lookup_string(ifs);
+            }
+
+            // geometry
+            for (u32 n = zero_offset; n < end_node; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::geometry))
+                    continue;
+
+                u32 submesh;
+                ifs.read((c8*)&submesh, sizeof(u32));
+
+                Str name = read_lookup_string(ifs);
+                Str geometry_name = read_lookup_string(ifs);
+
+                hash_id            id_geometry;
+                geometry_resource* gr = load_scene_geometry(project_dir, name, geometry_name, submesh, id_geometry);
+
+                if (!instantiate_scene_geometry(scene, n, gr, id_geometry, project_dir, name))
+                    error = true;
+            }
+
+            instantiate_scene_physics(scene, zero_offset, end_node);
+
+            // animations
+            for (u32 n = zero_offset; n < end_node; ++n)
+            {
+                s32 size;
+                ifs.read((c8*)&size, sizeof(s32));
+
+                for (s32 i = 0; i < size; ++i)
+                    if (!load_scene_animation(scene, n, project_dir, read_lookup_string(ifs)))
+                        error = true;
+            }
+
+            // materials
+            for (u32 n = zero_offset; n < end_node; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::material))
+                    continue;
+
+                Str material_name = read_lookup_string(ifs);
+                Str shader = read_lookup_string(ifs);
+                Str technique = read_lookup_string(ifs);
+
+                load_scene_material(scene, n, material_name, shader, technique);
+            }
+
+            // sdf shadow
+            for (u32 n = zero_offset; n < end_node; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::sdf_shadow))
+                    continue;
+
+                load_scene_sdf_shadow(scene, n, read_lookup_string(ifs));
+            }
+
+            // sampler binding textures
+            for (u32 n = zero_offset; n < end_node; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::samplers))
+                    continue;
+
+                cmp_samplers& samplers = scene->samplers[n];
+
+                for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
+                {
+                    Str texture_name = read_lookup_string(ifs);
+                    Str sampler_state_name = read_lookup_string(ifs);
+
+                    load_scene_sampler(samplers.sb[i], texture_name, sampler_state_name);
+                }
+            }
+
+            // read cams strings
+            for (u32 i = 0; i < num_cams; ++i)
+                read_lookup_string(ifs);
+
+            ifs.close();
+
+            end_scene_load(scene, zero_offset, end_node, sh.num_extensions, merge, sh.view_flags, error);
+
+            // cleanup
+            sb_free(component_sizes);
+            sb_free(exts);
+        }
+
+        // the sections of a mapped container with each of its strings made once
+        struct scene_container_view
+        {
+            scene_container_header           header;
+            const u8*                        data = nullptr;
+            const scene_container_component* component_table = nullptr;
+            const scene_container_extension* ext_table = nullptr;
+            const u32*                       node_strings = nullptr;
+            const scene_container_geometry*  geometry = nullptr;
+            const u32*                       node_geometry = nullptr;
+            const u32*                       animations = nullptr;
+            const u32*                       materials = nullptr;
+            const u32*                       shadows = nullptr;
+            const u32*                       samplers = nullptr;
+            const scene_container_camera*    cams = nullptr;
+            u32                              num_geometry = 0;
+            u32                              num_node_geometry = 0;
+            u32                              num_animations = 0;
+            u32                              num_materials = 0;
+            u32                              num_shadows = 0;
+            u32                              num_samplers = 0;
+            u32                              num_cams = 0;
+            std::vector<Str>                 strings;
+            Str                              empty = "";
+
+            const Str& get_string(u32 index) const
+            {
+                return index < strings.size() ? strings[index] : empty;
+            }
+        };
+
+        // checks every section lies inside of the container and makes its strings, returns an error or null. the scene
+        // is not touched and nothing is logged so this can run on the job workers.
+        static const c8* view_scene_container(const u8* data, size_t data_size, scene_container_view& cv)
         {
-            hash_id id;
-            ifs.read((c8*)&id, sizeof(hash_id));
+            scene_container_header& sh = cv.header;
+            memcpy(&sh, data, sizeof(scene_container_header));
+
+            if (sh.container_version > k_scene_container_version || sh.header_size != sizeof(scene_container_header))
+                return "unsupported container version";
+
+            u32 num_component_table, num_ext_table, num_strings, num_string_data, num_node_strings;
+
+            cv.data = data;
+            cv.component_table = get_scene_section<scene_container_component>(data, data_size, sh,
+                                                                               e_scene_section::components,
+                                                                               num_component_table);
+            cv.ext_table = get_scene_section<scene_container_extension>(data, data_size, sh,
+                                                                         e_scene_section::extensions, num_ext_table);
+            cv.node_strings = get_scene_section<u32>(data, data_size, sh, e_scene_section::node_strings,
+                                                     num_node_strings);
+            cv.geometry = get_scene_section<scene_container_geometry>(data, data_size, sh, e_scene_section::geometry,
+                                                                      cv.num_geometry);
+            cv.node_geometry = get_scene_section<u32>(data, data_size, sh, e_scene_section::node_geometry,
+                                                      cv.num_node_geometry);
+            cv.animations = get_scene_section<u32>(data, data_size, sh, e_scene_section::animations,
+                                                   cv.num_animations);
+            cv.materials = get_scene_section<u32>(data, data_size, sh, e_scene_section::materials, cv.num_materials);
+            cv.shadows = get_scene_section<u32>(data, data_size, sh, e_scene_section::shadows, cv.num_shadows);
+            cv.samplers = get_scene_section<u32>(data, data_size, sh, e_scene_section::samplers, cv.num_samplers);
+            cv.cams = get_scene_section<scene_container_camera>(data, data_size, sh, e_scene_section::cameras,
+                                                                cv.num_cams);
+
+            auto strings = get_scene_section<scene_container_string>(data, data_size, sh, e_scene_section::strings,
+                                                                     num_strings);
+            auto string_data = get_scene_section<c8>(data, data_size, sh, e_scene_section::string_data,
+                                                     num_string_data);
+
+            u32 num_nodes = sh.num_nodes;
+            if (!cv.component_table || !cv.ext_table || !strings || !string_data || !cv.node_strings || !cv.geometry ||
+                !cv.node_geometry || !cv.animations || !cv.materials || !cv.shadows || !cv.samplers || !cv.cams ||
+                num_component_table != sh.num_components || num_ext_table != sh.num_extensions ||
+                num_node_strings != num_nodes * 3 || cv.num_animations < num_nodes)
+                return "corrupt container";
 
-            u32 num_strings = sb_count(s_lookup_strings);
-            for (u32 i = 0; i < num_strings; ++i)
+            for (u32 i = 0; i < sh.num_components; ++i)
             {
-                if (s_lookup_strings[i].id == id)
-                {
-                    return s_lookup_strings[i].name;
-                }
+                const scene_container_component& c = cv.component_table[i];
+                if (c.offset > data_size || (u64)c.size * num_nodes > data_size - c.offset)
+                    return "corrupt container";
             }
 
-            return "";
-        }
-
-        hash_id rehash_lookup_string(hash_id id)
-        {
-            u32 num_strings = sb_count(s_lookup_strings);
+            // each unique string is made once and indices are looked up directly
+            cv.strings.resize(num_strings);
             for (u32 i = 0; i < num_strings; ++i)
             {
-                if (s_lookup_strings[i].id == id)
-                {
-                    return PEN_HASH(s_lookup_strings[i].name);
-                }
+                u32 end = strings[i].offset + strings[i].length;
+                if (end >= strings[i].offset && end < num_string_data && string_data[end] == '\0')
+                    cv.strings[i] = &string_data[strings[i].offset];
             }
 
-            return 0;
+            return nullptr;
         }
 
-        void save_sub_scene(ecs_scene* scene, u32 root)
+        // where the nodes of a container are being added to a scene, load_scene adds them all at once and
+        // update_scene_streams a chunk at a time so the cursors into the per node sections carry over
+        struct scene_container_commit
         {
-            std::vector<s32> nodes;
-            build_heirarchy_node_list(scene, root, nodes);
-
-            u32 num = nodes.size();
-
-            ecs_scene sub_scene;
+            Str                             project_dir;
+            u32                             zero_offset = 0;
+            scene_ext_components*           exts = nullptr;
+            std::vector<geometry_resource*> resources; // of each container geometry
+            std::vector<hash_id>            resource_ids;
+            u32                             gi = 0;
+            u32                             ai = 0;
+            u32                             mi = 0;
+            u32                             si = 0;
+            u32                             bi = 0;
+            bool                            error = false;
+        };
 
-            // create sub scene with same components
-            u32 num_ext = sb_count(scene->extensions);
-            for (u32 e = 0; e < num_ext; ++e)
-                scene->extensions[e].ext_func(&sub_scene);
+        static void begin_scene_container_commit(ecs_scene* scene, const scene_container_view& cv,
+                                                 scene_container_commit& cc, u32 zero_offset)
+        {
+            cc.zero_offset = zero_offset;
 
-            resize_scene_buffers(&sub_scene, num);
+            // animation instances follow the count of each node
+            cc.ai = cv.header.num_nodes;
 
-            for (u32 i = 0; i < num; ++i)
+            for (u32 i = 0; i < cv.header.num_extensions; ++i)
             {
-                u32 ii = nodes[i];
-                if (ii == PEN_INVALID_HANDLE)
-                    continue;
-
-                u32 ni = sub_scene.num_entities;
-
-                for (u32 c = 0; c < scene->num_components; ++c)
-                {
-                    generic_cmp_array& src = scene->get_component_array(c);
-                    generic_cmp_array& dst = sub_scene.get_component_array(c);
-
-                    memcpy(dst[ni], src[ii], src.size);
-                }
-
-                sub_scene.parents[ni] -= root;
-                sub_scene.num_entities++;
+                scene_ext_components ext;
+                ext.id = PEN_HASH(cv.get_string(cv.ext_table[i].name).c_str());
+                ext.start_cmp = cv.ext_table[i].start_cmp;
+                ext.num_cmp = cv.ext_table[i].num_cmp;
+                sb_push(cc.exts, ext);
             }
-
-            Str fn = "";
-            fn.appendf("../../assets/scene/%s.pms", sub_scene.names[0].c_str());
-
-            save_scene(fn.c_str(), &sub_scene);
-
-            free_scene_buffers(&sub_scene, true);
-            unregister_ecs_extensions(&sub_scene);
         }
 
-        void save_scene(const c8* filename, ecs_scene* scene)
+        // adds nodes [begin, end) of the container to the entities from cc.zero_offset + begin, which are allocated.
+        // nodes must be added in order, the resources of their geometry are found before.
+        static void commit_scene_container(ecs_scene* scene, const scene_container_view& cv, scene_container_commit& cc,
+                                           u32 begin, u32 end)
         {
-            const c8* wd = pen::os_get_user_info().working_directory;
-            Str       project_dir = dev_ui::get_program_preference_filename("project_dir", wd);
-
-            std::ofstream ofs(filename, std::ofstream::binary);
+            const scene_container_header& sh = cv.header;
 
-            sb_free(s_lookup_strings);
-            s_lookup_strings = nullptr;
+            u32 count = end - begin;
+            u32 first = cc.zero_offset + begin;
+            u32 last = cc.zero_offset + end;
 
-            // write basic components
-            for (u32 i = 0; i < scene->num_components; ++i)
+            // component arrays are copied in bulk, arrays which are missing or changed size are skipped
+            for (u32 i = 0; i < sh.num_components; ++i)
             {
-                generic_cmp_array& cmp = scene->get_component_array(i);
-                ofs.write((const c8*)cmp.data, cmp.size * scene->num_entities);
+                u32 ri = remap_scene_component(scene, i, sh.num_base_components, cc.exts, sh.num_extensions);
+                if (ri == -1)
+                    continue;
+
+                generic_cmp_array& cmp = scene->get_component_array(ri);
+                if (cmp.size != cv.component_table[i].size)
+                    continue;
+
+                c8*       dst = (c8*)cmp.data + (size_t)first * cmp.size;
+                const u8* src = cv.data + cv.component_table[i].offset + (size_t)begin * cmp.size;
+                memcpy(dst, src, (size_t)cmp.size * count);
             }
 
-            // specialisations ------------------------------------------------------------------------------
+            // fixup parents for scene import / merge, and everything needs updating. handles were saved with the
+            // components and are stale
+            for (u32 n = first; n < last; ++n)
+            {
+                scene->parents[n] += cc.zero_offset;
+                scene->dirty_flags[n] = e_dirty::all;
+                scene->cbuffer[n] = PEN_INVALID_HANDLE;
+            }
 
             // names
-            for (s32 n = 0; n < scene->num_entities; ++n)
+            const u32* ns = cv.node_strings + begin * 3;
+            for (u32 n = first; n < last; ++n, ns += 3)
             {
-                write_lookup_string(scene->names[n].c_str(), ofs);
-                write_lookup_string(scene->geometry_names[n].c_str(), ofs);
-                write_lookup_string(scene->material_names[n].c_str(), ofs);
+                memset(&scene->names[n], 0x0, sizeof(Str));
+                memset(&scene->geometry_names[n], 0x0, sizeof(Str));
+                memset(&scene->material_names[n], 0x0, sizeof(Str));
+
+                scene->names[n] = cv.get_string(ns[0]);
+                scene->geometry_names[n] = cv.get_string(ns[1]);
+                scene->material_names[n] = cv.get_string(ns[2]);
             }
 
             // geometry
-            for (s32 n = 0; n < scene->num_entities; ++n)
+            for (u32 n = first; n < last; ++n)
             {
                 if (!(scene->entities[n] & e_cmp::geometry))
                     continue;
 
-                geometry_resource* gr = get_geometry_resource(scene->id_geometry[n]);
-
-                ofs.write((const c8*)&gr->submesh_index, sizeof(u32));
+                u32 g = cc.gi < cv.num_node_geometry ? cv.node_geometry[cc.gi++] : cv.num_geometry;
+                if (g >= cv.num_geometry)
+                {
+                    scene->entities[n] &= ~e_cmp::geometry;
+                    cc.error = true;
+                    continue;
+                }
 
-                write_lookup_string(gr->filename.c_str(), ofs, project_dir.c_str());
-                write_lookup_string(gr->geometry_name.c_str(), ofs, project_dir.c_str());
+                const Str& name = cv.get_string(cv.geometry[g].filename);
+                if (!instantiate_scene_geometry(scene, n, cc.resources[g], cc.resource_ids[g], cc.project_dir, name))
+                    cc.error = true;
             }
 
-            // animations
-            for (s32 n = 0; n < scene->num_entities; ++n)
-            {
-                s32 size = 0;
-
-                if (scene->anim_controller_v2[n].anim_instances)
-                    size = sb_count(scene->anim_controller_v2[n].anim_instances);
-
-                ofs.write((const c8*)&size, sizeof(s32));
+            instantiate_scene_rigid_bodies(scene, first, last);
 
-                for (s32 i = 0; i < size; ++i)
+            // animations, counts for each node then the instances
+            for (u32 n = begin; n < end; ++n)
+                for (u32 i = 0; i < cv.animations[n] && cc.ai < cv.num_animations; ++i)
                 {
-                    // todo with anim controller v2
-                    // auto* anim = get_animation_resource(scene->anim_controller_v2[n].anim_instances[i].);
-                    write_lookup_string("placeholder", ofs, project_dir.c_str());
+                    const Str& name = cv.get_string(cv.animations[cc.ai++]);
+                    if (!load_scene_animation(scene, cc.zero_offset + n, cc.project_dir, name))
+                        cc.error = true;
                 }
-            }
 
-            // material
-            for (s32 n = 0; n < scene->num_entities; ++n)
+            // materials
+            for (u32 n = first; n < last && cc.mi + 3 <= cv.num_materials; ++n)
             {
                 if (!(scene->entities[n] & e_cmp::material))
                     continue;
 
-                cmp_material&      mat = scene->materials[n];
-                material_resource& mat_res = scene->material_resources[n];
-
-                const char* shader_name = pmfx::get_shader_name(mat.shader);
-                const char* technique_name = pmfx::get_technique_name(mat.shader, mat_res.id_technique);
-
-                write_lookup_string(mat_res.material_name.c_str(), ofs);
-                write_lookup_string(shader_name, ofs);
-                write_lookup_string(technique_name, ofs);
+                const u32* m = cv.materials + cc.mi;
+                load_scene_material(scene, n, cv.get_string(m[0]), cv.get_string(m[1]), cv.get_string(m[2]));
+                cc.mi += 3;
             }
 
-            // shadow
-            for (s32 n = 0; n < scene->num_entities; ++n)
+            // sdf shadow
+            for (u32 n = first; n < last && cc.si < cv.num_shadows; ++n)
             {
                 if (!(scene->entities[n] & e_cmp::sdf_shadow))
                     continue;
 
-                cmp_shadow& shadow = scene->shadows[n];
-
-                write_lookup_string(put::get_texture_filename(shadow.texture_handle).c_str(), ofs, project_dir.c_str());
+                load_scene_sdf_shadow(scene, n, cv.get_string(cv.shadows[cc.si++]));
             }
 
-            // sampler bindings
-            for (s32 n = 0; n < scene->num_entities; ++n)
+            // sampler binding textures
+            static const u32 k_sampler_strings = e_pmfx_constants::max_technique_sampler_bindings * 2;
+
+            for (u32 n = first; n < last && cc.bi + k_sampler_strings <= cv.num_samplers; ++n)
             {
                 if (!(scene->entities[n] & e_cmp::samplers))
                     continue;
 
-                cmp_samplers& samplers = scene->samplers[n];
-
-                for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
+                cmp_samplers& cs = scene->samplers[n];
+                for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i, cc.bi += 2)
                 {
-                    write_lookup_string(put::get_texture_filename(samplers.sb[i].handle).c_str(), ofs, project_dir.c_str());
-                    write_lookup_string(pmfx::get_render_state_name(samplers.sb[i].sampler_state).c_str(), ofs,
-                                        project_dir.c_str());
+                    const Str& texture = cv.get_string(cv.samplers[cc.bi]);
+                    load_scene_sampler(cs.sb[i], texture, cv.get_string(cv.samplers[cc.bi + 1]));
                 }
             }
+        }
 
-            // cameras
-            camera** cams = pmfx::get_cameras();
-            u32      num_cams = sb_count(cams);
-            for (u32 i = 0; i < num_cams; ++i)
+        // components are copied straight from the mapped file and strings and geometry are resolved once each
+        static void load_scene_container(const c8* filename, const u8* data, size_t data_size, ecs_scene* scene,
+                                         bool merge)
+        {
+            const c8* wd = pen::os_get_user_info().working_directory;
+
+            scene_container_view cv;
+            const c8*            err = view_scene_container(data, data_size, cv);
+            if (err)
             {
-                write_lookup_string(cams[i]->name.c_str(), ofs);
+                dev_ui::log_level(dev_ui::console_level::error, "[error] scene - %s: %s", err, filename);
+                return;
             }
 
-            // call extensions specific save
-            u32 num_extensions = sb_count(scene->extensions);
-            for (u32 i = 0; i < num_extensions; ++i)
-                if (scene->extensions[i].save_func)
-                    scene->extensions[i].save_func(scene->extensions[i], scene);
+            const scene_container_header& sh = cv.header;
 
-            ofs.close();
+            u32 num_nodes = sh.num_nodes;
+            u32 zero_offset = begin_scene_load(filename, scene, merge, sh.scene_version, num_nodes, sh.selected_index);
+            u32 end_node = zero_offset + num_nodes;
 
-            std::ifstream infile(filename, std::ifstream::binary);
+            scene_container_commit cc;
+            cc.project_dir = dev_ui::get_program_preference_filename("project_dir", wd);
+            begin_scene_container_commit(scene, cv, cc, zero_offset);
 
-            // get size of file
-            infile.seekg(0, infile.end);
-            u32 scene_data_size = (u32)infile.tellg();
-            infile.seekg(0);
+            if (!merge)
+                for (u32 i = 0; i < cv.num_cams; ++i)
+                    load_scene_camera(cv.cams[i]);
 
-            // allocate memory for file content
-            c8* scene_data = new c8[scene_data_size];
+            // geometry resources are found once for all of the nodes which use them
+            cc.resources.resize(cv.num_geometry);
+            cc.resource_ids.resize(cv.num_geometry);
+            for (u32 g = 0; g < cv.num_geometry; ++g)
+            {
+                const scene_container_geometry& cg = cv.geometry[g];
+                cc.resources[g] = load_scene_geometry(cc.project_dir, cv.get_string(cg.filename),
+                                                      cv.get_string(cg.geometry_name), cg.submesh, cc.resource_ids[g]);
+            }
 
-            // read content of infile
-            infile.read(scene_data, scene_data_size);
+            commit_scene_container(scene, cv, cc, 0, num_nodes);
+            instantiate_scene_constraints(scene, zero_offset, end_node);
 
-            ofs = std::ofstream(filename, std::ofstream::binary);
+            end_scene_load(scene, zero_offset, end_node, sh.num_extensions, merge, sh.view_flags, cc.error);
 
-            // header
-            scene_header sh;
-            sh.num_nodes = scene->num_entities;
-            sh.view_flags = scene->view_flags;
-            sh.selected_index = scene->selected_index;
-            sh.num_components = scene->num_components;
-            sh.num_base_components = scene->num_base_components;
-            sh.num_lookup_strings = sb_count(s_lookup_strings);
-            sh.num_extensions = sb_count(scene->extensions);
-            ofs.write((const c8*)&sh, sizeof(scene_header));
+            sb_free(cc.exts);
+        }
 
-            // component sizes
-            for (u32 c = 0; c < sh.num_components; ++c)
+        void load_scene(const c8* filename, ecs_scene* scene, bool merge)
+        {
+            // containers are mapped, older scenes are streamed
+            const void* data = nullptr;
+            size_t      data_size = 0;
+            pen_error   err = pen::filesystem_map_file(filename, &data, data_size);
+
+            if (err == PEN_ERR_OK && data_size >= sizeof(scene_container_header) &&
+                *(const u32*)data == k_scene_container_magic)
             {
-                ofs.write((const c8*)&scene->get_component_array(c).size, sizeof(u32));
+                load_scene_container(filename, (const u8*)data, data_size, scene, merge);
+                pen::filesystem_unmap_file(data, data_size);
+                return;
             }
 
-            // extensions
-            for (u32 i = 0; i < sh.num_extensions; ++i)
+            pen::filesystem_unmap_file(data, data_size);
+            load_scene_stream(filename, scene, merge);
+        }
+
+        namespace
+        {
+            // a pmm or pma a stream needs, decoded on a worker
+            struct stream_file
             {
-                u32 co = get_extension_component_offset(scene, i);
-                write_lookup_string(scene->extensions[i].name.c_str(), ofs);
-                ofs.write((const c8*)&co, sizeof(u32));
-                ofs.write((const c8*)&scene->extensions[i].num_components, sizeof(u32));
-            }
+                Str                filename;
+                hash_id            id_geometry = 0; // of one geometry in a pmm, to find if it has been loaded
+                bool               anim = false;
+                bool               valid = false;
+                pmm_geometry_file* geometry = nullptr;
+                animation_resource animation;
+                a_u32              decoded = {0};
+            };
 
-            // string lookups
-            for (u32 l = 0; l < sh.num_lookup_strings; ++l)
+            struct scene_stream
             {
-                write_parsable_string(s_lookup_strings[l].name.c_str(), ofs);
-                ofs.write((const c8*)&s_lookup_strings[l].id, sizeof(hash_id));
-            }
+                u32                 handle = 0;
+                ecs_scene*          scene = nullptr;
+                Str                 filename;
+                scene_stream_params params;
+                scene_stream_state  state = e_scene_stream_state::parsing;
+                a_u32               tasks = {0};
+
+                // written by the parse task
+                const void*          data = nullptr;
+                size_t               data_size = 0;
+                bool                 container = false;
+                const c8*            error = nullptr;
+                scene_container_view view;
+                stream_file*         files = nullptr;
+                u32                  num_files = 0;
+                std::vector<u32>     textures; // unique texture strings of the sampler bindings
+
+                // main thread progress, entities [start, end) belong to the stream and next is the one to add or remove
+                scene_container_commit commit;
+                u32                    next_file = 0;
+                u32                    next_texture = 0;
+                u32                    start = 0;
+                u32                    end = 0;
+                u32                    next = 0;
+                bool                   reserved = false;
+            };
 
-            // write camera info
-            ofs.write((const c8*)&num_cams, sizeof(u32));
-            for (u32 i = 0; i < num_cams; ++i)
+            std::vector<scene_stream*> s_scene_streams;
+        } // namespace
+
+        static void decode_stream_file(void* user_data)
+        {
+            stream_file* sf = (stream_file*)user_data;
+
+            if (sf->anim)
             {
-                hash_id id_cam = PEN_HASH(cams[i]->name);
-                ofs.write((const c8*)&id_cam, sizeof(hash_id));
-                ofs.write((const c8*)&cams[i]->pos, sizeof(vec3f));
-                ofs.write((const c8*)&cams[i]->focus, sizeof(vec3f));
-                ofs.write((const c8*)&cams[i]->rot, sizeof(vec2f));
-                ofs.write((const c8*)&cams[i]->fov, sizeof(f32));
-                ofs.write((const c8*)&cams[i]->aspect, sizeof(f32));
-                ofs.write((const c8*)&cams[i]->near_plane, sizeof(f32));
-                ofs.write((const c8*)&cams[i]->far_plane, sizeof(f32));
-                ofs.write((const c8*)&cams[i]->zoom, sizeof(f32));
+                sf->valid = read_pma(sf->filename.c_str(), sf->animation);
+            }
+            else
+            {
+                sf->geometry = read_pmm_geometry(sf->filename.c_str());
+                sf->valid = sf->geometry != nullptr;
             }
 
-            // write scene data
-            ofs.write(scene_data, scene_data_size);
-            ofs.close();
+            sf->decoded = 1;
         }
 
-        void load_scene(const c8* filename, ecs_scene* scene, bool merge)
+        // maps and checks the container and lists the files and textures it needs
+        static void parse_scene_stream(void* user_data)
         {
-            scene->flags |= e_scene_flags::invalidate_scene_tree;
-            bool      error = false;
-            const c8* wd = pen::os_get_user_info().working_directory;
-            Str       project_dir = dev_ui::get_program_preference_filename("project_dir", wd);
+            scene_stream* ss = (scene_stream*)user_data;
 
-            std::ifstream ifs(pen::os_path_for_resource(filename), std::ofstream::binary);
+            if (pen::filesystem_map_file(ss->filename.c_str(), &ss->data, ss->data_size) != PEN_ERR_OK)
+            {
+                ss->error = "cannot find file";
+                return;
+            }
 
-            // header
-            scene_header sh;
-            ifs.read((c8*)&sh, sizeof(scene_header));
+            // older scenes are loaded with load_scene when their entities are added
+            if (ss->data_size < sizeof(scene_container_header) || *(const u32*)ss->data != k_scene_container_magic)
+                return;
 
-            if (!merge)
+            ss->container = true;
+
+            scene_container_view& cv = ss->view;
+            ss->error = view_scene_container((const u8*)ss->data, ss->data_size, cv);
+            if (ss->error)
+                return;
+
+            scene_container_commit& cc = ss->commit;
+            cc.resource_ids.resize(cv.num_geometry);
+
+            // each file is decoded once for all of the nodes which use it
+            std::unordered_map<hash_id, u32> lookup;
+            std::vector<Str>                 filenames;
+            std::vector<hash_id>             ids;
+            u32                              num_pmm = 0;
+
+            for (u32 g = 0; g < cv.num_geometry; ++g)
             {
-                scene->version = sh.version;
-                scene->filename = filename;
+                const scene_container_geometry& cg = cv.geometry[g];
+                const Str&                      name = cv.get_string(cg.filename);
+                if (is_scene_primitive(name))
+                    continue;
+
+                Str filename = cc.project_dir;
+                filename.append(name.c_str());
+
+                cc.resource_ids[g] = get_scene_geometry_id(filename, cv.get_string(cg.geometry_name), cg.submesh);
+
+                hash_id id = PEN_HASH(filename.c_str());
+                if (lookup.find(id) != lookup.end())
+                    continue;
+
+                lookup[id] = (u32)filenames.size();
+                filenames.push_back(filename);
+                ids.push_back(cc.resource_ids[g]);
             }
 
-            // version 9 adds extensions
-            if (sh.version < 9)
-                sh.num_base_components = sh.num_components;
+            num_pmm = (u32)filenames.size();
 
-            // unpack header
-            s32 num_nodes = sh.num_nodes;
+            for (u32 a = cv.header.num_nodes; a < cv.num_animations; ++a)
+            {
+                Str filename = cc.project_dir;
+                filename.append(cv.get_string(cv.animations[a]).c_str());
 
-            scene->selected_index = sh.selected_index;
-            s32 scene_view_flags = sh.view_flags;
+                hash_id id = PEN_HASH(filename.c_str());
+                if (lookup.find(id) != lookup.end())
+                    continue;
 
-            u32 zero_offset = 0;
-            s32 new_num_nodes = num_nodes;
+                lookup[id] = (u32)filenames.size();
+                filenames.push_back(filename);
+            }
 
-            if (merge)
+            ss->num_files = (u32)filenames.size();
+            ss->files = new stream_file[ss->num_files];
+            for (u32 f = 0; f < ss->num_files; ++f)
             {
-                zero_offset = scene->num_entities;
-                new_num_nodes = scene->num_entities + num_nodes;
+                ss->files[f].filename = filenames[f];
+                ss->files[f].anim = f >= num_pmm;
+                ss->files[f].id_geometry = f < num_pmm ? ids[f] : 0;
             }
-            else
+
+            // textures, strings are unique so their index is too
+            std::vector<bool> texture_found(cv.strings.size(), false);
+            for (u32 b = 0; b < cv.num_samplers; b += 2)
             {
-                clear_scene(scene);
+                u32 t = cv.samplers[b];
+                if (t >= cv.strings.size() || texture_found[t] || cv.strings[t].empty())
+                    continue;
+
+                texture_found[t] = true;
+                ss->textures.push_back(t);
             }
+        }
 
-            if (new_num_nodes > scene->soa_size)
-                resize_scene_buffers(scene, num_nodes);
+        static void set_scene_stream_state(scene_stream* ss, scene_stream_state state)
+        {
+            ss->state = state;
 
-            scene->num_entities = new_num_nodes;
+            if (ss->params.callback)
+                ss->params.callback(ss->scene, ss->handle, state, ss->params.user_data);
+        }
 
-            // read component sizes
-            u32* component_sizes = nullptr;
-            for (u32 i = 0; i < sh.num_components; ++i)
+        // frees everything which is only needed while loading, the workers must be finished
+        static void release_scene_stream_data(scene_stream* ss)
+        {
+            // files which were decoded but not created, animations have no gpu resources and are kept
+            for (u32 f = ss->next_file; f < ss->num_files; ++f)
             {
-                u32 size;
-                ifs.read((c8*)&size, sizeof(u32));
-                sb_push(component_sizes, size);
+                stream_file& sf = ss->files[f];
+                if (sf.geometry)
+                    free_pmm_geometry(sf.geometry);
+                else if (sf.anim && sf.valid)
+                    add_animation_resource(sf.filename.c_str(), sf.animation);
             }
 
-            // extensions
-            struct ext_components
-            {
-                hash_id id;
-                u32     start_cmp;
-                u32     num_cmp;
-            };
-            ext_components* exts = nullptr;
+            delete[] ss->files;
+            ss->files = nullptr;
+            ss->num_files = 0;
+            ss->next_file = 0;
 
-            for (u32 i = 0; i < sh.num_extensions; ++i)
-            {
-                ext_components ext;
-                ifs.read((c8*)&ext.id, sizeof(hash_id));
-                ifs.read((c8*)&ext.start_cmp, sizeof(u32));
-                ifs.read((c8*)&ext.num_cmp, sizeof(u32));
+            if (ss->data)
+                pen::filesystem_unmap_file(ss->data, ss->data_size);
 
-                sb_push(exts, ext);
-            }
+            ss->data = nullptr;
+            ss->data_size = 0;
+            ss->view = scene_container_view();
+            ss->textures.clear();
+            ss->commit.resources.clear();
+            ss->commit.resource_ids.clear();
 
-            // read string lookups
-            sb_free(s_lookup_strings);
-            s_lookup_strings = nullptr;
+            sb_free(ss->commit.exts);
+            ss->commit.exts = nullptr;
+        }
 
-            for (u32 n = 0; n < sh.num_lookup_strings; ++n)
-            {
-                lookup_string ls;
-                ls.name = read_parsable_string(ifs);
-                ifs.read((c8*)&ls.id, sizeof(hash_id));
+        static void free_scene_stream(scene_stream* ss)
+        {
+            pen::jobs_wait(&ss->tasks);
+            release_scene_stream_data(ss);
 
-                sb_push(s_lookup_strings, ls);
-            }
+            s_scene_streams[ss->handle] = nullptr;
+            delete ss;
+        }
 
-            // rehash extension ids
-            for (u32 i = 0; i < sh.num_extensions; ++i)
-            {
-                exts[i].id = rehash_lookup_string(exts[i].id);
-            }
+        static void release_scene_streams(ecs_scene* scene)
+        {
+            for (scene_stream* ss : s_scene_streams)
+                if (ss && ss->scene == scene)
+                    free_scene_stream(ss);
+        }
 
-            // read cameras
-            u32 num_cams;
-            ifs.read((c8*)&num_cams, sizeof(u32));
+        // once the container is parsed files which are not loaded yet are decoded on the workers
+        static bool begin_scene_stream_resources(scene_stream* ss)
+        {
+            if (ss->tasks != 0)
+                return false;
 
-            for (u32 i = 0; i < num_cams; ++i)
+            if (ss->error)
             {
-                camera  cam;
-                hash_id id_cam;
+                dev_ui::log_level(dev_ui::console_level::error, "[error] scene - %s: %s", ss->error,
+                                  ss->filename.c_str());
+                set_scene_stream_state(ss, e_scene_stream_state::failed);
+                return false;
+            }
 
-                ifs.read((c8*)&id_cam, sizeof(hash_id));
-                ifs.read((c8*)&cam.pos, sizeof(vec3f));
-                ifs.read((c8*)&cam.focus, sizeof(vec3f));
-                ifs.read((c8*)&cam.rot, sizeof(vec2f));
-                ifs.read((c8*)&cam.fov, sizeof(f32));
-                ifs.read((c8*)&cam.aspect, sizeof(f32));
-                ifs.read((c8*)&cam.near_plane, sizeof(f32));
-                ifs.read((c8*)&cam.far_plane, sizeof(f32));
-                ifs.read((c8*)&cam.zoom, sizeof(f32));
+            if (!ss->container)
+            {
+                ss->state = e_scene_stream_state::committing;
+                return true;
+            }
 
-                // find camera and set
-                camera* _cam = pmfx::get_camera(id_cam);
-                if (_cam && !merge)
+            for (u32 f = 0; f < ss->num_files; ++f)
+            {
+                stream_file& sf = ss->files[f];
+                if (!sf.anim && get_geometry_resource(sf.id_geometry))
                 {
-                    _cam->pos = cam.pos;
-                    _cam->focus = cam.focus;
-                    _cam->rot = cam.rot;
-                    _cam->fov = cam.fov;
-                    _cam->aspect = cam.aspect;
-                    _cam->near_plane = cam.near_plane;
-                    _cam->far_plane = cam.far_plane;
-                    _cam->zoom = cam.zoom;
+                    sf.decoded = 1;
+                    continue;
                 }
+
+                pen::jobs_submit(decode_stream_file, &sf, &ss->tasks);
             }
 
-            // read all components
-            for (u32 i = 0; i < sh.num_components; ++i)
-            {
-                u32 ri = i; // remap i.. if we have extensions
+            ss->state = e_scene_stream_state::resources;
+            return true;
+        }
 
-                // extensions
-                if (i >= sh.num_base_components)
-                {
-                    ri = -1;
+        // files are created in order as the workers finish them then the textures are loaded
+        static bool create_scene_stream_resource(scene_stream* ss, u32& num_created)
+        {
+            if (num_created >= ss->params.resources_per_update)
+                return false;
 
-                    //find extension that maps to this component, allow out of order or missing components
-                    for (u32 e = 0; e < sh.num_extensions; ++e)
-                    {
-                        u32 ext_i = i - exts[e].start_cmp;
-                        if (i >= exts[e].start_cmp && ext_i < exts[e].num_cmp)
-                        {
-                            ri = get_extension_component_offset_from_id(scene, exts[e].id) + ext_i;
-                            break;
-                        }
-                    }
-                }
+            const scene_container_view& cv = ss->view;
+            scene_container_commit&     cc = ss->commit;
 
-                bool read = false;
+            if (ss->next_file < ss->num_files)
+            {
+                stream_file& sf = ss->files[ss->next_file];
+                if (!sf.decoded)
+                    return false;
 
-                if (ri != -1)
+                if (sf.geometry)
                 {
-                    generic_cmp_array& cmp = scene->get_component_array(ri);
-
-                    if (cmp.size == component_sizes[i])
-                    {
-                        // read whole array
-                        c8* data_offset = (c8*)cmp.data + zero_offset * cmp.size;
-                        ifs.read(data_offset, cmp.size * num_nodes);
-                        read = true;
-                    }
+                    create_pmm_geometry(sf.geometry);
+                    sf.geometry = nullptr;
+                    ++num_created;
                 }
-
-                if (!read)
+                else if (sf.anim && sf.valid)
                 {
-                    // read the old size
-                    u32 array_size = component_sizes[i] * num_nodes;
-                    c8* old = (c8*)pen::memory_alloc(array_size);
-                    ifs.read(old, array_size);
-
-                    // here any fuxup can be applied old into cmp.data
-
-                    pen::memory_free(old);
+                    add_animation_resource(sf.filename.c_str(), sf.animation);
+                    sf.valid = false;
                 }
-            }
 
-            // fixup parents for scene import / merge
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
-                scene->parents[n] += zero_offset;
+                ++ss->next_file;
+                return true;
+            }
 
-            // read specialisations
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
+            if (ss->next_texture < ss->textures.size())
             {
-                memset(&scene->names[n], 0x0, sizeof(Str));
-                memset(&scene->geometry_names[n], 0x0, sizeof(Str));
-                memset(&scene->material_names[n], 0x0, sizeof(Str));
-
-                scene->names[n] = read_lookup_string(ifs);
-                scene->geometry_names[n] = read_lookup_string(ifs);
-                scene->material_names[n] = read_lookup_string(ifs);
+                put::load_texture(cv.get_string(ss->textures[ss->next_texture++]).c_str());
+                ++num_created;
+                return true;
             }
 
-            // geometry
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
+            // everything exists, primitives are found by name and the rest by the id load_pmm gave them
+            cc.resources.resize(cv.num_geometry);
+            for (u32 g = 0; g < cv.num_geometry; ++g)
             {
-                if (scene->entities[n] & e_cmp::geometry)
-                {
-                    u32 submesh;
-                    ifs.read((c8*)&submesh, sizeof(u32));
+                if (cc.resource_ids[g])
+                    cc.resources[g] = get_geometry_resource(cc.resource_ids[g]);
+                else
+                    cc.resources[g] = get_geometry_resource(PEN_HASH(cv.get_string(cv.geometry[g].geometry_name)));
+            }
 
-                    Str filename = project_dir;
-                    Str name = read_lookup_string(ifs).c_str();
-                    Str geometry_name = read_lookup_string(ifs);
+            ss->state = e_scene_stream_state::committing;
+            return true;
+        }
 
-                    hash_id        name_hash = PEN_HASH(name.c_str());
-                    static hash_id primitive_id = PEN_HASH("primitive");
+        // the entities of a stream are allocated up front so nothing else is given them, until their chunk is added
+        // they are empty and have no parent
+        static void reserve_scene_stream_entities(scene_stream* ss)
+        {
+            ecs_scene* scene = ss->scene;
+            u32        num_nodes = ss->view.header.num_nodes;
 
-                    filename.append(name.c_str());
+            ss->start = (u32)scene->num_entities;
+            ss->end = ss->start + num_nodes;
+            ss->next = ss->start;
 
-                    geometry_resource* gr = nullptr;
+            // keeps an entity free after them for the free list
+            if (ss->end >= scene->soa_size)
+                resize_scene_buffers(scene, ss->end + 1 - scene->soa_size);
 
-                    if (name_hash != primitive_id)
-                    {
-                        dev_console_log("[scene load] %s", name.c_str());
-                        load_pmm(filename.c_str(), nullptr, e_pmm_load_flags::geometry);
+            for (u32 n = ss->start; n < ss->end; ++n)
+            {
+                scene->entities[n] = e_cmp::allocated;
+                scene->parents[n] = n;
+                scene->cbuffer[n] = PEN_INVALID_HANDLE;
+                scene->names[n].set_ref("");
+            }
 
-                        pen::hash_murmur hm;
-                        hm.begin(0);
-                        hm.add(filename.c_str(), filename.length());
-                        hm.add(geometry_name.c_str(), geometry_name.length());
-                        hm.add(submesh);
-                        hash_id geom_hash = hm.end();
+            scene->num_entities = ss->end;
+            scene->flags |= e_scene_flags::invalidate_scene_tree;
+            initialise_free_list(scene);
 
-                        gr = get_geometry_resource(geom_hash);
+            begin_scene_container_commit(scene, ss->view, ss->commit, ss->start);
+            ss->reserved = true;
+        }
 
-                        scene->id_geometry[n] = geom_hash;
-                    }
-                    else
-                    {
-                        hash_id geom_hash = PEN_HASH(geometry_name.c_str());
-                        gr = get_geometry_resource(geom_hash);
-                    }
+        static void end_scene_stream_commit(scene_stream* ss)
+        {
+            ecs_scene* scene = ss->scene;
 
-                    if (gr)
-                    {
-                        instantiate_geometry(gr, scene, n);
-                        instantiate_model_cbuffer(scene, n);
+            instantiate_scene_constraints(scene, ss->start, ss->end);
 
-                        if (gr->p_skin)
-                            instantiate_anim_controller_v2(scene, n);
-                    }
-                    else
-                    {
-                        dev_ui::log_level(dev_ui::console_level::error, "[error] geometry - cannot find pmm file: %s",
-                                          filename.c_str());
+            u32 num_extensions = std::min<u32>(ss->view.header.num_extensions, sb_count(scene->extensions));
+            for (u32 i = 0; i < num_extensions; ++i)
+                if (scene->extensions[i].load_func)
+                    scene->extensions[i].load_func(scene->extensions[i], scene);
 
-                        scene->entities[n] &= ~e_cmp::geometry;
-                        error = true;
-                    }
-                }
-            }
+            if (ss->commit.error)
+                dev_ui::log_level(dev_ui::console_level::error, "[error] scene - missing resources: %s",
+                                  ss->filename.c_str());
 
-            // instantiate physics
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
-                if (scene->entities[n] & e_cmp::physics)
-                    instantiate_rigid_body(scene, n);
+            initialise_free_list(scene);
+            release_scene_stream_data(ss);
+        }
 
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
-                if (scene->entities[n] & e_cmp::constraint)
-                    instantiate_constraint(scene, n);
+        // adds the next chunk of entities, baking what end_scene_load does for a whole scene at a time
+        static bool commit_scene_stream_chunk(scene_stream* ss)
+        {
+            ecs_scene* scene = ss->scene;
 
-            // animations
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
+            if (!ss->container)
             {
-                s32 size;
-                ifs.read((c8*)&size, sizeof(s32));
+                ss->start = (u32)scene->num_entities;
+                load_scene_stream(ss->filename.c_str(), scene, true);
+                ss->end = ss->next = (u32)scene->num_entities;
+                ss->reserved = true;
+
+                release_scene_stream_data(ss);
+                set_scene_stream_state(ss, e_scene_stream_state::ready);
+                return false;
+            }
 
-                for (s32 i = 0; i < size; ++i)
-                {
-                    Str anim_name = project_dir;
-                    anim_name.append(read_lookup_string(ifs).c_str());
+            if (!ss->reserved)
+            {
+                reserve_scene_stream_entities(ss);
+                return true;
+            }
 
-                    anim_handle h = load_pma(anim_name.c_str());
+            u32 count = std::min<u32>(ss->params.chunk_size, ss->end - ss->next);
+            u32 begin = ss->next - ss->start;
+            commit_scene_container(scene, ss->view, ss->commit, begin, begin + count);
 
-                    if (!is_valid(h))
-                    {
-                        dev_ui::log_level(dev_ui::console_level::error, "[error] animation - cannot find pma file: %s",
-                                          anim_name.c_str());
-                        error = true;
-                    }
+            for (u32 n = ss->next; n < ss->next + count; ++n)
+            {
+                if (scene->entities[n] & e_cmp::material)
+                    bake_material_handles(scene, n);
 
-                    bind_animation_to_rig(scene, h, n);
-                }
+                if (scene->entities[n] & e_cmp::light)
+                    instantiate_model_cbuffer(scene, n);
+
+                scene->physics_debug_cbuffer[n] = PEN_INVALID_HANDLE;
             }
 
-            // materials
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
-            {
-                if (!(scene->entities[n] & e_cmp::material))
-                    continue;
+            ss->next += count;
+            scene->flags |= e_scene_flags::invalidate_scene_tree;
 
-                cmp_material&      mat = scene->materials[n];
-                material_resource& mat_res = scene->material_resources[n];
+            if (ss->next < ss->end)
+                return true;
 
-                // Invalidate stuff we need to recreate
-                memset(&mat_res.material_name, 0x0, sizeof(Str));
-                memset(&mat_res.shader_name, 0x0, sizeof(Str));
-                mat.material_cbuffer = PEN_INVALID_HANDLE;
+            end_scene_stream_commit(ss);
+            set_scene_stream_state(ss, e_scene_stream_state::ready);
+            return false;
+        }
 
-                Str material_name = read_lookup_string(ifs);
-                Str shader = read_lookup_string(ifs);
-                Str technique = read_lookup_string(ifs);
+        // removes a chunk of entities from the end of the stream so children go before their parents
+        static bool unload_scene_stream_chunk(scene_stream* ss)
+        {
+            // a stream cancelled while loading waits for its workers
+            if (ss->tasks != 0)
+                return false;
 
-                mat_res.material_name = material_name;
-                mat_res.id_shader = PEN_HASH(shader.c_str());
-                mat_res.id_technique = PEN_HASH(technique.c_str());
-                mat_res.shader_name = shader;
-            }
+            if (ss->data || ss->files)
+                release_scene_stream_data(ss);
 
-            // sdf shadow
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
+            ecs_scene* scene = ss->scene;
+            u32        first = ss->next - std::min<u32>(ss->params.chunk_size, ss->next - ss->start);
+
+            for (u32 n = first; n < ss->next; ++n)
+                if (scene->entities[n] & e_cmp::allocated)
+                    delete_entity_first_pass(scene, n);
+
+            for (u32 n = first; n < ss->next; ++n)
             {
-                if (!(scene->entities[n] & e_cmp::sdf_shadow))
+                if (!(scene->entities[n] & e_cmp::allocated))
                     continue;
 
-                Str sdf_shadow_volume_file = read_lookup_string(ifs);
-                sdf_shadow_volume_file = pen::str_replace_string(sdf_shadow_volume_file, ".dds", ".pmv");
-
-                dev_console_log("[scene load] %s", sdf_shadow_volume_file.c_str());
-                instantiate_sdf_shadow(sdf_shadow_volume_file.c_str(), scene, n);
+                scene->names[n].clear();
+                scene->geometry_names[n].clear();
+                scene->material_names[n].clear();
+                delete_entity_second_pass(scene, n);
             }
 
-            // sampler binding textures
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
+            ss->next = first;
+            scene->flags |= e_scene_flags::invalidate_scene_tree;
+
+            if (ss->next > ss->start)
+                return true;
+
+            // give back the entities at the end of the scene
+            while (scene->num_entities > 0 && !(scene->entities[scene->num_entities - 1] & e_cmp::allocated))
+                --scene->num_entities;
+
+            initialise_free_list(scene);
+            set_scene_stream_state(ss, e_scene_stream_state::unloaded);
+            return false;
+        }
+
+        static bool step_scene_stream(scene_stream* ss, u32& num_created)
+        {
+            switch (ss->state)
             {
-                if (!(scene->entities[n] & e_cmp::samplers))
-                    continue;
+                case e_scene_stream_state::parsing:
+                    return begin_scene_stream_resources(ss);
+                case e_scene_stream_state::resources:
+                    return create_scene_stream_resource(ss, num_created);
+                case e_scene_stream_state::committing:
+                    return commit_scene_stream_chunk(ss);
+                case e_scene_stream_state::unloading:
+                    return unload_scene_stream_chunk(ss);
+                default:
+                    return false;
+            }
+        }
 
-                cmp_samplers& samplers = scene->samplers[n];
+        u32 load_scene_async(const c8* filename, ecs_scene* scene, const scene_stream_params& params)
+        {
+            const c8* wd = pen::os_get_user_info().working_directory;
 
-                for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
+            scene_stream* ss = new scene_stream();
+            ss->scene = scene;
+            ss->filename = filename;
+            ss->params = params;
+            ss->params.chunk_size = std::max<u32>(params.chunk_size, 1);
+            ss->params.resources_per_update = std::max<u32>(params.resources_per_update, 1);
+            ss->commit.project_dir = dev_ui::get_program_preference_filename("project_dir", wd);
+
+            // reuse the slot of a released stream
+            ss->handle = (u32)s_scene_streams.size();
+            for (u32 i = 0; i < s_scene_streams.size(); ++i)
+                if (!s_scene_streams[i])
                 {
-                    Str texture_name = read_lookup_string(ifs);
+                    ss->handle = i;
+                    break;
+                }
 
-                    if (!texture_name.empty())
-                    {
-                        samplers.sb[i].handle = put::load_texture(texture_name.c_str());
-                        samplers.sb[i].sampler_state =
-                            pmfx::get_render_state(PEN_HASH("wrap_linear"), pmfx::e_render_state::sampler);
-                    }
+            if (ss->handle == s_scene_streams.size())
+                s_scene_streams.push_back(ss);
+            else
+                s_scene_streams[ss->handle] = ss;
 
-                    Str sampler_state_name = read_lookup_string(ifs);
+            pen::jobs_submit(parse_scene_stream, ss, &ss->tasks);
+            return ss->handle;
+        }
 
-                    if (!sampler_state_name.empty())
-                    {
-                        samplers.sb[i].sampler_state =
-                            pmfx::get_render_state(PEN_HASH(sampler_state_name), pmfx::e_render_state::sampler);
-                    }
-                }
-            }
+        static scene_stream* get_scene_stream(u32 stream)
+        {
+            if (stream >= s_scene_streams.size())
+                return nullptr;
 
-            // read cams strings
-            for (u32 i = 0; i < num_cams; ++i)
-                read_lookup_string(ifs);
+            return s_scene_streams[stream];
+        }
 
-            // read extensions
-            for (u32 i = 0; i < sh.num_extensions; ++i)
-                if (scene->extensions[i].load_func)
-                    scene->extensions[i].load_func(scene->extensions[i], scene);
+        void unload_scene_async(u32 stream)
+        {
+            scene_stream* ss = get_scene_stream(stream);
+            if (!ss || ss->state >= e_scene_stream_state::unloading)
+                return;
 
-            bake_material_handles();
+            // entities which were reserved but not added yet are removed too
+            ss->next = ss->reserved ? ss->end : ss->start;
+            ss->state = e_scene_stream_state::unloading;
 
-            // light geom
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
+            // constraints go before the rigid bodies they join, which may be in another chunk
+            ecs_scene* scene = ss->scene;
+            for (u32 n = ss->start; n < ss->next; ++n)
             {
-                if (!(scene->entities[n] & e_cmp::light))
+                if (!(scene->entities[n] & e_cmp::constraint))
                     continue;
 
-                instantiate_model_cbuffer(scene, n);
+                physics::release_entity(scene->physics_handles[n]);
+                scene->entities[n] &= ~(e_cmp::constraint | e_cmp::physics);
             }
+        }
 
-            // invalidate physics debug cbuffer.. will recreate on demand
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
-                scene->physics_debug_cbuffer[n] = PEN_INVALID_HANDLE;
+        void update_scene_streams(ecs_scene* scene)
+        {
+            f64 start = pen::get_time_us();
 
-            if (!merge)
+            for (u32 i = 0; i < s_scene_streams.size(); ++i)
             {
-                scene->view_flags = scene_view_flags;
+                scene_stream* ss = s_scene_streams[i];
+                if (!ss || ss->scene != scene)
+                    continue;
 
-                // show bones and mats if we have an error, to aid deugging
-                if (error)
-                    scene->view_flags |= (e_scene_view_flags::matrix | e_scene_view_flags::bones);
+                // each update takes at least one step so every stream makes progress, then as many as fit the budget.
+                // steps which call back return false so ss is not used after a callback released it
+                f64 stream_start = pen::get_time_us();
+                u32 num_created = 0;
+                while (step_scene_stream(ss, num_created))
+                    if ((pen::get_time_us() - stream_start) / 1000.0 >= ss->params.budget_ms)
+                        break;
+
+                if (s_scene_streams[i] != ss)
+                    continue;
+
+                if (ss->state == e_scene_stream_state::unloaded || ss->state == e_scene_stream_state::failed)
+                    free_scene_stream(ss);
             }
 
-            ifs.close();
+            scene->update_timings[e_update_stage::streaming] = (pen::get_time_us() - start) / 1000.0;
+        }
 
-            initialise_free_list(scene);
+        scene_stream_state get_scene_stream_state(u32 stream)
+        {
+            scene_stream* ss = get_scene_stream(stream);
+            if (!ss)
+                return e_scene_stream_state::unloaded;
 
-            // cleanup
-            sb_free(component_sizes);
-            sb_free(exts);
+            return ss->state;
+        }
+
+        f32 get_scene_stream_progress(u32 stream)
+        {
+            scene_stream* ss = get_scene_stream(stream);
+            if (!ss)
+                return 0.0f;
+
+            switch (ss->state)
+            {
+                case e_scene_stream_state::parsing:
+                case e_scene_stream_state::failed:
+                    return 0.0f;
+                case e_scene_stream_state::resources:
+                case e_scene_stream_state::committing:
+                {
+                    // files and textures count the same as an entity
+                    u32 num_nodes = ss->view.header.num_nodes;
+                    u32 total = ss->num_files + (u32)ss->textures.size() + num_nodes;
+                    u32 done = ss->next_file + ss->next_texture + (ss->next - ss->start);
+                    return total > 0 ? (f32)done / (f32)total : 0.0f;
+                }
+                case e_scene_stream_state::unloading:
+                {
+                    u32 count = ss->end - ss->start;
+                    return count > 0 ? (f32)(ss->end - ss->next) / (f32)count : 1.0f;
+                }
+                default:
+                    return 1.0f;
+            }
+        }
+
+        bool get_scene_stream_entities(u32 stream, u32& start, u32& end)
+        {
+            scene_stream* ss = get_scene_stream(stream);
+            if (!ss || !ss->reserved)
+                return false;
+
+            start = ss->start;
+            end = ss->end;
+            return true;
         }
     } // namespace ecs
 } // namespace put
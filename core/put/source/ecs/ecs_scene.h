@@ -27,7 +27,11 @@ namespace put
     namespace ecs
     {
         struct anim_instance;
+        struct anim_sample_scratch;
+        struct auto_instance_view;
         struct ecs_scene;
+        struct pmm_renderable;
+        struct view_scratch;
 
         namespace e_scene_view_flags
         {
@@ -59,7 +63,11 @@ namespace put
             {
                 none = 0,
                 invalidate_scene_tree = 1 << 1,
-                pause_update = 1 << 2
+                pause_update = 1 << 2,
+                auto_instance = 1 << 3,    // batch entities with matching geometry and material into instanced draws
+                bvh_cull = 1 << 4,         // views descend the bvh instead of culling every renderable, wins when few are visible
+                clustered_lights = 1 << 5, // forward lit views only light pixels with the lights in their cluster
+                draw_stats = 1 << 6        // views count state changes before and after sorting, costs two draw walks
             };
         }
         typedef u32 scene_flags;
@@ -113,7 +121,8 @@ namespace put
             {
                 shadow_map = 15,
                 sdf_shadow = 14,
-                omni_shadow_map = 13
+                omni_shadow_map = 13,
+                bone_palette = 16 // structured buffer read by the vertex shader
             };
         }
 
@@ -139,6 +148,53 @@ namespace put
             };
         }
 
+        namespace e_dirty
+        {
+            enum dirty_t
+            {
+                world_matrix = 1 << 0, // propagates down the heirarchy, also implies bounds and draw_call
+                draw_call = 1 << 1,
+                material = 1 << 2,
+                bounds = 1 << 3,       // pos_extent was rewritten by the bounds pass
+                bone_palette = 1 << 4, // the palette of the rig was rebuilt by update_bone_palettes
+                all = world_matrix | draw_call | material | bounds | bone_palette
+            };
+        }
+
+        namespace e_update_stage
+        {
+            enum update_stage_t
+            {
+                hierarchy,
+                transforms,
+                parent_extents,
+                bvh,
+                component_lists,
+                animation,
+                lights,
+                sdf_shadow,
+                bone_palettes,
+                pre_skin,
+                instances,
+                streaming,
+                COUNT
+            };
+        }
+
+        // systems which visit few entities iterate a list of the entities with their component
+        namespace e_cmp_list
+        {
+            enum cmp_list_t
+            {
+                light,
+                sdf_shadow,
+                pre_skinned,
+                master_instance,
+                anim_controller,
+                COUNT
+            };
+        }
+
         namespace e_cmp
         {
             enum cmp_t
@@ -188,10 +244,9 @@ namespace put
 
         struct cmp_skin
         {
-            u32  num_joints;
-            mat4 bind_shape_matrix;
-            mat4 joint_bind_matrices[85];
-            u32  bone_cbuffer = PEN_INVALID_HANDLE;
+            u32   num_joints;
+            mat4  bind_shape_matrix;
+            mat4* joint_bind_matrices = nullptr; // num_joints
         };
 
         // contains handles and data to re-create a material from scratch
@@ -261,6 +316,126 @@ namespace put
             vec3f min;
             vec3f max;
         };
+
+        // structure of arrays copy of pos_extent which the simd culling kernels stream through for dense runs of
+        // entities. each array is k_align aligned and capacity is padded to k_pad entities so a full width load from
+        // any aligned entity stays in bounds.
+        struct cull_bounds
+        {
+            static const u32 k_align = 64;
+            static const u32 k_pad = 16;
+
+            f32* pos_x = nullptr;
+            f32* pos_y = nullptr;
+            f32* pos_z = nullptr;
+            f32* extent_x = nullptr;
+            f32* extent_y = nullptr;
+            f32* extent_z = nullptr;
+            f32* radius = nullptr;
+            u32  capacity = 0;
+        };
+
+        // entities with geometry and material which are not sub instances, in ascending order. update_scene diffs the
+        // entity flags against state and merges the changes in, so views cull this list rather than every entity.
+        struct renderable_set
+        {
+            u32* list = nullptr;
+            u32  count = 0;
+            u32* merge = nullptr; // scratch swapped with list after a merge
+            u32* added = nullptr; // entities which became renderable this update
+            u8*  state = nullptr; // per entity, 1 while in list
+            u32  capacity = 0;
+            u32  num_scanned = 0; // num_entities at the last update
+        };
+
+        // per e_cmp_list the entities which have its component in ascending order. update_scene diffs the entity flags
+        // against state and merges the changes into the lists they affect, so a list costs its members not every entity.
+        struct component_lists
+        {
+            u32* list[e_cmp_list::COUNT] = {0}; // sb
+            u32* merge = nullptr;               // sb, scratch swapped with a list after a merge
+            u32* changed = nullptr;             // sb, entities whose lists changed this update
+            u8*  state = nullptr;               // per entity, bit per list while in it
+            u32  capacity = 0;
+            u32  num_scanned = 0; // num_entities at the last update
+            u32  num_changes = 0;
+        };
+
+        // node of a dynamic aabb tree, internal nodes always have two children. leaves store their entity in child[0]
+        // and -1 in child[1], unused nodes are linked into the free list through parent.
+        struct bvh_node
+        {
+            vec3f min;
+            vec3f max;
+            s32   parent;
+            s32   child[2];
+            s32   height; // 0 for leaves, -1 while unused
+        };
+
+        // dynamic aabb tree over the bounds of entities with geometry. leaf bounds are fattened so entities can move a
+        // little before they need reinserting, update_bvh refits it after the bounds pass, ecs_cull.h has the queries.
+        struct bvh_tree
+        {
+            bvh_node* nodes = nullptr;
+            s32*      leaves = nullptr;  // per entity leaf node, -1 while the entity is not in the tree
+            u32*      pending = nullptr; // entities to insert this update
+            s32       root = -1;
+            s32       free_list = -1;
+            u32       num_nodes = 0; // high water mark of nodes, including free ones
+            u32       node_capacity = 0;
+            u32       num_leaves = 0;
+            u32       capacity = 0; // of the per entity arrays
+            u32       num_scanned = 0;
+            u64*      keys = nullptr;   // morton codes of the centres when building from scratch, doubled for sorting
+            u32*      values = nullptr; // entities sorted with keys
+            u32       key_capacity = 0;
+        };
+
+        // per entity position only mesh which can be rasterised by occlusion culling, null for entities which can't
+        // occlude. update_scene looks meshes up again when an entity's id_geometry changes.
+        struct occluder_set
+        {
+            const pmm_renderable** mesh = nullptr;
+            hash_id*               id_geometry = nullptr; // the geometry mesh was looked up from
+            u32                    capacity = 0;
+        };
+
+        // a shadow map slice, one per shadow_map or global_illumination light and one per cubemap face of omni_shadow_map
+        // lights. update_scene culls the casters of each slice and gives it a new version when its light, the set of
+        // casters or anything about them which changes the shadow map changes.
+        struct shadow_slice
+        {
+            u32  light;
+            u32  hash; // view projection, light and casters
+            u32  version;
+            u32* casters; // sb
+        };
+
+        // the version of each slice held in the target of a view, 0 if it has not been rendered
+        struct shadow_view_cache
+        {
+            hash_id id_view = 0;
+            u32*    versions = nullptr; // sb
+        };
+
+        struct shadow_cache
+        {
+            shadow_slice*       slices = nullptr;      // sb, in the order of shadow map array slices
+            shadow_slice*       omni_slices = nullptr; // sb, 6 faces per light in the order of cubemap array slices
+            shadow_view_cache** views = nullptr;       // sb, allocated on their own as views are recorded in parallel
+            u64*                masks = nullptr;       // sb, per renderable, scratch for culling the casters
+            u32                 next_version = 1;
+        };
+
+        // the renderables are culled against the frusta of every camera in one sweep per update, before views are
+        // recorded in parallel or by the first view to render. views then only read the masks of their frustum, a view
+        // whose camera has moved since the sweep culls its own frustum on its own.
+        struct view_cull_cache
+        {
+            frustum* frusta = nullptr; // sb, frusta[f] is bit f of masks
+            u64*     masks = nullptr;  // sb, per renderable
+            bool     swept = false;    // masks are complete for frusta, reset by update_scene
+        };
         
         struct cmp_geometry
         {
@@ -304,6 +479,7 @@ namespace put
             u8*            joint_flags = nullptr;
             anim_blend     blend;
             u32            joints_offset;
+            u32            bone_offset = PEN_INVALID_HANDLE; // first matrix of the rig in ecs_scene::bone_palettes
         };
 
         struct cmp_light
@@ -350,7 +526,7 @@ namespace put
             vec4f pos_radius; // radius = point radius and spot length
             vec4f dir_cutoff; // spot dir and cos cutoff
             vec4f colour;     // w = boolean cast shadow
-            vec4f data;       // x = spot falloff, yzw reserved
+            vec4f data;       // x = spot falloff, y = shadow map or omni shadow map slice, -1 for none, z = light type
         };
 
         struct forward_light_buffer
@@ -388,6 +564,91 @@ namespace put
             vec4f   volume_size;
         };
 
+        // clusters split the view frustum into a grid of tiles on screen and exponential depth slices
+        namespace e_light_cluster
+        {
+            enum light_cluster_t
+            {
+                grid_x = 16,
+                grid_y = 8,
+                grid_z = 24,
+                count = grid_x * grid_y * grid_z
+            };
+        }
+
+        // every light packed for the gpu each update, directional lights first then point then spot lights. bounds are
+        // the spheres point and spot lights can light, indexed the same as data.
+        struct light_set
+        {
+            light_data* data = nullptr;
+            vec4f*      bounds = nullptr;        // pos, radius
+            u32*        area_entities = nullptr; // sb, area lights then area_ex lights
+            u32         count = 0;
+            u32         num_dir = 0;
+            u32         num_point = 0;
+            u32         num_spot = 0;
+            u32         num_area = 0; // of area_entities which are constant colour area lights
+            u32         capacity = 0;
+            u32         version = 0;                 // incremented by each update
+            u32         buffer = PEN_INVALID_HANDLE; // structured buffer of data
+            u32         buffer_capacity = 0;
+        };
+
+        // per pass constants the shader finds the cluster of a pixel with, they mirror the binning on the cpu
+        struct light_cluster_info
+        {
+            mat4  view_projection; // ndc xy of a world pos picks the tile
+            vec4f depth_plane;     // dot(pos, xyz) + w is view depth
+            vec4f grid;            // xyz = cluster counts, w = number of directional lights
+            vec4f depth;           // x = near plane, y = depth slices / log2(far / near)
+        };
+
+        // point and spot lights binned into the clusters of a view. cluster c lists its lights in
+        // indices[grid[c * 2]] to indices[grid[c * 2] + grid[c * 2 + 1]], light indices are into light_set::data.
+        struct light_clusters
+        {
+            light_cluster_info info;
+            u32                grid[e_light_cluster::count * 2];
+            u32*               indices = nullptr;
+            u32                num_indices = 0;
+            u32                index_capacity = 0;
+            u8*                light_ranges = nullptr; // per light min and max cluster x, y and z, 6 bytes
+            u32                range_capacity = 0;
+            u32                num_lights = 0; // point and spot lights inside the frustum
+            u32                max_cluster_lights = 0;
+            f64                ms = 0.0;
+        };
+
+        // the clusters of a view and the buffers they are uploaded to
+        struct light_cluster_view
+        {
+            hash_id        id_view;
+            u32            version = 0; // of the light set the clusters were binned from
+            light_clusters clusters;
+            u32            info_buffer = PEN_INVALID_HANDLE;
+            u32            grid_buffer = PEN_INVALID_HANDLE;
+            u32            index_buffer = PEN_INVALID_HANDLE;
+            u32            index_buffer_capacity = 0;
+        };
+
+        // joint world matrices times joint bind matrices of every skinned and pre skinned rig packed one after the
+        // other. they are built once per update and uploaded in a single structured buffer, which every view and the
+        // pre skin pass read from the bone_offset of the rig, draw calls carry the offset in v1.w.
+        struct bone_palette_set
+        {
+            mat4* matrices = nullptr;
+            u32*  rigs = nullptr;    // entities with a palette in packed order
+            u32*  rebuild = nullptr; // rigs whose joints moved or whose offset changed this update
+            u32   count = 0;         // matrices
+            u32   num_rigs = 0;
+            u32   num_rebuild = 0;
+            u32   capacity = 0;
+            u32   rig_capacity = 0;
+            u32   buffer = PEN_INVALID_HANDLE; // structured buffer of matrices
+            u32   buffer_capacity = 0;
+            u32   pre_skin_cbuffer = PEN_INVALID_HANDLE; // per draw constants of the pre skin pass
+        };
+
         struct free_node_list
         {
             u32             node;
@@ -490,6 +751,7 @@ namespace put
             cmp_array<area_light_resource>          area_light_resources;
             cmp_array<pmfx::scene_render_flags>     render_flags;
             cmp_array<cmp_pos_extent>               pos_extent;
+            cmp_array<u32>                          dirty_flags;
 
             // num base components calculates value based on its address - entities address.
             u32 num_base_components;
@@ -517,6 +779,84 @@ namespace put
             u32              version = k_version;
             Str              filename = "";
 
+            // transient per frame data, entities sorted by depth so each level of the tree can update in parallel
+            u32* hierarchy_depth = nullptr;
+            u32* hierarchy_order = nullptr;
+            u32* hierarchy_levels = nullptr; // offsets into hierarchy_order, num_hierarchy_levels + 1 entries
+            u32  num_hierarchy_levels = 0;
+            u32  hierarchy_capacity = 0;
+            f64  update_timings[e_update_stage::COUNT] = {0}; // ms
+
+            // per batch renderable extents of the level being updated, merged after each level
+            extents* transform_batch_extents = nullptr;
+            u32      transform_batch_capacity = 0;
+
+            // written alongside pos_extent by the bounds pass, sized with the component buffers
+            cull_bounds bounds;
+
+            // maintained by update_scene, systems iterate these instead of every entity
+            component_lists cmp_lists;
+
+            // maintained by update_scene, render_scene_view culls from this
+            renderable_set   renderables;
+            bvh_tree         bvh;
+            occluder_set     occluders;
+            shadow_cache     shadow_map_cache;
+            view_cull_cache  view_culls;
+            light_set        packed_lights;
+            bone_palette_set bone_palettes;
+
+            // forward lit views with clustered_lights bin the lights once per update, views are recorded in parallel so
+            // each is allocated on its own and only the list is shared
+            light_cluster_view** light_cluster_views = nullptr; // sb
+
+            // instance data of views which auto instance, allocated the same way as the light cluster views
+            auto_instance_view** auto_instance_views = nullptr; // sb
+
+            // transient per view buffers render_scene_view reuses each frame, allocated the same way
+            view_scratch** view_scratches = nullptr; // sb
+
+            // keys sampled by update_animations, one entry per batch of controllers so batches run on the job workers
+            anim_sample_scratch* anim_scratch = nullptr;
+            u32                  anim_scratch_count = 0;
+
+            // per frame counters to verify static scenes do no work
+            u32 num_world_matrix_updates = 0;
+            u32 num_draw_call_uploads = 0;
+            u32 num_material_uploads = 0;
+            u32 num_instance_buffer_uploads = 0;
+            u32 num_renderable_changes = 0; // entities added to or removed from renderables
+            u32 num_bvh_reinserts = 0;      // new entities and ones which moved out of their fat bounds in the bvh
+            u32 num_palette_builds = 0;     // rigs whose bone palette was rebuilt
+            u32 num_bone_bytes_uploaded = 0;
+
+            // render_scene_view counters for the last frame, views are recorded in parallel so they accumulate into
+            // atomics which are published at the start of the next update
+            u32   num_draws = 0;                  // visible entities
+            u32   num_draw_calls = 0;             // draw calls issued for them
+            u32   num_auto_instances = 0;         // entities drawn in auto instanced batches
+            u32   num_state_changes = 0;          // shader, material and buffer changes sorted, with draw_stats
+            u32   num_state_changes_unsorted = 0; // the same draws in entity order, with draw_stats
+            u32   num_occluded = 0;               // entities in the frustum hidden by occlusion culling
+            f64   occlusion_ms = 0.0;             // occlusion culling cost summed over views
+            u32   num_shadow_slices_rendered = 0; // shadow map slices and cubemap faces drawn
+            u32   num_shadow_slices_reused = 0;   // slices kept from an earlier frame as nothing in them changed
+            u32   num_binned_lights = 0;          // point and spot lights binned into clusters summed over views
+            f64   light_binning_ms = 0.0;         // light cluster binning cost summed over views
+            u32   num_view_cull_sweeps = 0;       // passes over the renderables to cull the frusta of scene views
+            a_u32 frame_draws = {0};
+            a_u32 frame_draw_calls = {0};
+            a_u32 frame_auto_instances = {0};
+            a_u32 frame_state_changes = {0};
+            a_u32 frame_state_changes_unsorted = {0};
+            a_u32 frame_occluded = {0};
+            a_u32 frame_occlusion_us = {0};
+            a_u32 frame_shadow_slices_rendered = {0};
+            a_u32 frame_shadow_slices_reused = {0};
+            a_u32 frame_binned_lights = {0};
+            a_u32 frame_light_binning_us = {0};
+            a_u32 frame_view_cull_sweeps = {0};
+
             generic_cmp_array& get_component_array(u32 index);
         };
 
@@ -535,6 +875,32 @@ namespace put
 
         void update(f32 dt);
         void update_scene(ecs_scene* scene, f32 dt);
+        void update_scene_transforms(ecs_scene* scene);
+
+        // merges entities whose components changed since the last call into scene->cmp_lists, update_scene calls this
+        // before any system runs. only flags are read so it runs headless.
+        void update_component_lists(ecs_scene* scene);
+
+        // samples the playing anim instances of every anim controller into their joint transforms, update_scene calls
+        // this before the transform pass.
+        void update_animations(ecs_scene* scene, f32 dt);
+
+        // sizes point and spot light volumes to what they light, only lights whose radius or cutoff changed are marked
+        // dirty. update_scene calls this before the transform pass so the new size is in the same update.
+        void update_light_volumes(ecs_scene* scene);
+
+        // packs every light into scene->packed_lights with a single pass over the light list. update_scene calls this
+        // after the transform pass, there is no gpu work so it runs headless.
+        void update_lights(ecs_scene* scene);
+
+        // packs the bone palette of every skinned and pre skinned rig into scene->bone_palettes, only rigs whose joints
+        // moved are rebuilt and they are built on the job workers. update_scene calls this after the transform pass and
+        // uploads the palettes once for all views, there is no gpu work so it runs headless.
+        void update_bone_palettes(ecs_scene* scene);
+
+        // sweeps the renderables for the frusta of every camera if it has not been done since update_scene, call on
+        // the user thread before views of scene are recorded in parallel so render_scene_view only reads the result.
+        void cull_scene_views(ecs_scene* scene);
 
         void render_scene_view(const scene_view& view);
         void render_light_volumes(const scene_view& view);
@@ -543,6 +909,16 @@ namespace put
         void render_area_light_textures(const scene_view& view);
         void compute_volume_gi(const scene_view& view);
 
+        // draws entities which are already culled for view, they are sorted in place
+        void render_scene_entities(const scene_view& view, u32* entities, u32 count);
+
+        // shadow map slices are only drawn when something in them changed, the cached functions tell pmfx which slices
+        // of a shadow view can be kept. call invalidate when the shadow map targets are recreated so every slice is
+        // drawn again.
+        bool shadow_views_cached(const scene_view& view);
+        bool omni_shadow_views_cached(const scene_view& view);
+        void invalidate_shadow_cache(ecs_scene* scene);
+
         void clear_scene(ecs_scene* scene);
         void default_scene(ecs_scene* scene);
 
@@ -0,0 +1,121 @@
+#pragma once
+
+// shared by the translation units with simd kernels: the culling kernels and their dispatch in ecs_cull.cpp, the bvh,
+// occlusion and animation key kernels. include this after every other header.
+
+#include "ecs_scene.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CULL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CULL_NEON 1
+#include <arm_neon.h>
+#endif
+
+// kernels for wider instruction sets are compiled for their own target, so they can be selected at run time without
+// the whole binary requiring them
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CULL_TARGET(isa)
+#else
+#define CULL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// every implementation must produce identical results, so the compiler is not allowed to fuse multiplies and adds
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace put
+{
+    namespace ecs
+    {
+        // cmp_pos_extent as floats: pos xyz, unused, extent xyz, radius
+        const u32 k_pos_extent_stride = sizeof(cmp_pos_extent) / sizeof(f32);
+
+        // the 6 frustum planes padded to 8 with planes everything is inside of, so a node can be tested against
+        // every plane in a single 8 wide or two 4 wide registers
+        struct cull_planes
+        {
+            f32 nx[8], ny[8], nz[8]; // plane normal
+            f32 ax[8], ay[8], az[8]; // abs plane normal, projects aabb extents onto the normal
+            f32 d[8];                // plane distance
+        };
+
+        // culls count entities writing the visible ones to out and returning how many were written. out must hold
+        // count entries and may alias entities.
+        typedef u32 (*cull_func)(const ecs_scene* scene, const cull_planes& planes, const u32* entities, u32 count,
+                                 u32* out);
+
+        // tests count entities against the aabb planes of num_frusta frusta, bit f of masks[i] is set when
+        // entities[i] is inside planes[f]. the bounds of each entity are loaded once for every frustum.
+        typedef void (*multi_cull_func)(const ecs_scene* scene, const cull_planes* planes, u32 num_frusta,
+                                        const u32* entities, u32 count, u64* masks);
+
+        namespace e_node_cull
+        {
+            enum node_cull_t
+            {
+                outside,
+                intersect,
+                inside
+            };
+        }
+
+        // classifies a bvh node against all planes at once
+        typedef u32 (*node_cull_func)(const cull_planes& planes, const bvh_node& node);
+
+        // the occlusion buffer holds 1 / w of the nearest occluder per pixel and is cleared to 0, infinitely far.
+        // each 8x8 tile keeps the farthest depth of its pixels so most tests never look at the pixels.
+        const u32 k_occlusion_width = 256;
+        const u32 k_occlusion_height = 128;
+        const u32 k_occlusion_tile = 8;
+        const u32 k_occlusion_tiles_x = k_occlusion_width / k_occlusion_tile;
+        const u32 k_occlusion_tiles_y = k_occlusion_height / k_occlusion_tile;
+
+        // screen space occluder triangle, a pixel centre is covered when all 3 edge functions are >= 0
+        struct occluder_tri
+        {
+            f32 ea[3], eb[3], ec[3]; // edge functions ea * x + eb * y + ec
+            f32 za, zb, zc;          // depth plane, biased to the farthest depth within each pixel
+            u32 x0, y0, x1, y1;      // pixel bounds, max exclusive and x0 rounded down to a multiple of 4
+        };
+
+        // screen bounds of an entity being tested
+        struct occludee_rect
+        {
+            f32 min_x, min_y, max_x, max_y;
+            f32 depth; // 1 / w of the nearest corner
+        };
+
+        // rasterises tri into the pixels of row y from x0 to x1 in groups of 4, keeping the nearest depth
+        typedef void (*raster_row_func)(f32* row, const occluder_tri& tri, u32 y, u32 x0, u32 x1);
+
+        // projects the aabb in pos_extent by view_proj, returns false if any corner is in front of near_w
+        typedef bool (*project_box_func)(const f32* view_proj, const f32* pos_extent, f32 near_w, occludee_rect& rect);
+
+        // the kernels of one simd level, levels without their own version of a kernel use the next narrowest
+        struct cull_impl
+        {
+            const c8*        name;
+            cull_func        aabb;
+            cull_func        sphere;
+            multi_cull_func  multi;
+            node_cull_func   node;
+            raster_row_func  raster_row;
+            project_box_func project_box;
+        };
+
+        void get_cull_planes(const frustum& frust, cull_planes& planes);
+
+        // the kernels of the simd level frustum_cull_xxx dispatch to, initialises them on first use
+        const cull_impl& get_cull_impl();
+    } // namespace ecs
+} // namespace put
@@ -3,6 +3,7 @@
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
 #include "dev_ui.h"
+#include <algorithm>
 #include <fstream>
 
 #include "ecs/ecs_editor.h"
@@ -100,7 +101,10 @@ namespace put
 
             // iterate over nodes flagging allocated
             for (s32 i = start; i < end; ++i)
+            {
                 scene->entities[i] |= e_cmp::allocated;
+                scene->dirty_flags[i] = e_dirty::all;
+            }
 
             scene->free_list_head = scene->free_list[end].next;
 
@@ -165,6 +169,7 @@ namespace put
                 for (s32 i = 0; i < num + 1; ++i)
                 {
                     scene->entities[fnl_iter->node] |= e_cmp::allocated;
+                    scene->dirty_flags[fnl_iter->node] = e_dirty::all;
                     scene->free_list_head = fnl_iter;
                     fnl_iter = fnl_iter->next;
                 }
@@ -199,6 +204,7 @@ namespace put
             scene->num_entities = std::max<u32>(i + 1, scene->num_entities);
 
             scene->entities[i] = e_cmp::allocated;
+            scene->dirty_flags[i] = e_dirty::all;
 
             scene->names[i] = "";
             scene->names[i].appendf("entity_%i", i);
@@ -341,6 +347,7 @@ namespace put
             mat4 parent_mat = scene->world_matrices[parent];
 
             scene->local_matrices[child] = mat::inverse4x4(parent_mat) * scene->local_matrices[child];
+            scene->dirty_flags[child] |= e_dirty::world_matrix;
         }
 
         // set parent and also swap nodes to maintain valid heirarchy
@@ -637,8 +644,14 @@ namespace put
             animation_resource* anim = get_animation_resource(anim_handle);
             anim_instance       anim_instance;
             anim_instance.soa = anim->soa;
+            anim_instance.clip = anim->clip;
             anim_instance.length = anim->length;
 
+            // cached key of each compressed track
+            if (anim->clip)
+                for (u32 t = 0; t < anim->clip->num_tracks; ++t)
+                    sb_push(anim_instance.track_keys, 0);
+
             cmp_anim_controller_v2& controller = scene->anim_controller_v2[node_index];
 
             // initialise anim with starting transform
@@ -707,5 +720,66 @@ namespace put
             scene->entities[node_index] |= e_cmp::anim_controller;
             return anim_index;
         }
+
+        void radix_sort(u64* keys, u32* values, u32 count, u64* tmp_keys, u32* tmp_values)
+        {
+            static const u32 k_num_digits = 8;
+
+            if (count < 2)
+                return;
+
+            // histogram every digit in a single pass
+            u32 histogram[k_num_digits][256];
+            memset(histogram, 0x0, sizeof(histogram));
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u64 k = keys[i];
+                for (u32 d = 0; d < k_num_digits; ++d)
+                    histogram[d][(k >> (d * 8)) & 0xff]++;
+            }
+
+            u64* src_keys = keys;
+            u32* src_values = values;
+            u64* dst_keys = tmp_keys;
+            u32* dst_values = tmp_values;
+
+            for (u32 d = 0; d < k_num_digits; ++d)
+            {
+                u32  shift = d * 8;
+                u32* h = histogram[d];
+
+                // all keys share this digit, order is unchanged
+                if (h[(src_keys[0] >> shift) & 0xff] == count)
+                    continue;
+
+                // exclusive prefix sum into offsets
+                u32 offset = 0;
+                for (u32 b = 0; b < 256; ++b)
+                {
+                    u32 c = h[b];
+                    h[b] = offset;
+                    offset += c;
+                }
+
+                for (u32 i = 0; i < count; ++i)
+                {
+                    u64 k = src_keys[i];
+                    u32 dst = h[(k >> shift) & 0xff]++;
+                    dst_keys[dst] = k;
+                    dst_values[dst] = src_values[i];
+                }
+
+                std::swap(src_keys, dst_keys);
+                std::swap(src_values, dst_values);
+            }
+
+            // odd number of passes leaves the result in tmp
+            if (src_keys != keys)
+            {
+                memcpy(keys, src_keys, count * sizeof(u64));
+                memcpy(values, src_values, count * sizeof(u32));
+            }
+        }
     } // namespace ecs
 } // namespace put
@@ -53,5 +53,9 @@ namespace put
         Str  read_parsable_string(std::ifstream& ifs);
         void write_parsable_string(const Str& str, std::ofstream& ofs);
         void write_parsable_string_u32(const Str& str, std::ofstream& ofs);
+
+        // sorts count keys ascending carrying values with them, lsd radix in 8 bit digits, digits which are the same for
+        // every key are skipped. tmp_keys and tmp_values must hold count entries, the result is in keys and values.
+        void radix_sort(u64* keys, u32* values, u32 count, u64* tmp_keys, u32* tmp_values);
     } // namespace ecs
 } // namespace put
@@ -53,7 +53,8 @@ namespace put
         enum shader_permutation_t
         {
             skinned = 1 << 31,
-            instanced = 1 << 30
+            instanced = 1 << 30,
+            clustered_lights = 1 << 29
         };
     }
     typedef u32 shader_permutation;
@@ -74,6 +75,7 @@ namespace put
         hash_id         id_technique = 0;
         u32             permutation = 0;
         ecs::ecs_scene* scene = nullptr;
+        hash_id         id_view = 0; // the pmfx view being rendered
     };
 
     struct scene_view_renderer
@@ -82,6 +84,11 @@ namespace put
         hash_id id_name = 0;
 
         void (*render_function)(const scene_view&) = nullptr;
+        bool parallel = false; // render_function is safe to call from job threads, views will be recorded in parallel.
+
+        // optional, returns true when the target slice at array_index still holds what render_function would draw.
+        // when every scene view of a view returns true for a slice it is neither cleared nor rendered this frame.
+        bool (*cached_function)(const scene_view&) = nullptr;
     };
 
     struct technique_constant_data
@@ -193,6 +200,7 @@ namespace put
                 forward_lit = 1,
                 shadow_map = 1 << 1,
                 alpha_blended = 1 << 2,
+                occlusion_cull = 1 << 3, // cpu software occlusion culling after the frustum cull
                 COUNT
             };
         }
@@ -231,13 +239,32 @@ namespace put
             u32 widget = e_permutation_widget::checkbox;
         };
 
+        // techniques are loaded lazily by whichever thread records a view with them first, other threads check the flag
+        // without a lock. it is atomic so a thread which sees it set sees the whole technique, copies copy the value.
+        struct technique_loaded_flag
+        {
+            a_bool value = {false};
+
+            technique_loaded_flag() = default;
+
+            technique_loaded_flag(const technique_loaded_flag& other) : value(pen_atomic_load(other.value))
+            {
+            }
+
+            technique_loaded_flag& operator=(const technique_loaded_flag& other)
+            {
+                value = pen_atomic_load(other.value);
+                return *this;
+            }
+        };
+
         struct shader_program
         {
-            hash_id id_name;
-            hash_id id_sub_type;
-            Str     name;
-            bool    loaded = false;
-            pen::json info;
+            hash_id               id_name;
+            hash_id               id_sub_type;
+            Str                   name;
+            technique_loaded_flag loaded;
+            pen::json             info;
 
             u32 vertex_shader;
             u32 pixel_shader;
@@ -20,6 +20,7 @@
 #include "pen_string.h"
 #include "renderer_shared.h"
 #include "str_utilities.h"
+#include "threads.h"
 #include "timer.h"
 
 #include <fstream>
@@ -64,7 +65,8 @@ namespace
             generate_mips = (1 << 5),   // generate mip maps for the render target after resolving
             compute = (1<<6),           // runs a compute job instead of render job
             cubemap_array = (1<<7),
-            jitter = 1<<8               // apply jitter to the camera for taa
+            jitter = 1<<8,              // apply jitter to the camera for taa
+            parallel = 1<<9             // all scene views can be recorded from job threads into a cmd list.
         };
     }
 
@@ -193,6 +195,7 @@ namespace
         "forward_lit", e_scene_render_flags::forward_lit,
         "shadow_map", e_scene_render_flags::shadow_map,
         "alpha_blended", e_scene_render_flags::alpha_blended,
+        "occlusion_cull", e_scene_render_flags::occlusion_cull,
         nullptr, 0
     };
     
@@ -251,6 +254,7 @@ namespace
         put::camera*    camera;
 
         std::vector<void (*)(const put::scene_view&)> render_functions;
+        std::vector<bool (*)(const put::scene_view&)> cached_functions; // per render function, may be null
 
         // targets
         u32 render_targets[pen::MAX_MRT] = {
@@ -382,6 +386,12 @@ namespace
     geometry_utility                     s_geometry;
     std::vector<Str>                     s_script_files;
     bool                                 s_reload = false;
+    u32*                                 s_view_cmd_lists = nullptr;  // cmd list per view for parallel recording
+    std::vector<u32>                     s_parallel_views;            // views recorded in parallel this frame
+    bool                                 s_record_serial = true;      // record serially after views are (re)loaded
+    u32                                  s_cb_2d = PEN_INVALID_HANDLE;
+    u32                                  s_cb_sampler_info = PEN_INVALID_HANDLE;
+    u32                                  s_cb_pp_info = PEN_INVALID_HANDLE;
 
     // ids
 } // namespace
@@ -1853,6 +1863,7 @@ namespace put
 
                 // scene views
                 pen::json scene_views = view["scene_views"];
+                bool      parallel = scene_views.size() > 0;
                 for (s32 ii = 0; ii < scene_views.size(); ++ii)
                 {
                     hash_id id = scene_views[ii].as_hash_id();
@@ -1862,7 +1873,9 @@ namespace put
                         if (id == sv.id_name)
                         {
                             found = true;
+                            parallel &= sv.parallel;
                             new_view.render_functions.push_back(sv.render_function);
+                            new_view.cached_functions.push_back(sv.cached_function);
                         }
                     }
 
@@ -1877,6 +1890,9 @@ namespace put
                 if (scene_views.size() > 0)
                     new_view.view_flags |= e_view_flags::scene_view;
 
+                if (parallel)
+                    new_view.view_flags |= e_view_flags::parallel;
+
                 // sampler bindings
                 parse_sampler_bindings(view, new_view);
 
@@ -2634,6 +2650,8 @@ namespace put
             s_post_process_names.clear();
             s_virtual_rt.clear();
             s_partial_blend_states.clear();
+
+            s_record_serial = true;
         }
 
         void shutdown()
@@ -2844,7 +2862,44 @@ namespace put
                 pen::renderer_set_texture(0, 0, i, pen::TEXTURE_BIND_PS | pen::TEXTURE_BIND_VS);
         }
 
-        void render_view(view_params& v)
+        void create_view_cbuffers()
+        {
+            if (is_valid(s_cb_2d))
+                return;
+
+            pen::buffer_creation_params bcp;
+            bcp.usage_flags = PEN_USAGE_DYNAMIC;
+            bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+            bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+            bcp.data = (void*)nullptr;
+
+            // cb for 2d ortho
+            bcp.buffer_size = sizeof(float) * 20;
+            s_cb_2d = pen::renderer_create_buffer(bcp);
+
+            // cb for sampler info
+            bcp.buffer_size = sizeof(vec4f) * 16; // 16 samplers worth, x = 1.0 / width, y = 1.0 / height
+            s_cb_sampler_info = pen::renderer_create_buffer(bcp);
+
+            // cb for post process info
+            bcp.buffer_size = sizeof(post_process::pp_info);
+            s_cb_pp_info = pen::renderer_create_buffer(bcp);
+        }
+
+        // a slice is only skipped when every scene view of v has kept what it would render into it
+        bool view_slice_cached(const view_params& v, const scene_view& sv)
+        {
+            if (v.cached_functions.empty() || v.cached_functions.size() != v.render_functions.size())
+                return false;
+
+            for (auto& cf : v.cached_functions)
+                if (!cf || !cf(sv))
+                    return false;
+
+            return true;
+        }
+
+        void render_view(view_params& v, bool update_camera = true)
         {
             // compute doesnt need render pipeline setup
             if (v.view_flags & e_view_flags::compute)
@@ -2881,29 +2936,7 @@ namespace put
             if (v.num_colour_targets == 0 && v.depth_target == PEN_INVALID_HANDLE)
                 return;
 
-            static u32 cb_2d = PEN_INVALID_HANDLE;
-            static u32 cb_sampler_info = PEN_INVALID_HANDLE;
-            static u32 cb_pp_info = PEN_INVALID_HANDLE;
-            if (!is_valid(cb_2d))
-            {
-                pen::buffer_creation_params bcp;
-                bcp.usage_flags = PEN_USAGE_DYNAMIC;
-                bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-                bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-                bcp.data = (void*)nullptr;
-
-                // cb for 2d ortho
-                bcp.buffer_size = sizeof(float) * 20;
-                cb_2d = pen::renderer_create_buffer(bcp);
-                
-                // cb for sampler info
-                bcp.buffer_size = sizeof(vec4f) * 16; // 16 samplers worth, x = 1.0 / width, y = 1.0 / height
-                cb_sampler_info = pen::renderer_create_buffer(bcp);
-                
-                // cb for post process info
-                bcp.buffer_size = sizeof(post_process::pp_info);
-                cb_pp_info = pen::renderer_create_buffer(bcp);
-            }
+            create_view_cbuffers();
 
             // unbind samplers to stop validation layers complaining, render targets may still be bound on output.
             for (s32 i = 0; i < e_pmfx_constants::max_sampler_bindings; ++i)
@@ -2924,7 +2957,7 @@ namespace put
             f32 W = 2.0f / vvp.width;
             f32 H = 2.0f / vvp.height;
             f32 mvp[4][4] = {{W, 0.0, 0.0, 0.0}, {0.0, H, 0.0, 0.0}, {0.0, 0.0, 1.0, 0.0}, {-1.0, -1.0, 0.0, 1.0}};
-            pen::renderer_update_buffer(cb_2d, mvp, sizeof(mvp), 0);
+            pen::renderer_update_buffer(s_cb_2d, mvp, sizeof(mvp), 0);
 
             // build scene view info
             scene_view sv;
@@ -2936,9 +2969,10 @@ namespace put
             sv.blend_state = v.blend_state;
             sv.camera = v.camera;
             sv.viewport = &vp;
-            sv.cb_2d_view = cb_2d;
+            sv.cb_2d_view = s_cb_2d;
             sv.pmfx_shader = v.pmfx_shader;
             sv.permutation = v.technique_permutation;
+            sv.id_view = v.id_name;
 
             // render passes.. multi pass for cubemaps or arrays
             for (u32 a = 0; a < v.num_arrays; ++a)
@@ -2946,6 +2980,10 @@ namespace put
                 sv.array_index = a;
                 sv.num_arrays = v.num_arrays;
 
+                // keep the contents of slices which would render the same as last time
+                if (view_slice_cached(v, sv))
+                    continue;
+
                 // generate 3d view proj matrix
                 if (v.camera)
                 {
@@ -2961,7 +2999,10 @@ namespace put
                     if (v.view_flags & e_view_flags::cubemap)
                         put::camera_set_cubemap_face(v.camera, a);
 
-                    put::camera_update_shader_constants(v.camera);
+                    // views recorded in parallel have their camera updated on the user thread before recording
+                    if (update_camera)
+                        put::camera_update_shader_constants(v.camera);
+
                     sv.cb_view = v.camera->cbuffer;
                 }
                 else
@@ -3000,8 +3041,8 @@ namespace put
                 u32 num_samplers = (u32)v.sampler_bindings.size();
                 if (num_samplers > 0)
                 {
-                    pen::renderer_update_buffer(cb_sampler_info, v.sampler_info, num_samplers * sizeof(vec4f));
-                    pen::renderer_set_constant_buffer(cb_sampler_info, e_cbuffer_location::sampler_info,
+                    pen::renderer_update_buffer(s_cb_sampler_info, v.sampler_info, num_samplers * sizeof(vec4f));
+                    pen::renderer_set_constant_buffer(s_cb_sampler_info, e_cbuffer_location::sampler_info,
                                                       pen::CBUFFER_BIND_PS);
                 }
 
@@ -3024,8 +3065,8 @@ namespace put
                 {
                     post_process::pp_info pp_info;
                     pp_info.frame_jitter.xy = halton(pen::_renderer_frame_index());
-                    pen::renderer_update_buffer(cb_pp_info, &pp_info, sizeof(pp_info));
-                    pen::renderer_set_constant_buffer(cb_pp_info, e_cbuffer_location::post_process_info,
+                    pen::renderer_update_buffer(s_cb_pp_info, &pp_info, sizeof(pp_info));
+                    pen::renderer_set_constant_buffer(s_cb_pp_info, e_cbuffer_location::post_process_info,
                                                       pen::CBUFFER_BIND_PS);
                 }
 
@@ -3061,33 +3102,125 @@ namespace put
             {
                 // default to fs quad
                 if(v.render_functions.empty())
+                {
                     v.render_functions.push_back(&fullscreen_quad);
+                    v.cached_functions.push_back(nullptr);
+                }
 
                 render_view(v);
             }
         }
 
+        void render_view_and_post_process(view_params& v)
+        {
+            if (v.view_flags & e_view_flags::abstract)
+            {
+                render_abstract_view(v);
+            }
+            else
+            {
+                render_view(v);
+
+                if (v.post_process_flags & e_pp_flags::enabled)
+                    render_post_process(v);
+            }
+        }
+
+        bool can_record_parallel(const view_params& v)
+        {
+            // all scene views must be registered as parallel, and the view setup must not touch shared state
+            if (!(v.view_flags & e_view_flags::parallel))
+                return false;
+
+            static const u32 k_serial_flags = e_view_flags::template_view | e_view_flags::abstract |
+                                              e_view_flags::compute | e_view_flags::cubemap |
+                                              e_view_flags::cubemap_array | e_view_flags::jitter;
+            if (v.view_flags & k_serial_flags)
+                return false;
+
+            if (v.post_process_flags & e_pp_flags::enabled)
+                return false;
+
+            return v.camera && v.num_arrays == 1 && !v.stash_output;
+        }
+
+        void record_views_parallel(u32 start, u32 end, void* user_data)
+        {
+            for (u32 i = start; i < end; ++i)
+            {
+                u32 vi = s_parallel_views[i];
+
+                pen::renderer_begin_cmd_list(s_view_cmd_lists[vi]);
+                render_view(s_views[vi], false);
+                pen::renderer_end_cmd_list();
+            }
+        }
+
         void render()
         {
             reload();
-            
-            for (auto& v : s_views)
+
+            create_view_cbuffers();
+
+            u32 num_views = (u32)s_views.size();
+
+            s_parallel_views.clear();
+            for (u32 i = 0; i < num_views; ++i)
+                if (can_record_parallel(s_views[i]))
+                    s_parallel_views.push_back(i);
+
+            // after (re)loading, views are recorded on the user thread so render functions can initialise statics and
+            // lazily created resources safely
+            if (s_record_serial || s_parallel_views.size() < 2)
             {
+                for (auto& v : s_views)
+                {
+                    if (v.view_flags & e_view_flags::template_view)
+                        continue;
+
+                    render_view_and_post_process(v);
+                }
+
+                s_record_serial = false;
+                return;
+            }
+
+            while (sb_count(s_view_cmd_lists) < num_views)
+                sb_push(s_view_cmd_lists, pen::renderer_create_cmd_list());
+
+            // serial views and camera updates for parallel views are recorded into their cmd lists on the user thread
+            u32 pi = 0;
+            for (u32 i = 0; i < num_views; ++i)
+            {
+                view_params& v = s_views[i];
                 if (v.view_flags & e_view_flags::template_view)
                     continue;
 
-                if (v.view_flags & e_view_flags::abstract)
+                pen::renderer_begin_cmd_list(s_view_cmd_lists[i]);
+
+                if (pi < s_parallel_views.size() && s_parallel_views[pi] == i)
                 {
-                    render_abstract_view(v);
+                    put::camera_update_shader_constants(v.camera);
+                    ++pi;
                 }
                 else
                 {
-                    render_view(v);
-
-                    if (v.post_process_flags & e_pp_flags::enabled)
-                        render_post_process(v);
+                    render_view_and_post_process(v);
                 }
+
+                pen::renderer_end_cmd_list();
             }
+
+            // cull the scenes of parallel views up front so recording only reads the result
+            for (u32 i : s_parallel_views)
+                if (s_views[i].scene)
+                    ecs::cull_scene_views(s_views[i].scene);
+
+            // record the remainder of parallel views on job threads
+            pen::jobs_parallel_for((u32)s_parallel_views.size(), 1, record_views_parallel, nullptr);
+
+            // submit in view order so the command stream matches serial recording
+            pen::renderer_submit_cmd_lists(s_view_cmd_lists, num_views);
         }
 
         void render_target_info_ui(const render_target& rt)
@@ -19,6 +19,7 @@
 #include "pen_json.h"
 #include "pen_string.h"
 #include "renderer.h"
+#include "threads.h"
 
 using namespace put;
 using namespace pmfx;
@@ -610,12 +611,24 @@ namespace put
         
         void lazy_load_shader_technique(shader_program& t, u32 shader)
         {
+            // pairs with the store below, seeing it set means every other field of t is visible
+            if (pen_atomic_load(t.loaded.value))
+                return;
+
+            // views can be recorded from multiple threads, only one may load the technique
+            static pen::mutex* s_load_mutex = pen::mutex_create();
+            pen::mutex_lock(s_load_mutex);
+
             auto& s = s_pmfx_list[shader];
-            if(!t.loaded)
+            if(!pen_atomic_load(t.loaded.value))
             {
                 t = load_shader_technique(s.filename.c_str(), t.info, s.info);
-                t.loaded = true;
+
+                // publish loaded last so threads checking outside the lock see a complete technique
+                t.loaded.value = true;
             }
+
+            pen::mutex_unlock(s_load_mutex);
         }
 
         void initialise_constant_defaults(u32 shader, u32 technique_index, f32* data)
@@ -0,0 +1,294 @@
+// bench_common.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Synthetic scenes shared by the headless benchmark apps. Nothing is created on the gpu so they can be updated, culled,
+// animated, saved and loaded without a renderer.
+
+#pragma once
+
+#include "ecs/ecs_resources.h"
+#include "ecs/ecs_scene.h"
+#include "ecs/ecs_utilities.h"
+
+#include "data_struct.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace
+{
+    struct bench_scene_params
+    {
+        u32 num_roots;
+        u32 fanout;
+        u32 depth;
+    };
+
+    // creates num_roots trees with fanout children per node up to depth levels, nodes are laid out in a grid like
+    // cull_sort. the scene is created without gpu resources so it can be updated headless.
+    ecs::ecs_scene* create_bench_scene(const bench_scene_params& params)
+    {
+        ecs::ecs_scene* scene = new ecs::ecs_scene();
+
+        u32 nodes_per_tree = 0;
+        u32 level_nodes = 1;
+        for (u32 d = 0; d < params.depth; ++d)
+        {
+            nodes_per_tree += level_nodes;
+            level_nodes *= params.fanout;
+        }
+
+        ecs::resize_scene_buffers(scene, params.num_roots * nodes_per_tree + 1);
+
+        u32 grid = 1;
+        while (grid * grid * grid < params.num_roots)
+            ++grid;
+
+        f32  spacing = 10.0f;
+        u32* level = nullptr;
+        u32* next_level = nullptr;
+
+        for (u32 r = 0; r < params.num_roots; ++r)
+        {
+            sb_clear(level);
+            sb_clear(next_level);
+
+            vec3f pos = vec3f((f32)(r % grid), (f32)((r / grid) % grid), (f32)(r / (grid * grid))) * spacing;
+
+            for (u32 d = 0; d < params.depth; ++d)
+            {
+                u32 num_parents = d == 0 ? 1 : sb_count(level);
+                for (u32 p = 0; p < num_parents; ++p)
+                {
+                    u32 num_children = d == 0 ? 1 : params.fanout;
+                    for (u32 c = 0; c < num_children; ++c)
+                    {
+                        u32 n = ecs::get_new_entity(scene);
+                        scene->parents[n] = d == 0 ? n : level[p];
+                        scene->transforms[n].rotation = quat();
+                        scene->transforms[n].scale = vec3f::one();
+                        scene->transforms[n].translation = d == 0 ? pos : vec3f((f32)c, 1.0f, 0.0f);
+                        scene->bounding_volumes[n].min_extents = -vec3f::one();
+                        scene->bounding_volumes[n].max_extents = vec3f::one();
+                        scene->cbuffer[n] = PEN_INVALID_HANDLE;
+                        scene->entities[n] |= ecs::e_cmp::transform;
+                        scene->entities[n] |= ecs::e_cmp::geometry;
+                        sb_push(next_level, n);
+                    }
+                }
+
+                std::swap(level, next_level);
+                sb_clear(next_level);
+            }
+        }
+
+        sb_free(level);
+        sb_free(next_level);
+
+        return scene;
+    }
+
+    void destroy_bench_scene(ecs::ecs_scene* scene)
+    {
+        ecs::destroy_scene(scene);
+        delete scene;
+    }
+
+    bool bench_same_entities(u32* a, u32* b)
+    {
+        u32 count = sb_count(a);
+        if (count != sb_count(b))
+            return false;
+
+        std::sort(a, a + count);
+        std::sort(b, b + count);
+        return count == 0 || memcmp(a, b, count * sizeof(u32)) == 0;
+    }
+
+    // a looping clip with a translation and rotation key on every frame of every channel, laid out the same as the soa
+    // data load_pma bakes so update_animations samples it the same way.
+    struct bench_anim
+    {
+        ecs::soa_anim soa;
+        f32           length = 0.0f;
+        u32           num_frames = 0;
+    };
+
+    void create_bench_anim(bench_anim& anim, u32 num_channels, u32 num_frames)
+    {
+        static const f32 k_frame_time = 1.0f / 30.0f;
+
+        ecs::soa_anim& soa = anim.soa;
+        soa.num_channels = num_channels;
+        soa.channels = new ecs::anim_channel[num_channels];
+        soa.data = new f32*[num_frames];
+        soa.info = new ecs::anim_info*[num_frames];
+
+        memset(soa.data, 0x0, num_frames * sizeof(f32*));
+        memset(soa.info, 0x0, num_frames * sizeof(ecs::anim_info*));
+
+        for (u32 c = 0; c < num_channels; ++c)
+        {
+            ecs::anim_channel& channel = soa.channels[c];
+            channel.num_frames = num_frames;
+            channel.element_count = 7;
+            channel.flags = 0;
+
+            for (u32 i = 0; i < 3; ++i)
+                channel.element_offset[i] = ecs::e_anim_output::translate_x + i;
+
+            for (u32 i = 3; i < 7; ++i)
+                channel.element_offset[i] = ecs::e_anim_output::quaternion;
+        }
+
+        for (u32 t = 0; t < num_frames; ++t)
+        {
+            for (u32 c = 0; c < num_channels; ++c)
+            {
+                ecs::anim_info ai;
+                ai.time = (f32)t * k_frame_time;
+                ai.interpolation = ecs::e_anim_interpolation::linear;
+                ai.offset = sb_count(soa.data[t]);
+                sb_push(soa.info[t], ai);
+
+                f32 phase = (f32)t / (f32)num_frames * (f32)M_PI * 2.0f + (f32)c;
+
+                sb_push(soa.data[t], 0.0f);
+                sb_push(soa.data[t], 1.0f + sinf(phase) * 0.1f);
+                sb_push(soa.data[t], 0.0f);
+
+                quat q = quat(0.0f, 0.0f, sinf(phase) * 0.5f);
+                for (u32 i = 0; i < 4; ++i)
+                    sb_push(soa.data[t], q.v[i]);
+            }
+        }
+
+        ecs::build_anim_key_lookup(soa);
+
+        anim.length = (f32)(num_frames - 1) * k_frame_time;
+        anim.num_frames = num_frames;
+    }
+
+    void free_bench_anim(bench_anim& anim)
+    {
+        ecs::soa_anim& soa = anim.soa;
+        for (u32 t = 0; t < anim.num_frames; ++t)
+        {
+            sb_free(soa.data[t]);
+            sb_free(soa.info[t]);
+        }
+
+        for (u32 c = 0; c < soa.num_channels; ++c)
+            delete[] soa.channels[c].key_lookup;
+
+        delete[] soa.data;
+        delete[] soa.info;
+        delete[] soa.channels;
+        anim = bench_anim();
+    }
+
+    // appends num_rigs chains of num_joints joints, each under a root with an anim controller playing anim. joint j is
+    // driven by channel j like bind_animation_to_rig binds channels by name. when clip is passed the rigs sample it
+    // instead of the soa keys of anim.
+    void add_bench_rigs(ecs::ecs_scene* scene, const bench_anim& anim, u32 num_rigs, u32 num_joints,
+                        const ecs::anim_clip* clip = nullptr)
+    {
+        for (u32 r = 0; r < num_rigs; ++r)
+        {
+            u32 root = ecs::get_new_entity(scene);
+            scene->transforms[root].rotation = quat();
+            scene->transforms[root].scale = vec3f::one();
+            scene->transforms[root].translation = vec3f((f32)(r % 32), 0.0f, (f32)(r / 32)) * 5.0f;
+            scene->bounding_volumes[root].min_extents = -vec3f::one();
+            scene->bounding_volumes[root].max_extents = vec3f::one();
+            scene->cbuffer[root] = PEN_INVALID_HANDLE;
+            scene->entities[root] |= ecs::e_cmp::transform;
+
+            // entities are created before any component is referenced, the buffers may grow
+            u32 first_joint = scene->num_entities;
+            u32 parent = root;
+            for (u32 j = 0; j < num_joints; ++j)
+            {
+                u32 jn = ecs::get_new_entity(scene);
+                scene->parents[jn] = parent;
+                scene->transforms[jn].rotation = quat();
+                scene->transforms[jn].scale = vec3f::one();
+                scene->transforms[jn].translation = vec3f(0.0f, 1.0f, 0.0f);
+                scene->initial_transform[jn] = scene->transforms[jn];
+                scene->bounding_volumes[jn].min_extents = -vec3f::one();
+                scene->bounding_volumes[jn].max_extents = vec3f::one();
+                scene->cbuffer[jn] = PEN_INVALID_HANDLE;
+                scene->entities[jn] |= ecs::e_cmp::transform;
+                scene->entities[jn] |= ecs::e_cmp::bone;
+                parent = jn;
+            }
+
+            ecs::cmp_anim_controller_v2& controller = scene->anim_controller_v2[root];
+            controller = ecs::cmp_anim_controller_v2();
+            controller.joints_offset = first_joint;
+
+            ecs::anim_instance instance;
+            instance.soa = anim.soa;
+            instance.clip = clip;
+            instance.length = anim.length;
+
+            if (clip)
+                for (u32 t = 0; t < clip->num_tracks; ++t)
+                    sb_push(instance.track_keys, 0);
+
+            for (u32 j = 0; j < num_joints; ++j)
+            {
+                u32 jn = first_joint + j;
+                sb_push(controller.joint_indices, jn);
+
+                const ecs::cmp_transform& t = scene->initial_transform[jn];
+                sb_push(instance.joints, t);
+
+                ecs::anim_target at = ecs::anim_target();
+                for (u32 e = 0; e < 3; ++e)
+                {
+                    at.t[e] = t.translation[e];
+                    at.t[e + 6] = t.scale[e];
+                }
+
+                sb_push(instance.targets, at);
+            }
+
+            for (u32 c = 0; c < anim.soa.num_channels; ++c)
+            {
+                ecs::anim_sampler sampler = {0};
+                sampler.joint = c < num_joints ? c : PEN_INVALID_HANDLE;
+                sb_push(instance.samplers, sampler);
+            }
+
+            sb_push(controller.anim_instances, instance);
+            scene->entities[root] |= ecs::e_cmp::anim_controller;
+        }
+    }
+
+    // anim controllers are not freed with the scene
+    void free_bench_rigs(ecs::ecs_scene* scene)
+    {
+        for (u32 n = 0; n < scene->num_entities; ++n)
+        {
+            if (!(scene->entities[n] & ecs::e_cmp::anim_controller))
+                continue;
+
+            ecs::cmp_anim_controller_v2& controller = scene->anim_controller_v2[n];
+            for (u32 i = 0; i < sb_count(controller.anim_instances); ++i)
+            {
+                sb_free(controller.anim_instances[i].joints);
+                sb_free(controller.anim_instances[i].targets);
+                sb_free(controller.anim_instances[i].samplers);
+                sb_free(controller.anim_instances[i].track_keys);
+            }
+
+            sb_free(controller.anim_instances);
+            sb_free(controller.joint_indices);
+            controller = ecs::cmp_anim_controller_v2();
+            scene->entities[n] &= ~ecs::e_cmp::anim_controller;
+        }
+    }
+} // namespace
@@ -0,0 +1,1448 @@
+// benchmarks.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Headless console app to measure engine systems, run with -bench <name> to run a single benchmark.
+
+#include "camera.h"
+#include "ecs/ecs_cull.h"
+#include "ecs/ecs_resources.h"
+#include "ecs/ecs_scene.h"
+#include "ecs/ecs_utilities.h"
+
+#include "console.h"
+#include "data_struct.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "pen_string.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "str/Str.h"
+
+#include "../bench_common.h"
+
+#include <algorithm>
+
+using namespace pen;
+using namespace put;
+
+static Str* s_args = nullptr;
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        for (u32 i = 0; i < argc; ++i)
+            sb_push(s_args, argv[i]);
+
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "benchmarks";
+        p.window_sample_count = 1;
+        p.user_thread_function = user_entry;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    // job system vs semaphore per job
+
+    namespace e_bench_constants
+    {
+        enum bench_constants_t
+        {
+            num_tasks = 100000,
+            num_job_threads = 4,
+            parallel_for_size = 1 << 22
+        };
+    }
+
+    a_u64 s_task_sum = {0};
+    bool  s_failed = false;
+
+    // results are checked in release builds too, a failed check is logged and the app exits with an error code
+    void bench_check(bool ok, const c8* what)
+    {
+        if (ok)
+            return;
+
+        PEN_LOG("FAILED: %s", what);
+        s_failed = true;
+    }
+
+    void bench_task(void* user_data)
+    {
+        s_task_sum += (u64)(size_t)user_data;
+    }
+
+    void bench_parallel_for(u32 start, u32 end, void* user_data)
+    {
+        f32* data = (f32*)user_data;
+        for (u32 i = start; i < end; ++i)
+            data[i] = data[i] * 0.5f + 1.0f;
+    }
+
+    void* semaphore_job_thread(void* params)
+    {
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        for (;;)
+        {
+            pen::semaphore_wait(p_thread_info->p_sem_consume);
+
+            if (pen::semaphore_try_wait(p_thread_info->p_sem_exit))
+                break;
+
+            bench_task((void*)1);
+            pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+        }
+
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        return PEN_THREAD_OK;
+    }
+
+    void bench_jobs()
+    {
+        const u32 nt = e_bench_constants::num_tasks;
+        const u32 nj = e_bench_constants::num_job_threads;
+
+        pen::timer* timer = pen::timer_create();
+
+        // semaphore per job, the model used by jobs_create_job: kick a thread and wait for it to signal back
+        pen::job* jobs[nj];
+        for (u32 i = 0; i < nj; ++i)
+            jobs[i] = pen::jobs_create_job(semaphore_job_thread, 1024 * 1024, nullptr, e_thread_start_flags::detached);
+
+        s_task_sum = 0;
+        pen::timer_start(timer);
+        for (u32 i = 0; i < nt; i += nj)
+        {
+            for (u32 j = 0; j < nj; ++j)
+                pen::semaphore_post(jobs[j]->p_sem_consume, 1);
+
+            for (u32 j = 0; j < nj; ++j)
+                pen::semaphore_wait(jobs[j]->p_sem_continue);
+        }
+        f64 sem_ms = pen::timer_elapsed_ms(timer);
+        bench_check(s_task_sum == nt, "jobs: semaphore per job task count");
+
+        for (u32 i = 0; i < nj; ++i)
+        {
+            pen::semaphore_post(jobs[i]->p_sem_exit, 1);
+            pen::semaphore_post(jobs[i]->p_sem_consume, 1);
+            pen::semaphore_wait(jobs[i]->p_sem_continue);
+            pen::jobs_release_job(jobs[i]);
+        }
+
+        // work stealing tasks
+        pen::jobs_create_workers();
+
+        s_task_sum = 0;
+        a_u32 counter = {0};
+        pen::timer_start(timer);
+        for (u32 i = 0; i < nt; ++i)
+            pen::jobs_submit(bench_task, (void*)1, &counter);
+        pen::jobs_wait(&counter);
+        f64 task_ms = pen::timer_elapsed_ms(timer);
+        bench_check(s_task_sum == nt, "jobs: work stealing task count");
+
+        // single task round trip latency
+        s_task_sum = 0;
+        pen::timer_start(timer);
+        for (u32 i = 0; i < nt; ++i)
+        {
+            pen::jobs_submit(bench_task, (void*)1, &counter);
+            pen::jobs_wait(&counter);
+        }
+        f64 latency_ms = pen::timer_elapsed_ms(timer);
+        bench_check(s_task_sum == nt, "jobs: round trip task count");
+
+        // parallel for
+        const u32 pfs = e_bench_constants::parallel_for_size;
+        f32*      data = (f32*)pen::memory_alloc(pfs * sizeof(f32));
+        for (u32 i = 0; i < pfs; ++i)
+            data[i] = (f32)i;
+
+        pen::timer_start(timer);
+        bench_parallel_for(0, pfs, data);
+        f64 serial_ms = pen::timer_elapsed_ms(timer);
+
+        pen::timer_start(timer);
+        pen::jobs_parallel_for(pfs, 4096, bench_parallel_for, data);
+        f64 pf_ms = pen::timer_elapsed_ms(timer);
+
+        pen::memory_free(data);
+        pen::timer_destroy(timer);
+
+        PEN_LOG("jobs: workers %i, tasks %i", pen::jobs_get_num_workers(), nt);
+        PEN_LOG("jobs: semaphore per job (%i threads): %f ms, %f us per task", nj, sem_ms, (sem_ms * 1000.0) / nt);
+        PEN_LOG("jobs: work stealing submit + wait: %f ms, %f us per task", task_ms, (task_ms * 1000.0) / nt);
+        PEN_LOG("jobs: work stealing round trip: %f ms, %f us per task", latency_ms, (latency_ms * 1000.0) / nt);
+        PEN_LOG("jobs: parallel_for %i elements: serial %f ms, parallel %f ms", pfs, serial_ms, pf_ms);
+    }
+
+    // renderer command payloads, heap allocation per command vs per-frame linear allocator. this emulates the
+    // renderer_update_buffer path with a consumer thread standing in for the render thread.
+
+    namespace e_cmd_bench_constants
+    {
+        enum cmd_bench_constants_t
+        {
+            cmds_per_frame = 100000,
+            num_frames = 16,
+            num_frame_allocators = 3,
+            dest_size = 256
+        };
+    }
+
+    struct bench_cmd
+    {
+        u32   command_index; // 0 = update buffer, 1 = present
+        u32   allocator;
+        void* data;
+        u32   data_size;
+    };
+
+    struct cmd_bench_ctx
+    {
+        ring_buffer<bench_cmd> cmd_buffer;
+        linear_allocator       frame_allocators[e_cmd_bench_constants::num_frame_allocators];
+        bool                   use_allocator = false;
+        a_u64                  frames_retired = {0};
+        a_bool                 exit = {false};
+        u8                     dest[e_cmd_bench_constants::dest_size];
+    };
+
+    void* cmd_bench_consumer_thread(void* params)
+    {
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        cmd_bench_ctx*          ctx = (cmd_bench_ctx*)job_params->user_data;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        for (;;)
+        {
+            bench_cmd* cmd = ctx->cmd_buffer.get();
+            if (!cmd)
+            {
+                if (ctx->exit)
+                    break;
+
+                pen::thread_sleep_us(10);
+                continue;
+            }
+
+            if (cmd->command_index == 0)
+            {
+                memcpy(ctx->dest, cmd->data, cmd->data_size);
+                if (!ctx->use_allocator)
+                    pen::memory_free(cmd->data);
+            }
+            else
+            {
+                if (ctx->use_allocator)
+                    ctx->frame_allocators[cmd->allocator].reset();
+
+                ctx->frames_retired++;
+            }
+        }
+
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        return PEN_THREAD_OK;
+    }
+
+    void bench_cmd_alloc()
+    {
+        const u32 cpf = e_cmd_bench_constants::cmds_per_frame;
+        const u32 nf = e_cmd_bench_constants::num_frames;
+        const u32 nfa = e_cmd_bench_constants::num_frame_allocators;
+
+        u8 src[e_cmd_bench_constants::dest_size];
+        for (u32 i = 0; i < PEN_ARRAY_SIZE(src); ++i)
+            src[i] = (u8)i;
+
+        pen::timer* timer = pen::timer_create();
+
+        for (u32 mode = 0; mode < 2; ++mode)
+        {
+            cmd_bench_ctx* ctx = new cmd_bench_ctx();
+            ctx->use_allocator = mode == 1;
+            ctx->cmd_buffer.create((cpf + 1) * nfa + 1);
+
+            // same initial and max sizes as the renderer
+            for (u32 i = 0; i < nfa; ++i)
+                ctx->frame_allocators[i].create(1024 * 1024, 64 * 1024 * 1024);
+
+            pen::job* consumer =
+                pen::jobs_create_job(cmd_bench_consumer_thread, 1024 * 1024, ctx, e_thread_start_flags::detached);
+
+            u64 frames_submitted = 0;
+            u32 first_frame_heap_allocs = 0;
+            u32 last_frame_heap_allocs = 0;
+            f64 produce_ms = 0.0;
+
+            pen::timer_start(timer);
+            for (u32 f = 0; f < nf; ++f)
+            {
+                u32               fa_index = frames_submitted % nfa;
+                linear_allocator& fa = ctx->frame_allocators[fa_index];
+
+                f64 frame_start = pen::timer_elapsed_ms(timer);
+                for (u32 i = 0; i < cpf; ++i)
+                {
+                    // cbuffer sized payloads, 64 - 256 bytes
+                    bench_cmd cmd;
+                    cmd.command_index = 0;
+                    cmd.data_size = 64 + (i & 3) * 64;
+                    cmd.data = ctx->use_allocator ? fa.alloc(cmd.data_size) : pen::memory_alloc(cmd.data_size);
+                    memcpy(cmd.data, src, cmd.data_size);
+                    ctx->cmd_buffer.put(cmd);
+                }
+                produce_ms += pen::timer_elapsed_ms(timer) - frame_start;
+
+                if (f == 0)
+                    first_frame_heap_allocs = ctx->use_allocator ? fa.num_heap_allocs : cpf;
+                last_frame_heap_allocs = ctx->use_allocator ? fa.num_heap_allocs : cpf;
+
+                bench_cmd present;
+                present.command_index = 1;
+                present.allocator = fa_index;
+                ctx->cmd_buffer.put(present);
+
+                frames_submitted++;
+                while (frames_submitted - ctx->frames_retired >= nfa)
+                    pen::thread_sleep_us(10);
+            }
+
+            while (ctx->frames_retired < frames_submitted)
+                pen::thread_sleep_us(10);
+
+            f64 total_ms = pen::timer_elapsed_ms(timer);
+
+            ctx->exit = true;
+            pen::semaphore_wait(consumer->p_sem_continue);
+            pen::jobs_release_job(consumer);
+
+            PEN_LOG("cmd_alloc: %s, %i update_buffer cmds per frame, %i frames",
+                    ctx->use_allocator ? "frame allocator" : "heap", cpf, nf);
+            PEN_LOG("    produce: %f ms per frame, produce + consume: %f ms per frame", produce_ms / nf, total_ms / nf);
+            PEN_LOG("    heap allocs: first frame %i, last frame %i, allocator capacity %i kb", first_frame_heap_allocs,
+                    last_frame_heap_allocs, (u32)(ctx->frame_allocators[0]._capacity / 1024));
+
+            for (u32 i = 0; i < nfa; ++i)
+                ctx->frame_allocators[i].destroy();
+
+            delete ctx;
+        }
+
+        pen::timer_destroy(timer);
+
+        // payloads which overflow the block keep their alignment, a spike grows the block and it shrinks back to the
+        // initial size once the space goes unused
+        linear_allocator la;
+        la.create(1024, 64 * 1024 * 1024);
+
+        bool aligned = true;
+        for (u32 i = 0; i < 1024; ++i)
+            aligned &= ((size_t)la.alloc(48, 64) & 63) == 0;
+
+        la.reset();
+        size_t grown = la._capacity;
+
+        for (u32 i = 0; i < linear_allocator::trim_resets; ++i)
+        {
+            la.alloc(256);
+            la.reset();
+        }
+
+        bench_check(aligned, "cmd_alloc: allocation alignment");
+        bench_check(grown > 1024 && la._capacity == 1024, "cmd_alloc: allocator trim");
+        PEN_LOG("    allocator spike: grown to %i kb, trimmed to %i kb", (u32)(grown / 1024), (u32)(la._capacity / 1024));
+
+        la.destroy();
+    }
+
+    // renderer command encoding, fixed size commands (a union sized by the largest params) vs a packed stream of
+    // header + payload. the command mix per draw emulates render_scene_view and a consumer thread stands in for the
+    // render thread.
+
+    namespace e_stream_bench_constants
+    {
+        enum stream_bench_constants_t
+        {
+            draws_per_frame = 10000,
+            cmds_per_draw = 8,
+            num_frames = 16,
+            frames_in_flight = 3,
+            present = cmds_per_draw
+        };
+    }
+
+    // set_shader, 2x set_constant_buffer, 2x set_texture, set_vertex_buffer, set_index_buffer, draw_indexed
+    const u32 k_stream_bench_payload_sizes[] = {8, 12, 12, 16, 16, 40, 12, 16};
+
+    struct bench_fixed_cmd
+    {
+        u32 command_index;
+        u32 resource_slot;
+        u64 frame_index;
+
+        union {
+            u32                          args[10];
+            pen::texture_creation_params create_texture;
+            pen::clear_state             clear_state_params;
+        };
+
+        bench_fixed_cmd(){};
+    };
+
+    struct stream_bench_ctx
+    {
+        ring_buffer<bench_fixed_cmd> fixed_buffer;
+        packet_ring_buffer           packed_buffer;
+        bool                         packed = false;
+        u64                          checksum = 0;
+        f64                          consume_ms = 0.0;
+        a_u64                        frames_retired = {0};
+        a_bool                       exit = {false};
+    };
+
+    void* stream_bench_consumer_thread(void* params)
+    {
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        stream_bench_ctx*       ctx = (stream_bench_ctx*)job_params->user_data;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        pen::timer* timer = pen::timer_create();
+
+        for (;;)
+        {
+            // only time spent decoding and executing is measured, not waiting on the producer
+            pen::timer_start(timer);
+
+            u32 consumed = 0;
+            for (;;)
+            {
+                u32 command_index;
+                u32 args[10];
+                if (ctx->packed)
+                {
+                    packet_header* h = ctx->packed_buffer.peek();
+                    if (!h)
+                        break;
+
+                    command_index = h->id;
+                    memcpy(args, h + 1, h->size);
+                    ctx->packed_buffer.pop();
+                }
+                else
+                {
+                    bench_fixed_cmd* cmd = ctx->fixed_buffer.get();
+                    if (!cmd)
+                        break;
+
+                    command_index = cmd->command_index;
+                    memcpy(args, cmd->args, sizeof(args));
+                }
+
+                ++consumed;
+                if (command_index == e_stream_bench_constants::present)
+                {
+                    ctx->frames_retired++;
+                    continue;
+                }
+
+                // execute
+                u32 num_args = k_stream_bench_payload_sizes[command_index] / sizeof(u32);
+                for (u32 i = 0; i < num_args; ++i)
+                    ctx->checksum += args[i];
+            }
+
+            if (consumed)
+                ctx->consume_ms += pen::timer_elapsed_ms(timer);
+
+            if (ctx->exit)
+                break;
+
+            pen::thread_sleep_us(10);
+        }
+
+        pen::timer_destroy(timer);
+
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        return PEN_THREAD_OK;
+    }
+
+    void bench_cmd_stream()
+    {
+        const u32 dpf = e_stream_bench_constants::draws_per_frame;
+        const u32 cpd = e_stream_bench_constants::cmds_per_draw;
+        const u32 nf = e_stream_bench_constants::num_frames;
+        const u32 fif = e_stream_bench_constants::frames_in_flight;
+        const u32 cmds_per_frame = dpf * cpd + 1;
+
+        pen::timer* timer = pen::timer_create();
+
+        u64 checksums[2] = {0};
+        for (u32 mode = 0; mode < 2; ++mode)
+        {
+            stream_bench_ctx* ctx = new stream_bench_ctx();
+            ctx->packed = mode == 1;
+            if (ctx->packed)
+                ctx->packed_buffer.create(cmds_per_frame * fif * 32);
+            else
+                ctx->fixed_buffer.create(cmds_per_frame * fif + 1);
+
+            pen::job* consumer =
+                pen::jobs_create_job(stream_bench_consumer_thread, 1024 * 1024, ctx, e_thread_start_flags::detached);
+
+            u64 frames_submitted = 0;
+            u64 bytes = 0;
+
+            pen::timer_start(timer);
+            for (u32 f = 0; f < nf; ++f)
+            {
+                for (u32 c = 0; c < cmds_per_frame; ++c)
+                {
+                    u32 command_index = c < dpf * cpd ? c % cpd : (u32)e_stream_bench_constants::present;
+                    u32 payload_size = c < dpf * cpd ? k_stream_bench_payload_sizes[command_index] : 0;
+
+                    if (ctx->packed)
+                    {
+                        u32            packed[11];
+                        packet_header* h = (packet_header*)&packed[0];
+                        h->id = (u16)command_index;
+                        h->size = (u16)payload_size;
+                        for (u32 i = 0; i < payload_size / sizeof(u32); ++i)
+                            packed[1 + i] = c + i;
+
+                        u32 size = sizeof(packet_header) + payload_size;
+                        while (ctx->packed_buffer.put(&packed[0], size) == 0)
+                            pen::thread_sleep_us(10);
+
+                        bytes += size;
+                    }
+                    else
+                    {
+                        bench_fixed_cmd cmd;
+                        cmd.command_index = command_index;
+                        for (u32 i = 0; i < payload_size / sizeof(u32); ++i)
+                            cmd.args[i] = c + i;
+
+                        ctx->fixed_buffer.put(cmd);
+                        bytes += sizeof(bench_fixed_cmd);
+                    }
+                }
+
+                frames_submitted++;
+                while (frames_submitted - ctx->frames_retired >= fif)
+                    pen::thread_sleep_us(10);
+            }
+
+            while (ctx->frames_retired < frames_submitted)
+                pen::thread_sleep_us(10);
+
+            f64 total_ms = pen::timer_elapsed_ms(timer);
+
+            ctx->exit = true;
+            pen::semaphore_wait(consumer->p_sem_continue);
+            pen::jobs_release_job(consumer);
+
+            checksums[mode] = ctx->checksum;
+
+            PEN_LOG("cmd_stream: %s, %i cmds per frame, %i frames", ctx->packed ? "packed" : "fixed size",
+                    cmds_per_frame, nf);
+            PEN_LOG("    %i kb per frame, consume: %f ms per frame, produce + consume: %f ms per frame",
+                    (u32)(bytes / nf / 1024), ctx->consume_ms / nf, total_ms / nf);
+
+            delete ctx;
+        }
+
+        bench_check(checksums[0] == checksums[1], "cmd_stream: checksums");
+
+        pen::timer_destroy(timer);
+    }
+
+    // scene update
+
+    void bench_scene_transforms()
+    {
+        static const u32 k_iterations = 16;
+
+        static const bench_scene_params k_scenes[] = {
+            {32768, 1, 1},  // cull_sort
+            {100000, 1, 1}, // flat
+            {5000, 4, 3},   // 105k nodes, 3 levels
+            {1000, 2, 7}    // 127k nodes, 7 levels
+        };
+
+        for (u32 i = 0; i < PEN_ARRAY_SIZE(k_scenes); ++i)
+        {
+            ecs::ecs_scene* scene = create_bench_scene(k_scenes[i]);
+
+            f64 timings[ecs::e_update_stage::COUNT] = {0};
+            for (u32 it = 0; it < k_iterations; ++it)
+            {
+                // dirty all transforms to measure the worst case
+                for (u32 n = 0; n < scene->num_entities; ++n)
+                    scene->entities[n] |= ecs::e_cmp::transform;
+
+                ecs::update_scene_transforms(scene);
+
+                for (u32 s = 0; s < ecs::e_update_stage::COUNT; ++s)
+                    timings[s] += scene->update_timings[s];
+            }
+
+            u32 dynamic_updates = scene->num_world_matrix_updates;
+
+            // static scene, nothing dirty so only the hierarchy and extents are touched
+            f64 static_timings[ecs::e_update_stage::COUNT] = {0};
+            for (u32 it = 0; it < k_iterations; ++it)
+            {
+                pen::memory_zero(scene->dirty_flags.data, scene->num_entities * sizeof(u32));
+
+                ecs::update_scene_transforms(scene);
+
+                for (u32 s = 0; s < ecs::e_update_stage::COUNT; ++s)
+                    static_timings[s] += scene->update_timings[s];
+            }
+
+            PEN_LOG("scene_transforms: %i nodes, %i levels, workers %i", (u32)scene->num_entities,
+                    scene->num_hierarchy_levels, pen::jobs_get_num_workers());
+            PEN_LOG("    hierarchy: %f ms (static %f ms)", timings[ecs::e_update_stage::hierarchy] / k_iterations,
+                    static_timings[ecs::e_update_stage::hierarchy] / k_iterations);
+            PEN_LOG("    transforms + bounds: %f ms (static %f ms)", timings[ecs::e_update_stage::transforms] / k_iterations,
+                    static_timings[ecs::e_update_stage::transforms] / k_iterations);
+            PEN_LOG("    parent extents: %f ms (static %f ms)", timings[ecs::e_update_stage::parent_extents] / k_iterations,
+                    static_timings[ecs::e_update_stage::parent_extents] / k_iterations);
+            PEN_LOG("    world matrix updates: %i (static %i)", dynamic_updates, scene->num_world_matrix_updates);
+
+            destroy_bench_scene(scene);
+        }
+    }
+
+    // frustum culling of 1m entities with every simd level the cpu supports, each must match the scalar result exactly.
+    // the dense list streams the soa cull bounds, the sparse list has no runs long enough and gathers pos_extent.
+
+    void bench_cull()
+    {
+        static const u32 k_iterations = 16;
+
+        ecs::ecs_scene* scene = create_bench_scene({1000000, 1, 1});
+        ecs::update_scene_transforms(scene);
+
+        u32* lists[2] = {nullptr, nullptr};
+        for (u32 n = 0; n < scene->num_entities; ++n)
+        {
+            sb_push(lists[0], n);
+            if (n % 4 != 3)
+                sb_push(lists[1], n);
+        }
+
+        // looking into the grid from outside so part of it is visible
+        camera cam;
+        camera_create_perspective(&cam, 60.0f, 16.0f / 9.0f, 0.1f, 2000.0f);
+        cam.focus = vec3f(495.0f);
+        cam.rot = vec2f(-0.4f, 0.6f);
+        cam.zoom = 1200.0f;
+        camera_update_look_at(&cam);
+        camera_update_frustum(&cam);
+
+        ecs::simd_level default_level = ecs::get_simd_level();
+        pen::timer*     timer = pen::timer_create();
+
+        for (u32 list = 0; list < 2; ++list)
+        {
+            u32* entities = lists[list];
+            u32  num_entities = sb_count(entities);
+
+            for (u32 shape = 0; shape < 2; ++shape)
+            {
+                const c8* shape_name = shape == 0 ? "aabb" : "sphere";
+
+                u32* reference = nullptr;
+                u32* culled = nullptr;
+
+                // single threaded scalar reference
+                f64 scalar_ms = 0.0;
+                for (u32 it = 0; it < k_iterations; ++it)
+                {
+                    if (reference)
+                        stb__sbn(reference) = 0;
+
+                    pen::timer_start(timer);
+                    if (shape == 0)
+                        ecs::frustum_cull_aabb_scalar(scene, &cam, entities, &reference);
+                    else
+                        ecs::frustum_cull_sphere_scalar(scene, &cam, entities, &reference);
+                    scalar_ms += pen::timer_elapsed_ms(timer);
+                }
+
+                scalar_ms /= k_iterations;
+
+                u32 num_visible = sb_count(reference);
+                PEN_LOG("cull: %s, %s, %i entities, %i visible, workers %i", list == 0 ? "dense" : "sparse", shape_name,
+                        num_entities, num_visible, pen::jobs_get_num_workers());
+                PEN_LOG("    scalar (single threaded): %f ms, %f entities/ns", scalar_ms,
+                        num_entities / (scalar_ms * 1000000.0));
+
+                for (u32 l = 0; l < ecs::e_simd::COUNT; ++l)
+                {
+                    ecs::simd_level level = (ecs::simd_level)l;
+                    if (!ecs::set_simd_level(level))
+                        continue;
+
+                    f64 ms = 0.0;
+                    for (u32 it = 0; it < k_iterations; ++it)
+                    {
+                        if (culled)
+                            stb__sbn(culled) = 0;
+
+                        pen::timer_start(timer);
+                        if (shape == 0)
+                            ecs::frustum_cull_aabb(scene, &cam, entities, &culled);
+                        else
+                            ecs::frustum_cull_sphere(scene, &cam, entities, &culled);
+                        ms += pen::timer_elapsed_ms(timer);
+                    }
+
+                    ms /= k_iterations;
+
+                    bool identical = sb_count(culled) == num_visible &&
+                                     (num_visible == 0 || memcmp(culled, reference, num_visible * sizeof(u32)) == 0);
+
+                    PEN_LOG("    %s: %f ms, %f entities/ns, %s", ecs::get_simd_level_name(level), ms,
+                            num_entities / (ms * 1000000.0), identical ? "identical" : "mismatch");
+                    bench_check(identical, "cull: results differ");
+                }
+
+                sb_free(reference);
+                sb_free(culled);
+            }
+        }
+
+        ecs::set_simd_level(default_level);
+
+        pen::timer_destroy(timer);
+        sb_free(lists[0]);
+        sb_free(lists[1]);
+        destroy_bench_scene(scene);
+    }
+
+    // culling 1m entities against the main camera and the cube faces of point lights in the grid, once per frustum
+    // against a single sweep for all of them. each frustum must give the same entities either way.
+
+    void bench_multi_cull()
+    {
+        static const u32 k_iterations = 8;
+        static const u32 k_lights[] = {0, 1, 4, 10};
+
+        ecs::ecs_scene* scene = create_bench_scene({1000000, 1, 1});
+        ecs::update_scene_transforms(scene);
+
+        u32* entities = nullptr;
+        for (u32 n = 0; n < scene->num_entities; ++n)
+            sb_push(entities, n);
+
+        u32 num_entities = sb_count(entities);
+
+        camera cam;
+        camera_create_perspective(&cam, 60.0f, 16.0f / 9.0f, 0.1f, 2000.0f);
+        cam.focus = vec3f(495.0f);
+        cam.rot = vec2f(-0.4f, 0.6f);
+        cam.zoom = 1200.0f;
+        camera_update_look_at(&cam);
+        camera_update_frustum(&cam);
+
+        // faces look down each axis, tilted off y so the look at has an up vector
+        static const vec3f k_faces[] = {vec3f(1.0f, 0.0f, 0.0f),  vec3f(-1.0f, 0.0f, 0.0f), vec3f(0.1f, 1.0f, 0.0f),
+                                        vec3f(0.1f, -1.0f, 0.0f), vec3f(0.0f, 0.0f, 1.0f),  vec3f(0.0f, 0.0f, -1.0f)};
+
+        frustum frusta[ecs::e_cull_limits::max_frusta];
+        u64*    masks = nullptr;
+        sb_add(masks, num_entities);
+
+        pen::timer* timer = pen::timer_create();
+
+        for (u32 i = 0; i < PEN_ARRAY_SIZE(k_lights); ++i)
+        {
+            u32 num_frusta = 0;
+            frusta[num_frusta++] = cam.camera_frustum;
+
+            for (u32 l = 0; l < k_lights[i]; ++l)
+            {
+                vec3f pos = vec3f(100.0f + l * 80.0f, 250.0f, 300.0f);
+                for (u32 f = 0; f < 6; ++f)
+                {
+                    camera face;
+                    camera_create_perspective(&face, 90.0f, 1.0f, 0.1f, 100.0f);
+                    camera_update_look_at(&face, pos, pos + k_faces[f]);
+                    camera_update_frustum(&face);
+                    frusta[num_frusta++] = face.camera_frustum;
+                }
+            }
+
+            // one pass over the entities per frustum
+            u32* single[ecs::e_cull_limits::max_frusta] = {0};
+            f64  single_ms = 0.0;
+            for (u32 it = 0; it < k_iterations; ++it)
+            {
+                pen::timer_start(timer);
+                for (u32 f = 0; f < num_frusta; ++f)
+                {
+                    if (single[f])
+                        stb__sbn(single[f]) = 0;
+
+                    ecs::frustum_cull_aabb(scene, frusta[f], entities, num_entities, &single[f]);
+                }
+                single_ms += pen::timer_elapsed_ms(timer);
+            }
+
+            // one pass for every frustum then a pass over the masks per frustum
+            f64  multi_ms = 0.0;
+            f64  gather_ms = 0.0;
+            u32* gathered = nullptr;
+            bool identical = true;
+            for (u32 it = 0; it < k_iterations; ++it)
+            {
+                pen::timer_start(timer);
+                ecs::frustum_cull_aabb_multi(scene, frusta, num_frusta, entities, num_entities, masks);
+                multi_ms += pen::timer_elapsed_ms(timer);
+
+                for (u32 f = 0; f < num_frusta; ++f)
+                {
+                    if (gathered)
+                        stb__sbn(gathered) = 0;
+
+                    pen::timer_start(timer);
+                    u32 count = ecs::gather_visible_entities(entities, masks, num_entities, (u64)1 << f, &gathered);
+                    gather_ms += pen::timer_elapsed_ms(timer);
+
+                    identical &= count == sb_count(single[f]) &&
+                                 (count == 0 || memcmp(gathered, single[f], count * sizeof(u32)) == 0);
+                }
+            }
+
+            PEN_LOG("multi_cull: %i entities, %i frusta, %s, workers %i", num_entities, num_frusta,
+                    ecs::get_simd_level_name(ecs::get_simd_level()), pen::jobs_get_num_workers());
+            PEN_LOG("    per frustum: %f ms, single sweep: %f ms + gather %f ms, %s", single_ms / k_iterations,
+                    multi_ms / k_iterations, gather_ms / k_iterations, identical ? "identical" : "mismatch");
+            bench_check(identical, "multi_cull: results differ");
+
+            for (u32 f = 0; f < num_frusta; ++f)
+                sb_free(single[f]);
+
+            sb_free(gathered);
+        }
+
+        pen::timer_destroy(timer);
+        sb_free(masks);
+        sb_free(entities);
+        destroy_bench_scene(scene);
+    }
+
+    // bvh build, refit and query cost from 10k to 1m entities. frustum queries must return the same entities as
+    // frustum_cull_aabb, aabb and ray queries are checked against a linear scan of pos_extent.
+
+    void bench_bvh()
+    {
+        static const u32 k_iterations = 16;
+        static const u32 k_sizes[] = {10000, 100000, 1000000};
+        static const f32 k_far_scale[] = {0.1f, 0.3f, 1.0f};
+
+        pen::timer* timer = pen::timer_create();
+
+        for (u32 i = 0; i < PEN_ARRAY_SIZE(k_sizes); ++i)
+        {
+            ecs::ecs_scene* scene = create_bench_scene({k_sizes[i], 1, 1});
+            u32             num_entities = scene->num_entities;
+
+            ecs::update_scene_transforms(scene);
+
+            pen::timer_start(timer);
+            ecs::update_bvh(scene);
+            f64 build_ms = pen::timer_elapsed_ms(timer);
+
+            pen::memory_zero(scene->dirty_flags.data, num_entities * sizeof(u32));
+
+            // nothing moved, only the entity flags are scanned
+            f64 static_ms = 0.0;
+            for (u32 it = 0; it < k_iterations; ++it)
+            {
+                pen::timer_start(timer);
+                ecs::update_bvh(scene);
+                static_ms += pen::timer_elapsed_ms(timer);
+            }
+
+            // 1% of entities moving steadily, they are only reinserted once they leave their fattened bounds
+            f64 moving_ms = 0.0;
+            u32 reinserts = 0;
+            for (u32 it = 0; it < k_iterations; ++it)
+            {
+                for (u32 n = 0; n < num_entities; n += 100)
+                {
+                    scene->transforms[n].translation.x += 0.05f;
+                    scene->entities[n] |= ecs::e_cmp::transform;
+                }
+
+                ecs::update_scene_transforms(scene);
+
+                pen::timer_start(timer);
+                ecs::update_bvh(scene);
+                moving_ms += pen::timer_elapsed_ms(timer);
+                reinserts += scene->num_bvh_reinserts;
+
+                pen::memory_zero(scene->dirty_flags.data, num_entities * sizeof(u32));
+            }
+
+            PEN_LOG("bvh: %i entities, %i nodes", num_entities, scene->bvh.num_nodes);
+            PEN_LOG("    build: %f ms", build_ms);
+            PEN_LOG("    update static: %f ms", static_ms / k_iterations);
+            PEN_LOG("    update 1%% moving: %f ms, %f reinserts per frame", moving_ms / k_iterations,
+                    (f32)reinserts / k_iterations);
+
+            u32* entities = nullptr;
+            for (u32 n = 0; n < num_entities; ++n)
+                sb_push(entities, n);
+
+            // from the centre of the grid looking out with the far plane at a fraction of its size
+            extents ext = scene->renderable_extents;
+            vec3f   centre = ext.min + (ext.max - ext.min) * 0.5f;
+            f32     size = ext.max.x - ext.min.x;
+
+            u32* reference = nullptr;
+            u32* culled = nullptr;
+
+            for (u32 f = 0; f < PEN_ARRAY_SIZE(k_far_scale); ++f)
+            {
+                camera cam;
+                camera_create_perspective(&cam, 60.0f, 16.0f / 9.0f, 0.1f, size * k_far_scale[f]);
+                camera_update_look_at(&cam, centre, centre + vec3f(1.0f, 0.3f, 0.2f));
+                camera_update_frustum(&cam);
+
+                f64 linear_ms = 0.0;
+                f64 bvh_ms = 0.0;
+                for (u32 it = 0; it < k_iterations; ++it)
+                {
+                    if (reference)
+                        stb__sbn(reference) = 0;
+
+                    if (culled)
+                        stb__sbn(culled) = 0;
+
+                    pen::timer_start(timer);
+                    ecs::frustum_cull_aabb(scene, &cam, entities, &reference);
+                    linear_ms += pen::timer_elapsed_ms(timer);
+
+                    pen::timer_start(timer);
+                    ecs::bvh_query_frustum(scene, cam.camera_frustum, &culled);
+                    bvh_ms += pen::timer_elapsed_ms(timer);
+                }
+
+                u32  num_visible = sb_count(reference);
+                bool identical = bench_same_entities(culled, reference);
+
+                PEN_LOG("    frustum %2.1f%% visible: linear %f ms, bvh %f ms, %s", 100.0f * num_visible / num_entities,
+                        linear_ms / k_iterations, bvh_ms / k_iterations, identical ? "identical" : "mismatch");
+                bench_check(identical, "bvh: results differ");
+            }
+
+            // a box around the centre and a ray through it
+            vec3f box_min = centre - vec3f(size * 0.05f);
+            vec3f box_max = centre + vec3f(size * 0.05f);
+            vec3f ray_origin = ext.min - vec3f(1.0f);
+            vec3f ray_dir = normalised(ext.max - ext.min);
+
+            for (u32 q = 0; q < 2; ++q)
+            {
+                if (reference)
+                    stb__sbn(reference) = 0;
+
+                if (culled)
+                    stb__sbn(culled) = 0;
+
+                pen::timer_start(timer);
+                for (u32 n = 0; n < num_entities; ++n)
+                {
+                    vec3f emin = scene->pos_extent[n].pos.xyz - scene->pos_extent[n].extent.xyz;
+                    vec3f emax = scene->pos_extent[n].pos.xyz + scene->pos_extent[n].extent.xyz;
+
+                    bool  hit = false;
+                    vec3f ip;
+                    if (q == 0)
+                        hit = maths::aabb_vs_aabb(box_min, box_max, emin, emax);
+                    else
+                        hit = maths::ray_vs_aabb(emin, emax, ray_origin, ray_dir, ip);
+
+                    if (hit)
+                        sb_push(reference, n);
+                }
+                f64 linear_ms = pen::timer_elapsed_ms(timer);
+
+                pen::timer_start(timer);
+                if (q == 0)
+                    ecs::bvh_query_aabb(scene, box_min, box_max, &culled);
+                else
+                    ecs::bvh_query_ray(scene, ray_origin, ray_dir, FLT_MAX, &culled);
+                f64 bvh_ms = pen::timer_elapsed_ms(timer);
+
+                u32  num_hits = sb_count(reference);
+                bool identical = bench_same_entities(culled, reference);
+
+                PEN_LOG("    %s %i hits: linear %f ms, bvh %f ms, %s", q == 0 ? "aabb" : "ray", num_hits, linear_ms, bvh_ms,
+                        identical ? "identical" : "mismatch");
+            }
+
+            sb_free(reference);
+            sb_free(culled);
+            sb_free(entities);
+            destroy_bench_scene(scene);
+        }
+
+        pen::timer_destroy(timer);
+    }
+
+    // software occlusion culling of a grid with walls of large boxes covering half of it from the camera, each simd level
+    // must occlude the same entities. the cube occluder mesh is assigned by hand as the bench scene has no geometry.
+
+    void bench_occlusion()
+    {
+        static const u32 k_iterations = 16;
+
+        static vec4f cube_vertices[8];
+        static u16   cube_indices[36];
+        static const u16 k_faces[6][4] = {{0, 1, 3, 2}, {4, 6, 7, 5}, {0, 4, 5, 1}, {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 5, 7, 3}};
+
+        for (u32 v = 0; v < 8; ++v)
+            cube_vertices[v] = vec4f((v & 1) ? 1.0f : -1.0f, (v & 2) ? 1.0f : -1.0f, (v & 4) ? 1.0f : -1.0f, 1.0f);
+
+        for (u32 f = 0; f < 6; ++f)
+        {
+            static const u32 k_quad[6] = {0, 1, 2, 0, 2, 3};
+            for (u32 i = 0; i < 6; ++i)
+                cube_indices[f * 6 + i] = k_faces[f][k_quad[i]];
+        }
+
+        ecs::pmm_renderable cube = {0};
+        cube.num_vertices = 8;
+        cube.vertex_size = sizeof(vec4f);
+        cube.num_indices = 36;
+        cube.index_type = PEN_FORMAT_R16_UINT;
+        cube.cpu_vertex_buffer = cube_vertices;
+        cube.cpu_index_buffer = cube_indices;
+
+        ecs::ecs_scene* scene = create_bench_scene({32768, 1, 1});
+
+        // the front slice of the grid in 4x4 blocks, the left half becomes walls
+        u32* walls = nullptr;
+        for (u32 n = 0; n < scene->num_entities; ++n)
+        {
+            // grid cell of the entity, nodes are 10 apart
+            u32 x = (u32)(scene->transforms[n].translation.x / 10.0f);
+            u32 y = (u32)(scene->transforms[n].translation.y / 10.0f);
+            u32 z = (u32)(scene->transforms[n].translation.z / 10.0f);
+            if (z != 0 || x % 4 != 0 || y % 4 != 0 || x >= 16)
+                continue;
+
+            scene->transforms[n].scale = vec3f(20.0f, 20.0f, 1.0f);
+            sb_push(walls, n);
+        }
+
+        ecs::update_scene_transforms(scene);
+        ecs::update_occluders(scene);
+
+        for (u32 i = 0; i < sb_count(walls); ++i)
+            scene->occluders.mesh[walls[i]] = &cube;
+
+        camera cam;
+        camera_create_perspective(&cam, 60.0f, 16.0f / 9.0f, 0.1f, 2000.0f);
+        camera_update_look_at(&cam, vec3f(155.0f, 155.0f, -250.0f), vec3f(155.0f, 155.0f, 155.0f));
+        camera_update_frustum(&cam);
+
+        u32* entities = nullptr;
+        for (u32 n = 0; n < scene->num_entities; ++n)
+            sb_push(entities, n);
+
+        u32* in_frustum = nullptr;
+        ecs::frustum_cull_aabb(scene, &cam, entities, &in_frustum);
+        u32 num_in_frustum = sb_count(in_frustum);
+
+        ecs::simd_level default_level = ecs::get_simd_level();
+        pen::timer*     timer = pen::timer_create();
+
+        u32* reference = nullptr;
+        u32  num_reference = 0;
+
+        PEN_LOG("occlusion: %i entities, %i in frustum, %i walls, workers %i", scene->num_entities, num_in_frustum,
+                sb_count(walls), pen::jobs_get_num_workers());
+
+        for (u32 l = 0; l < ecs::e_simd::COUNT; ++l)
+        {
+            ecs::simd_level level = (ecs::simd_level)l;
+            if (!ecs::set_simd_level(level))
+                continue;
+
+            u32* visible = nullptr;
+            for (u32 i = 0; i < num_in_frustum; ++i)
+                sb_push(visible, in_frustum[i]);
+
+            f64 ms = 0.0;
+            u32 num_visible = 0;
+            for (u32 it = 0; it < k_iterations; ++it)
+            {
+                // culling compacts in place so restore the frustum culled list each time
+                memcpy(visible, in_frustum, num_in_frustum * sizeof(u32));
+
+                pen::timer_start(timer);
+                num_visible = ecs::occlusion_cull(scene, &cam, visible, num_in_frustum);
+                ms += pen::timer_elapsed_ms(timer);
+            }
+
+            ms /= k_iterations;
+
+            bool identical = true;
+            if (!reference)
+            {
+                reference = visible;
+                num_reference = num_visible;
+            }
+            else
+            {
+                identical = num_visible == num_reference && memcmp(visible, reference, num_visible * sizeof(u32)) == 0;
+                sb_free(visible);
+            }
+
+            PEN_LOG("    %s: %f ms, %i occluded, %s", ecs::get_simd_level_name(level), ms, num_in_frustum - num_visible,
+                    identical ? "identical" : "mismatch");
+            bench_check(identical, "occlusion: results differ");
+        }
+
+        ecs::set_simd_level(default_level);
+
+        pen::timer_destroy(timer);
+        sb_free(reference);
+        sb_free(in_frustum);
+        sb_free(entities);
+        sb_free(walls);
+        destroy_bench_scene(scene);
+    }
+
+    // clustered light binning of grids of point lights seen from inside the grid. points inside the frustum are checked
+    // against every light so a light which reaches a point must be listed in the cluster the shader would look up.
+
+    u32 bench_light_cluster(const ecs::light_cluster_info& info, const vec3f& pos)
+    {
+        vec4f cp = info.view_projection.transform_vector(vec4f(pos, 1.0f));
+        vec2f ndc = cp.xy / cp.w;
+
+        s32 tx = (s32)floorf((ndc.x * 0.5f + 0.5f) * info.grid.x);
+        s32 ty = (s32)floorf((ndc.y * 0.5f + 0.5f) * info.grid.y);
+        u32 x = (u32)std::min<s32>(std::max<s32>(tx, 0), (s32)info.grid.x - 1);
+        u32 y = (u32)std::min<s32>(std::max<s32>(ty, 0), (s32)info.grid.y - 1);
+
+        f32 depth = dot(pos, info.depth_plane.xyz) + info.depth_plane.w;
+        u32 slice = 0;
+        if (depth > info.depth.x)
+            slice = std::min<u32>((u32)(log2f(depth / info.depth.x) * info.depth.y), (u32)info.grid.z - 1);
+
+        return (slice * (u32)info.grid.y + y) * (u32)info.grid.x + x;
+    }
+
+    void bench_lights()
+    {
+        static const u32 k_iterations = 16;
+        static const u32 k_samples = 20000;
+        static const u32 k_counts[] = {1000, 4000, 16000};
+
+        pen::timer* timer = pen::timer_create();
+
+        for (u32 i = 0; i < PEN_ARRAY_SIZE(k_counts); ++i)
+        {
+            // bench scene nodes become point lights 10 apart which reach about 1.5 neighbours
+            ecs::ecs_scene* scene = create_bench_scene({k_counts[i], 1, 1});
+            for (u32 n = 0; n < scene->num_entities; ++n)
+            {
+                scene->lights[n].type = ecs::e_light_type::point;
+                scene->lights[n].colour = vec3f::one();
+                scene->lights[n].radius = 7.0f;
+                scene->entities[n] &= ~ecs::e_cmp::geometry;
+                scene->entities[n] |= ecs::e_cmp::light;
+            }
+
+            ecs::update_scene_transforms(scene);
+            ecs::update_component_lists(scene);
+
+            pen::timer_start(timer);
+            ecs::update_lights(scene);
+            f64 pack_ms = pen::timer_elapsed_ms(timer);
+
+            const ecs::light_set& ls = scene->packed_lights;
+
+            // grid extents, camera in a corner looking across
+            vec3f ext = vec3f::zero();
+            for (u32 n = 0; n < scene->num_entities; ++n)
+                ext = max_union(ext, scene->transforms[n].translation);
+
+            camera cam;
+            camera_create_perspective(&cam, 60.0f, 16.0f / 9.0f, 0.1f, mag(ext) * 1.5f);
+            camera_update_look_at(&cam, -vec3f(10.0f), ext);
+            camera_update_frustum(&cam);
+
+            ecs::light_clusters clusters;
+            f64                 ms = 0.0;
+            for (u32 it = 0; it < k_iterations; ++it)
+            {
+                pen::timer_start(timer);
+                ecs::bin_lights(scene, &cam, clusters);
+                ms += pen::timer_elapsed_ms(timer);
+            }
+
+            // points inside the frustum
+            u32 num_checked = 0;
+            u32 num_missed = 0;
+            srand(i);
+            for (u32 s = 0; s < k_samples; ++s)
+            {
+                vec3f pos = vec3f((f32)rand() / RAND_MAX, (f32)rand() / RAND_MAX, (f32)rand() / RAND_MAX) * ext;
+
+                bool outside = false;
+                for (u32 p = 0; p < 6; ++p)
+                    outside |= dot(cam.camera_frustum.n[p], pos - cam.camera_frustum.p[p]) > 0.0f;
+
+                if (outside)
+                    continue;
+
+                u32        c = bench_light_cluster(clusters.info, pos);
+                const u32* list = &clusters.indices[clusters.grid[c * 2]];
+                u32        count = clusters.grid[c * 2 + 1];
+
+                for (u32 l = ls.num_dir; l < ls.count; ++l)
+                {
+                    if (mag(pos - ls.bounds[l].xyz) > ls.bounds[l].w)
+                        continue;
+
+                    ++num_checked;
+                    if (std::find(list, list + count, l) == list + count)
+                        ++num_missed;
+                }
+            }
+
+            PEN_LOG("lights: %i point lights, pack %f ms, bin %f ms, %i in view, %i indices, max %i per cluster, %i of %i "
+                    "lit points missed",
+                    ls.count, pack_ms, ms / k_iterations, clusters.num_lights, clusters.num_indices,
+                    clusters.max_cluster_lights, num_missed, num_checked);
+            bench_check(num_missed == 0, "lights: lit points missed");
+
+            ecs::free_light_clusters(clusters);
+            destroy_bench_scene(scene);
+        }
+
+        pen::timer_destroy(timer);
+    }
+
+    // component lists against scanning every entity for each system, with a fixed number of lights as the scene grows.
+    // the lists must match a scan after lights are added and removed.
+
+    void bench_component_lists()
+    {
+        static const u32 k_iterations = 16;
+        static const u32 k_lights = 64;
+        static const u32 k_sizes[] = {10000, 100000, 1000000};
+
+        pen::timer* timer = pen::timer_create();
+
+        for (u32 i = 0; i < PEN_ARRAY_SIZE(k_sizes); ++i)
+        {
+            ecs::ecs_scene* scene = create_bench_scene({k_sizes[i], 1, 1});
+            u32             num_entities = scene->num_entities;
+            u32             stride = num_entities / k_lights;
+
+            for (u32 n = 0; n < num_entities; n += stride)
+            {
+                scene->lights[n].type = ecs::e_light_type::point;
+                scene->lights[n].colour = vec3f::one();
+                scene->lights[n].radius = 7.0f;
+                scene->entities[n] |= ecs::e_cmp::light;
+            }
+
+            ecs::update_scene_transforms(scene);
+
+            ecs::update_component_lists(scene);
+            f64 first_ms = scene->update_timings[ecs::e_update_stage::component_lists];
+
+            // nothing changes, lists are diffed then each system visits its members
+            f64 list_ms = 0.0;
+            f64 lights_ms = 0.0;
+            for (u32 it = 0; it < k_iterations; ++it)
+            {
+                ecs::update_component_lists(scene);
+                ecs::update_lights(scene);
+                list_ms += scene->update_timings[ecs::e_update_stage::component_lists];
+                lights_ms += scene->update_timings[ecs::e_update_stage::lights];
+            }
+
+            // what each system paid before, a scan of every entity for its flag
+            static const u64 k_flags[] = {ecs::e_cmp::light, ecs::e_cmp::sdf_shadow, ecs::e_cmp::pre_skinned,
+                                          ecs::e_cmp::master_instance, ecs::e_cmp::anim_controller};
+
+            u32 members = 0;
+            pen::timer_start(timer);
+            for (u32 it = 0; it < k_iterations; ++it)
+                for (u32 f = 0; f < PEN_ARRAY_SIZE(k_flags); ++f)
+                    for (u32 n = 0; n < num_entities; ++n)
+                        members += (scene->entities[n] & k_flags[f]) ? 1 : 0;
+            f64 scan_ms = pen::timer_elapsed_ms(timer);
+
+            // move every light along one entity
+            for (u32 n = 0; n < num_entities; n += stride)
+            {
+                scene->entities[n] &= ~ecs::e_cmp::light;
+                if (n + 1 < num_entities)
+                    scene->entities[n + 1] |= ecs::e_cmp::light;
+            }
+
+            ecs::update_component_lists(scene);
+            f64 change_ms = scene->update_timings[ecs::e_update_stage::component_lists];
+
+            u32* reference = nullptr;
+            for (u32 n = 0; n < num_entities; ++n)
+                if (scene->entities[n] & ecs::e_cmp::light)
+                    sb_push(reference, n);
+
+            bool identical = bench_same_entities(scene->cmp_lists.list[ecs::e_cmp_list::light], reference);
+
+            PEN_LOG("component_lists: %i entities, %i lights", num_entities, members / k_iterations);
+            PEN_LOG("    scan per system: %f ms", scan_ms / k_iterations);
+            PEN_LOG("    lists: %f ms (first %f ms, %i changed %f ms), update_lights %f ms, %s", list_ms / k_iterations,
+                    first_ms, scene->cmp_lists.num_changes, change_ms, lights_ms / k_iterations,
+                    identical ? "identical" : "mismatch");
+            bench_check(identical, "component_lists: results differ");
+
+            sb_free(reference);
+            destroy_bench_scene(scene);
+        }
+
+        pen::timer_destroy(timer);
+    }
+
+    // update_animations for 1000 rigs playing a clip with a translation and rotation key per joint per frame, at each
+    // simd level. every level starts from the bind pose and must leave the joints in the same place as scalar.
+    void bench_animation()
+    {
+        static const u32 k_rigs = 1000;
+        static const u32 k_joints = 64;
+        static const u32 k_frames = 60;
+        static const u32 k_iterations = 120;
+        static const f32 k_dt = 1.0f / 60.0f;
+
+        bench_anim anim;
+        create_bench_anim(anim, k_joints, k_frames);
+
+        ecs::simd_level default_level = ecs::get_simd_level();
+        pen::timer*     timer = pen::timer_create();
+
+        PEN_LOG("animation: %i rigs, %i joints, %i keys, workers %i", k_rigs, k_joints, k_frames,
+                pen::jobs_get_num_workers());
+
+        ecs::cmp_transform* reference = nullptr;
+        for (u32 l = 0; l < ecs::e_simd::COUNT; ++l)
+        {
+            ecs::simd_level level = (ecs::simd_level)l;
+            if (!ecs::set_simd_level(level))
+                continue;
+
+            ecs::ecs_scene* scene = create_bench_scene({1, 1, 1});
+            add_bench_rigs(scene, anim, k_rigs, k_joints);
+            ecs::update_component_lists(scene);
+
+            f64 ms = 0.0;
+            for (u32 it = 0; it < k_iterations; ++it)
+            {
+                pen::timer_start(timer);
+                ecs::update_animations(scene, k_dt);
+                ms += pen::timer_elapsed_ms(timer);
+            }
+
+            ms /= k_iterations;
+
+            if (!reference)
+                for (u32 n = 0; n < scene->num_entities; ++n)
+                    sb_push(reference, scene->transforms[n]);
+
+            size_t size = sb_count(reference) * sizeof(ecs::cmp_transform);
+            bool   identical = memcmp(reference, &scene->transforms[0], size) == 0;
+
+            PEN_LOG("    %s: %f ms, %f us per instance, %s", ecs::get_simd_level_name(level), ms,
+                    (ms * 1000.0) / k_rigs, identical ? "identical" : "mismatch");
+            bench_check(identical, "animation: results differ");
+
+            free_bench_rigs(scene);
+            destroy_bench_scene(scene);
+        }
+
+        ecs::set_simd_level(default_level);
+
+        pen::timer_destroy(timer);
+        sb_free(reference);
+        free_bench_anim(anim);
+    }
+
+    struct benchmark
+    {
+        const c8* name;
+        void (*func)();
+    };
+
+    benchmark s_benchmarks[] = {
+        {"jobs", bench_jobs},
+        {"scene_transforms", bench_scene_transforms},
+        {"cull", bench_cull},
+        {"multi_cull", bench_multi_cull},
+        {"bvh", bench_bvh},
+        {"occlusion", bench_occlusion},
+        {"lights", bench_lights},
+        {"component_lists", bench_component_lists},
+        {"animation", bench_animation},
+        {"cmd_alloc", bench_cmd_alloc},
+        {"cmd_stream", bench_cmd_stream}
+    };
+} // namespace
+
+void* pen::user_entry(void* params)
+{
+    pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+    pen::job*               p_thread_info = job_params->job_info;
+    pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+    Str  bench_name = "";
+    u32  argc = sb_count(s_args);
+    for (u32 i = 0; i < argc; ++i)
+    {
+        if (s_args[i] == "-bench" && i + 1 < argc)
+            bench_name = s_args[i + 1];
+    }
+
+    for (u32 i = 0; i < PEN_ARRAY_SIZE(s_benchmarks); ++i)
+    {
+        if (!bench_name.empty() && !(bench_name == s_benchmarks[i].name))
+            continue;
+
+        s_benchmarks[i].func();
+    }
+
+    pen::os_terminate(s_failed ? 1 : 0);
+    pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+
+    return PEN_THREAD_OK;
+}
@@ -26,8 +26,15 @@ void example_setup(ecs::ecs_scene* scene, camera& cam)
 
     clear_scene(scene);
 
+    // spheres and boxes share geometry and material so they can be drawn with instancing
+    scene->flags |= e_scene_flags::auto_instance;
+
+    // count state changes to compare sorted and entity order
+    scene->flags |= e_scene_flags::draw_stats;
+
     material_resource* default_material = get_material_resource(PEN_HASH("default_material"));
-    geometry_resource* box_resource = get_geometry_resource(PEN_HASH("sphere"));
+    geometry_resource* sphere_resource = get_geometry_resource(PEN_HASH("sphere"));
+    geometry_resource* box_resource = get_geometry_resource(PEN_HASH("cube"));
 
     // add light
     u32 light = get_new_entity(scene);
@@ -42,7 +49,7 @@ void example_setup(ecs::ecs_scene* scene, camera& cam)
     scene->entities[light] |= e_cmp::light;
     scene->entities[light] |= e_cmp::transform;
 
-    // add some spheres
+    // add some spheres and boxes, interleaved so entity order is the worst case for state changes
     f32   num_spheres = 32.0f;
     f32   d = 10.0f;
     vec3f start_pos = vec3f(-d * (num_spheres+1.0f)/2.0f);
@@ -64,10 +71,13 @@ void example_setup(ecs::ecs_scene* scene, camera& cam)
                 scene->parents[s] = s;
                 scene->entities[s] |= e_cmp::transform;
 
-                instantiate_geometry(box_resource, scene, s);
+                instantiate_geometry((s % 2) ? sphere_resource : box_resource, scene, s);
                 instantiate_material(default_material, scene, s);
                 instantiate_model_cbuffer(scene, s);
 
+                // instanced permutations take albedo from v2.rgb and roughness from v2.a
+                scene->draw_call_data[s].v2 = vec4f(1.0f, 1.0f, 1.0f, 0.5f);
+
                 pos.z += d;
             }
 
@@ -80,4 +90,45 @@ void example_setup(ecs::ecs_scene* scene, camera& cam)
 
 void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
 {
+    ImGui::Begin("Cull Sort", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+    bool auto_instance = scene->flags & e_scene_flags::auto_instance;
+    if (ImGui::Checkbox("Auto Instance", &auto_instance))
+    {
+        if (auto_instance)
+            scene->flags |= e_scene_flags::auto_instance;
+        else
+            scene->flags &= ~e_scene_flags::auto_instance;
+    }
+
+    bool bvh_cull = scene->flags & e_scene_flags::bvh_cull;
+    if (ImGui::Checkbox("BVH Cull", &bvh_cull))
+    {
+        if (bvh_cull)
+            scene->flags |= e_scene_flags::bvh_cull;
+        else
+            scene->flags &= ~e_scene_flags::bvh_cull;
+    }
+
+    ImGui::Text("Renderables: %i (%i changed)", scene->renderables.count, scene->num_renderable_changes);
+    ImGui::Text("BVH: %i leaves (%i inserted) %2.2f ms", scene->bvh.num_leaves, scene->num_bvh_reinserts,
+                scene->update_timings[e_update_stage::bvh]);
+    ImGui::Text("Occluded: %i (%2.2f ms)", scene->num_occluded, scene->occlusion_ms);
+    ImGui::Text("View Cull Sweeps: %i", scene->num_view_cull_sweeps);
+    ImGui::Text("Draws: %i", scene->num_draws);
+    ImGui::Text("Draw Calls: %i (%i auto instanced)", scene->num_draw_calls, scene->num_auto_instances);
+    ImGui::Text("State Changes (entity order): %i", scene->num_state_changes_unsorted);
+    ImGui::Text("State Changes (sorted): %i", scene->num_state_changes);
+
+    // per system update cost
+    static const c8* k_stage_names[] = {"Hierarchy", "Transforms", "Parent Extents", "BVH", "Component Lists",
+                                        "Animation", "Lights", "SDF Shadow", "Bone Palettes", "Pre Skin", "Instances",
+                                        "Streaming"};
+    static_assert(PEN_ARRAY_SIZE(k_stage_names) == e_update_stage::COUNT, "mismatched elements");
+
+    if (ImGui::CollapsingHeader("Update Timings"))
+        for (u32 i = 0; i < e_update_stage::COUNT; ++i)
+            ImGui::Text("%s: %2.3f ms", k_stage_names[i], scene->update_timings[i]);
+
+    ImGui::End();
 }
@@ -0,0 +1,1027 @@
+// ecs_bench.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Headless benchmark suite for the ecs hot paths, built on catch. Each test case builds a synthetic scene, checks the
+// systems agree with each other and times them. Timings are written as one json object per line to stdout and to the
+// --results file so runs of different versions can be compared.
+//
+// ecs_bench --roots 5000 --fanout 4 --depth 3 --iterations 32 --label v1 --results bench.jsonl "[cull]"
+//
+// any catch option or test spec can be passed along with the scene options.
+
+#define CATCH_CONFIG_RUNNER
+#include "catch/catch.hpp"
+
+#include "camera.h"
+#include "ecs/ecs_anim.h"
+#include "ecs/ecs_cull.h"
+#include "ecs/ecs_resources.h"
+#include "ecs/ecs_scene.h"
+#include "ecs/ecs_utilities.h"
+
+#include "data_struct.h"
+#include "file_system.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "pen_string.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "str/Str.h"
+
+#include "../bench_common.h"
+
+#include <stdio.h>
+
+using namespace pen;
+using namespace put;
+
+static Str* s_args = nullptr;
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        for (u32 i = 0; i < argc; ++i)
+            sb_push(s_args, argv[i]);
+
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "ecs_bench";
+        p.window_sample_count = 1;
+        p.user_thread_function = user_entry;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    struct bench_config
+    {
+        u32         num_roots = 100000;
+        u32         fanout = 1;
+        u32         depth = 1;
+        u32         iterations = 16;
+        u32         num_lights = 64;
+        u32         num_rigs = 1000;
+        u32         num_joints = 32;
+        std::string label = "";
+        std::string results = "";
+    };
+
+    bench_config s_config;
+    FILE*        s_results_file = nullptr;
+    pen::timer*  s_timer = nullptr;
+
+    // one json object per line, the scene and machine setup is repeated on each line so results from many runs can be
+    // concatenated and compared by a script.
+    void bench_result(const c8* suite, const c8* name, u32 count, const f64* ms, u32 num_ms)
+    {
+        if (num_ms == 0)
+            return;
+
+        f64* sorted = nullptr;
+        f64  total = 0.0;
+        for (u32 i = 0; i < num_ms; ++i)
+        {
+            sb_push(sorted, ms[i]);
+            total += ms[i];
+        }
+
+        std::sort(sorted, sorted + num_ms);
+
+        c8 line[1024];
+        snprintf(line, sizeof(line),
+                 "{\"label\": \"%s\", \"suite\": \"%s\", \"case\": \"%s\", \"count\": %u, \"roots\": %u, \"fanout\": %u, "
+                 "\"depth\": %u, \"iterations\": %u, \"workers\": %u, \"scene_version\": %u, \"mean_ms\": %.4f, "
+                 "\"median_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f}",
+                 s_config.label.c_str(), suite, name, count, s_config.num_roots, s_config.fanout, s_config.depth, num_ms,
+                 pen::jobs_get_num_workers(), ecs::ecs_scene::k_version, total / num_ms, sorted[num_ms / 2], sorted[0],
+                 sorted[num_ms - 1]);
+
+        printf("%s\n", line);
+
+        if (s_results_file)
+        {
+            fprintf(s_results_file, "%s\n", line);
+            fflush(s_results_file);
+        }
+
+        sb_free(sorted);
+    }
+
+    // memory results are written in the same way with bytes in place of timings
+    void bench_memory(const c8* suite, const c8* name, u32 count, size_t bytes)
+    {
+        c8 line[1024];
+        snprintf(line, sizeof(line),
+                 "{\"label\": \"%s\", \"suite\": \"%s\", \"case\": \"%s\", \"count\": %u, \"scene_version\": %u, "
+                 "\"bytes\": %llu}",
+                 s_config.label.c_str(), suite, name, count, ecs::ecs_scene::k_version, (unsigned long long)bytes);
+
+        printf("%s\n", line);
+
+        if (s_results_file)
+        {
+            fprintf(s_results_file, "%s\n", line);
+            fflush(s_results_file);
+        }
+    }
+
+    // runs func once to warm up then records the wall time of each of the configured iterations
+    template <typename T>
+    void bench_time(const c8* suite, const c8* name, u32 count, T func)
+    {
+        f64* ms = nullptr;
+
+        func();
+
+        for (u32 it = 0; it < s_config.iterations; ++it)
+        {
+            pen::timer_start(s_timer);
+            func();
+            sb_push(ms, pen::timer_elapsed_ms(s_timer));
+        }
+
+        bench_result(suite, name, count, ms, sb_count(ms));
+        sb_free(ms);
+    }
+
+    ecs::ecs_scene* create_config_scene()
+    {
+        return create_bench_scene({s_config.num_roots, s_config.fanout, s_config.depth});
+    }
+
+    // every k-th node becomes a point light so the light list and packing have members at any scene size
+    void add_config_lights(ecs::ecs_scene* scene)
+    {
+        u32 stride = std::max<u32>(scene->num_entities / std::max<u32>(s_config.num_lights, 1), 1);
+        for (u32 n = 0; n < scene->num_entities; n += stride)
+        {
+            scene->lights[n].type = ecs::e_light_type::point;
+            scene->lights[n].colour = vec3f::one();
+            scene->lights[n].radius = 7.0f;
+            scene->entities[n] |= ecs::e_cmp::light;
+        }
+    }
+
+    // looking into the grid from outside so part of it is visible, like benchmarks cull
+    void create_config_camera(const ecs::ecs_scene* scene, camera& cam)
+    {
+        vec3f ext = vec3f::zero();
+        for (u32 n = 0; n < scene->num_entities; ++n)
+            ext = max_union(ext, scene->pos_extent[n].pos.xyz);
+
+        camera_create_perspective(&cam, 60.0f, 16.0f / 9.0f, 0.1f, mag(ext) * 2.0f + 10.0f);
+        cam.focus = ext * 0.5f;
+        cam.rot = vec2f(-0.4f, 0.6f);
+        cam.zoom = mag(ext) * 1.2f + 10.0f;
+        camera_update_look_at(&cam);
+        camera_update_frustum(&cam);
+    }
+
+    bool bench_identical(const u32* a, const u32* b)
+    {
+        u32 count = sb_count(a);
+        return count == sb_count(b) && (count == 0 || memcmp(a, b, count * sizeof(u32)) == 0);
+    }
+} // namespace
+
+// the cpu stages of update_scene, the rest of update_scene uploads to the gpu and needs a renderer
+
+TEST_CASE("update_scene stages", "[update]")
+{
+    static const ecs::e_update_stage::update_stage_t k_transform_stages[] = {
+        ecs::e_update_stage::hierarchy, ecs::e_update_stage::transforms, ecs::e_update_stage::parent_extents};
+
+    static const c8* k_transform_stage_names[] = {"hierarchy", "transforms", "parent_extents"};
+
+    ecs::ecs_scene* scene = create_config_scene();
+    u32             num_entities = scene->num_entities;
+    add_config_lights(scene);
+
+    // dirty every transform for the worst case, the stages time themselves
+    f64* timings[PEN_ARRAY_SIZE(k_transform_stages)] = {0};
+    ecs::update_scene_transforms(scene);
+
+    for (u32 it = 0; it < s_config.iterations; ++it)
+    {
+        for (u32 n = 0; n < num_entities; ++n)
+            scene->entities[n] |= ecs::e_cmp::transform;
+
+        ecs::update_scene_transforms(scene);
+
+        for (u32 s = 0; s < PEN_ARRAY_SIZE(k_transform_stages); ++s)
+            sb_push(timings[s], scene->update_timings[k_transform_stages[s]]);
+    }
+
+    REQUIRE(scene->num_world_matrix_updates > 0);
+    REQUIRE(scene->num_hierarchy_levels == (s_config.fanout > 0 ? s_config.depth : 1));
+
+    for (u32 s = 0; s < PEN_ARRAY_SIZE(k_transform_stages); ++s)
+    {
+        bench_result("update_scene", k_transform_stage_names[s], num_entities, timings[s], sb_count(timings[s]));
+        sb_free(timings[s]);
+    }
+
+    // nothing dirty, only the hierarchy and extents are touched
+    bench_time("update_scene", "transforms_static", num_entities, [&]() {
+        pen::memory_zero(scene->dirty_flags.data, num_entities * sizeof(u32));
+        ecs::update_scene_transforms(scene);
+    });
+
+    bench_time("update_scene", "component_lists", num_entities, [&]() { ecs::update_component_lists(scene); });
+
+    u32* scanned = nullptr;
+    for (u32 n = 0; n < num_entities; ++n)
+        if (scene->entities[n] & ecs::e_cmp::light)
+            sb_push(scanned, n);
+
+    REQUIRE(bench_identical(scene->cmp_lists.list[ecs::e_cmp_list::light], scanned));
+    sb_free(scanned);
+
+    bench_time("update_scene", "lights", sb_count(scene->cmp_lists.list[ecs::e_cmp_list::light]),
+               [&]() { ecs::update_lights(scene); });
+
+    // the tree is refit after every node moves, rebuilds are the first call
+    bench_time("update_scene", "bvh", num_entities, [&]() {
+        for (u32 n = 0; n < num_entities; ++n)
+            if (scene->parents[n] == n)
+                scene->transforms[n].translation.y += 0.5f;
+
+        for (u32 n = 0; n < num_entities; ++n)
+            scene->entities[n] |= ecs::e_cmp::transform;
+
+        ecs::update_scene_transforms(scene);
+        ecs::update_bvh(scene);
+    });
+
+    REQUIRE(scene->bvh.num_leaves == num_entities);
+
+    destroy_bench_scene(scene);
+}
+
+// the cpu stages of update_scene in the order it runs them, a static light must stay clean from one update to the next
+// and a new radius must reach its world matrix in the same update
+
+TEST_CASE("static lights", "[update]")
+{
+    ecs::ecs_scene* scene = create_bench_scene({64, 1, 1});
+    add_config_lights(scene);
+
+    u32 spot = scene->num_entities - 1;
+    scene->lights[spot].type = ecs::e_light_type::spot;
+    scene->lights[spot].radius = 10.0f;
+    scene->lights[spot].cos_cutoff = 0.2f;
+    scene->entities[spot] |= ecs::e_cmp::light;
+
+    auto update = [&]() {
+        ecs::update_component_lists(scene);
+        ecs::update_light_volumes(scene);
+        ecs::update_scene_transforms(scene);
+        ecs::update_lights(scene);
+    };
+
+    update();
+    update();
+
+    const u32* lights = scene->cmp_lists.list[ecs::e_cmp_list::light];
+    u32        num_lights = sb_count(lights);
+    REQUIRE(num_lights > 1);
+
+    // the second update has nothing to do, no light was marked for the next one either
+    CHECK(scene->num_world_matrix_updates == 0);
+    for (u32 i = 0; i < num_lights; ++i)
+        CHECK((scene->entities[lights[i]] & ecs::e_cmp::transform) == 0);
+
+    u32 n = lights[0];
+    scene->lights[n].radius = 12.0f;
+    update();
+
+    CHECK(scene->num_world_matrix_updates == 1);
+    CHECK(fabs(mag(scene->world_matrices[n].get_column(0).xyz) - 24.0f) < 1e-3f);
+
+    destroy_bench_scene(scene);
+}
+
+// culling from the entity list of the scene, every variant and simd level must give the same entities
+
+TEST_CASE("culling", "[cull]")
+{
+    ecs::ecs_scene* scene = create_config_scene();
+    u32             num_entities = scene->num_entities;
+
+    // filter_entities_scalar passes renderables with a material
+    for (u32 n = 0; n < num_entities; ++n)
+        scene->entities[n] |= ecs::e_cmp::material;
+
+    ecs::update_scene_transforms(scene);
+    ecs::update_bvh(scene);
+
+    camera cam;
+    create_config_camera(scene, cam);
+
+    u32* filtered = nullptr;
+    bench_time("cull", "filter_entities_scalar", num_entities, [&]() {
+        if (filtered)
+            stb__sbn(filtered) = 0;
+
+        ecs::filter_entities_scalar(scene, &filtered);
+    });
+
+    REQUIRE(sb_count(filtered) == num_entities);
+
+    u32* reference[2] = {nullptr, nullptr};
+    u32* culled = nullptr;
+
+    auto cull_list = [&](u32** list) {
+        if (*list)
+            stb__sbn(*list) = 0;
+        return list;
+    };
+
+    bench_time("cull", "frustum_cull_aabb_scalar", num_entities,
+               [&]() { ecs::frustum_cull_aabb_scalar(scene, &cam, filtered, cull_list(&reference[0])); });
+
+    bench_time("cull", "frustum_cull_sphere_scalar", num_entities,
+               [&]() { ecs::frustum_cull_sphere_scalar(scene, &cam, filtered, cull_list(&reference[1])); });
+
+    REQUIRE(sb_count(reference[0]) > 0);
+    REQUIRE(sb_count(reference[0]) < num_entities);
+
+    ecs::simd_level default_level = ecs::get_simd_level();
+
+    for (u32 l = 0; l < ecs::e_simd::COUNT; ++l)
+    {
+        ecs::simd_level level = (ecs::simd_level)l;
+        if (!ecs::set_simd_level(level))
+            continue;
+
+        const c8* level_name = ecs::get_simd_level_name(level);
+
+        Str name;
+        name.setf("frustum_cull_aabb/%s", level_name);
+        bench_time("cull", name.c_str(), num_entities,
+                   [&]() { ecs::frustum_cull_aabb(scene, &cam, filtered, cull_list(&culled)); });
+
+        CHECK(bench_identical(culled, reference[0]));
+
+        name.setf("frustum_cull_sphere/%s", level_name);
+        bench_time("cull", name.c_str(), num_entities,
+                   [&]() { ecs::frustum_cull_sphere(scene, &cam, filtered, cull_list(&culled)); });
+
+        CHECK(bench_identical(culled, reference[1]));
+
+        name.setf("frustum_cull_aabb_count/%s", level_name);
+        bench_time("cull", name.c_str(), num_entities,
+                   [&]() { ecs::frustum_cull_aabb(scene, &cam, filtered, num_entities, cull_list(&culled)); });
+
+        CHECK(bench_identical(culled, reference[0]));
+
+        name.setf("frustum_cull_sphere_count/%s", level_name);
+        bench_time("cull", name.c_str(), num_entities,
+                   [&]() { ecs::frustum_cull_sphere(scene, &cam, filtered, num_entities, cull_list(&culled)); });
+
+        CHECK(bench_identical(culled, reference[1]));
+
+        name.setf("frustum_cull_aabb_planes/%s", level_name);
+        bench_time("cull", name.c_str(), num_entities, [&]() {
+            ecs::frustum_cull_aabb(scene, cam.camera_frustum, filtered, num_entities, cull_list(&culled));
+        });
+
+        CHECK(bench_identical(culled, reference[0]));
+
+        // the main camera and a second view in one sweep
+        camera side = cam;
+        side.rot.y += 1.0f;
+        camera_update_look_at(&side);
+        camera_update_frustum(&side);
+
+        frustum frusta[2] = {cam.camera_frustum, side.camera_frustum};
+        u64*    masks = nullptr;
+        sb_add(masks, num_entities);
+
+        name.setf("frustum_cull_aabb_multi/%s", level_name);
+        bench_time("cull", name.c_str(), num_entities,
+                   [&]() { ecs::frustum_cull_aabb_multi(scene, frusta, 2, filtered, num_entities, masks); });
+
+        ecs::gather_visible_entities(filtered, masks, num_entities, 1, cull_list(&culled));
+        CHECK(bench_identical(culled, reference[0]));
+
+        u32* side_culled = nullptr;
+        ecs::frustum_cull_aabb(scene, &side, filtered, &side_culled);
+        ecs::gather_visible_entities(filtered, masks, num_entities, 2, cull_list(&culled));
+        CHECK(bench_identical(culled, side_culled));
+
+        sb_free(side_culled);
+        sb_free(masks);
+    }
+
+    ecs::set_simd_level(default_level);
+
+    // bvh returns tree order
+    bench_time("cull", "bvh_query_frustum", num_entities,
+               [&]() { ecs::bvh_query_frustum(scene, cam.camera_frustum, cull_list(&culled)); });
+
+    CHECK(bench_same_entities(culled, reference[0]));
+
+    sb_free(filtered);
+    sb_free(reference[0]);
+    sb_free(reference[1]);
+    sb_free(culled);
+    destroy_bench_scene(scene);
+}
+
+// geometry is stripped, loading a scene instantiates geometry from pmm files which need a renderer. nodes are named
+// from a pool of names, the stream format searches every lookup string for each name so unique names would make it
+// quadratic in the node count.
+
+TEST_CASE("save_scene load_scene", "[io]")
+{
+    static const c8* k_filename = "ecs_bench.pms";
+    static const c8* k_stream_filename = "ecs_bench_stream.pms";
+    static const u32 k_unique_names = 1024;
+
+    ecs::ecs_scene* scene = create_config_scene();
+    u32             num_entities = scene->num_entities;
+
+    for (u32 n = 0; n < num_entities; ++n)
+    {
+        scene->entities[n] &= ~ecs::e_cmp::geometry;
+        scene->names[n].setf("node_%u", n % k_unique_names);
+    }
+
+    ecs::update_scene_transforms(scene);
+
+    bench_time("io", "save_scene", num_entities, [&]() { ecs::save_scene(k_filename, scene); });
+    bench_time("io", "save_scene_stream", num_entities, [&]() { ecs::save_scene_stream(k_stream_filename, scene); });
+
+    const c8* files[] = {k_filename, k_stream_filename};
+    const c8* cases[] = {"scene_container", "scene_stream"};
+    for (u32 i = 0; i < 2; ++i)
+    {
+        const void* data = nullptr;
+        size_t      size = 0;
+        REQUIRE(pen::filesystem_map_file(files[i], &data, size) == PEN_ERR_OK);
+        bench_memory("io", cases[i], num_entities, size);
+        pen::filesystem_unmap_file(data, size);
+    }
+
+    ecs::ecs_scene* loaded = new ecs::ecs_scene();
+    ecs::resize_scene_buffers(loaded, 1);
+
+    const c8* load_cases[] = {"load_scene", "load_scene_stream"};
+    for (u32 i = 0; i < 2; ++i)
+    {
+        bench_time("io", load_cases[i], num_entities, [&]() { ecs::load_scene(files[i], loaded); });
+
+        REQUIRE(loaded->num_entities == scene->num_entities);
+        CHECK(memcmp(loaded->parents.data, scene->parents.data, num_entities * sizeof(u32)) == 0);
+        CHECK(memcmp(loaded->transforms.data, scene->transforms.data, num_entities * sizeof(ecs::cmp_transform)) == 0);
+
+        u32 mismatched_names = 0;
+        for (u32 n = 0; n < num_entities; ++n)
+            if (!(loaded->names[n] == scene->names[n].c_str()))
+                ++mismatched_names;
+
+        CHECK(mismatched_names == 0);
+    }
+
+    destroy_bench_scene(loaded);
+    destroy_bench_scene(scene);
+    remove(k_filename);
+    remove(k_stream_filename);
+}
+
+// a saved scene is streamed into a scene which already has entities while it keeps updating, each pump of the streams
+// and transform update is a frame. the streamed entities must match the saved ones and unloading gives them all back.
+
+namespace
+{
+    struct bench_stream
+    {
+        u32                     callbacks = 0;
+        ecs::scene_stream_state state = ecs::e_scene_stream_state::parsing;
+    };
+
+    void bench_stream_callback(ecs::ecs_scene* scene, u32 stream, ecs::scene_stream_state state, void* user_data)
+    {
+        bench_stream* bs = (bench_stream*)user_data;
+        bs->callbacks++;
+        bs->state = state;
+    }
+
+    // updates until the stream calls back or a minute has passed, returns the number of updates
+    u32 bench_stream_updates(ecs::ecs_scene* scene, bench_stream& bs, f64** frame_ms)
+    {
+        static const f64 k_timeout_ms = 60000.0;
+
+        u32 callbacks = bs.callbacks;
+        u32 frames = 0;
+        f64 start = pen::get_time_ms();
+        while (bs.callbacks == callbacks && pen::get_time_ms() - start < k_timeout_ms)
+        {
+            pen::timer_start(s_timer);
+            ecs::update_scene_streams(scene);
+            ecs::update_scene_transforms(scene);
+            sb_push(*frame_ms, pen::timer_elapsed_ms(s_timer));
+            ++frames;
+        }
+
+        return frames;
+    }
+} // namespace
+
+TEST_CASE("load_scene_async", "[io]")
+{
+    static const c8* k_filename = "ecs_bench_async.pms";
+    static const u32 k_unique_names = 1024;
+
+    ecs::ecs_scene* scene = create_config_scene();
+    u32             num_entities = scene->num_entities;
+
+    for (u32 n = 0; n < num_entities; ++n)
+    {
+        scene->entities[n] &= ~ecs::e_cmp::geometry;
+        scene->names[n].setf("node_%u", n % k_unique_names);
+    }
+
+    ecs::update_scene_transforms(scene);
+    ecs::save_scene(k_filename, scene);
+
+    ecs::ecs_scene* streamed = create_bench_scene({1, 1, 1});
+    u32             base = streamed->num_entities;
+
+    bench_stream bs;
+
+    ecs::scene_stream_params params;
+    params.callback = bench_stream_callback;
+    params.user_data = &bs;
+
+    // the mean is the cost of a frame while streaming and the max the worst hitch, compare with load_scene
+    f64* frame_ms = nullptr;
+    u32  stream = ecs::load_scene_async(k_filename, streamed, params);
+    u32  frames = bench_stream_updates(streamed, bs, &frame_ms);
+
+    bench_result("io", "load_scene_async/frame", num_entities, frame_ms, sb_count(frame_ms));
+    sb_free(frame_ms);
+    frame_ms = nullptr;
+
+    REQUIRE(bs.state == ecs::e_scene_stream_state::ready);
+    CHECK(bs.callbacks == 1);
+
+    // many chunks do not fit in one budget so the scene has to arrive over several frames
+    if (num_entities > params.chunk_size * 64)
+        CHECK(frames > 1);
+    CHECK(ecs::get_scene_stream_progress(stream) == 1.0f);
+
+    u32 start = 0;
+    u32 end = 0;
+    REQUIRE(ecs::get_scene_stream_entities(stream, start, end));
+    CHECK(start == base);
+    CHECK(end == base + num_entities);
+    REQUIRE(streamed->num_entities == base + num_entities);
+
+    u32 mismatched = 0;
+    for (u32 n = 0; n < num_entities; ++n)
+    {
+        u32 s = base + n;
+        if (streamed->parents[s] != scene->parents[n] + base || !(streamed->names[s] == scene->names[n].c_str()) ||
+            memcmp(&streamed->transforms[s], &scene->transforms[n], sizeof(ecs::cmp_transform)) != 0)
+            ++mismatched;
+    }
+
+    CHECK(mismatched == 0);
+
+    ecs::unload_scene_async(stream);
+    bench_stream_updates(streamed, bs, &frame_ms);
+
+    bench_result("io", "unload_scene_async/frame", num_entities, frame_ms, sb_count(frame_ms));
+    sb_free(frame_ms);
+    frame_ms = nullptr;
+
+    CHECK(bs.state == ecs::e_scene_stream_state::unloaded);
+    CHECK(bs.callbacks == 2);
+    CHECK(streamed->num_entities == base);
+    CHECK(ecs::get_scene_stream_state(stream) == ecs::e_scene_stream_state::unloaded);
+
+    // unloading a stream which is still loading cancels it
+    bench_stream cancelled;
+    params.user_data = &cancelled;
+
+    stream = ecs::load_scene_async(k_filename, streamed, params);
+    ecs::unload_scene_async(stream);
+    bench_stream_updates(streamed, cancelled, &frame_ms);
+    sb_free(frame_ms);
+
+    CHECK(cancelled.state == ecs::e_scene_stream_state::unloaded);
+    CHECK(cancelled.callbacks == 1);
+    CHECK(streamed->num_entities == base);
+
+    destroy_bench_scene(streamed);
+    destroy_bench_scene(scene);
+    remove(k_filename);
+}
+
+// rigs of num_joints chained bones each playing the same looping clip with a key on every frame
+
+TEST_CASE("animation sampling", "[anim]")
+{
+    static const u32 k_frames = 60;
+
+    bench_anim anim;
+    create_bench_anim(anim, s_config.num_joints, k_frames);
+
+    ecs::ecs_scene* scene = create_bench_scene({1, 1, 1});
+    add_bench_rigs(scene, anim, s_config.num_rigs, s_config.num_joints);
+
+    ecs::update_component_lists(scene);
+    REQUIRE(sb_count(scene->cmp_lists.list[ecs::e_cmp_list::anim_controller]) == s_config.num_rigs);
+
+    u32 num_joints = s_config.num_rigs * s_config.num_joints;
+    bench_time("anim", "update_animations", num_joints, [&]() { ecs::update_animations(scene, 1.0f / 60.0f); });
+
+    // joints follow the clip, every translation key is above the bind pose offset of 1 - 0.1
+    u32 first_joint = 2;
+    CHECK(scene->transforms[first_joint].translation.y > 0.89f);
+
+    bench_time("anim", "update_animations_and_transforms", num_joints, [&]() {
+        ecs::update_animations(scene, 1.0f / 60.0f);
+        ecs::update_scene_transforms(scene);
+    });
+
+    free_bench_rigs(scene);
+    destroy_bench_scene(scene);
+
+    // each level samples fresh rigs for the same number of updates and must leave every joint where scalar does, the
+    // count is rigs so mean_ms / count is the cost per instance
+    ecs::simd_level     default_level = ecs::get_simd_level();
+    ecs::cmp_transform* reference = nullptr;
+
+    for (u32 l = 0; l < ecs::e_simd::COUNT; ++l)
+    {
+        ecs::simd_level level = (ecs::simd_level)l;
+        if (!ecs::set_simd_level(level))
+            continue;
+
+        ecs::ecs_scene* level_scene = create_bench_scene({1, 1, 1});
+        add_bench_rigs(level_scene, anim, s_config.num_rigs, s_config.num_joints);
+        ecs::update_component_lists(level_scene);
+
+        Str name;
+        name.setf("update_animations/%s", ecs::get_simd_level_name(level));
+        bench_time("anim", name.c_str(), s_config.num_rigs,
+                   [&]() { ecs::update_animations(level_scene, 1.0f / 60.0f); });
+
+        if (!reference)
+            for (u32 n = 0; n < level_scene->num_entities; ++n)
+                sb_push(reference, level_scene->transforms[n]);
+
+        size_t size = sb_count(reference) * sizeof(ecs::cmp_transform);
+        CHECK(memcmp(reference, &level_scene->transforms[0], size) == 0);
+
+        free_bench_rigs(level_scene);
+        destroy_bench_scene(level_scene);
+    }
+
+    ecs::set_simd_level(default_level);
+
+    sb_free(reference);
+    free_bench_anim(anim);
+}
+
+// slerp_keys approximates slerp, at every simd level it must stay within 1e-3 radians of an exact double precision
+// slerp for keys at any angle apart. keys close to 180 degrees apart have no shortest path and are skipped.
+
+TEST_CASE("slerp_keys error", "[anim]")
+{
+    static const u32 k_count = 4099; // not a multiple of the simd width so the scalar tail runs too
+
+    f32* a = new f32[k_count * 4];
+    f32* b = new f32[k_count * 4];
+    f32* t = new f32[k_count];
+    f32* out = new f32[k_count * 4];
+    f64* ref = new f64[k_count * 4];
+
+    // the first keys sweep the angle between them up to 180 degrees, the rest are random
+    u32 seed = 1;
+    for (u32 i = 0; i < k_count; ++i)
+    {
+        f64 qa[4];
+        f64 qb[4];
+        if (i < 360)
+        {
+            f64 half = (f64)(i / 2) * M_PI / 360.0;
+            qa[0] = 0.0, qa[1] = 0.0, qa[2] = 0.0, qa[3] = 1.0;
+            qb[0] = sin(half), qb[1] = 0.0, qb[2] = 0.0, qb[3] = (i & 1) ? -cos(half) : cos(half);
+        }
+        else
+        {
+            f64 la = 0.0;
+            f64 lb = 0.0;
+            for (u32 j = 0; j < 4; ++j)
+            {
+                seed = seed * 1664525 + 1013904223;
+                qa[j] = (f64)(seed >> 8) / (f64)(1 << 24) * 2.0 - 1.0;
+                seed = seed * 1664525 + 1013904223;
+                qb[j] = (f64)(seed >> 8) / (f64)(1 << 24) * 2.0 - 1.0;
+                la += qa[j] * qa[j];
+                lb += qb[j] * qb[j];
+            }
+
+            for (u32 j = 0; j < 4; ++j)
+            {
+                qa[j] /= sqrt(la);
+                qb[j] /= sqrt(lb);
+            }
+        }
+
+        seed = seed * 1664525 + 1013904223;
+        t[i] = (f32)(seed >> 8) / (f32)(1 << 24);
+
+        for (u32 j = 0; j < 4; ++j)
+        {
+            a[i + j * k_count] = (f32)qa[j];
+            b[i + j * k_count] = (f32)qb[j];
+        }
+
+        // the reference slerps the keys as rounded to f32 so only the approximation is measured
+        f64 d = 0.0;
+        for (u32 j = 0; j < 4; ++j)
+        {
+            qa[j] = a[i + j * k_count];
+            qb[j] = b[i + j * k_count];
+            d += qa[j] * qb[j];
+        }
+
+        // no shortest path, either way round is a valid result so only the end key is checked
+        if (fabs(d) < 1e-3)
+            t[i] = 0.0f;
+
+        f64 sign = d < 0.0 ? -1.0 : 1.0;
+        f64 theta = acos(std::min<f64>(d * sign, 1.0));
+        f64 wa = 1.0 - t[i];
+        f64 wb = t[i];
+        if (theta > 1e-6)
+        {
+            wa = sin((1.0 - t[i]) * theta) / sin(theta);
+            wb = sin(t[i] * theta) / sin(theta);
+        }
+
+        f64 l = 0.0;
+        for (u32 j = 0; j < 4; ++j)
+        {
+            ref[i + j * k_count] = qa[j] * wa + qb[j] * sign * wb;
+            l += ref[i + j * k_count] * ref[i + j * k_count];
+        }
+
+        for (u32 j = 0; j < 4; ++j)
+            ref[i + j * k_count] /= sqrt(l);
+    }
+
+    ecs::simd_level default_level = ecs::get_simd_level();
+
+    for (u32 l = 0; l < ecs::e_simd::COUNT; ++l)
+    {
+        ecs::simd_level level = (ecs::simd_level)l;
+        if (!ecs::set_simd_level(level))
+            continue;
+
+        Str name;
+        name.setf("slerp_keys/%s", ecs::get_simd_level_name(level));
+        bench_time("anim", name.c_str(), k_count, [&]() { ecs::slerp_keys(a, b, t, out, k_count, k_count); });
+
+        // angle from the chord between the rotations, acos of the dot product is too coarse for small angles
+        f64 max_error = 0.0;
+        for (u32 i = 0; i < k_count; ++i)
+        {
+            f64 chord_pos = 0.0;
+            f64 chord_neg = 0.0;
+            for (u32 j = 0; j < 4; ++j)
+            {
+                f64 o = out[i + j * k_count];
+                f64 r = ref[i + j * k_count];
+                chord_pos += (o - r) * (o - r);
+                chord_neg += (o + r) * (o + r);
+            }
+
+            f64 chord = sqrt(std::min<f64>(chord_pos, chord_neg));
+            max_error = std::max<f64>(max_error, 4.0 * asin(std::min<f64>(chord * 0.5, 1.0)));
+        }
+
+        INFO(ecs::get_simd_level_name(level) << " max error " << max_error << " radians");
+        CHECK(max_error < 1e-3);
+    }
+
+    ecs::set_simd_level(default_level);
+
+    delete[] a;
+    delete[] b;
+    delete[] t;
+    delete[] out;
+    delete[] ref;
+}
+
+// the same clip compressed offline, memory of both formats is reported and rigs sampling either must pose their joints
+// within the error tolerance of each other
+
+TEST_CASE("compressed clips", "[anim]")
+{
+    static const u32 k_frames = 60;
+    static const u32 k_updates = 40;
+
+    bench_anim anim;
+    create_bench_anim(anim, s_config.num_joints, k_frames);
+
+    ecs::anim_compress_params params;
+    ecs::anim_clip            clip;
+    ecs::compress_anim_clip(anim.soa, anim.length, params, clip);
+
+    // translate x and z never move so each channel has a constant, an animated and a quaternion track
+    CHECK(clip.num_tracks == anim.soa.num_channels * 3);
+
+    size_t soa_bytes = ecs::get_anim_memory(anim.soa);
+    size_t clip_bytes = ecs::get_anim_memory(clip);
+    bench_memory("anim", "soa_anim", anim.soa.num_channels, soa_bytes);
+    bench_memory("anim", "anim_clip", clip.num_channels, clip_bytes);
+    CHECK(clip_bytes * 2 < soa_bytes);
+
+    ecs::ecs_scene* soa_scene = create_bench_scene({1, 1, 1});
+    add_bench_rigs(soa_scene, anim, s_config.num_rigs, s_config.num_joints);
+    ecs::update_component_lists(soa_scene);
+
+    ecs::ecs_scene* clip_scene = create_bench_scene({1, 1, 1});
+    add_bench_rigs(clip_scene, anim, s_config.num_rigs, s_config.num_joints, &clip);
+    ecs::update_component_lists(clip_scene);
+
+    // less than one loop so both sample the same times between keys
+    f32 max_translation_error = 0.0f;
+    f32 max_rotation_error = 0.0f;
+    for (u32 i = 0; i < k_updates; ++i)
+    {
+        ecs::update_animations(soa_scene, 1.0f / 60.0f);
+        ecs::update_animations(clip_scene, 1.0f / 60.0f);
+
+        for (u32 n = 0; n < soa_scene->num_entities; ++n)
+        {
+            if (!(soa_scene->entities[n] & ecs::e_cmp::bone))
+                continue;
+
+            const ecs::cmp_transform& a = soa_scene->transforms[n];
+            const ecs::cmp_transform& b = clip_scene->transforms[n];
+            max_translation_error = std::max<f32>(max_translation_error, mag(a.translation - b.translation));
+
+            // angle from the chord between the rotations, acos of the dot product is too coarse for small angles
+            f32 d = 0.0f;
+            for (u32 j = 0; j < 4; ++j)
+                d += a.rotation.v[j] * b.rotation.v[j];
+
+            f32 chord = 0.0f;
+            for (u32 j = 0; j < 4; ++j)
+            {
+                f32 c = a.rotation.v[j] - (d < 0.0f ? -b.rotation.v[j] : b.rotation.v[j]);
+                chord += c * c;
+            }
+
+            f32 angle = 4.0f * asinf(std::min<f32>(sqrtf(chord) * 0.5f, 1.0f));
+            max_rotation_error = std::max<f32>(max_rotation_error, angle);
+        }
+    }
+
+    // tolerance is measured at the source keys, between them both formats interpolate with their own error
+    CHECK(max_translation_error < params.translation_error * 4.0f);
+    CHECK(max_rotation_error < params.rotation_error * 4.0f + 1e-3f);
+
+    bench_time("anim", "update_animations/soa_anim", s_config.num_rigs,
+               [&]() { ecs::update_animations(soa_scene, 1.0f / 60.0f); });
+
+    bench_time("anim", "update_animations/anim_clip", s_config.num_rigs,
+               [&]() { ecs::update_animations(clip_scene, 1.0f / 60.0f); });
+
+    free_bench_rigs(soa_scene);
+    destroy_bench_scene(soa_scene);
+    free_bench_rigs(clip_scene);
+    destroy_bench_scene(clip_scene);
+
+    ecs::free_anim_clip(clip);
+    free_bench_anim(anim);
+}
+
+// the same rigs skinned with an identity bind pose so each palette matrix is the world matrix of its joint
+
+TEST_CASE("bone palettes", "[anim]")
+{
+    static const u32 k_frames = 60;
+
+    bench_anim anim;
+    create_bench_anim(anim, s_config.num_joints, k_frames);
+
+    ecs::cmp_skin skin;
+    skin.num_joints = s_config.num_joints;
+    skin.bind_shape_matrix = mat4::create_identity();
+    skin.joint_bind_matrices = new mat4[s_config.num_joints];
+    for (u32 j = 0; j < s_config.num_joints; ++j)
+        skin.joint_bind_matrices[j] = mat4::create_identity();
+
+    ecs::ecs_scene* scene = create_bench_scene({1, 1, 1});
+    add_bench_rigs(scene, anim, s_config.num_rigs, s_config.num_joints);
+
+    for (u32 n = 0; n < scene->num_entities; ++n)
+    {
+        if (!(scene->entities[n] & ecs::e_cmp::anim_controller))
+            continue;
+
+        scene->geometries[n].p_skin = &skin;
+        scene->entities[n] |= ecs::e_cmp::skinned;
+    }
+
+    ecs::update_component_lists(scene);
+    ecs::update_animations(scene, 1.0f / 60.0f);
+    ecs::update_scene_transforms(scene);
+    ecs::update_bone_palettes(scene);
+
+    const ecs::bone_palette_set& bp = scene->bone_palettes;
+    REQUIRE(bp.num_rigs == s_config.num_rigs);
+    REQUIRE(bp.count == s_config.num_rigs * s_config.num_joints);
+    CHECK(scene->num_palette_builds == s_config.num_rigs);
+
+    for (u32 r = 0; r < bp.num_rigs; ++r)
+    {
+        const ecs::cmp_anim_controller_v2& controller = scene->anim_controller_v2[bp.rigs[r]];
+        const mat4*                        joints = &scene->world_matrices[controller.joints_offset];
+        CHECK(memcmp(&bp.matrices[controller.bone_offset], joints, s_config.num_joints * sizeof(mat4)) == 0);
+        CHECK((scene->dirty_flags[bp.rigs[r]] & ecs::e_dirty::bone_palette));
+    }
+
+    // dirty flags are not cleared outside of update_scene so every rig is rebuilt each time
+    bench_time("anim", "update_bone_palettes", s_config.num_rigs, [&]() { ecs::update_bone_palettes(scene); });
+
+    // rigs which did not move keep their palette
+    pen::memory_zero(scene->dirty_flags.data, scene->num_entities * sizeof(u32));
+    ecs::update_bone_palettes(scene);
+    CHECK(scene->num_palette_builds == 0);
+
+    // so skinned shadow casters which did not deform are not re-rendered
+    for (u32 r = 0; r < bp.num_rigs; ++r)
+        CHECK(!(scene->dirty_flags[bp.rigs[r]] & ecs::e_dirty::bone_palette));
+
+    free_bench_rigs(scene);
+    destroy_bench_scene(scene);
+
+    delete[] skin.joint_bind_matrices;
+    free_bench_anim(anim);
+}
+
+void* pen::user_entry(void* params)
+{
+    pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+    pen::job*               p_thread_info = job_params->job_info;
+    pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+    pen::jobs_create_workers();
+    s_timer = pen::timer_create();
+
+    u32    argc = sb_count(s_args);
+    c8**   argv = nullptr;
+    for (u32 i = 0; i < argc; ++i)
+        sb_push(argv, (c8*)s_args[i].c_str());
+
+    using namespace Catch::clara;
+
+    Catch::Session session;
+    auto cli = session.cli() | Opt(s_config.num_roots, "roots")["--roots"]("number of root nodes in the scene") |
+               Opt(s_config.fanout, "fanout")["--fanout"]("children per node") |
+               Opt(s_config.depth, "depth")["--depth"]("levels of hierarchy") |
+               Opt(s_config.iterations, "iterations")["--iterations"]("timed runs of each case") |
+               Opt(s_config.num_lights, "lights")["--lights"]("point lights in the update scene") |
+               Opt(s_config.num_rigs, "rigs")["--rigs"]("animated rigs") |
+               Opt(s_config.num_joints, "joints")["--joints"]("joints per rig") |
+               Opt(s_config.label, "label")["--label"]("written with each result to tell versions apart") |
+               Opt(s_config.results, "file")["--results"]("appends json lines to file");
+
+    session.cli(cli);
+
+    int result = session.applyCommandLine(argc, argv);
+    if (result == 0)
+    {
+        if (!s_config.results.empty())
+            s_results_file = fopen(s_config.results.c_str(), "a");
+
+        result = session.run();
+
+        if (s_results_file)
+            fclose(s_results_file);
+    }
+
+    sb_free(argv);
+    pen::timer_destroy(s_timer);
+
+    pen::os_terminate(result);
+    pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+
+    return PEN_THREAD_OK;
+}
@@ -360,6 +360,7 @@ void test_ray_vs_aabb(ecs_scene* scene, bool initialise)
         dbg::add_point(ip, 0.5f, vec4f::white());
 
     scene->draw_call_data[aabb.node].v2 = col;
+    scene->dirty_flags[aabb.node] |= e_dirty::draw_call;
 }
 
 void test_ray_vs_obb(ecs_scene* scene, bool initialise)
@@ -438,6 +439,7 @@ void test_ray_vs_obb(ecs_scene* scene, bool initialise)
         dbg::add_point(ip, 0.5f, vec4f::white());
 
     scene->draw_call_data[obb.node].v2 = col;
+    scene->dirty_flags[obb.node] |= e_dirty::draw_call;
 }
 
 void test_point_plane_distance(ecs_scene* scene, bool initialise)
@@ -531,6 +533,7 @@ void test_sphere_vs_plane(ecs_scene* scene, bool initialise)
     ImGui::Text("Classification %s", classifications[c]);
 
     scene->draw_call_data[sphere.node].v2 = vec4f(classification_colours[c]);
+    scene->dirty_flags[sphere.node] |= e_dirty::draw_call;
 
     dbg::add_plane(plane.point, plane.normal);
 }
@@ -765,7 +768,9 @@ void test_sphere_vs_sphere(ecs_scene* scene, bool initialise)
         col = vec4f::red();
 
     scene->draw_call_data[sphere0.node].v2 = vec4f(col);
+    scene->dirty_flags[sphere0.node] |= e_dirty::draw_call;
     scene->draw_call_data[sphere1.node].v2 = vec4f(col);
+    scene->dirty_flags[sphere1.node] |= e_dirty::draw_call;
 }
 
 void test_sphere_vs_aabb(ecs_scene* scene, bool initialise)
@@ -795,7 +800,9 @@ void test_sphere_vs_aabb(ecs_scene* scene, bool initialise)
         col = vec4f::red();
 
     scene->draw_call_data[sphere.node].v2 = vec4f(col);
+    scene->dirty_flags[sphere.node] |= e_dirty::draw_call;
     scene->draw_call_data[aabb.node].v2 = vec4f(col);
+    scene->dirty_flags[aabb.node] |= e_dirty::draw_call;
 }
 
 void test_aabb_vs_aabb(ecs_scene* scene, bool initialise)
@@ -825,7 +832,9 @@ void test_aabb_vs_aabb(ecs_scene* scene, bool initialise)
         col = vec4f::red();
 
     scene->draw_call_data[aabb0.node].v2 = vec4f(col);
+    scene->dirty_flags[aabb0.node] |= e_dirty::draw_call;
     scene->draw_call_data[aabb1.node].v2 = vec4f(col);
+    scene->dirty_flags[aabb1.node] |= e_dirty::draw_call;
 }
 
 void test_sphere_vs_frustum(ecs_scene* scene, bool initialise)
@@ -870,6 +879,7 @@ void test_sphere_vs_frustum(ecs_scene* scene, bool initialise)
         col = vec4f::red();
 
     scene->draw_call_data[sphere.node].v2 = vec4f(col);
+    scene->dirty_flags[sphere.node] |= e_dirty::draw_call;
 }
 
 void test_aabb_vs_frustum(ecs_scene* scene, bool initialise)
@@ -919,6 +929,7 @@ void test_aabb_vs_frustum(ecs_scene* scene, bool initialise)
         col = vec4f::red();
 
     scene->draw_call_data[aabb0.node].v2 = vec4f(col);
+    scene->dirty_flags[aabb0.node] |= e_dirty::draw_call;
 }
 
 void test_point_sphere(ecs_scene* scene, bool initialise)
@@ -955,6 +966,7 @@ void test_point_sphere(ecs_scene* scene, bool initialise)
     dbg::add_point(point.point, 0.4f, col);
 
     scene->draw_call_data[sphere.node].v2 = vec4f(col);
+    scene->dirty_flags[sphere.node] |= e_dirty::draw_call;
 }
 
 void test_point_cone(ecs_scene* scene, bool initialise)
@@ -992,6 +1004,7 @@ void test_point_cone(ecs_scene* scene, bool initialise)
     dbg::add_point(point.point, 0.4f, col);
 
     scene->draw_call_data[cone.node].v2 = vec4f(col);
+    scene->dirty_flags[cone.node] |= e_dirty::draw_call;
 }
 
 void test_line_vs_line(ecs_scene* scene, bool initialise)
@@ -27,7 +27,9 @@ struct forward_lit_material
 
 namespace
 {
-    u32 pillar_start = 0;
+    u32  pillar_start = 0;
+    bool animate_lights = true;
+    bool animate_pillars = true;
 }
 
 void example_setup(ecs_scene* scene, camera& cam)
@@ -190,6 +192,29 @@ void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
 {
     dt *= 0.001f;
 
+    // shadow slices are only rendered again when their light or casters move
+    ImGui::Begin("Shadow Maps", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::Checkbox("Animate Lights", &animate_lights);
+    ImGui::Checkbox("Animate Pillars", &animate_pillars);
+    ImGui::Text("Shadow Slices Rendered: %i", scene->num_shadow_slices_rendered);
+    ImGui::Text("Shadow Slices Reused: %i", scene->num_shadow_slices_reused);
+
+    // forward lit views light each pixel with the lights binned into its cluster
+    bool clustered_lights = scene->flags & e_scene_flags::clustered_lights;
+    if (ImGui::Checkbox("Clustered Lights", &clustered_lights))
+    {
+        if (clustered_lights)
+            scene->flags |= e_scene_flags::clustered_lights;
+        else
+            scene->flags &= ~e_scene_flags::clustered_lights;
+    }
+
+    ImGui::Text("Binned Lights: %i (%2.2f ms)", scene->num_binned_lights, scene->light_binning_ms);
+    ImGui::End();
+
+    if (!animate_lights)
+        dt = 0.0f;
+
     // animating lights
     quat q;
 
@@ -234,7 +259,7 @@ void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
     static pen::timer* timer = pen::timer_create();
 
     pen::timer_start(timer);
-    for (s32 i = pillar_start; i < scene->num_entities; ++i)
+    for (s32 i = pillar_start; i < scene->num_entities && animate_pillars; ++i)
     {
         scene->transforms.data[i].rotation = scene->transforms.data[i].rotation * q;
         scene->entities.data[i] |= e_cmp::transform;
@@ -81,4 +81,13 @@ void example_setup(ecs_scene* scene, camera& cam)
 
 void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
 {
+    ImGui::Begin("Skinning", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+    const bone_palette_set& bp = scene->bone_palettes;
+    ImGui::Text("Bone Palettes: %i rigs, %i matrices", bp.num_rigs, bp.count);
+    ImGui::Text("Palette Builds: %i (%2.3f ms)", scene->num_palette_builds,
+                scene->update_timings[e_update_stage::bone_palettes]);
+    ImGui::Text("Bone Bytes Uploaded: %i", scene->num_bone_bytes_uploaded);
+
+    ImGui::End();
 }
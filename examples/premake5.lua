@@ -74,3 +74,5 @@ create_app_example( "compute_demo", script_path() ) -- hide
 create_app_example( "global_illumination", script_path() )
 create_app_example( "game", script_path() ) -- hide
 
+create_app_example( "benchmarks", script_path() ) -- hide
+create_app_example( "ecs_bench", script_path() ) -- hide
@@ -41,16 +41,26 @@ end
 local function setup_linux()
 	--linux must be linked in order
 	add_pmtech_links()
-	links 
-	{ 
-		"pthread",
-		"GLEW",
-		"GLU",
-		"GL",
-		"X11",
-		"fmod",
-		"dl"
-	}
+	if renderer_dir == "null" then
+		-- headless, no window or gl context
+		links 
+		{ 
+			"pthread",
+			"fmod",
+			"dl"
+		}
+	else
+		links 
+		{ 
+			"pthread",
+			"GLEW",
+			"GLU",
+			"GL",
+			"X11",
+			"fmod",
+			"dl"
+		}
+	end
 end
 
 local function setup_win32()